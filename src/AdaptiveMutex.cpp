@@ -0,0 +1,110 @@
+ /*
+  * Copyright (c) 2001,2002 Steven M. Cherry. All rights reserved.
+  *
+  * This file is a part of slib - a c++ utility library
+  *
+  * The slib project, including all files needed to compile
+  * it, is free software; you can redistribute it and/or use it and/or modify
+  * it under the terms of the GNU Lesser General Public License as published by
+  * the Free Software Foundation.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program.  See file COPYING for details.
+  */
+
+#include <thread>
+#if defined(_MSC_VER)
+#include <intrin.h>
+#endif
+
+#include "AdaptiveMutex.h"
+#include "Timer.h"
+using namespace SLib;
+
+/// Tells the CPU that we are spinning, so that it can ease off and let the other hyperthread run.
+static inline void adaptive_pause(void)
+{
+#if defined(_MSC_VER)
+	_mm_pause();
+#elif defined(__i386__) || defined(__x86_64__)
+	__builtin_ia32_pause();
+#elif defined(__aarch64__)
+	__asm__ __volatile__("yield");
+#endif
+}
+
+/// The most we will spin on this machine.  Spinning can't help when there is only one CPU.
+static int adaptive_max_spins(void)
+{
+	static int maxSpins = std::thread::hardware_concurrency() > 1 ? ADAPTIVEMUTEX_MAX_SPINS : 0;
+	return maxSpins;
+}
+
+AdaptiveMutex::AdaptiveMutex(const char* name)
+{
+	m_state.store( 0 );
+	m_spins.store( 8 * 10 );
+	m_name = name;
+	m_holder.store( NULL );
+	m_profile.store( NULL );
+}
+
+AdaptiveMutex::~AdaptiveMutex()
+{
+
+}
+
+void AdaptiveMutex::lockSlow(void)
+{
+	bool profiling = LockProfile::ProfilingOn();
+	const char* holder = profiling ? m_holder.load( std::memory_order_relaxed ) : NULL;
+	uint64_t start = profiling ? Timer::GetRawCycleCount() : 0;
+
+	// Spin for up to twice as long as it has been taking lately, in the same way as glibc's
+	// adaptive mutexes.
+	int average = m_spins.load( std::memory_order_relaxed ) / 8;
+	int limit = average * 2 + 10;
+	if(limit > adaptive_max_spins()){
+		limit = adaptive_max_spins();
+	}
+	bool got = false;
+	int spins = 0;
+	for(; spins < limit; spins++){
+		if(m_state.load( std::memory_order_relaxed ) == 0){
+			uint32_t expected = 0;
+			if(m_state.compare_exchange_weak( expected, 1, std::memory_order_acquire,
+				std::memory_order_relaxed)
+			){
+				got = true;
+				break;
+			}
+		}
+		adaptive_pause();
+	}
+	if(limit > 0){
+		m_spins.fetch_add( spins - average, std::memory_order_relaxed );
+	}
+
+	// Then sleep.  Whoever gets the lock this way leaves it marked as 2, so that the next
+	// unlock wakes up anyone else who is still sleeping.
+	while(!got){
+		if(m_state.exchange( 2, std::memory_order_acquire ) == 0){
+			break;
+		}
+		uint32_t key = m_sleepers.prepareWait();
+		if(m_state.load( std::memory_order_relaxed ) == 0){
+			m_sleepers.cancelWait();
+			continue;
+		}
+		m_sleepers.wait( key );
+	}
+
+	if(profiling){
+		LockProfile::RecordWait( m_profile, m_name, Timer::GetRawCycleCount() - start, holder );
+		m_holder.store( LockProfile::CurrentSite(), std::memory_order_relaxed );
+	}
+}
@@ -0,0 +1,162 @@
+#ifndef ADAPTIVEMUTEX_H
+#define ADAPTIVEMUTEX_H
+ /*
+  * Copyright (c) 2001,2002 Steven M. Cherry. All rights reserved.
+  *
+  * This file is a part of slib - a c++ utility library
+  *
+  * The slib project, including all files needed to compile
+  * it, is free software; you can redistribute it and/or use it and/or modify
+  * it under the terms of the GNU Lesser General Public License as published by
+  * the Free Software Foundation.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program.  See file COPYING for details.
+  */
+
+#ifdef _WIN32
+#	ifndef DLLEXPORT
+#		define DLLEXPORT __declspec(dllexport)
+#	endif
+#else
+#	define DLLEXPORT
+#endif
+
+#include <stdint.h>
+#include <atomic>
+
+#include "EventCount.h"
+#include "LockProfile.h"
+
+namespace SLib {
+
+/// The most times an AdaptiveMutex will spin before it goes to sleep
+#define ADAPTIVEMUTEX_MAX_SPINS 1000
+
+/**
+  * A mutex for very short critical sections, such as a few loads and stores on a shared
+  * structure.  Taking it when it is free is one compare-and-swap, and giving it back when
+  * nobody is waiting is one exchange, with no system calls either way.
+  * <P>
+  * A thread that finds it locked spins for a while first, since the holder is likely to be
+  * done in less time than it takes to go to sleep and be woken up again.  How long it spins
+  * adapts to how long spinning has been taking to pay off for this mutex, up to
+  * ADAPTIVEMUTEX_MAX_SPINS, and on a machine with one hardware thread it doesn't spin at all.
+  * If spinning doesn't get the lock, the thread sleeps on an EventCount until the holder
+  * lets go.
+  * <P>
+  * Use AdaptiveLock to hold one.  It is not recursive.  While LockProfile is on, waits are
+  * recorded there in the same way as for Mutex.
+  *
+  * @author Steven M. Cherry
+  */
+class DLLEXPORT AdaptiveMutex
+{
+	private:
+		/// copy constructor is private to prevent use
+		AdaptiveMutex(const AdaptiveMutex& c) {}
+
+		/// assignmet operator is private to prevent use
+		AdaptiveMutex& operator=(const AdaptiveMutex& c) { return *this;}
+
+	public:
+		/// Standard constructor.  The name is what LockProfile reports us as, and is not copied.
+		AdaptiveMutex(const char* name = NULL);
+
+		/// Standard destructor
+		virtual ~AdaptiveMutex();
+
+		/// Locks the mutex, spinning and then sleeping if someone else has it.
+		void lock(void) {
+			uint32_t expected = 0;
+			if(!m_state.compare_exchange_strong( expected, 1, std::memory_order_acquire,
+				std::memory_order_relaxed)
+			){
+				lockSlow();
+			} else if(LockProfile::ProfilingOn()){
+				m_holder.store( LockProfile::CurrentSite(), std::memory_order_relaxed );
+			}
+		}
+
+		/// Locks the mutex if it is free, and returns true.  Returns false straight away otherwise.
+		bool trylock(void) {
+			uint32_t expected = 0;
+			return m_state.compare_exchange_strong( expected, 1, std::memory_order_acquire,
+				std::memory_order_relaxed );
+		}
+
+		/// Unlocks the mutex, and wakes up one thread that is sleeping on it, if there is one.
+		void unlock(void) {
+			if(m_state.exchange( 0, std::memory_order_release ) == 2){
+				m_sleepers.notifyOne();
+			}
+		}
+
+	private:
+
+		/// Where lock goes when the mutex isn't free
+		void lockSlow(void);
+
+		/// 0 = unlocked, 1 = locked, 2 = locked and someone may be sleeping on it
+		std::atomic<uint32_t> m_state;
+
+		/// The average number of spins it has taken to get the lock, times 8
+		std::atomic<int> m_spins;
+
+		/// Where threads sleep when spinning doesn't get them the lock
+		EventCount m_sleepers;
+
+		/// Our name for LockProfile, or NULL
+		const char* m_name;
+
+		/// The EnEx method that last locked us while LockProfile was on
+		std::atomic<const char*> m_holder;
+
+		/// Where LockProfile keeps our counters
+		std::atomic<LockProfileEntry*> m_profile;
+};
+
+/**
+  * Holds an AdaptiveMutex for as long as this object exists, in the same way that Lock
+  * holds a Mutex.
+  */
+class AdaptiveLock
+{
+	private:
+		/// copy constructor is private to prevent use
+		AdaptiveLock(const AdaptiveLock& c) {}
+
+		/// assignmet operator is private to prevent use
+		AdaptiveLock& operator=(const AdaptiveLock& c) { return *this;}
+
+	public:
+		/// Locks the given mutex straight away.
+		AdaptiveLock(AdaptiveMutex* the_mutex) {
+			m_mut = the_mutex;
+			m_mut->lock();
+		}
+
+		/// Unlocks the mutex, if we still have it.
+		virtual ~AdaptiveLock() {
+			UnLock();
+		}
+
+		/// Unlocks the mutex early.
+		void UnLock() {
+			if(m_mut != NULL){
+				m_mut->unlock();
+				m_mut = NULL;
+			}
+		}
+
+	private:
+		AdaptiveMutex* m_mut;
+};
+
+} // End Namespace SLib
+
+#endif // ADAPTIVEMUTEX_H Defined
@@ -1,40 +1,81 @@
 #ifndef BLOCKINGQUEUE_H
 #define BLOCKINGQUEUE_H
 
+#include <stdint.h>
 #ifdef _WIN32
 #include <windows.h>
 #else
+#include <time.h>
 #include "Mutex.h"
 #include "Lock.h"
 #endif
 
-// std::queue
-#include <queue>
+// std::deque
+#include <deque>
+#include <vector>
+#include <utility>
 
 namespace SLib {
 
+/**
+  * A thread-safe queue for handing work from producer threads to consumer threads.
+  *
+  * The queue can be given a capacity, in which case push blocks while it is full, so that
+  * producers are held back to the rate that consumers can keep up with.  The default capacity
+  * of 0 means the queue is unbounded.  Consumers can wait forever, wait for a while, or not
+  * wait at all, and drain lets a consumer take a batch of items for the cost of one lock.
+  *
+  * Calling close wakes up everyone who is waiting.  After that push refuses new items, and
+  * pop hands out whatever is left before reporting that the queue is finished.
+  *
+  * Timeouts are given in milliseconds.
+  */
 template <typename Data>
 class BlockingQueue
 {
 	private:
-		std::queue<Data> the_queue;
+		std::deque<Data> the_queue;
+		size_t the_capacity;
+		bool the_closed;
 
 #ifdef _WIN32
 		mutable CRITICAL_SECTION CritSection;
-		mutable CONDITION_VARIABLE ConditionVar;
+		mutable CONDITION_VARIABLE NotEmpty;
+		mutable CONDITION_VARIABLE NotFull;
 #else
 		mutable Mutex the_mutex;
-		pthread_cond_t the_condition_variable;
+		pthread_cond_t the_not_empty;
+		pthread_cond_t the_not_full;
 #endif
 
+		/// copy constructor is private to prevent use
+		BlockingQueue(const BlockingQueue& c) {}
+
+		/// assignment operator is private to prevent use
+		BlockingQueue& operator=(const BlockingQueue& c) { return *this; }
+
 	public:
-		BlockingQueue()
+		/// Standard constructor.  A capacity of 0 means the queue never fills up.
+		BlockingQueue(size_t capacity = 0)
 		{
+			the_capacity = capacity;
+			the_closed = false;
 #ifdef _WIN32
 			InitializeCriticalSection( &CritSection );
-			InitializeConditionVariable( &ConditionVar );
+			InitializeConditionVariable( &NotEmpty );
+			InitializeConditionVariable( &NotFull );
 #else
-			pthread_cond_init(&the_condition_variable, NULL);
+			// Timed waits count down on the same monotonic clock as our deadlines, so changing
+			// the system time doesn't stretch or cut short a wait.  macOS can't do this, and
+			// uses a relative wait instead.
+			pthread_condattr_t attr;
+			pthread_condattr_init(&attr);
+#ifndef __APPLE__
+			pthread_condattr_setclock(&attr, CLOCK_MONOTONIC);
+#endif
+			pthread_cond_init(&the_not_empty, &attr);
+			pthread_cond_init(&the_not_full, &attr);
+			pthread_condattr_destroy(&attr);
 #endif
 		}
 
@@ -43,84 +84,303 @@ class BlockingQueue
 #ifdef _WIN32
 			DeleteCriticalSection( &CritSection );
 #else
-			pthread_cond_destroy(&the_condition_variable);
+			pthread_cond_destroy(&the_not_empty);
+			pthread_cond_destroy(&the_not_full);
 #endif
 		}
 
-		void push(Data const& data)
+		/** Adds an item to the back of the queue, waiting for room if the queue is full.
+		  * Returns false, without adding it, if the queue is closed.
+		  */
+		bool push(Data const& data)
 		{
-#ifdef _WIN32
-			EnterCriticalSection( &CritSection );
-#else
-			Lock the_lock(&the_mutex);
-#endif
-			the_queue.push(data);
+			{
+				QueueLock the_lock(this);
+				while(full() && !the_closed){
+					waitOn( notFull(), -1 );
+				}
+				if(!pushLocked( data )){
+					return false;
+				}
+			}
+			wakeOne( notEmpty() );
+			return true;
+		}
 
-#ifdef _WIN32
-			LeaveCriticalSection( &CritSection );
-#else
-			the_lock.UnLock();
-#endif
+		/// Adds an item if there is room for it right now.  Returns false if there isn't.
+		bool try_push(Data const& data)
+		{
+			{
+				QueueLock the_lock(this);
+				if(full() || !pushLocked( data )){
+					return false;
+				}
+			}
+			wakeOne( notEmpty() );
+			return true;
+		}
 
-#ifdef _WIN32
-			WakeConditionVariable( &ConditionVar );
-#else
-			pthread_cond_signal( &the_condition_variable );
-#endif
+		/** Adds an item, waiting up to ms milliseconds for room.  Returns false if there was
+		  * no room in time, or the queue is closed.
+		  */
+		bool push_for(Data const& data, int ms)
+		{
+			uint64_t deadline = nowMs() + (uint64_t)(ms < 0 ? 0 : ms);
+			{
+				QueueLock the_lock(this);
+				while(full() && !the_closed){
+					uint64_t now = nowMs();
+					if(now >= deadline){
+						return false;
+					}
+					waitOn( notFull(), (int)(deadline - now) );
+				}
+				if(!pushLocked( data )){
+					return false;
+				}
+			}
+			wakeOne( notEmpty() );
+			return true;
+		}
+
+		/** Removes the item at the front of the queue, waiting for one if the queue is empty.
+		  * If the queue is closed and empty, this returns a default constructed Data (NULL for
+		  * a queue of pointers).  Use pop(Data&) where that can't be told apart from an item.
+		  */
+		Data pop(void)
+		{
+			Data ret = Data();
+			pop( ret );
+			return ret;
+		}
+
+		/** Moves the item at the front of the queue into out, waiting for one if the queue
+		  * is empty.  Returns false if the queue is closed and empty.
+		  */
+		bool pop(Data& out)
+		{
+			{
+				QueueLock the_lock(this);
+				while(the_queue.empty() && !the_closed){
+					waitOn( notEmpty(), -1 );
+				}
+				if(!popLocked( out )){
+					return false;
+				}
+			}
+			wakeProducer();
+			return true;
+		}
+
+		/// Moves the item at the front of the queue into out if there is one.  Returns false if not.
+		bool try_pop(Data& out)
+		{
+			{
+				QueueLock the_lock(this);
+				if(!popLocked( out )){
+					return false;
+				}
+			}
+			wakeProducer();
+			return true;
+		}
+
+		/** Moves the item at the front of the queue into out, waiting up to ms milliseconds
+		  * for one.  Returns false if nothing arrived in time, or the queue is closed and empty.
+		  */
+		bool pop_for(Data& out, int ms)
+		{
+			uint64_t deadline = nowMs() + (uint64_t)(ms < 0 ? 0 : ms);
+			{
+				QueueLock the_lock(this);
+				while(the_queue.empty() && !the_closed){
+					uint64_t now = nowMs();
+					if(now >= deadline){
+						break;
+					}
+					waitOn( notEmpty(), (int)(deadline - now) );
+				}
+				if(!popLocked( out )){
+					return false;
+				}
+			}
+			wakeProducer();
+			return true;
+		}
+
+		/** Waits until the queue has something in it, and then moves up to max items onto the
+		  * end of out under a single lock.  Returns the number of items taken, which is 0 only
+		  * when the queue is closed and empty.
+		  */
+		size_t drain(std::vector<Data>& out, size_t max)
+		{
+			size_t count = 0;
+			{
+				QueueLock the_lock(this);
+				while(the_queue.empty() && !the_closed){
+					waitOn( notEmpty(), -1 );
+				}
+				while(count < max && !the_queue.empty()){
+					out.push_back( std::move( the_queue.front() ) );
+					the_queue.pop_front();
+					count++;
+				}
+			}
+			if(count != 0 && the_capacity != 0){
+				wakeAll( notFull() );
+			}
+			return count;
+		}
+
+		/** Closes the queue.  Everyone waiting in push or pop is woken up, new items are
+		  * refused, and the items already in the queue can still be popped.
+		  */
+		void close(void)
+		{
+			{
+				QueueLock the_lock(this);
+				the_closed = true;
+			}
+			wakeAll( notEmpty() );
+			wakeAll( notFull() );
+		}
+
+		/// Returns true once close has been called
+		bool closed() const
+		{
+			QueueLock the_lock(this);
+			return the_closed;
 		}
 
 		bool empty() const
 		{
-#ifdef _WIN32
-			bool ret;
-			EnterCriticalSection( &CritSection );
-			ret = the_queue.empty();
-			LeaveCriticalSection( &CritSection );
-			return ret;	
-#else
-			Lock the_lock(&the_mutex);
+			QueueLock the_lock(this);
 			return the_queue.empty();
-#endif
 		}
 
-		Data& pop(void)
+		int size() const
 		{
+			QueueLock the_lock(this);
+			return (int)the_queue.size();
+		}
+
+		/// Returns the most items the queue will hold, or 0 if it is unbounded
+		size_t capacity() const
+		{
+			return the_capacity;
+		}
+
+	private:
+
 #ifdef _WIN32
-			EnterCriticalSection( &CritSection );
-#else
-			Lock the_lock(&the_mutex);
-#endif
-			while(the_queue.empty()) {
-#ifdef _WIN32
-				SleepConditionVariableCS( &ConditionVar, &CritSection, INFINITE );
+		/// Holds our critical section for as long as it is in scope
+		class QueueLock {
+			public:
+				QueueLock(const BlockingQueue* q) : m_q(q) { EnterCriticalSection( &m_q->CritSection ); }
+				~QueueLock() { LeaveCriticalSection( &m_q->CritSection ); }
+			private:
+				const BlockingQueue* m_q;
+		};
 #else
-				pthread_cond_wait(&the_condition_variable, the_mutex.internalMutex() );
+		/// Holds our mutex for as long as it is in scope
+		class QueueLock : public Lock {
+			public:
+				QueueLock(const BlockingQueue* q) : Lock( &q->the_mutex ) {}
+		};
 #endif
+
+		/// Returns true if the queue has no room.  Must be called while holding our lock.
+		bool full() const
+		{
+			return the_capacity != 0 && the_queue.size() >= the_capacity;
+		}
+
+		/// Adds data if we are still open.  Must be called while holding our lock.
+		bool pushLocked(Data const& data)
+		{
+			if(the_closed){
+				return false;
+			}
+			the_queue.push_back( data );
+			return true;
+		}
+
+		/// Moves the front item into out if there is one.  Must be called while holding our lock.
+		bool popLocked(Data& out)
+		{
+			if(the_queue.empty()){
+				return false;
 			}
+			out = std::move( the_queue.front() );
+			the_queue.pop_front();
+			return true;
+		}
 
-			Data& ret = the_queue.front();
-			the_queue.pop();
+		/// Lets a producer know there is room, after we have taken an item.
+		void wakeProducer()
+		{
+			if(the_capacity != 0){
+				wakeOne( notFull() );
+			}
+		}
 
+		/// Milliseconds on a clock that only moves forward, for working out how long is left to wait
+		static uint64_t nowMs(void)
+		{
 #ifdef _WIN32
-			LeaveCriticalSection( &CritSection );
+			return (uint64_t)GetTickCount64();
+#else
+			struct timespec ts;
+			clock_gettime( CLOCK_MONOTONIC, &ts );
+			return (uint64_t)ts.tv_sec * 1000 + (uint64_t)(ts.tv_nsec / 1000000);
 #endif
+		}
 
-			return ret;
+#ifdef _WIN32
+		typedef CONDITION_VARIABLE Condition;
+		Condition* notEmpty() const { return &NotEmpty; }
+		Condition* notFull() const { return &NotFull; }
+
+		void wakeOne(Condition* cond) { WakeConditionVariable( cond ); }
+		void wakeAll(Condition* cond) { WakeAllConditionVariable( cond ); }
+
+		/// Waits on cond for up to ms milliseconds, or forever if ms is negative.  Must hold our lock.
+		void waitOn(Condition* cond, int ms)
+		{
+			SleepConditionVariableCS( cond, &CritSection, ms < 0 ? INFINITE : (DWORD)ms );
 		}
+#else
+		typedef pthread_cond_t Condition;
+		Condition* notEmpty() { return &the_not_empty; }
+		Condition* notFull() { return &the_not_full; }
 
-		int size() const
+		void wakeOne(Condition* cond) { pthread_cond_signal( cond ); }
+		void wakeAll(Condition* cond) { pthread_cond_broadcast( cond ); }
+
+		/// Waits on cond for up to ms milliseconds, or forever if ms is negative.  Must hold our lock.
+		void waitOn(Condition* cond, int ms)
 		{
-#ifdef _WIN32
-			int ret;
-			EnterCriticalSection( &CritSection );
-			ret = (int)the_queue.size();
-			LeaveCriticalSection( &CritSection );
-			return ret;
+			if(ms < 0){
+				pthread_cond_wait( cond, the_mutex.internalMutex() );
+				return;
+			}
+			struct timespec ts;
+#ifdef __APPLE__
+			ts.tv_sec = ms / 1000;
+			ts.tv_nsec = (long)(ms % 1000) * 1000000;
+			pthread_cond_timedwait_relative_np( cond, the_mutex.internalMutex(), &ts );
 #else
-			Lock the_lock(&the_mutex);
-			return (int)the_queue.size();
+			clock_gettime( CLOCK_MONOTONIC, &ts );
+			ts.tv_sec += ms / 1000;
+			ts.tv_nsec += (long)(ms % 1000) * 1000000;
+			if(ts.tv_nsec >= 1000000000){
+				ts.tv_sec ++;
+				ts.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait( cond, the_mutex.internalMutex(), &ts );
 #endif
 		}
+#endif
 
 };
 
@@ -27,12 +27,22 @@
 
 using namespace SLib;
 
+/// Fills in out with the local time for t.  Unlike localtime, this is safe on any thread.
+static void date_localtime(const time_t* t, struct tm* out)
+{
+#ifdef _WIN32
+	localtime_s(out, t);
+#else
+	localtime_r(t, out);
+#endif
+}
+
 Date::Date()
 {
 	// Set the internal structures to the current time.
 	m_TimeVal = time(NULL);
 	m_TimeStruct = (struct tm *)malloc(sizeof(struct tm));
-	memcpy(m_TimeStruct, localtime(&m_TimeVal), sizeof(struct tm));
+	date_localtime(&m_TimeVal, m_TimeStruct);
 	m_picture = (char *)malloc(64);
 	m_len = 19;
 }	
@@ -103,7 +113,7 @@ Date& Date::SetMinValue(void)
 void Date::SetCurrent(void)
 {
 	m_TimeVal = time(NULL);
-	memcpy(m_TimeStruct, localtime(&m_TimeVal), sizeof(struct tm));
+	date_localtime(&m_TimeVal, m_TimeStruct);
 }
 
 void Date::SetValue(const char *date)
@@ -326,7 +336,7 @@ void Date::SetValuef(twine& format)
 void Date::SetValue(const time_t t)
 {
 	m_TimeVal = t;
-	memcpy(m_TimeStruct, localtime(&m_TimeVal), sizeof(struct tm));
+	date_localtime(&m_TimeVal, m_TimeStruct);
 }
 
 Date::operator time_t() const
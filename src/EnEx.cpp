@@ -1,15 +1,25 @@
 /* C Standard Headers */
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#include <math.h>
+#ifdef _WIN32
+#include <intrin.h>
+#endif
 #ifndef _WIN32
 #include <inttypes.h>
+#include <signal.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <errno.h>
 #endif
 
 
 /* C++ Standard Headers */
 #include <vector>
 #include <utility>
-#include <map>
+#include <atomic>
+#include <algorithm>
 using namespace std;
 
 /* SLib Headers */
@@ -18,39 +28,575 @@ using namespace std;
 #include "Thread.h"
 #include "Log.h"
 #include "xmlinc.h"
+#include "Tools.h"
+#include "Lock.h"
+#include "AnException.h"
 using namespace SLib;
 
-/** This is the global hit counter collection that will be updated by
-    each thread periodically as they do their work.  It's only guaranteed
-    to be written to when you use the EnEx constructor with the saveToGlobal
-    flag turned on.
-*/
-map<const char*, EnExProfile*>* global_hit_counter = NULL;
-SLib::Mutex* global_hit_counter_mutex = NULL;
+/** The counters for one method on one thread.  Only the owning thread ever writes them, so
+  * plain loads and stores are enough.  They are atomic so that other threads can read them
+  * at any time without a lock.
+  */
+struct SLib::EnExCounter {
+	std::atomic<uint64_t> hits;
+	std::atomic<uint64_t> totalTime;
+	std::atomic<uint64_t> minTime;
+	std::atomic<uint64_t> maxTime;
+
+	/// The number of calls that were timed, which is less than hits when sampling
+	std::atomic<uint64_t> timed;
+
+	/// Calls left to skip before we time the next one, when sampling
+	std::atomic<uint32_t> countdown;
+
+	/// Histogram buckets, allocated the first time the method is timed on this thread
+	std::atomic<std::atomic<uint64_t>*> hist;
+};
+
+/// Counters are allocated in chunks of this many methods, as a thread first uses them.
+#define ENEX_CHUNK 256
+
+/** One entry in a trace ring buffer.  These are atomic so that WriteChromeTrace can read them
+  * while the owning thread keeps writing.
+  */
+struct EnExTraceEvent {
+	std::atomic<const char*> name;
+	std::atomic<uint64_t> stamp;
+	std::atomic<uint32_t> tid;
+	std::atomic<char> phase;
+};
+
+/** One node in a thread's call tree - a method, reached through the path leading to its
+  * parent node.  Only the owning thread writes these.  The parent and site never change once
+  * the node is published, and the times are atomic so that other threads can read them.
+  */
+struct EnExCallNode {
+	uint32_t parent;
+	uint32_t site;
+
+	/// The owner's links to find a child again - nobody else reads these
+	uint32_t firstChild;
+	uint32_t nextSibling;
+
+	std::atomic<uint64_t> hits;
+	std::atomic<uint64_t> inclusiveTime;
 
-/** Each thread gets its own hit counter where it can store thread-local information
-  * about methods that have beeen used and timing for those methods.
+	/// Time spent in our children, which is taken off inclusiveTime to get our exclusive time
+	std::atomic<uint64_t> childTime;
+};
+
+/// Call tree nodes are allocated in chunks of this many, as a thread first needs them.
+#define ENEX_NODE_CHUNK 1024
+
+/// Marks an EnterExit that isn't in the call tree
+#define ENEX_NO_NODE 0xFFFFFFFF
+
+/** Every thread gets one of these blocks of counters, indexed by method.  Blocks are kept on
+  * a list for the global view to read, and are never freed.  When a thread exits its counts are
+  * moved into the retired block, which keeps them in the totals, and its block is released.  The
+  * next new thread takes it over starting from zero.  That keeps the number of blocks down to the
+  * most threads we've had at once.
   */
-thread_local map<const char*, EnExProfile*> thread_hit_counter;
+struct EnExThreadBlock {
+	std::atomic<EnExCounter*> chunks[ ENEX_MAX_SITES / ENEX_CHUNK ];
+	std::atomic<bool> owned;
+
+	/// The reset epoch that our counters belong to.  Stale blocks are cleared by their owner.
+	std::atomic<uint32_t> epoch;
+
+	/// The trace ring buffer, allocated the first time this block traces anything
+	std::atomic<EnExTraceEvent*> trace;
+	size_t traceSize;
+
+	/// The number of trace events ever written to the ring
+	std::atomic<uint64_t> traceHead;
+
+	/// The call tree.  Node 0 is the root, which stands for no method at all.
+	std::atomic<EnExCallNode*> nodes[ ENEX_MAX_PATHS / ENEX_NODE_CHUNK ];
+	std::atomic<uint32_t> nodeCount;
+
+	EnExThreadBlock* next;
+};
+
+/// The list of all thread blocks.  New blocks are pushed on the front and never removed.
+static std::atomic<EnExThreadBlock*> enex_blocks(NULL);
+
+/// Bumped by ResetProfiles.  Blocks from an older epoch count as empty.
+static std::atomic<uint32_t> enex_epoch(0);
+
+/// Sampling settings
+static std::atomic<uint32_t> enex_sample_rate(1);
+static std::atomic<bool> enex_request_sampling(false);
+thread_local bool thread_request_sampled = false;
+
+/// Call tree settings, and the node each thread is currently in
+static std::atomic<bool> enex_call_tree(false);
+thread_local uint32_t thread_call_node = 0;
+
+/// Tracing settings
+static std::atomic<bool> enex_tracing(false);
+static std::atomic<size_t> enex_trace_size(65536);
+static std::atomic<uint64_t> enex_trace_start(0);
+
+/// Each thread that traces gets a small number to show as its tid
+static std::atomic<uint32_t> enex_trace_tids(0);
+thread_local uint32_t thread_trace_tid = 0;
+
+/// The log id (LogMsg::tid) of the thread behind each trace tid, so that traces can show thread names
+#define ENEX_MAX_TRACE_TIDS 4096
+static std::atomic<uint32_t> enex_trace_log_ids[ ENEX_MAX_TRACE_TIDS ];
+
+/** The method registry.  The first time a method name is seen it is given the next index,
+  * which is then used for that method's counters in every thread block.  The name pointer
+  * is hashed into enex_site_key to find the index again on every later entry.  Index 0 is
+  * the overflow entry that is used once the registry is full.
+  */
+static std::atomic<const char*> enex_site_key[ ENEX_MAX_SITES ];
+static std::atomic<uint32_t> enex_site_index[ ENEX_MAX_SITES ]; // index + 1, 0 until published
+static std::atomic<const char*> enex_site_name[ ENEX_MAX_SITES ];
+static std::atomic<uint32_t> enex_site_count(1);
+
+/** This thread's block of counters.
+  */
+thread_local EnExThreadBlock* thread_block = NULL;
+
+static void enex_retire_block(EnExThreadBlock* b);
+
+/** Releases this thread's block for re-use when the thread exits.
+  */
+struct EnExThreadRelease {
+	~EnExThreadRelease() {
+		if(thread_block != NULL){
+			enex_retire_block( thread_block );
+			thread_block->owned.store( false, std::memory_order_release );
+			thread_block = NULL;
+		}
+	}
+};
+thread_local EnExThreadRelease thread_release;
 
 /** This is the stack trace for each thread.
  */
 thread_local vector<const char*> thread_stack_trace;
 
-map<const char*, EnExProfile*>& GlobalHitCounter()
+/** The innermost method on this thread's stack.  This is a plain pointer, so unlike
+  * thread_stack_trace it is still safe to read while the thread is being torn down.
+  */
+thread_local const char* thread_current_method = NULL;
+
+/// Finds (or assigns) the counter index for the given method name.
+static uint32_t enex_site(const char* name)
+{
+	uint64_t h = (uint64_t)(uintptr_t)name * 0x9E3779B97F4A7C15ULL;
+	size_t start = (size_t)(h >> 32);
+	for(size_t probe = 0; probe < ENEX_MAX_SITES; probe++){
+		size_t slot = (start + probe) & (ENEX_MAX_SITES - 1);
+		const char* key = enex_site_key[ slot ].load( std::memory_order_acquire );
+		if(key == NULL){
+			if(enex_site_key[ slot ].compare_exchange_strong( key, name )){
+				// We own this slot - give it the next index.
+				uint32_t idx = enex_site_count.fetch_add( 1 );
+				if(idx >= ENEX_MAX_SITES){
+					idx = 0; // the registry is full
+				} else {
+					enex_site_name[ idx ].store( name, std::memory_order_release );
+				}
+				enex_site_index[ slot ].store( idx + 1, std::memory_order_release );
+				return idx;
+			}
+			// Someone else took the slot first - key now holds their name.
+		}
+		if(key == name){
+			uint32_t idx;
+			while((idx = enex_site_index[ slot ].load( std::memory_order_acquire )) == 0){
+				// The thread that registered this name is just about to publish its index.
+			}
+			return idx - 1;
+		}
+	}
+	return 0;
+}
+
+/// Creates a new block, already owned by whoever asked for it, and adds it to the list.
+static EnExThreadBlock* enex_new_block(void)
+{
+	EnExThreadBlock* b = new EnExThreadBlock();
+	for(size_t i = 0; i < ENEX_MAX_SITES / ENEX_CHUNK; i++){
+		b->chunks[ i ].store( NULL, std::memory_order_relaxed );
+	}
+	b->owned.store( true, std::memory_order_relaxed );
+	b->epoch.store( enex_epoch.load( std::memory_order_relaxed ), std::memory_order_relaxed );
+	b->trace.store( NULL, std::memory_order_relaxed );
+	b->traceSize = 0;
+	b->traceHead.store( 0, std::memory_order_relaxed );
+	for(size_t i = 0; i < ENEX_MAX_PATHS / ENEX_NODE_CHUNK; i++){
+		b->nodes[ i ].store( NULL, std::memory_order_relaxed );
+	}
+	b->nodeCount.store( 0, std::memory_order_relaxed );
+	b->next = enex_blocks.load( std::memory_order_relaxed );
+	while(!enex_blocks.compare_exchange_weak( b->next, b, std::memory_order_release )){
+		// b->next has been updated to the new head - try again.
+	}
+	return b;
+}
+
+/// Finds a released block to take over, or creates a new one.
+static EnExThreadBlock* enex_claim_block(void)
+{
+	(void)&thread_release; // make sure we release the block when this thread exits
+
+	for(EnExThreadBlock* b = enex_blocks.load( std::memory_order_acquire ); b != NULL; b = b->next){
+		bool expected = false;
+		if(b->owned.compare_exchange_strong( expected, true, std::memory_order_acquire )){
+			thread_block = b;
+			return b;
+		}
+	}
+
+	thread_block = enex_new_block();
+	return thread_block;
+}
+
+/** The block that holds the counts of threads that have exited.  It is owned for good, so no
+  * thread ever claims it, and being on the list puts it in the global view.
+  */
+static EnExThreadBlock* enex_retired(void)
+{
+	static EnExThreadBlock* retired = enex_new_block();
+	return retired;
+}
+
+/// Only one exiting thread at a time adds to the retired block.
+static Mutex* enex_retired_mutex(void)
+{
+	// Never deleted, so that it is still there for threads that exit during exit.
+	static Mutex* mut = new Mutex();
+	return mut;
+}
+
+/// Zeroes every counter in our own block, after a reset.
+static void enex_clear_block(EnExThreadBlock* b)
+{
+	for(size_t c = 0; c < ENEX_MAX_SITES / ENEX_CHUNK; c++){
+		EnExCounter* chunk = b->chunks[ c ].load( std::memory_order_relaxed );
+		if(chunk == NULL){
+			continue;
+		}
+		for(size_t i = 0; i < ENEX_CHUNK; i++){
+			chunk[ i ].hits.store( 0, std::memory_order_relaxed );
+			chunk[ i ].totalTime.store( 0, std::memory_order_relaxed );
+			chunk[ i ].minTime.store( UINT64_MAX, std::memory_order_relaxed );
+			chunk[ i ].maxTime.store( 0, std::memory_order_relaxed );
+			chunk[ i ].timed.store( 0, std::memory_order_relaxed );
+			std::atomic<uint64_t>* hist = chunk[ i ].hist.load( std::memory_order_relaxed );
+			if(hist != NULL){
+				for(size_t h = 0; h < ENEX_HIST_BUCKETS; h++){
+					hist[ h ].store( 0, std::memory_order_relaxed );
+				}
+			}
+		}
+	}
+	// The shape of the call tree is kept, only its times start over.
+	uint32_t nodes = b->nodeCount.load( std::memory_order_relaxed );
+	for(uint32_t i = 0; i < nodes; i++){
+		EnExCallNode& n = b->nodes[ i / ENEX_NODE_CHUNK ].load( std::memory_order_relaxed )[ i % ENEX_NODE_CHUNK ];
+		n.hits.store( 0, std::memory_order_relaxed );
+		n.inclusiveTime.store( 0, std::memory_order_relaxed );
+		n.childTime.store( 0, std::memory_order_relaxed );
+	}
+}
+
+/// Returns a block's counters for the given method index.  Only the block's owner may call this.
+static EnExCounter* enex_block_counter(EnExThreadBlock* b, uint32_t idx)
+{
+	std::atomic<EnExCounter*>& chunkPtr = b->chunks[ idx / ENEX_CHUNK ];
+	EnExCounter* chunk = chunkPtr.load( std::memory_order_relaxed );
+	if(chunk == NULL){
+		chunk = new EnExCounter[ ENEX_CHUNK ];
+		for(size_t i = 0; i < ENEX_CHUNK; i++){
+			chunk[ i ].hits.store( 0, std::memory_order_relaxed );
+			chunk[ i ].totalTime.store( 0, std::memory_order_relaxed );
+			chunk[ i ].minTime.store( UINT64_MAX, std::memory_order_relaxed ); // nothing timed yet
+			chunk[ i ].maxTime.store( 0, std::memory_order_relaxed );
+			chunk[ i ].timed.store( 0, std::memory_order_relaxed );
+			chunk[ i ].countdown.store( 0, std::memory_order_relaxed );
+			chunk[ i ].hist.store( NULL, std::memory_order_relaxed );
+		}
+		chunkPtr.store( chunk, std::memory_order_release );
+	}
+	return &chunk[ idx % ENEX_CHUNK ];
+}
+
+/// Returns this thread's counters for the given method index.
+static EnExCounter* enex_counter(uint32_t idx)
+{
+	EnExThreadBlock* b = thread_block;
+	if(b == NULL){
+		b = enex_claim_block();
+	}
+	uint32_t epoch = enex_epoch.load( std::memory_order_relaxed );
+	if(b->epoch.load( std::memory_order_relaxed ) != epoch){
+		enex_clear_block( b );
+		b->epoch.store( epoch, std::memory_order_release );
+	}
+	return enex_block_counter( b, idx );
+}
+
+/// Returns a counter's histogram buckets, allocating them the first time.  Only the owner may call this.
+static std::atomic<uint64_t>* enex_hist(EnExCounter* ctr)
+{
+	std::atomic<uint64_t>* hist = ctr->hist.load( std::memory_order_relaxed );
+	if(hist == NULL){
+		hist = new std::atomic<uint64_t>[ ENEX_HIST_BUCKETS ];
+		for(size_t i = 0; i < ENEX_HIST_BUCKETS; i++){
+			hist[ i ].store( 0, std::memory_order_relaxed );
+		}
+		ctr->hist.store( hist, std::memory_order_release );
+	}
+	return hist;
+}
+
+/// Returns the given node in a block's call tree.
+static EnExCallNode& enex_node(EnExThreadBlock* b, uint32_t idx)
+{
+	return b->nodes[ idx / ENEX_NODE_CHUNK ].load( std::memory_order_relaxed )[ idx % ENEX_NODE_CHUNK ];
+}
+
+/// Adds a node to this thread's call tree, and returns its index.
+static uint32_t enex_add_node(EnExThreadBlock* b, uint32_t parent, uint32_t site)
+{
+	uint32_t idx = b->nodeCount.load( std::memory_order_relaxed );
+	if(idx >= ENEX_MAX_PATHS){
+		return ENEX_NO_NODE; // the tree is full
+	}
+	std::atomic<EnExCallNode*>& chunkPtr = b->nodes[ idx / ENEX_NODE_CHUNK ];
+	if(chunkPtr.load( std::memory_order_relaxed ) == NULL){
+		chunkPtr.store( new EnExCallNode[ ENEX_NODE_CHUNK ], std::memory_order_release );
+	}
+	EnExCallNode& n = enex_node( b, idx );
+	n.parent = parent;
+	n.site = site;
+	n.firstChild = 0;
+	n.nextSibling = 0;
+	n.hits.store( 0, std::memory_order_relaxed );
+	n.inclusiveTime.store( 0, std::memory_order_relaxed );
+	n.childTime.store( 0, std::memory_order_relaxed );
+	if(idx != 0){
+		EnExCallNode& p = enex_node( b, parent );
+		n.nextSibling = p.firstChild;
+		p.firstChild = idx;
+	}
+	b->nodeCount.store( idx + 1, std::memory_order_release );
+	return idx;
+}
+
+/// Finds (or adds) the node for the given method called from the given node in a block's call tree.
+static uint32_t enex_find_node(EnExThreadBlock* b, uint32_t parent, uint32_t site)
 {
-	if(global_hit_counter == NULL){
-		global_hit_counter = new map<const char*, EnExProfile*>();
+	if(b->nodeCount.load( std::memory_order_relaxed ) == 0){
+		enex_add_node( b, 0, ENEX_NO_NODE ); // the root
+	}
+	for(uint32_t c = enex_node( b, parent ).firstChild; c != 0; c = enex_node( b, c ).nextSibling){
+		if(enex_node( b, c ).site == site){
+			return c;
+		}
 	}
-	return *global_hit_counter;
+	return enex_add_node( b, parent, site );
+}
+
+/// Finds (or adds) the node for the given method called from the given node on this thread.
+static uint32_t enex_call_node(uint32_t parent, uint32_t site)
+{
+	return enex_find_node( thread_block, parent, site );
+}
+
+/// Adds v to a counter that only we write
+static void enex_add(std::atomic<uint64_t>& ctr, uint64_t v)
+{
+	ctr.store( ctr.load( std::memory_order_relaxed ) + v, std::memory_order_relaxed );
 }
 
-SLib::Mutex* GlobalHitCounterMutex()
+/** Moves an exiting thread's counts and call tree into the retired block, so that the totals
+  * keep them, and clears its own block for the next thread to claim it.
+  */
+static void enex_retire_block(EnExThreadBlock* b)
 {
-	if(global_hit_counter_mutex == NULL){
-		global_hit_counter_mutex = new Mutex();
+	uint32_t epoch = enex_epoch.load( std::memory_order_acquire );
+	if(b->epoch.load( std::memory_order_relaxed ) != epoch){
+		return; // reset since this thread last counted anything - the next owner clears it
+	}
+	EnExThreadBlock* r = enex_retired();
+	Lock theLock( enex_retired_mutex() );
+	if(r->epoch.load( std::memory_order_relaxed ) != epoch){
+		enex_clear_block( r );
+		r->epoch.store( epoch, std::memory_order_release );
 	}
-	return global_hit_counter_mutex;
+
+	for(size_t c = 0; c < ENEX_MAX_SITES / ENEX_CHUNK; c++){
+		EnExCounter* chunk = b->chunks[ c ].load( std::memory_order_relaxed );
+		if(chunk == NULL){
+			continue;
+		}
+		for(size_t i = 0; i < ENEX_CHUNK; i++){
+			EnExCounter& from = chunk[ i ];
+			uint64_t hits = from.hits.load( std::memory_order_relaxed );
+			if(hits == 0){
+				continue;
+			}
+			EnExCounter* to = enex_block_counter( r, (uint32_t)(c * ENEX_CHUNK + i) );
+			enex_add( to->hits, hits );
+			enex_add( to->timed, from.timed.load( std::memory_order_relaxed ) );
+			enex_add( to->totalTime, from.totalTime.load( std::memory_order_relaxed ) );
+			if(from.minTime.load( std::memory_order_relaxed ) < to->minTime.load( std::memory_order_relaxed )){
+				to->minTime.store( from.minTime.load( std::memory_order_relaxed ), std::memory_order_relaxed );
+			}
+			if(from.maxTime.load( std::memory_order_relaxed ) > to->maxTime.load( std::memory_order_relaxed )){
+				to->maxTime.store( from.maxTime.load( std::memory_order_relaxed ), std::memory_order_relaxed );
+			}
+			std::atomic<uint64_t>* hist = from.hist.load( std::memory_order_relaxed );
+			if(hist != NULL){
+				std::atomic<uint64_t>* toHist = enex_hist( to );
+				for(size_t h = 0; h < ENEX_HIST_BUCKETS; h++){
+					enex_add( toHist[ h ], hist[ h ].load( std::memory_order_relaxed ) );
+				}
+			}
+		}
+	}
+
+	// A parent is always added before its children, so it has been mapped by the time we need it.
+	uint32_t count = b->nodeCount.load( std::memory_order_relaxed );
+	vector<uint32_t> map( count, ENEX_NO_NODE );
+	if(count != 0){
+		map[ 0 ] = 0;
+	}
+	for(uint32_t i = 1; i < count; i++){
+		EnExCallNode& n = enex_node( b, i );
+		if(map[ n.parent ] == ENEX_NO_NODE){
+			continue; // the retired tree is full
+		}
+		map[ i ] = enex_find_node( r, map[ n.parent ], n.site );
+		if(map[ i ] == ENEX_NO_NODE){
+			continue;
+		}
+		EnExCallNode& to = enex_node( r, map[ i ] );
+		enex_add( to.hits, n.hits.load( std::memory_order_relaxed ) );
+		enex_add( to.inclusiveTime, n.inclusiveTime.load( std::memory_order_relaxed ) );
+		enex_add( to.childTime, n.childTime.load( std::memory_order_relaxed ) );
+	}
+
+	enex_clear_block( b );
+}
+
+/// Records one entry or exit in this thread's trace ring buffer.
+static void enex_trace(char phase, const char* name, uint64_t stamp)
+{
+	EnExThreadBlock* b = thread_block;
+	if(b == NULL){
+		return; // this thread is exiting
+	}
+	EnExTraceEvent* ring = b->trace.load( std::memory_order_relaxed );
+	if(ring == NULL){
+		size_t size = 1;
+		while(size < enex_trace_size.load( std::memory_order_relaxed )){
+			size <<= 1;
+		}
+		ring = new EnExTraceEvent[ size ];
+		for(size_t i = 0; i < size; i++){
+			ring[ i ].name.store( NULL, std::memory_order_relaxed );
+			ring[ i ].stamp.store( 0, std::memory_order_relaxed );
+			ring[ i ].tid.store( 0, std::memory_order_relaxed );
+			ring[ i ].phase.store( 0, std::memory_order_relaxed );
+		}
+		b->traceSize = size;
+		b->trace.store( ring, std::memory_order_release );
+	}
+	if(thread_trace_tid == 0){
+		thread_trace_tid = enex_trace_tids.fetch_add( 1 ) + 1;
+		if(thread_trace_tid < ENEX_MAX_TRACE_TIDS){
+			enex_trace_log_ids[ thread_trace_tid ].store( Thread::CurrentLogId(), std::memory_order_relaxed );
+		}
+	}
+
+	uint64_t head = b->traceHead.load( std::memory_order_relaxed );
+	EnExTraceEvent& e = ring[ head & (b->traceSize - 1) ];
+	e.name.store( name, std::memory_order_relaxed );
+	e.stamp.store( stamp, std::memory_order_relaxed );
+	e.tid.store( thread_trace_tid, std::memory_order_relaxed );
+	e.phase.store( phase, std::memory_order_relaxed );
+	b->traceHead.store( head + 1, std::memory_order_release );
+}
+
+/// Adds the counters in one block into profiles, which is indexed by method.
+static void enex_merge_block(EnExThreadBlock* b, vector<EnExProfile>& profiles)
+{
+	if(b->epoch.load( std::memory_order_acquire ) != enex_epoch.load( std::memory_order_acquire )){
+		return; // reset since this block was last used
+	}
+	for(size_t c = 0; c < ENEX_MAX_SITES / ENEX_CHUNK; c++){
+		EnExCounter* chunk = b->chunks[ c ].load( std::memory_order_acquire );
+		if(chunk == NULL){
+			continue;
+		}
+		for(size_t i = 0; i < ENEX_CHUNK; i++){
+			size_t idx = c * ENEX_CHUNK + i;
+			if(idx >= profiles.size()){
+				return;
+			}
+			EnExCounter& ctr = chunk[ i ];
+			profiles[ idx ].Merge(
+				ctr.hits.load( std::memory_order_relaxed ),
+				ctr.timed.load( std::memory_order_relaxed ),
+				ctr.totalTime.load( std::memory_order_relaxed ),
+				ctr.minTime.load( std::memory_order_relaxed ),
+				ctr.maxTime.load( std::memory_order_relaxed )
+			);
+			std::atomic<uint64_t>* hist = ctr.hist.load( std::memory_order_acquire );
+			if(hist != NULL){
+				profiles[ idx ].MergeHistogram( hist );
+			}
+		}
+	}
+}
+
+static bool enex_profile_less(const EnExProfile& a, const EnExProfile& b)
+{
+	return strcmp( a.MethodName(), b.MethodName() ) < 0;
+}
+
+/// Builds profiles from either every block, or just the given one.
+static vector<EnExProfile> enex_collect(EnExThreadBlock* only)
+{
+	size_t count = enex_site_count.load( std::memory_order_acquire );
+	if(count > ENEX_MAX_SITES){
+		count = ENEX_MAX_SITES;
+	}
+	vector<EnExProfile> profiles;
+	profiles.reserve( count );
+	for(size_t i = 0; i < count; i++){
+		const char* name = enex_site_name[ i ].load( std::memory_order_acquire );
+		if(i == 0){
+			name = "EnEx overflow";
+		}
+		profiles.push_back( EnExProfile( name == NULL ? "" : name ) );
+		profiles.back().Hits( 0 );
+	}
+
+	if(only != NULL){
+		enex_merge_block( only, profiles );
+	} else {
+		for(EnExThreadBlock* b = enex_blocks.load( std::memory_order_acquire ); b != NULL; b = b->next){
+			enex_merge_block( b, profiles );
+		}
+	}
+
+	vector<EnExProfile> ret;
+	for(size_t i = 0; i < profiles.size(); i++){
+		if(profiles[ i ].Hits() != 0){
+			ret.push_back( profiles[ i ] );
+		}
+	}
+	std::sort( ret.begin(), ret.end(), enex_profile_less );
+	return ret;
 }
 
 EnterExit::EnterExit(const char* methodName) : 
@@ -91,33 +637,91 @@ EnterExit::EnterExit(const char* file, int line, const char* methodName, bool sa
 
 void EnterExit::Init(void)
 {
-	map<const char*, EnExProfile*>::iterator it = thread_hit_counter.find(m_methodName);
-	if(it != thread_hit_counter.end()){
-		// keep track of this for exit timing.
-		m_methodProfile = it->second; 
-		m_methodProfile->HitsInc();
-	} else {
-		// keep track of this for exit timing.
-		m_methodProfile = new EnExProfile(m_methodName);
-		thread_hit_counter[ m_methodName ] = m_methodProfile;
-	}
+	uint32_t site = enex_site( m_methodName );
+	m_counter = enex_counter( site );
+	m_counter->hits.store( m_counter->hits.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
 
 	if(m_line) TRACE(m_file, m_line, "%s: Entering Method", m_methodName);
 	thread_stack_trace.push_back(m_methodName);
-	m_methodEntryStamp = Timer::GetCycleCount();
+	m_prevMethod = thread_current_method;
+	thread_current_method = m_methodName;
+
+	m_node = ENEX_NO_NODE;
+	if(enex_call_tree.load( std::memory_order_relaxed )){
+		m_parentNode = thread_call_node;
+		m_node = enex_call_node( m_parentNode, site );
+		if(m_node != ENEX_NO_NODE){
+			thread_call_node = m_node;
+		}
+	}
+
+	// Decide whether to time this call.  Tracing and the call tree need every call.
+	m_timed = true;
+	bool tracing = enex_tracing.load( std::memory_order_relaxed );
+	if(!tracing && m_node == ENEX_NO_NODE){
+		if(enex_request_sampling.load( std::memory_order_relaxed ) && !thread_request_sampled){
+			m_timed = false;
+		} else {
+			uint32_t rate = enex_sample_rate.load( std::memory_order_relaxed );
+			if(rate > 1){
+				uint32_t countdown = m_counter->countdown.load( std::memory_order_relaxed );
+				if(countdown > 1){
+					m_counter->countdown.store( countdown - 1, std::memory_order_relaxed );
+					m_timed = false;
+				} else {
+					m_counter->countdown.store( rate, std::memory_order_relaxed );
+				}
+			}
+		}
+		if(!m_timed){
+			return;
+		}
+	}
+
+	m_methodEntryStamp = Timer::GetRawCycleCount();
+	if(tracing){
+		enex_trace( 'B', m_methodName, m_methodEntryStamp );
+	}
 }
 
 EnterExit::~EnterExit()
 {
-	m_methodExitStamp = Timer::GetCycleCount();
+	if(!m_timed){
+		if(m_line) TRACE(m_file, m_line, "%s: Exiting Method", m_methodName);
+		thread_stack_trace.pop_back();
+		thread_current_method = m_prevMethod;
+		return;
+	}
+
+	m_methodExitStamp = Timer::GetRawCycleCount();
+	if(enex_tracing.load( std::memory_order_relaxed )){
+		enex_trace( 'E', m_methodName, m_methodExitStamp );
+	}
 	if(m_line) TRACE(m_file, m_line, "%s: Exiting Method", m_methodName);
 	thread_stack_trace.pop_back();
+	thread_current_method = m_prevMethod;
 
-	m_methodProfile->RecordEntryExit(m_methodEntryStamp, m_methodExitStamp);
+	uint64_t diff = m_methodExitStamp - m_methodEntryStamp;
+	m_counter->timed.store( m_counter->timed.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+	m_counter->totalTime.store( m_counter->totalTime.load( std::memory_order_relaxed ) + diff, std::memory_order_relaxed );
+	if(diff < m_counter->minTime.load( std::memory_order_relaxed )){
+		m_counter->minTime.store( diff, std::memory_order_relaxed );
+	}
+	if(diff > m_counter->maxTime.load( std::memory_order_relaxed )){
+		m_counter->maxTime.store( diff, std::memory_order_relaxed );
+	}
+
+	std::atomic<uint64_t>* hist = enex_hist( m_counter );
+	std::atomic<uint64_t>& bucket = hist[ EnExHistogram::Bucket( diff ) ];
+	bucket.store( bucket.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
 
-	if(m_saveToGlobal){
-		// Save our whole hit counter map to the global aggregate
-		SaveToGlobal();
+	if(m_node != ENEX_NO_NODE && thread_block != NULL){
+		EnExCallNode& n = enex_node( thread_block, m_node );
+		n.hits.store( n.hits.load( std::memory_order_relaxed ) + 1, std::memory_order_relaxed );
+		n.inclusiveTime.store( n.inclusiveTime.load( std::memory_order_relaxed ) + diff, std::memory_order_relaxed );
+		EnExCallNode& p = enex_node( thread_block, m_parentNode );
+		p.childTime.store( p.childTime.load( std::memory_order_relaxed ) + diff, std::memory_order_relaxed );
+		thread_call_node = m_parentNode;
 	}
 }
 
@@ -144,7 +748,12 @@ void EnterExit::PrintStackTrace(int channel)
 twine EnterExit::GetStackTrace(void)
 {
 	twine tmp, msg;
-	tmp.format("Stack trace for thread: %d\n", (uint32_t)(intptr_t)Thread::CurrentThreadId() );
+	twine name = Thread::CurrentName();
+	if(name.empty()){
+		tmp.format("Stack trace for thread: %d\n", (uint32_t)(intptr_t)Thread::CurrentThreadId() );
+	} else {
+		tmp.format("Stack trace for thread: %d (%s)\n", (uint32_t)(intptr_t)Thread::CurrentThreadId(), name() );
+	}
 	msg += tmp;
 	for(auto trace : thread_stack_trace){
 		tmp.format("\t%s\n", trace );
@@ -153,158 +762,549 @@ twine EnterExit::GetStackTrace(void)
 	return msg;
 }
 
+const char* EnterExit::CurrentMethod(void)
+{
+	return thread_current_method;
+}
+
 void EnterExit::SaveToGlobal(void)
 {
-	SLib::Lock the_lock(GlobalHitCounterMutex());
+	// Nothing to do - GlobalProfiles reads every thread's counters directly.
+}
 
-	map<const char*, EnExProfile*>::iterator our_it;
-	map<const char*, EnExProfile*>::iterator glob_it;
+vector<EnExProfile> EnterExit::GlobalProfiles(void)
+{
+	return enex_collect( NULL );
+}
 
-	// Walk all of our hit counters:
-	for(our_it = thread_hit_counter.begin(); our_it != thread_hit_counter.end(); our_it++){
+vector<EnExProfile> EnterExit::ThreadProfiles(void)
+{
+	if(thread_block == NULL){
+		return vector<EnExProfile>();
+	}
+	return enex_collect( thread_block );
+}
 
-		// Now find this entry in the global hit counter map:
+void EnterExit::ResetProfiles(void)
+{
+	enex_epoch.fetch_add( 1 );
+}
 
-		glob_it = GlobalHitCounter().find(our_it->first);
-		EnExProfile* glob_method_profile = 0;
-		if(glob_it != GlobalHitCounter().end()){
-			// We found the method in the global map
-			glob_method_profile = glob_it->second;
+void EnterExit::SetSampleRate(uint32_t oneIn)
+{
+	enex_sample_rate.store( oneIn == 0 ? 1 : oneIn );
+}
+
+uint32_t EnterExit::SampleRate(void)
+{
+	return enex_sample_rate.load();
+}
+
+void EnterExit::SetRequestSampling(bool onoff)
+{
+	enex_request_sampling.store( onoff );
+}
+
+void EnterExit::SampleRequest(bool sampled)
+{
+	thread_request_sampled = sampled;
+}
+
+void EnterExit::SetTracing(bool onoff)
+{
+	enex_tracing.store( onoff );
+}
+
+bool EnterExit::TracingOn(void)
+{
+	return enex_tracing.load();
+}
+
+void EnterExit::SetTraceBufferSize(size_t events)
+{
+	enex_trace_size.store( events == 0 ? 1 : events );
+}
+
+void EnterExit::ClearTrace(void)
+{
+	enex_trace_start.store( Timer::GetRawCycleCount() );
+}
+
+/// A copy of one trace event, taken while writing the trace out
+struct EnExTraceCopy {
+	const char* name;
+	uint64_t stamp;
+	uint32_t tid;
+	char phase;
+};
+
+static bool enex_trace_less(const EnExTraceCopy& a, const EnExTraceCopy& b)
+{
+	return a.stamp < b.stamp;
+}
+
+/// Copies whatever is in one block's ring buffer that is still intact.
+static void enex_copy_trace(EnExThreadBlock* b, uint64_t since, vector<EnExTraceCopy>& events)
+{
+	EnExTraceEvent* ring = b->trace.load( std::memory_order_acquire );
+	if(ring == NULL){
+		return;
+	}
+	size_t size = b->traceSize;
+	uint64_t head = b->traceHead.load( std::memory_order_acquire );
+	uint64_t start = head > size ? head - size : 0;
+	size_t first = events.size();
+	for(uint64_t i = start; i < head; i++){
+		EnExTraceEvent& e = ring[ i & (size - 1) ];
+		EnExTraceCopy c;
+		c.name = e.name.load( std::memory_order_relaxed );
+		c.stamp = e.stamp.load( std::memory_order_relaxed );
+		c.tid = e.tid.load( std::memory_order_relaxed );
+		c.phase = e.phase.load( std::memory_order_relaxed );
+		events.push_back( c );
+	}
+
+	// Drop anything the owner may have overwritten while we were copying.
+	uint64_t after = b->traceHead.load( std::memory_order_acquire );
+	uint64_t overwritten = after + 1 > size ? after + 1 - size : 0;
+	size_t keepFrom = first + (size_t)(overwritten > start ? overwritten - start : 0);
+	if(keepFrom > events.size()){
+		keepFrom = events.size();
+	}
+	events.erase( events.begin() + first, events.begin() + keepFrom );
+
+	// And anything from before the last ClearTrace.
+	for(size_t i = first; i < events.size(); ){
+		if(events[ i ].stamp < since || events[ i ].name == NULL){
+			events.erase( events.begin() + i );
 		} else {
-			// We didn't find the method in the global map.  We need to
-			// add a new one.
-			glob_method_profile = new EnExProfile(our_it->first);
-			glob_method_profile->Hits(0); // Zero out the hit count.
-			GlobalHitCounter()[ our_it->first ] = glob_method_profile;
+			i++;
 		}
+	}
+}
 
-		// Now update the global method profile with our information:
-		glob_method_profile->Add( *(our_it->second) );
+/// Writes a method name as a JSON string
+static void enex_json_string(FILE* fp, const char* str)
+{
+	fputc( '"', fp );
+	for(const char* c = str; *c != '\0'; c++){
+		if(*c == '"' || *c == '\\'){
+			fputc( '\\', fp );
+			fputc( *c, fp );
+		} else if((unsigned char)*c < 0x20){
+			fprintf( fp, "\\u%04x", (unsigned char)*c );
+		} else {
+			fputc( *c, fp );
+		}
+	}
+	fputc( '"', fp );
+}
 
-		// After adding it to the global profile, remember to zero out our values
-		// so that we don't double things up in the global profile later.
-		our_it->second->Reset();
+void EnterExit::WriteChromeTrace(const twine& fileName)
+{
+	uint64_t since = enex_trace_start.load();
+	vector<EnExTraceCopy> events;
+	for(EnExThreadBlock* b = enex_blocks.load( std::memory_order_acquire ); b != NULL; b = b->next){
+		enex_copy_trace( b, since, events );
+	}
+	std::stable_sort( events.begin(), events.end(), enex_trace_less );
 
+	FILE* fp = fopen( fileName(), "w" );
+	if(fp == NULL){
+		throw AnException(0, FL, "Error opening trace file %s", fileName() );
 	}
+	uint64_t base = events.size() == 0 ? 0 : events[ 0 ].stamp;
+#ifdef _WIN32
+	int pid = (int)GetCurrentProcessId();
+#else
+	int pid = (int)getpid();
+#endif
+	fprintf( fp, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n" );
 
-	// Exiting this method releases the lock on the global hit counter map.
+	// Metadata events that name the threads that have names.
+	vector<bool> named;
+	for(size_t i = 0; i < events.size(); i++){
+		uint32_t tid = events[ i ].tid;
+		if(tid >= ENEX_MAX_TRACE_TIDS){
+			continue;
+		}
+		if(named.size() <= tid){
+			named.resize( tid + 1, false );
+		}
+		if(named[ tid ]){
+			continue;
+		}
+		named[ tid ] = true;
+		// The trace can outlive the threads in it.
+		twine name = Thread::NameOf( enex_trace_log_ids[ tid ].load( std::memory_order_relaxed ), true );
+		if(!name.empty()){
+			fprintf( fp, "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%u,\"args\":{\"name\":", pid, tid );
+			enex_json_string( fp, name() );
+			fprintf( fp, "}},\n" );
+		}
+	}
+	for(size_t i = 0; i < events.size(); i++){
+		fprintf( fp, "{\"name\":" );
+		enex_json_string( fp, events[ i ].name );
+		fprintf( fp, ",\"cat\":\"EnEx\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%u}%s\n",
+			events[ i ].phase,
+			Timer::CyclesToNs( (double)(events[ i ].stamp - base) ) / 1000.0,
+			pid, events[ i ].tid,
+			i + 1 < events.size() ? "," : ""
+		);
+	}
+	fprintf( fp, "]}\n" );
+	bool failed = ferror( fp ) != 0;
+	fclose( fp );
+	if(failed){
+		throw AnException(0, FL, "Error writing trace file %s", fileName() );
+	}
+}
+
+#ifndef _WIN32
+/** Our signal handler writes a byte to this pipe, and our dump thread sleeps reading from it.
+  * Writing to a pipe is one of the few things a signal handler can safely do.
+  */
+static int enex_dump_pipe[ 2 ] = { -1, -1 };
+static Thread* enex_dump_thread = NULL;
+
+/// The file to dump to.  Guarded by enex_dump_mutex, along with starting the thread.  Never deleted.
+static twine* enex_dump_file = NULL;
+
+static Mutex* enex_dump_mutex(void)
+{
+	// Never deleted, so that it is still there for a signal that arrives during exit.
+	static Mutex* mut = new Mutex();
+	return mut;
+}
+
+static void enex_dump_signal(int sig)
+{
+	int savedErrno = errno;
+	char c = 1;
+	// The write end doesn't block.  If the pipe is full a dump is already on its way.
+	ssize_t ignored = write( enex_dump_pipe[ 1 ], &c, 1 );
+	(void)ignored;
+	errno = savedErrno;
+}
+
+static void* enex_dump_loop(void* arg)
+{
+	char buf[ 64 ];
+	while(true){
+		ssize_t got = read( enex_dump_pipe[ 0 ], buf, sizeof(buf) );
+		if(got <= 0){
+			if(got < 0 && errno == EINTR){
+				continue;
+			}
+			break; // the pipe is gone
+		}
+		twine fileName;
+		{
+			Lock theLock( enex_dump_mutex() );
+			fileName = *enex_dump_file;
+		}
+		try {
+			EnterExit::WriteChromeTrace( fileName );
+		} catch (AnException& e){
+			printf("Error writing EnEx trace: %s\n", e.Msg() );
+		}
+	}
+	return NULL;
+}
+#endif
+
+void EnterExit::DumpTraceOnSignal(int signal, const twine& fileName)
+{
+#ifdef _WIN32
+	throw AnException(0, FL, "DumpTraceOnSignal is not available on Windows.");
+#else
+	{
+		Lock theLock( enex_dump_mutex() );
+		if(enex_dump_file == NULL){
+			enex_dump_file = new twine( fileName );
+		} else {
+			*enex_dump_file = fileName;
+		}
+		if(enex_dump_thread == NULL){
+			if(pipe( enex_dump_pipe ) != 0){
+				throw AnException(0, FL, "Error creating the trace dump pipe: %d", errno );
+			}
+			fcntl( enex_dump_pipe[ 1 ], F_SETFL, fcntl( enex_dump_pipe[ 1 ], F_GETFL ) | O_NONBLOCK );
+			Thread* t = new Thread();
+			if(t->start( enex_dump_loop, NULL ) != 0){
+				delete t;
+				close( enex_dump_pipe[ 0 ] );
+				close( enex_dump_pipe[ 1 ] );
+				enex_dump_pipe[ 0 ] = enex_dump_pipe[ 1 ] = -1;
+				throw AnException(0, FL, "Unable to start the trace dump thread.");
+			}
+			t->detach();
+			enex_dump_thread = t;
+		}
+	}
+	struct sigaction sa;
+	memset( &sa, 0, sizeof(sa) );
+	sa.sa_handler = enex_dump_signal;
+	sigemptyset( &sa.sa_mask );
+	sa.sa_flags = SA_RESTART;
+	if(sigaction( signal, &sa, NULL ) != 0){
+		throw AnException(0, FL, "Error installing the trace dump handler for signal %d", signal );
+	}
+#endif
+}
+
+void EnterExit::SetCallTree(bool onoff)
+{
+	enex_call_tree.store( onoff );
+}
+
+bool EnterExit::CallTreeOn(void)
+{
+	return enex_call_tree.load();
+}
+
+/// Adds the call paths in one block's tree onto paths.
+static void enex_copy_paths(EnExThreadBlock* b, vector<EnExCallPath>& paths)
+{
+	if(b->epoch.load( std::memory_order_acquire ) != enex_epoch.load( std::memory_order_acquire )){
+		return; // reset since this block was last used
+	}
+	uint32_t count = b->nodeCount.load( std::memory_order_acquire );
+
+	// A parent is always added before its children, so its path is ready when we need it.
+	vector<twine> names( count );
+	for(uint32_t i = 1; i < count; i++){
+		EnExCallNode& n = b->nodes[ i / ENEX_NODE_CHUNK ].load( std::memory_order_acquire )[ i % ENEX_NODE_CHUNK ];
+		const char* name = n.site == 0 ? "EnEx overflow" : enex_site_name[ n.site ].load( std::memory_order_acquire );
+		twine frame( name == NULL ? "" : name );
+		for(size_t c = 0; c < frame.size(); c++){
+			if(frame[ c ] == ';' || frame[ c ] == '\n'){
+				frame[ c ] = '_'; // these would break the folded format
+			}
+		}
+		if(n.parent != 0){
+			names[ i ] = names[ n.parent ];
+			names[ i ] += ";";
+		}
+		names[ i ] += frame;
+
+		uint64_t hits = n.hits.load( std::memory_order_relaxed );
+		if(hits == 0){
+			continue;
+		}
+		uint64_t inclusive = n.inclusiveTime.load( std::memory_order_relaxed );
+		uint64_t child = n.childTime.load( std::memory_order_relaxed );
+		EnExCallPath path;
+		path.path = names[ i ];
+		path.hits = hits;
+		path.inclusiveTime = Timer::CyclesToNs( (double)inclusive );
+		path.exclusiveTime = Timer::CyclesToNs( (double)(child < inclusive ? inclusive - child : 0) );
+		paths.push_back( path );
+	}
+}
+
+static bool enex_path_less(const EnExCallPath& a, const EnExCallPath& b)
+{
+	return a.path.compare( b.path ) < 0;
+}
+
+vector<EnExCallPath> EnterExit::CallPaths(void)
+{
+	vector<EnExCallPath> paths;
+	for(EnExThreadBlock* b = enex_blocks.load( std::memory_order_acquire ); b != NULL; b = b->next){
+		enex_copy_paths( b, paths );
+	}
+	std::sort( paths.begin(), paths.end(), enex_path_less );
+
+	vector<EnExCallPath> ret;
+	for(size_t i = 0; i < paths.size(); i++){
+		if(ret.size() != 0 && ret.back().path == paths[ i ].path){
+			ret.back().hits += paths[ i ].hits;
+			ret.back().inclusiveTime += paths[ i ].inclusiveTime;
+			ret.back().exclusiveTime += paths[ i ].exclusiveTime;
+		} else {
+			ret.push_back( paths[ i ] );
+		}
+	}
+	return ret;
+}
+
+twine EnterExit::FoldedStacks(void)
+{
+	vector<EnExCallPath> paths = CallPaths();
+	twine ret, tmp;
+	for(size_t i = 0; i < paths.size(); i++){
+		tmp.format( "%s %llu\n", paths[ i ].path(), (unsigned long long)(paths[ i ].exclusiveTime + 0.5) );
+		ret += tmp;
+	}
+	return ret;
+}
+
+void EnterExit::WriteFoldedStacks(const twine& fileName)
+{
+	twine folded = FoldedStacks();
+	FILE* fp = fopen( fileName(), "w" );
+	if(fp == NULL){
+		throw AnException(0, FL, "Error opening folded stack file %s", fileName() );
+	}
+	bool failed = fwrite( folded(), 1, folded.size(), fp ) != folded.size();
+	if(fclose( fp ) != 0){
+		failed = true;
+	}
+	if(failed){
+		throw AnException(0, FL, "Error writing folded stack file %s", fileName() );
+	}
 }
 
 void EnterExit::PrintHitMap(void)
 {
-	printf("%40s\t%12s\t%16s\t%16s\t%16s\t%16s\n",
+	printf("%40s\t%12s\t%16s\t%16s\t%16s\t%16s\t%16s\t%16s\t%16s\n",
 		"Method Name",
 		"Total Hits",
-		"Average Cycles",
-		"Min Cycles",
-		"Max Cycles",
-		"Total Cycles");
-	printf("%40s\t%12s\t%16s\t%16s\t%16s\t%16s\n",
+		"Average ns",
+		"Min ns",
+		"Max ns",
+		"Total ns",
+		"P50 ns",
+		"P99 ns",
+		"P99.9 ns");
+	printf("%40s\t%12s\t%16s\t%16s\t%16s\t%16s\t%16s\t%16s\t%16s\n",
 		"===========",
 		"==========",
 		"==============",
 		"==========",
 		"==========",
+		"============",
+		"==========",
+		"==========",
 		"============");
-	for(auto it : thread_hit_counter){
-		printf("%40s\t%12ld\t%16.2f\t%16.2f\t%16.2f\t%16.2f\n",
-			it.first, it.second->Hits(),
-			it.second->AvgTime(),
-			it.second->MinTime(),
-			it.second->MaxTime(),
-			it.second->TotalTime()
+	vector<EnExProfile> profiles = ThreadProfiles();
+	for(auto& it : profiles){
+		printf("%40s\t%12ld\t%16.2f\t%16.2f\t%16.2f\t%16.2f\t%16.2f\t%16.2f\t%16.2f\n",
+			it.MethodName(), it.Hits(),
+			it.AvgTime(),
+			it.MinTime(),
+			it.MaxTime(),
+			it.TotalTime(),
+			it.Percentile( 50.0 ),
+			it.Percentile( 99.0 ),
+			it.Percentile( 99.9 )
 		);
-		if(it.second->StopProfile()){
-			printf("\tProfiling stopped after a thousand hits with an average less than 0.0001\n");
-		}
 	}
 }
 
 void EnterExit::PrintGlobalHitMap(void)
 {
-	map<const char*, EnExProfile*>::iterator it;
-	printf("%40s\t%12s\t%16s\t%16s\t%16s\t%16s\n",
+	vector<EnExProfile> profiles = GlobalProfiles();
+	printf("%40s\t%12s\t%16s\t%16s\t%16s\t%16s\t%16s\t%16s\t%16s\n",
 		"Method Name",
 		"Total Hits",
-		"Average Cycles",
-		"Min Cycles",
-		"Max Cycles",
-		"Total Cycles");
-	printf("%40s\t%12s\t%16s\t%16s\t%16s\t%16s\n",
+		"Average ns",
+		"Min ns",
+		"Max ns",
+		"Total ns",
+		"P50 ns",
+		"P99 ns",
+		"P99.9 ns");
+	printf("%40s\t%12s\t%16s\t%16s\t%16s\t%16s\t%16s\t%16s\t%16s\n",
 		"===========",
 		"==========",
 		"==============",
 		"==========",
 		"==========",
+		"============",
+		"==========",
+		"==========",
 		"============");
-	for(it = GlobalHitCounter().begin(); it != GlobalHitCounter().end(); it++){
-		printf("%40s\t%12ld\t%16.2f\t%16.2f\t%16.2f\t%16.2f\n",
-			it->first, it->second->Hits(),
-			it->second->AvgTime(),
-			it->second->MinTime(),
-			it->second->MaxTime(),
-			it->second->TotalTime()
+	for(auto it = profiles.begin(); it != profiles.end(); it++){
+		printf("%40s\t%12ld\t%16.2f\t%16.2f\t%16.2f\t%16.2f\t%16.2f\t%16.2f\t%16.2f\n",
+			it->MethodName(), it->Hits(),
+			it->AvgTime(),
+			it->MinTime(),
+			it->MaxTime(),
+			it->TotalTime(),
+			it->Percentile( 50.0 ),
+			it->Percentile( 99.0 ),
+			it->Percentile( 99.9 )
 		);
-		if(it->second->StopProfile()){
-			printf("\tProfiling stopped after a thousand hits with an average less than 0.0001\n");
-		}
 	}
 }
 
 void EnterExit::PrintGlobalHitMap(twine& output)
 {
 	twine tmp;
-	map<const char*, EnExProfile*>::iterator it;
-	tmp.format("%40s\t%12s\t%16s\t%16s\t%16s\t%16s\n",
+	vector<EnExProfile> profiles = GlobalProfiles();
+	tmp.format("%40s\t%12s\t%16s\t%16s\t%16s\t%16s\t%16s\t%16s\t%16s\n",
 		"Method Name",
 		"Total Hits",
-		"Average Cycles",
-		"Min Cycles",
-		"Max Cycles",
-		"Total Cycles");
+		"Average ns",
+		"Min ns",
+		"Max ns",
+		"Total ns",
+		"P50 ns",
+		"P99 ns",
+		"P99.9 ns");
 	output += tmp;
-	tmp.format("%40s\t%12s\t%16s\t%16s\t%16s\t%16s\n",
+	tmp.format("%40s\t%12s\t%16s\t%16s\t%16s\t%16s\t%16s\t%16s\t%16s\n",
 		"===========",
 		"==========",
 		"==============",
 		"==========",
 		"==========",
+		"============",
+		"==========",
+		"==========",
 		"============");
 	output += tmp;
-	for(it = GlobalHitCounter().begin(); it != GlobalHitCounter().end(); it++){
-		tmp.format("%40s\t%12ld\t%16.2f\t%16.2f\t%16.2f\t%16.2f\n",
-			it->first, it->second->Hits(),
-			it->second->AvgTime(),
-			it->second->MinTime(),
-			it->second->MaxTime(),
-			it->second->TotalTime()
+	for(auto it = profiles.begin(); it != profiles.end(); it++){
+		tmp.format("%40s\t%12ld\t%16.2f\t%16.2f\t%16.2f\t%16.2f\t%16.2f\t%16.2f\t%16.2f\n",
+			it->MethodName(), it->Hits(),
+			it->AvgTime(),
+			it->MinTime(),
+			it->MaxTime(),
+			it->TotalTime(),
+			it->Percentile( 50.0 ),
+			it->Percentile( 99.0 ),
+			it->Percentile( 99.9 )
 		);
 		output += tmp;
-		if(it->second->StopProfile()){
-			tmp.format("\tProfiling stopped after a thousand hits with an average less than 0.0001\n");
-			output += tmp;
-		}
 	}
 }
 
 void EnterExit::RecordGlobalHitMap(xmlNodePtr node)
 {
 	twine tmp;
-	map<const char*, EnExProfile*>::iterator it;
+	vector<EnExProfile> profiles = GlobalProfiles();
 
-	for(it = GlobalHitCounter().begin(); it != GlobalHitCounter().end(); it++){
+	for(auto it = profiles.begin(); it != profiles.end(); it++){
 		xmlNodePtr child = xmlNewChild(node, NULL, (const xmlChar*)"HitMap", NULL);
-		xmlSetProp(child, (const xmlChar*)"MethodName", (const xmlChar*)it->first);
-		tmp.format("%ld", it->second->Hits());
+		xmlSetProp(child, (const xmlChar*)"MethodName", (const xmlChar*)it->MethodName());
+		tmp.format("%ld", it->Hits());
 		xmlSetProp(child, (const xmlChar*)"TotalHits", tmp);
-		tmp.format("%ld", (long)it->second->AvgTime());
+		// The *Cycles attributes have always been in Timer::GetCycleCount units, which are microseconds.
+		tmp.format("%ld", (long)(it->AvgTime() / 1000.0));
 		xmlSetProp(child, (const xmlChar*)"AverageCycles", tmp);
-		tmp.format("%ld", (long)it->second->MinTime());
+		tmp.format("%ld", (long)(it->MinTime() / 1000.0));
 		xmlSetProp(child, (const xmlChar*)"MinCycles", tmp);
-		tmp.format("%ld", (long)it->second->MaxTime());
+		tmp.format("%ld", (long)(it->MaxTime() / 1000.0));
 		xmlSetProp(child, (const xmlChar*)"MaxCycles", tmp);
-		tmp.format("%ld", (long)it->second->TotalTime());
+		tmp.format("%ld", (long)(it->TotalTime() / 1000.0));
 		xmlSetProp(child, (const xmlChar*)"TotalCycles", tmp);
+		tmp.format("%ld", (long)it->AvgTime());
+		xmlSetProp(child, (const xmlChar*)"AverageNs", tmp);
+		tmp.format("%ld", (long)it->MinTime());
+		xmlSetProp(child, (const xmlChar*)"MinNs", tmp);
+		tmp.format("%ld", (long)it->MaxTime());
+		xmlSetProp(child, (const xmlChar*)"MaxNs", tmp);
+		tmp.format("%ld", (long)it->TotalTime());
+		xmlSetProp(child, (const xmlChar*)"TotalNs", tmp);
+		tmp.format("%ld", (long)it->Percentile( 50.0 ));
+		xmlSetProp(child, (const xmlChar*)"P50Ns", tmp);
+		tmp.format("%ld", (long)it->Percentile( 99.0 ));
+		xmlSetProp(child, (const xmlChar*)"P99Ns", tmp);
+		tmp.format("%ld", (long)it->Percentile( 99.9 ));
+		xmlSetProp(child, (const xmlChar*)"P999Ns", tmp);
 	}
 }
 
@@ -312,10 +1312,10 @@ EnExProfile::EnExProfile(const char* methodName)
 {
 	m_methodName = methodName;
 	m_hits = 1;	
+	m_timed = 0;
 	m_totalTime = 0;
 	m_minTime = 100000000;
 	m_maxTime = 0;
-	m_stopProfile = false;
 }
 
 EnExProfile::~EnExProfile()
@@ -326,14 +1326,17 @@ EnExProfile::~EnExProfile()
 void EnExProfile::Reset(void)
 {
 	m_hits = 0;
+	m_timed = 0;
 	m_totalTime = 0;
 	m_minTime = 0;
 	m_maxTime = 0;
+	m_hist.Reset();
 }
 
 void EnExProfile::Add( const EnExProfile& eep)
 {
 	m_hits += eep.m_hits;
+	m_timed += eep.m_timed;
 	m_totalTime += eep.m_totalTime;
 	if(eep.m_minTime < m_minTime){
 		m_minTime = eep.m_minTime;
@@ -341,6 +1344,52 @@ void EnExProfile::Add( const EnExProfile& eep)
 	if(eep.m_maxTime > m_maxTime){
 		m_maxTime = eep.m_maxTime;
 	}
+	m_hist.Add( eep.m_hist );
+}
+
+void EnExProfile::Merge(uint64_t hits, uint64_t timed, uint64_t totalTime, uint64_t minTime, uint64_t maxTime)
+{
+	if(hits == 0){
+		return;
+	}
+	if(m_hits == 0){
+		m_minTime = UINT64_MAX; // MinTime reports 0 until something has been timed
+		m_maxTime = 0;
+	}
+	if(minTime < m_minTime){
+		m_minTime = minTime;
+	}
+	if(maxTime > m_maxTime){
+		m_maxTime = maxTime;
+	}
+	m_hits += hits;
+	m_timed += timed;
+	m_totalTime += totalTime;
+}
+
+void EnExProfile::MergeHistogram(const std::atomic<uint64_t>* buckets)
+{
+	for(size_t i = 0; i < ENEX_HIST_BUCKETS; i++){
+		uint64_t count = buckets[ i ].load( std::memory_order_relaxed );
+		if(count != 0){
+			m_hist.AddBucket( i, count );
+		}
+	}
+}
+
+const char* EnExProfile::MethodName(void) const
+{
+	return m_methodName;
+}
+
+double EnExProfile::Percentile(double percent)
+{
+	return Timer::CyclesToNs( (double)m_hist.Percentile( percent ) );
+}
+
+const EnExHistogram& EnExProfile::Histogram(void) const
+{
+	return m_hist;
 }
 
 unsigned long EnExProfile::Hits(void)
@@ -358,34 +1407,39 @@ void EnExProfile::HitsInc(void)
 	m_hits ++;
 }
 
-bool EnExProfile::StopProfile(void)
+uint64_t EnExProfile::TimedHits(void)
 {
-	return m_stopProfile;
-}
-
-void EnExProfile::StopProfile(bool tf)
-{
-	m_stopProfile = tf;
+	return m_timed;
 }
 
 double EnExProfile::AvgTime(void)
 {
-	return TotalTime() / m_hits * 1.0;
+	if(m_timed == 0){
+		return 0.0;
+	}
+	return Timer::CyclesToNs( (double)m_totalTime ) / m_timed;
 }
 
 double EnExProfile::MinTime(void)
 {
-	return (double)m_minTime;
+	if(m_minTime == UINT64_MAX){
+		return 0.0;
+	}
+	return Timer::CyclesToNs( (double)m_minTime );
 }
 
 double EnExProfile::MaxTime(void)
 {
-	return (double)m_maxTime;
+	return Timer::CyclesToNs( (double)m_maxTime );
 }
 
 double EnExProfile::TotalTime(void)
 {
-	return (double)m_totalTime;
+	// When sampling, scale the time of the calls we timed up to all of them.
+	if(m_timed != 0 && m_timed < m_hits){
+		return Timer::CyclesToNs( (double)m_totalTime ) * ((double)m_hits / (double)m_timed);
+	}
+	return Timer::CyclesToNs( (double)m_totalTime );
 }
 
 void EnExProfile::RecordEntryExit(uint64_t entry, uint64_t exit)
@@ -396,6 +1450,7 @@ void EnExProfile::RecordEntryExit(uint64_t entry, uint64_t exit)
 	}
 
 	// Add To the total time:
+	m_timed ++;
 	m_totalTime += diff;
 
 	// Is it less than the min?
@@ -408,4 +1463,100 @@ void EnExProfile::RecordEntryExit(uint64_t entry, uint64_t exit)
 		m_maxTime = diff;
 	}
 
+	m_hist.Record( diff );
+}
+
+EnExHistogram::EnExHistogram()
+{
+	Reset();
+}
+
+void EnExHistogram::Reset(void)
+{
+	memset( m_counts, 0, sizeof(m_counts) );
+	m_count = 0;
+}
+
+void EnExHistogram::Record(uint64_t value)
+{
+	m_counts[ Bucket( value ) ] ++;
+	m_count ++;
+}
+
+void EnExHistogram::Add(const EnExHistogram& other)
+{
+	for(size_t i = 0; i < ENEX_HIST_BUCKETS; i++){
+		m_counts[ i ] += other.m_counts[ i ];
+	}
+	m_count += other.m_count;
+}
+
+void EnExHistogram::AddBucket(size_t bucket, uint64_t count)
+{
+	m_counts[ bucket ] += count;
+	m_count += count;
+}
+
+uint64_t EnExHistogram::Count(void) const
+{
+	return m_count;
+}
+
+uint64_t EnExHistogram::Percentile(double percent) const
+{
+	if(m_count == 0){
+		return 0;
+	}
+	uint64_t target = (uint64_t)ceil( percent / 100.0 * (double)m_count );
+	if(target == 0){
+		target = 1;
+	}
+	uint64_t seen = 0;
+	for(size_t i = 0; i < ENEX_HIST_BUCKETS; i++){
+		seen += m_counts[ i ];
+		if(seen >= target){
+			return BucketLow( i ) + (BucketHigh( i ) - BucketLow( i )) / 2;
+		}
+	}
+	return BucketHigh( ENEX_HIST_BUCKETS - 1 );
+}
+
+size_t EnExHistogram::Bucket(uint64_t value)
+{
+	const uint64_t sub = 1 << ENEX_HIST_SUB_BITS;
+	if(value < sub){
+		return (size_t)value; // small values get a bucket each
+	}
+#ifdef _WIN32
+	unsigned long top;
+	_BitScanReverse64( &top, value );
+#else
+	int top = 63 - __builtin_clzll( value );
+#endif
+	if(top >= ENEX_HIST_MAX_BITS){
+		return ENEX_HIST_BUCKETS - 1;
+	}
+	int shift = (int)top - ENEX_HIST_SUB_BITS;
+	return (size_t)( sub + shift * sub + ( (value >> shift) & (sub - 1) ) );
+}
+
+uint64_t EnExHistogram::BucketLow(size_t bucket)
+{
+	const uint64_t sub = 1 << ENEX_HIST_SUB_BITS;
+	if(bucket < sub){
+		return bucket;
+	}
+	uint64_t shift = (bucket - sub) / sub;
+	uint64_t offset = (bucket - sub) % sub;
+	return (sub + offset) << shift;
+}
+
+uint64_t EnExHistogram::BucketHigh(size_t bucket)
+{
+	const uint64_t sub = 1 << ENEX_HIST_SUB_BITS;
+	if(bucket < sub){
+		return bucket;
+	}
+	uint64_t shift = (bucket - sub) / sub;
+	return BucketLow( bucket ) + ((uint64_t)1 << shift) - 1;
 }
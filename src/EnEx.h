@@ -16,6 +16,7 @@
 #include <vector>
 #include <string>
 #include <map>
+#include <atomic>
 using namespace std;
 
 /* SLib headers */
@@ -24,6 +25,68 @@ using namespace std;
 #include "xmlinc.h"
 namespace SLib {
 
+/// The most distinct methods we keep counters for.  Methods beyond this share one overflow entry.
+#define ENEX_MAX_SITES 8192
+
+/// Counters for one method on one thread.  Defined in EnEx.cpp.
+struct EnExCounter;
+
+/// The most distinct call paths we keep for each thread.  Calls beyond this are left out of the call tree.
+#define ENEX_MAX_PATHS 65536
+
+/// Each power of 2 in a histogram is split into 2 ^ ENEX_HIST_SUB_BITS equal buckets.
+#define ENEX_HIST_SUB_BITS 3
+
+/// Times of 2 ^ ENEX_HIST_MAX_BITS and above all go in the last histogram bucket.
+#define ENEX_HIST_MAX_BITS 40
+
+/// The number of buckets in a histogram
+#define ENEX_HIST_BUCKETS ((1 << ENEX_HIST_SUB_BITS) + (ENEX_HIST_MAX_BITS - ENEX_HIST_SUB_BITS) * (1 << ENEX_HIST_SUB_BITS))
+
+/**
+  * A log-linear latency histogram, in the style of HdrHistogram.  Small times get a bucket
+  * each, and above that every power of 2 is split into a fixed number of equal buckets, so
+  * any recorded time is known to within 12.5% using a fixed amount of memory.
+  */
+class DLLEXPORT EnExHistogram {
+	public:
+		EnExHistogram();
+
+		/// Clears every bucket
+		void Reset(void);
+
+		/// Records one time
+		void Record(uint64_t value);
+
+		/// Adds the counts in the given buckets to ours
+		void Add(const EnExHistogram& other);
+
+		/// Adds count to the given bucket
+		void AddBucket(size_t bucket, uint64_t count);
+
+		/// The total number of times recorded
+		uint64_t Count(void) const;
+
+		/** Returns the time below which the given percentage (0-100) of recorded times fall.
+		  * This is the middle of the bucket the percentile lands in, or 0 if nothing has
+		  * been recorded.
+		  */
+		uint64_t Percentile(double percent) const;
+
+		/// Returns the bucket that a time is recorded in
+		static size_t Bucket(uint64_t value);
+
+		/// Returns the smallest time recorded in the given bucket
+		static uint64_t BucketLow(size_t bucket);
+
+		/// Returns the largest time recorded in the given bucket
+		static uint64_t BucketHigh(size_t bucket);
+
+	private:
+		uint64_t m_counts[ ENEX_HIST_BUCKETS ];
+		uint64_t m_count;
+};
+
 class DLLEXPORT EnExProfile {
 	public:
 
@@ -36,9 +99,9 @@ class DLLEXPORT EnExProfile {
 		void Hits(unsigned long);
 		void HitsInc(void);
 
-		bool StopProfile(void);
-		void StopProfile(bool tf);
-
+		/** Call times are recorded in Timer::GetRawCycleCount units, and these return them
+		  * converted to nanoseconds.
+		  */
 		double AvgTime(void);
 		double MinTime(void);
 		double MaxTime(void);
@@ -46,6 +109,28 @@ class DLLEXPORT EnExProfile {
 
 		void RecordEntryExit(uint64_t entry, uint64_t exit);
 
+		/// Returns the name of the method we are profiling
+		const char* MethodName(void) const;
+
+		/// Returns the time, in nanoseconds, below which the given percentage (0-100) of calls finished
+		double Percentile(double percent);
+
+		/// Returns our histogram of call times
+		const EnExHistogram& Histogram(void) const;
+
+		/** Merges raw counters into ours.  This is how the global view is built up from the
+		  * counters that each thread keeps.
+		  */
+		void Merge(uint64_t hits, uint64_t timed, uint64_t totalTime, uint64_t minTime, uint64_t maxTime);
+
+		/** The number of calls that were timed.  When EnEx is sampling, this is less than
+		  * Hits, and TotalTime is scaled up from the timed calls to all of them.
+		  */
+		uint64_t TimedHits(void);
+
+		/// Merges raw histogram buckets into ours
+		void MergeHistogram(const std::atomic<uint64_t>* buckets);
+
 		/** Add information from another profile object into ours.  This is primarily used
 		  * when we are held in the global profile list and the thread-based profiles are
 		  * adding their information into us.
@@ -55,12 +140,28 @@ class DLLEXPORT EnExProfile {
 	private:
 		const char* m_methodName;
 		uint64_t m_hits;
+		uint64_t m_timed;
 		uint64_t m_totalTime;
 		uint64_t m_minTime;
 		uint64_t m_maxTime;
-		bool m_stopProfile;
+		EnExHistogram m_hist;
 };
 
+/** The time spent along one call path, as returned by EnterExit::CallPaths.
+  */
+struct EnExCallPath {
+	/// The method names from the outermost call in, separated by ';'
+	twine path;
+
+	/// The number of calls that finished along this path
+	uint64_t hits;
+
+	/// Nanoseconds spent in the last method on the path, including everything it called
+	double inclusiveTime;
+
+	/// Nanoseconds spent in the last method on the path itself, leaving out what it called
+	double exclusiveTime;
+};
 
 class DLLEXPORT EnterExit {
 	public:
@@ -105,6 +206,103 @@ class DLLEXPORT EnterExit {
 		 */
 		static void RecordGlobalHitMap(xmlNodePtr node);
 
+		/** Returns a profile for every method that has been hit on any thread, sorted by
+		  * method name.  This is built by adding up every thread's counters at the time
+		  * of the call.
+		  */
+		static vector<EnExProfile> GlobalProfiles(void);
+
+		/** Returns a profile for every method that has been hit on the current thread,
+		  * sorted by method name.
+		  */
+		static vector<EnExProfile> ThreadProfiles(void);
+
+		/** Starts every profile over from zero, on every thread.  Each thread clears its own
+		  * counters the next time it enters a method, and until then its old counters are
+		  * left out of GlobalProfiles.  Together with GlobalProfiles this gives a snapshot of
+		  * each interval, for tracking tail latency over time.
+		  */
+		static void ResetProfiles(void);
+
+		/** Times only 1 in every oneIn calls to each method on each thread, to keep the cost
+		  * of profiling down.  Every call is still counted in the hits, and the total time is
+		  * scaled up from the calls that were timed.  The default is 1, which times every call.
+		  * Tracing times every call while it is on, whatever this is set to.
+		  */
+		static void SetSampleRate(uint32_t oneIn);
+
+		/// Returns the current sample rate
+		static uint32_t SampleRate(void);
+
+		/** Turns request sampling on (or off).  While it is on, calls are only timed on
+		  * threads that are working on a request marked with SampleRequest(true).  The sample
+		  * rate still applies within those requests.
+		  */
+		static void SetRequestSampling(bool onoff);
+
+		/** Marks the request the current thread is working on as sampled (or not).  Call this
+		  * as each request starts, when request sampling is on.
+		  */
+		static void SampleRequest(bool sampled);
+
+		/** Turns tracing on (or off).  While it is on, every method entry and exit is
+		  * recorded with its time stamp in a ring buffer kept by each thread, so that the
+		  * most recent calls can be written out with WriteChromeTrace.  Tracing is off by
+		  * default, and costs one atomic load per method when it is off.
+		  */
+		static void SetTracing(bool onoff);
+
+		/// Returns true if tracing is turned on
+		static bool TracingOn(void);
+
+		/** Sets the number of events each thread's ring buffer holds, rounded up to a power
+		  * of 2.  This only applies to threads that haven't traced anything yet.  The
+		  * default is 65536.
+		  */
+		static void SetTraceBufferSize(size_t events);
+
+		/// Forgets everything traced so far
+		static void ClearTrace(void);
+
+		/** Writes everything in the trace ring buffers to the given file as Chrome Trace Event
+		  * JSON.  This can be loaded into chrome://tracing or the Perfetto UI.  Throws an
+		  * AnException if the file can't be written.
+		  */
+		static void WriteChromeTrace(const twine& fileName);
+
+		/** Writes the trace to the given file every time this process receives the given
+		  * signal (SIGUSR2 for example).  The signal handler only wakes up a background thread,
+		  * which writes the file.  Calling this again changes the file name.  Not available on
+		  * Windows.
+		  */
+		static void DumpTraceOnSignal(int signal, const twine& fileName);
+
+		/** Turns the call tree on (or off).  While it is on, each thread keeps a tree of the
+		  * distinct call paths it has been through, and the inclusive and exclusive time spent
+		  * along each one.  Every call is timed while it is on, whatever the sample rate is.
+		  * It is off by default, and costs one atomic load per method when it is off.
+		  */
+		static void SetCallTree(bool onoff);
+
+		/// Returns true if the call tree is turned on
+		static bool CallTreeOn(void);
+
+		/** Returns every call path recorded on any thread, sorted by path.  Paths that more
+		  * than one thread went through are added together.
+		  */
+		static vector<EnExCallPath> CallPaths(void);
+
+		/** Returns the call tree in the folded stack format used by flamegraph.pl and
+		  * speedscope: one line per call path, with the method names separated by ';',
+		  * followed by a space and the exclusive nanoseconds spent along that path.
+		  */
+		static twine FoldedStacks(void);
+
+		/** Writes FoldedStacks to the given file.  Throws an AnException if the file can't
+		  * be written.
+		  */
+		static void WriteFoldedStacks(const twine& fileName);
+
 		/** This will print our stack trace to standard output
 		  */
 		static void PrintStackTrace(void);
@@ -117,11 +315,16 @@ class DLLEXPORT EnterExit {
 		  */
 		static twine GetStackTrace(void);
 
-		/** This handles saving our thread-local hit counter information into the
-		    global structure.  This will take more time because we have to lock the
-		    global structure mutex, but if called only seldom on major functions, this
-		    will be effective at keeping the global aggregate numbers accurate and up
-		    to date.
+		/** Returns the name of the innermost method on the current thread's stack, or NULL
+		  * if there isn't one.  The name is the one given to the constructor, so it lives
+		  * as long as the program does.
+		  */
+		static const char* CurrentMethod(void);
+
+		/** This used to copy our thread-local hit counters into the global structure.
+		    The global view now reads every thread's counters directly when it is asked
+		    for, so it is always up to date and there is nothing left to do here.  This
+		    is kept so that existing callers still compile.
 		*/
 		void SaveToGlobal(void);
 
@@ -137,7 +340,11 @@ class DLLEXPORT EnterExit {
 		uint64_t m_methodEntryStamp;
 		uint64_t m_methodExitStamp;
 		bool m_saveToGlobal;
-		EnExProfile* m_methodProfile;
+		bool m_timed;
+		EnExCounter* m_counter;
+		uint32_t m_node;
+		uint32_t m_parentNode;
+		const char* m_prevMethod;
 };
 
 /** This is a mirror of the EnterExit class, but it does nothing.  We use a define to swap between these
@@ -158,9 +365,28 @@ class EnterExitLight {
 		static void PrintGlobalHitMap(void) {printf("Compiled with light version.  Doing no profiling.\n");}
 		static void PrintGlobalHitMap(twine& output){};
 		static void RecordGlobalHitMap(xmlNodePtr node) {}
+		static vector<EnExProfile> GlobalProfiles(void) {return vector<EnExProfile>();}
+		static vector<EnExProfile> ThreadProfiles(void) {return vector<EnExProfile>();}
+		static void ResetProfiles(void) {}
+		static void SetSampleRate(uint32_t oneIn) {}
+		static uint32_t SampleRate(void) {return 1;}
+		static void SetRequestSampling(bool onoff) {}
+		static void SampleRequest(bool sampled) {}
+		static void SetTracing(bool onoff) {}
+		static bool TracingOn(void) {return false;}
+		static void SetTraceBufferSize(size_t events) {}
+		static void ClearTrace(void) {}
+		static void WriteChromeTrace(const twine& fileName) {}
+		static void DumpTraceOnSignal(int signal, const twine& fileName) {}
+		static void SetCallTree(bool onoff) {}
+		static bool CallTreeOn(void) {return false;}
+		static vector<EnExCallPath> CallPaths(void) {return vector<EnExCallPath>();}
+		static twine FoldedStacks(void) {return twine("");}
+		static void WriteFoldedStacks(const twine& fileName) {}
 		static void PrintStackTrace(void){}
 		static void PrintStackTrace(int channel){}
 		static twine GetStackTrace(void) {return twine("");}
+		static const char* CurrentMethod(void) {return NULL;}
 		void SaveToGlobal(void) {}
 
 };
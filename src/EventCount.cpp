@@ -0,0 +1,219 @@
+ /*
+  * Copyright (c) 2001,2002 Steven M. Cherry. All rights reserved.
+  *
+  * This file is a part of slib - a c++ utility library
+  *
+  * The slib project, including all files needed to compile
+  * it, is free software; you can redistribute it and/or use it and/or modify
+  * it under the terms of the GNU Lesser General Public License as published by
+  * the Free Software Foundation.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program.  See file COPYING for details.
+  */
+
+#include <limits.h>
+#include <time.h>
+#ifdef _WIN32
+#include <windows.h>
+#elif defined(__linux__)
+#include <unistd.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#else
+#include <errno.h>
+#include "Mutex.h"
+#include "Lock.h"
+#endif
+
+#include "EventCount.h"
+using namespace SLib;
+
+#ifdef _WIN32
+/// What we sleep on when there are no futexes
+struct EventCountSleep {
+	CRITICAL_SECTION crit;
+	CONDITION_VARIABLE cond;
+};
+#elif !defined(__linux__)
+/// What we sleep on when there are no futexes
+struct EventCountSleep {
+	Mutex mutex;
+	pthread_cond_t cond;
+};
+#endif
+
+EventCount::EventCount()
+{
+	m_epoch.store( 0 );
+	m_waiters.store( 0 );
+	m_sleep = NULL;
+#ifdef _WIN32
+	EventCountSleep* s = new EventCountSleep();
+	InitializeCriticalSection( &s->crit );
+	InitializeConditionVariable( &s->cond );
+	m_sleep = s;
+#elif !defined(__linux__)
+	EventCountSleep* s = new EventCountSleep();
+	pthread_cond_init( &s->cond, NULL );
+	m_sleep = s;
+#endif
+}
+
+EventCount::~EventCount()
+{
+#ifdef _WIN32
+	EventCountSleep* s = (EventCountSleep*)m_sleep;
+	DeleteCriticalSection( &s->crit );
+	delete s;
+#elif !defined(__linux__)
+	EventCountSleep* s = (EventCountSleep*)m_sleep;
+	pthread_cond_destroy( &s->cond );
+	delete s;
+#endif
+}
+
+uint32_t EventCount::prepareWait(void)
+{
+	// This has to be seen by notify before we check the condition again.
+	m_waiters.fetch_add( 1, std::memory_order_seq_cst );
+	return m_epoch.load( std::memory_order_seq_cst );
+}
+
+void EventCount::cancelWait(void)
+{
+	m_waiters.fetch_sub( 1, std::memory_order_relaxed );
+}
+
+void EventCount::wait(uint32_t key)
+{
+#ifdef _WIN32
+	EventCountSleep* s = (EventCountSleep*)m_sleep;
+	EnterCriticalSection( &s->crit );
+	while(m_epoch.load( std::memory_order_acquire ) == key){
+		SleepConditionVariableCS( &s->cond, &s->crit, INFINITE );
+	}
+	LeaveCriticalSection( &s->crit );
+#elif defined(__linux__)
+	while(m_epoch.load( std::memory_order_acquire ) == key){
+		// Returns straight away if the epoch has already moved on.
+		syscall( SYS_futex, (uint32_t*)&m_epoch, FUTEX_WAIT_PRIVATE, key, NULL, NULL, 0 );
+	}
+#else
+	EventCountSleep* s = (EventCountSleep*)m_sleep;
+	Lock theLock( &s->mutex );
+	while(m_epoch.load( std::memory_order_acquire ) == key){
+		pthread_cond_wait( &s->cond, s->mutex.internalMutex() );
+	}
+#endif
+	m_waiters.fetch_sub( 1, std::memory_order_relaxed );
+}
+
+bool EventCount::wait(uint32_t key, int ms)
+{
+	bool notified = true;
+#ifdef _WIN32
+	EventCountSleep* s = (EventCountSleep*)m_sleep;
+	ULONGLONG deadline = GetTickCount64() + (ULONGLONG)(ms < 0 ? 0 : ms);
+	EnterCriticalSection( &s->crit );
+	while(m_epoch.load( std::memory_order_acquire ) == key){
+		ULONGLONG now = GetTickCount64();
+		if(now >= deadline){
+			notified = false;
+			break;
+		}
+		SleepConditionVariableCS( &s->cond, &s->crit, (DWORD)(deadline - now) );
+	}
+	LeaveCriticalSection( &s->crit );
+#else
+	struct timespec deadline;
+#	ifdef __linux__
+	clock_gettime( CLOCK_MONOTONIC, &deadline );
+#	else
+	clock_gettime( CLOCK_REALTIME, &deadline );
+#	endif
+	deadline.tv_sec += (ms < 0 ? 0 : ms) / 1000;
+	deadline.tv_nsec += (long)((ms < 0 ? 0 : ms) % 1000) * 1000000;
+	if(deadline.tv_nsec >= 1000000000){
+		deadline.tv_sec ++;
+		deadline.tv_nsec -= 1000000000;
+	}
+#	ifdef __linux__
+	while(m_epoch.load( std::memory_order_acquire ) == key){
+		// FUTEX_WAIT takes a relative time, so work out how much is left each time around.
+		struct timespec now, left;
+		clock_gettime( CLOCK_MONOTONIC, &now );
+		left.tv_sec = deadline.tv_sec - now.tv_sec;
+		left.tv_nsec = deadline.tv_nsec - now.tv_nsec;
+		if(left.tv_nsec < 0){
+			left.tv_sec --;
+			left.tv_nsec += 1000000000;
+		}
+		if(left.tv_sec < 0){
+			notified = false;
+			break;
+		}
+		syscall( SYS_futex, (uint32_t*)&m_epoch, FUTEX_WAIT_PRIVATE, key, &left, NULL, 0 );
+	}
+#	else
+	EventCountSleep* s = (EventCountSleep*)m_sleep;
+	Lock theLock( &s->mutex );
+	while(m_epoch.load( std::memory_order_acquire ) == key){
+		if(pthread_cond_timedwait( &s->cond, s->mutex.internalMutex(), &deadline ) == ETIMEDOUT){
+			notified = m_epoch.load( std::memory_order_acquire ) != key;
+			break;
+		}
+	}
+#	endif
+#endif
+	m_waiters.fetch_sub( 1, std::memory_order_relaxed );
+	return notified;
+}
+
+void EventCount::notifyOne(void)
+{
+	notify( 1 );
+}
+
+void EventCount::notifyAll(void)
+{
+	notify( INT_MAX );
+}
+
+void EventCount::notify(int count)
+{
+	// Whatever made the condition true has to be visible before we look for waiters.
+	std::atomic_thread_fence( std::memory_order_seq_cst );
+	if(m_waiters.load( std::memory_order_relaxed ) == 0){
+		return;
+	}
+	m_epoch.fetch_add( 1, std::memory_order_release );
+
+#ifdef _WIN32
+	EventCountSleep* s = (EventCountSleep*)m_sleep;
+	EnterCriticalSection( &s->crit );
+	LeaveCriticalSection( &s->crit );
+	if(count == 1){
+		WakeConditionVariable( &s->cond );
+	} else {
+		WakeAllConditionVariable( &s->cond );
+	}
+#elif defined(__linux__)
+	syscall( SYS_futex, (uint32_t*)&m_epoch, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0 );
+#else
+	// Taking the lock makes sure a waiter that saw the old epoch is asleep before we signal.
+	EventCountSleep* s = (EventCountSleep*)m_sleep;
+	{
+		Lock theLock( &s->mutex );
+	}
+	if(count == 1){
+		pthread_cond_signal( &s->cond );
+	} else {
+		pthread_cond_broadcast( &s->cond );
+	}
+#endif
+}
@@ -0,0 +1,111 @@
+#ifndef EVENTCOUNT_H
+#define EVENTCOUNT_H
+ /*
+  * Copyright (c) 2001,2002 Steven M. Cherry. All rights reserved.
+  *
+  * This file is a part of slib - a c++ utility library
+  *
+  * The slib project, including all files needed to compile
+  * it, is free software; you can redistribute it and/or use it and/or modify
+  * it under the terms of the GNU Lesser General Public License as published by
+  * the Free Software Foundation.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program.  See file COPYING for details.
+  */
+
+#ifdef _WIN32
+#	ifndef DLLEXPORT
+#		define DLLEXPORT __declspec(dllexport)
+#	endif
+#else
+#	define DLLEXPORT
+#endif
+
+#include <stdint.h>
+#include <atomic>
+
+namespace SLib {
+
+/**
+  * An eventcount lets threads sleep until some condition that is checked without a lock
+  * becomes true, such as a lock-free queue having something in it.  A waiter does this:
+  * <pre>
+  *    while(!queue.try_pop( item )){
+  *        uint32_t key = ec.prepareWait();
+  *        if(queue.try_pop( item )){
+  *            ec.cancelWait();
+  *            break;
+  *        }
+  *        ec.wait( key );
+  *    }
+  * </pre>
+  * and whoever makes the condition true calls notifyOne or notifyAll afterwards.  A notify
+  * that happens after prepareWait makes wait return straight away, so no wakeup is lost.
+  * When nobody is waiting, a notify costs one fence and one atomic load.
+  *
+  * On Linux the waiters sleep on a futex.  Everywhere else they use a mutex and condition
+  * variable.
+  *
+  * @author Steven M. Cherry
+  */
+class DLLEXPORT EventCount
+{
+	private:
+		/// copy constructor is private to prevent use
+		EventCount(const EventCount& c) {}
+
+		/// assignmet operator is private to prevent use
+		EventCount& operator=(const EventCount& c) { return *this;}
+
+	public:
+		/// Standard constructor
+		EventCount();
+
+		/// Standard destructor
+		virtual ~EventCount();
+
+		/** Registers us as a waiter, and returns the key to pass to wait.  Check the
+		  * condition again after this, and call either cancelWait or wait.
+		  */
+		uint32_t prepareWait(void);
+
+		/// Backs out of prepareWait, when the condition turned out to be true after all.
+		void cancelWait(void);
+
+		/// Sleeps until someone notifies us after the prepareWait that returned key.
+		void wait(uint32_t key);
+
+		/** Like wait, but gives up after ms milliseconds.  Returns false if we gave up,
+		  * and true if we were notified.
+		  */
+		bool wait(uint32_t key, int ms);
+
+		/// Wakes up one waiting thread, if there are any.
+		void notifyOne(void);
+
+		/// Wakes up every waiting thread.
+		void notifyAll(void);
+
+	private:
+
+		/// Bumps our epoch and wakes up to count threads.
+		void notify(int count);
+
+		/// Bumped by every notify that finds someone waiting
+		std::atomic<uint32_t> m_epoch;
+
+		/// The number of threads between prepareWait and the end of wait or cancelWait
+		std::atomic<uint32_t> m_waiters;
+
+		/// The mutex and condition variable used where there are no futexes
+		void* m_sleep;
+};
+
+} // End Namespace SLib
+
+#endif // EVENTCOUNT_H Defined
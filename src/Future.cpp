@@ -0,0 +1,153 @@
+ /*
+  * Copyright (c) 2001,2002 Steven M. Cherry. All rights reserved.
+  *
+  * This file is a part of slib - a c++ utility library
+  *
+  * The slib project, including all files needed to compile
+  * it, is free software; you can redistribute it and/or use it and/or modify
+  * it under the terms of the GNU Lesser General Public License as published by
+  * the Free Software Foundation.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program.  See file COPYING for details.
+  */
+
+#include "Future.h"
+#include "TimerWheel.h"
+#include "AnException.h"
+using namespace SLib;
+
+FutureStateBase::FutureStateBase()
+{
+	m_claimed = false;
+	m_ready.store( false );
+}
+
+FutureStateBase::~FutureStateBase()
+{
+
+}
+
+void FutureStateBase::wait(void)
+{
+	while(!ready()){
+		uint32_t key = m_waiters.prepareWait();
+		if(ready()){
+			m_waiters.cancelWait();
+			break;
+		}
+		m_waiters.wait( key );
+	}
+}
+
+bool FutureStateBase::wait(int ms)
+{
+	uint64_t deadline = Timer::NowNs() + (uint64_t)ms * 1000000;
+	while(!ready()){
+		uint64_t now = Timer::NowNs();
+		if(now >= deadline){
+			break;
+		}
+		uint32_t key = m_waiters.prepareWait();
+		if(ready()){
+			m_waiters.cancelWait();
+			break;
+		}
+		m_waiters.wait( key, (int)((deadline - now + 999999) / 1000000) );
+	}
+	return ready();
+}
+
+void FutureStateBase::onReady(std::function<void()> fn)
+{
+	{
+		AdaptiveLock theLock( &m_lock );
+		if(!ready()){
+			m_then.push_back( std::move( fn ) );
+			return;
+		}
+	}
+	fn();
+}
+
+void FutureStateBase::setError(std::exception_ptr e)
+{
+	if(e == nullptr){
+		throw AnException(0, FL, "A Future can't fail without an exception");
+	}
+	claim();
+	markReady( e );
+}
+
+void FutureStateBase::rethrow(void)
+{
+	if(m_error != nullptr){
+		std::rethrow_exception( m_error );
+	}
+}
+
+void FutureStateBase::claim(void)
+{
+	AdaptiveLock theLock( &m_lock );
+	if(m_claimed){
+		throw AnException(0, FL, "This Future has already been set");
+	}
+	m_claimed = true;
+}
+
+void FutureStateBase::markReady(std::exception_ptr e)
+{
+	vector<std::function<void()> > then;
+	{
+		AdaptiveLock theLock( &m_lock );
+		m_error = e;
+		m_ready.store( true, std::memory_order_release );
+		then.swap( m_then );
+	}
+	m_waiters.notifyAll();
+
+	// Continuations are ours to run, and there is nobody to hand an exception back to.
+	// The ones we create ourselves never throw.
+	for(size_t i = 0; i < then.size(); i++){
+		then[ i ]();
+	}
+}
+
+void SLib::future_empty(void)
+{
+	throw AnException(0, FL, "This Future is empty");
+}
+
+void SLib::future_none(std::shared_ptr<FutureState<size_t> > s)
+{
+	try {
+		throw AnException(0, FL, "when_any was given no futures");
+	} catch (...) {
+		s->setError( std::current_exception() );
+	}
+}
+
+Future<void> SLib::make_ready_future(void)
+{
+	std::shared_ptr<FutureState<void> > s( new FutureState<void>() );
+	s->setValue();
+	return Future<void>( s );
+}
+
+Future<void> SLib::delay(uint64_t ms)
+{
+	std::shared_ptr<FutureState<void> > s( new FutureState<void>() );
+	TimerWheel::Global().Schedule( ms, [s]() { s->setValue(); } );
+	return Future<void>( s );
+}
+
+Future<void> SLib::delay(const Interval& interval)
+{
+	std::shared_ptr<FutureState<void> > s( new FutureState<void>() );
+	TimerWheel::Global().Schedule( interval, [s]() { s->setValue(); } );
+	return Future<void>( s );
+}
@@ -0,0 +1,596 @@
+#ifndef FUTURE_H
+#define FUTURE_H
+ /*
+  * Copyright (c) 2001,2002 Steven M. Cherry. All rights reserved.
+  *
+  * This file is a part of slib - a c++ utility library
+  *
+  * The slib project, including all files needed to compile
+  * it, is free software; you can redistribute it and/or use it and/or modify
+  * it under the terms of the GNU Lesser General Public License as published by
+  * the Free Software Foundation.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program.  See file COPYING for details.
+  */
+
+#ifdef _WIN32
+#	ifndef DLLEXPORT
+#		define DLLEXPORT __declspec(dllexport)
+#	endif
+#else
+#	define DLLEXPORT
+#endif
+
+#include <stddef.h>
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+#include <memory>
+#include <functional>
+#include <exception>
+#include <new>
+#include <type_traits>
+#include <utility>
+using namespace std;
+
+#include "ThreadPool.h"
+#include "AdaptiveMutex.h"
+#include "EventCount.h"
+#include "Interval.h"
+
+// Coroutine support is there whenever the compiler has it, which means building with
+// -std=c++20 or later.  Nothing else here depends on it.
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#	if __has_include(<coroutine>)
+#		include <coroutine>
+#		define SLIB_COROUTINES 1
+#	endif
+#endif
+
+namespace SLib {
+
+/**
+  * The part of a Future's shared state that doesn't depend on its type: whether it is
+  * ready, the exception it failed with, the threads waiting for it and the continuations
+  * to run when it is ready.  Use Future and Promise rather than this.
+  *
+  * @author Steven M. Cherry
+  */
+class DLLEXPORT FutureStateBase
+{
+	private:
+		/// copy constructor is private to prevent use
+		FutureStateBase(const FutureStateBase& c) {}
+
+		/// assignmet operator is private to prevent use
+		FutureStateBase& operator=(const FutureStateBase& c) { return *this;}
+
+	public:
+		/// Standard constructor
+		FutureStateBase();
+
+		/// Standard destructor
+		virtual ~FutureStateBase();
+
+		/// True once we have a value or an exception
+		bool ready(void) const { return m_ready.load( std::memory_order_acquire ); }
+
+		/// True once we have an exception
+		bool failed(void) const { return ready() && m_error != nullptr; }
+
+		/// Blocks until we are ready
+		void wait(void);
+
+		/// Blocks for up to ms milliseconds until we are ready.  Returns ready().
+		bool wait(int ms);
+
+		/** Runs fn once we are ready, on the thread that makes us ready, or straight away on
+		  * this thread if we already are.
+		  */
+		void onReady(std::function<void()> fn);
+
+		/// Fails us with the given exception
+		void setError(std::exception_ptr e);
+
+		/// Rethrows our exception, if we have one
+		void rethrow(void);
+
+		/// Our exception, or null.  Only meaningful once we are ready.
+		std::exception_ptr error(void) const { return m_error; }
+
+	protected:
+		/** Claims the right to set our result, so that a second attempt throws rather than
+		  * overwriting the first.  Call markReady once the result is stored.
+		  */
+		void claim(void);
+
+		/** Marks us ready, having failed with e if it isn't null, wakes up anyone waiting
+		  * and runs the continuations.
+		  */
+		void markReady(std::exception_ptr e = nullptr);
+
+	private:
+
+		/// Guards m_claimed and m_then
+		AdaptiveMutex m_lock;
+
+		/// Set once something has claimed the right to set our result
+		bool m_claimed;
+
+		/// Set once the result is stored
+		std::atomic<bool> m_ready;
+
+		/// What we failed with, if we did
+		std::exception_ptr m_error;
+
+		/// What to run when we are ready
+		vector<std::function<void()> > m_then;
+
+		/// Where wait sleeps
+		EventCount m_waiters;
+};
+
+/// What a Future<void> holds
+struct FutureVoid {};
+
+/// How a Future stores its value, and what get returns
+template <class T> struct FutureTraits {
+	typedef T storage;
+	typedef const T& result;
+};
+template <> struct FutureTraits<void> {
+	typedef FutureVoid storage;
+	typedef void result;
+};
+
+/// The shared state behind a Future and its Promise
+template <class T>
+class FutureState : public FutureStateBase
+{
+	public:
+		typedef typename FutureTraits<T>::storage storage;
+
+		/// Standard destructor
+		virtual ~FutureState()
+		{
+			if(ready() && !failed()){
+				((storage*)&m_value)->~storage();
+			}
+		}
+
+		/// Stores a value built from the arguments, and makes us ready
+		template <class... A>
+		void setValue(A&&... a)
+		{
+			claim();
+			try {
+				new (&m_value) storage( std::forward<A>(a)... );
+			} catch (...) {
+				markReady( std::current_exception() );
+				return;
+			}
+			markReady();
+		}
+
+		/// Waits for us, and then returns our value or throws our exception
+		storage& value(void)
+		{
+			wait();
+			rethrow();
+			return *(storage*)&m_value;
+		}
+
+	private:
+		/// The value, once it has been set
+		typename std::aligned_storage<sizeof(storage), alignof(storage)>::type m_value;
+};
+
+template <class T> class Future;
+template <class T> class Promise;
+
+/// Tells whether a type is a Future, and what it is a future for
+template <class T> struct FutureUnwrap {
+	static const bool isFuture = false;
+	typedef T type;
+};
+template <class T> struct FutureUnwrap<Future<T> > {
+	static const bool isFuture = true;
+	typedef T type;
+};
+
+/// Calls f( args... ) and sets what it returns, or throws, on state
+template <class R, class F, class... A>
+void future_invoke(FutureState<R>* state, std::false_type isVoid, F&& f, A&&... args)
+{
+	try {
+		state->setValue( f( std::forward<A>(args)... ) );
+	} catch (...) {
+		state->setError( std::current_exception() );
+	}
+}
+template <class R, class F, class... A>
+void future_invoke(FutureState<R>* state, std::true_type isVoid, F&& f, A&&... args)
+{
+	try {
+		f( std::forward<A>(args)... );
+		state->setValue();
+	} catch (...) {
+		state->setError( std::current_exception() );
+	}
+}
+
+/// What a continuation on a Future<V> returns
+template <class V, class F> struct FutureThenResult {
+	typedef decltype( std::declval<F&>()( std::declval<const V&>() ) ) type;
+};
+template <class F> struct FutureThenResult<void, F> {
+	typedef decltype( std::declval<F&>()() ) type;
+};
+
+/// Makes state take on whatever inner ends up with
+template <class T>
+void future_forward(std::shared_ptr<FutureState<T> > state, std::shared_ptr<FutureState<T> > inner);
+
+/**
+  * The result of something that is happening asynchronously: either a value of type T, or
+  * the exception that was thrown instead.  Unlike std::future, any number of copies can
+  * be taken, waited on and read, and it can have continuations that run when it is ready
+  * instead of tying up a thread to wait for it.
+  * <P>
+  * Futures come from spawn, which runs a function on a ThreadPool; from then, which runs
+  * a function on the result of another future; from when_all, when_any and delay; and from
+  * a Promise, for things that finish some other way.  For example:
+  * <pre>
+  *    Future<twine> page = spawn( [url]() { return fetch( url ); } );
+  *    Future<size_t> words = page.then( [](const twine& p) { return countWords( p ); } );
+  *    printf( "%d words\n", (int)words.get() );
+  * </pre>
+  * If a future fails, the exception passes through every then that follows it, without
+  * calling them, and get rethrows it.
+  * <P>
+  * When the compiler supports C++20 coroutines, a function that returns a Future can be a
+  * coroutine, and can co_await other futures.  It runs on the caller's thread up to its
+  * first co_await of something that isn't ready, and then carries on, on whichever thread
+  * makes that ready, which is a pool worker for anything that came from spawn, then or
+  * delay.  co_await resume_on( pool ) moves it onto a pool.  So a request handler can be
+  * written as a straight line, without a thread sitting blocked for each request:
+  * <pre>
+  *    Future<void> handle(Request req) {
+  *        twine body = co_await spawn( [req]() { return readBody( req ); } );
+  *        co_await delay( 10 );
+  *        co_return;
+  *    }
+  * </pre>
+  * Calling get or wait from a pool task ties up that worker until the future is ready, so
+  * tasks should use then or co_await instead.
+  *
+  * @author Steven M. Cherry
+  */
+template <class T>
+class Future
+{
+	public:
+		/// An empty future.  Everything but valid() throws on one of these.
+		Future() {}
+
+		/// A future for the given shared state
+		explicit Future(std::shared_ptr<FutureState<T> > state) : m_state( state ) {}
+
+		/// True unless this is an empty future
+		bool valid(void) const { return (bool)m_state; }
+
+		/// True once the value or exception is there
+		bool ready(void) const { return state()->ready(); }
+
+		/// True once it has failed
+		bool failed(void) const { return state()->failed(); }
+
+		/// Blocks until we are ready
+		void wait(void) const { state()->wait(); }
+
+		/// Blocks for up to ms milliseconds until we are ready.  Returns ready().
+		bool wait(int ms) const { return state()->wait( ms ); }
+
+		/// Waits until we are ready, and returns the value or throws the exception.
+		typename FutureTraits<T>::result get(void) const
+		{
+			return static_cast<typename FutureTraits<T>::result>( state()->value() );
+		}
+
+		/** Returns a future for fn( value ), which is run on the given pool once we are
+		  * ready - fn() for a Future<void>.  If fn returns a Future itself, the future
+		  * returned here is for whatever that one ends up with.  If we fail, fn is not
+		  * called, and the returned future fails with the same exception.
+		  */
+		template <class F>
+		Future<typename FutureUnwrap<typename FutureThenResult<T, F>::type>::type>
+		then(F fn, ThreadPool& pool = ThreadPool::Global()) const
+		{
+			typedef typename FutureThenResult<T, F>::type R;
+			typedef typename FutureUnwrap<R>::type U;
+			std::shared_ptr<FutureState<T> > from = state();
+			std::shared_ptr<FutureState<U> > to( new FutureState<U>() );
+			ThreadPool* p = &pool;
+			from->onReady( [from, to, fn, p]() mutable {
+				if(from->failed()){
+					to->setError( from->error() );
+					return;
+				}
+				try {
+					p->execute( [from, to, fn]() mutable {
+						thenRun( from, to, fn, std::integral_constant<bool, FutureUnwrap<R>::isFuture>() );
+					} );
+				} catch (...) {
+					to->setError( std::current_exception() );
+				}
+			} );
+			return Future<U>( to );
+		}
+
+		/// Our shared state.  Throws an AnException if we are empty.
+		const std::shared_ptr<FutureState<T> >& state(void) const;
+
+#ifdef SLIB_COROUTINES
+		/// Lets a coroutine return a Future.  It starts straight away, and doesn't wait to be awaited.
+		struct promise_type;
+
+		/// Lets a coroutine co_await a Future
+		struct awaiter {
+			std::shared_ptr<FutureState<T> > m_state;
+			bool await_ready() const noexcept { return m_state->ready(); }
+			void await_suspend(std::coroutine_handle<> h) {
+				m_state->onReady( [h]() { h.resume(); } );
+			}
+			typename FutureTraits<T>::result await_resume() {
+				return static_cast<typename FutureTraits<T>::result>( m_state->value() );
+			}
+		};
+		awaiter operator co_await() const { return awaiter{ state() }; }
+#endif
+
+	private:
+
+		/// Runs a continuation that returns a plain value
+		template <class U, class F>
+		static void thenRun(std::shared_ptr<FutureState<T> >& from, std::shared_ptr<FutureState<U> >& to,
+			F& fn, std::false_type isFuture)
+		{
+			thenCall( from, to, fn, std::is_void<U>(), std::is_void<T>() );
+		}
+
+		/// Runs a continuation that returns another Future
+		template <class U, class F>
+		static void thenRun(std::shared_ptr<FutureState<T> >& from, std::shared_ptr<FutureState<U> >& to,
+			F& fn, std::true_type isFuture)
+		{
+			std::shared_ptr<FutureState<Future<U> > > outer( new FutureState<Future<U> >() );
+			thenCall( from, outer, fn, std::false_type(), std::is_void<T>() );
+			if(outer->failed()){
+				to->setError( outer->error() );
+				return;
+			}
+			future_forward( to, outer->value().state() );
+		}
+
+		/// Calls fn with from's value, or with nothing for a Future<void>
+		template <class U, class F, class UVoid>
+		static void thenCall(std::shared_ptr<FutureState<T> >& from, std::shared_ptr<FutureState<U> >& to,
+			F& fn, UVoid uvoid, std::false_type tvoid)
+		{
+			future_invoke( to.get(), uvoid, fn, (const T&)from->value() );
+		}
+		template <class U, class F, class UVoid>
+		static void thenCall(std::shared_ptr<FutureState<T> >& from, std::shared_ptr<FutureState<U> >& to,
+			F& fn, UVoid uvoid, std::true_type tvoid)
+		{
+			future_invoke( to.get(), uvoid, fn );
+		}
+
+		/// What we are a future for
+		std::shared_ptr<FutureState<T> > m_state;
+};
+
+/**
+  * The other end of a Future, for results that aren't produced by a function on a pool -
+  * the answer to a message, say.  Copies of a Promise share the same future.  Setting it
+  * a second time throws an AnException.
+  *
+  * @author Steven M. Cherry
+  */
+template <class T>
+class Promise
+{
+	public:
+		/// Standard constructor
+		Promise() : m_state( new FutureState<T>() ) {}
+
+		/// The future that we set
+		Future<T> future(void) const { return Future<T>( m_state ); }
+
+		/// Sets the value - with no arguments for a Promise<void>
+		template <class... A>
+		void setValue(A&&... a) const { m_state->setValue( std::forward<A>(a)... ); }
+
+		/// Fails the future with e
+		void setError(std::exception_ptr e) const { m_state->setError( e ); }
+
+		/// Fails the future with whatever exception is being handled
+		void setCurrentError(void) const { m_state->setError( std::current_exception() ); }
+
+	private:
+		/// What we set
+		std::shared_ptr<FutureState<T> > m_state;
+};
+
+/// Throws the AnException for using an empty Future
+DLLEXPORT void future_empty(void);
+
+template <class T>
+const std::shared_ptr<FutureState<T> >& Future<T>::state(void) const
+{
+	if(!m_state){
+		future_empty();
+	}
+	return m_state;
+}
+
+template <class T>
+void future_forward(std::shared_ptr<FutureState<T> > state, std::shared_ptr<FutureState<T> > inner)
+{
+	inner->onReady( [state, inner]() {
+		if(inner->failed()){
+			state->setError( inner->error() );
+			return;
+		}
+		future_invoke( state.get(), std::is_void<T>(), [inner]() -> typename FutureTraits<T>::result {
+			return static_cast<typename FutureTraits<T>::result>( inner->value() );
+		} );
+	} );
+}
+
+/// A future that already has the given value
+template <class T>
+Future<typename std::decay<T>::type> make_ready_future(T&& value)
+{
+	typedef typename std::decay<T>::type V;
+	std::shared_ptr<FutureState<V> > s( new FutureState<V>() );
+	s->setValue( std::forward<T>(value) );
+	return Future<V>( s );
+}
+
+/// A Future<void> that is already ready
+DLLEXPORT Future<void> make_ready_future(void);
+
+/// A future that has already failed with e
+template <class T>
+Future<T> make_failed_future(std::exception_ptr e)
+{
+	std::shared_ptr<FutureState<T> > s( new FutureState<T>() );
+	s->setError( e );
+	return Future<T>( s );
+}
+
+/** Runs f() on the given pool, and returns a future for what it returns or throws.  If the
+  * pool won't take it because it is shutting down, the future fails with that exception.
+  */
+template <class F>
+Future<decltype( std::declval<F&>()() )> spawn(F f, ThreadPool& pool = ThreadPool::Global(),
+	ThreadPool::Priority priority = ThreadPool::Normal)
+{
+	typedef decltype( std::declval<F&>()() ) R;
+	std::shared_ptr<FutureState<R> > s( new FutureState<R>() );
+	try {
+		pool.execute( [s, f]() mutable { future_invoke( s.get(), std::is_void<R>(), f ); }, priority );
+	} catch (...) {
+		s->setError( std::current_exception() );
+	}
+	return Future<R>( s );
+}
+
+/// Fails the given future with the AnException for when_any of nothing
+DLLEXPORT void future_none(std::shared_ptr<FutureState<size_t> > s);
+
+/** A future that is ready once every one of the given futures is, whether they worked or
+  * failed.  Its value is the same futures, so that each can be read without waiting.
+  */
+template <class T>
+Future<vector<Future<T> > > when_all(const vector<Future<T> >& futures)
+{
+	std::shared_ptr<FutureState<vector<Future<T> > > > s( new FutureState<vector<Future<T> > >() );
+	if(futures.empty()){
+		s->setValue( futures );
+		return Future<vector<Future<T> > >( s );
+	}
+	std::shared_ptr<vector<Future<T> > > all( new vector<Future<T> >( futures ) );
+	std::shared_ptr<std::atomic<size_t> > left( new std::atomic<size_t>( futures.size() ) );
+	for(size_t i = 0; i < futures.size(); i++){
+		futures[ i ].state()->onReady( [s, left, all]() {
+			if(left->fetch_sub( 1 ) == 1){
+				s->setValue( std::move( *all ) );
+			}
+		} );
+	}
+	return Future<vector<Future<T> > >( s );
+}
+
+/** A future that is ready as soon as any one of the given futures is, whether it worked or
+  * failed.  Its value is the index of that future.  With no futures it fails.
+  */
+template <class T>
+Future<size_t> when_any(const vector<Future<T> >& futures)
+{
+	std::shared_ptr<FutureState<size_t> > s( new FutureState<size_t>() );
+	if(futures.empty()){
+		future_none( s );
+		return Future<size_t>( s );
+	}
+	std::shared_ptr<std::atomic<bool> > done( new std::atomic<bool>( false ) );
+	for(size_t i = 0; i < futures.size(); i++){
+		futures[ i ].state()->onReady( [s, done, i]() {
+			if(!done->exchange( true )){
+				s->setValue( i );
+			}
+		} );
+	}
+	return Future<size_t>( s );
+}
+
+/** A Future<void> that becomes ready ms milliseconds from now, on TimerWheel::Global().  A
+  * coroutine can co_await it to pause without holding up a thread.
+  */
+DLLEXPORT Future<void> delay(uint64_t ms);
+
+/// A Future<void> that becomes ready after the given interval
+DLLEXPORT Future<void> delay(const Interval& interval);
+
+#ifdef SLIB_COROUTINES
+
+/// What lets a coroutine co_return a value into its Future
+template <class T>
+struct FuturePromiseBase {
+	std::shared_ptr<FutureState<T> > m_state;
+	template <class V>
+	void return_value(V&& v) { m_state->setValue( std::forward<V>(v) ); }
+};
+template <>
+struct FuturePromiseBase<void> {
+	std::shared_ptr<FutureState<void> > m_state;
+	void return_void() { m_state->setValue(); }
+};
+
+template <class T>
+struct Future<T>::promise_type : public FuturePromiseBase<T> {
+	promise_type() { this->m_state.reset( new FutureState<T>() ); }
+	Future<T> get_return_object() { return Future<T>( this->m_state ); }
+	std::suspend_never initial_suspend() noexcept { return {}; }
+	std::suspend_never final_suspend() noexcept { return {}; }
+	void unhandled_exception() { this->m_state->setError( std::current_exception() ); }
+};
+
+/// What co_await resume_on( pool ) returns
+struct ResumeOn {
+	ThreadPool* m_pool;
+	ThreadPool::Priority m_priority;
+	bool await_ready() const noexcept { return false; }
+	void await_suspend(std::coroutine_handle<> h) {
+		m_pool->execute( [h]() { h.resume(); }, m_priority );
+	}
+	void await_resume() const noexcept {}
+};
+
+/// co_await this to carry on as a task on the given pool
+inline ResumeOn resume_on(ThreadPool& pool = ThreadPool::Global(), ThreadPool::Priority priority = ThreadPool::Normal)
+{
+	return ResumeOn{ &pool, priority };
+}
+
+#endif // SLIB_COROUTINES
+
+} // End Namespace SLib
+
+#endif // FUTURE_H Defined
@@ -0,0 +1,237 @@
+ /*
+  * Copyright (c) 2001,2002 Steven M. Cherry. All rights reserved.
+  *
+  * This file is a part of slib - a c++ utility library
+  *
+  * The slib project, including all files needed to compile
+  * it, is free software; you can redistribute it and/or use it and/or modify
+  * it under the terms of the GNU Lesser General Public License as published by
+  * the Free Software Foundation.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program.  See file COPYING for details.
+  */
+
+#include <string.h>
+#include <mutex>
+#include <map>
+#include <algorithm>
+
+#include "LockProfile.h"
+#include "EnEx.h"
+#include "Timer.h"
+
+using namespace SLib;
+
+std::atomic<bool> LockProfile::m_on( false );
+
+namespace SLib {
+
+/// The counters for one holder call site of one lock
+struct LockProfileHolderCount {
+	uint64_t waits;
+	uint64_t waitCycles;
+};
+
+/// The counters for one lock, or for every unnamed lock first waited for in the same place
+struct LockProfileEntry {
+	const char* name;
+	uint64_t waits;
+	uint64_t waitCycles;
+	uint64_t maxWaitCycles;
+
+	/// Keyed by the EnEx method name pointer, which EnEx keeps for good
+	map<const char*, LockProfileHolderCount> holders;
+};
+
+} // End Namespace SLib
+
+/** Guards every entry and the list of them.  These are only touched after someone has
+  * already waited for a lock, so one std::mutex is plenty.  It has to be a std::mutex so
+  * that it isn't profiled itself.
+  */
+static std::mutex& lockprofile_mutex(void)
+{
+	static std::mutex* mut = new std::mutex();
+	return *mut;
+}
+
+/// Every entry, keyed by name.  Entries are never freed, since locks keep pointers to them.
+static map<twine, LockProfileEntry*>& lockprofile_entries(void)
+{
+	static map<twine, LockProfileEntry*>* entries = new map<twine, LockProfileEntry*>();
+	return *entries;
+}
+
+void LockProfile::SetProfiling(bool onoff)
+{
+	m_on.store( onoff );
+}
+
+const char* LockProfile::CurrentSite(void)
+{
+	return EnterExit::CurrentMethod();
+}
+
+void LockProfile::RecordWait(std::atomic<LockProfileEntry*>& entry, const char* name,
+	uint64_t waitCycles, const char* holder)
+{
+	std::lock_guard<std::mutex> theLock( lockprofile_mutex() );
+
+	LockProfileEntry* e = entry.load( std::memory_order_acquire );
+	if(e == NULL){
+		twine key;
+		if(name != NULL){
+			key = name;
+		} else {
+			const char* site = CurrentSite();
+			key.format( "(unnamed lock in %s)", site == NULL ? "unknown" : site );
+		}
+		map<twine, LockProfileEntry*>& entries = lockprofile_entries();
+		if(entries.count( key ) == 0){
+			e = new LockProfileEntry();
+			e->name = strdup( key() );
+			e->waits = 0;
+			e->waitCycles = 0;
+			e->maxWaitCycles = 0;
+			entries[ key ] = e;
+		} else {
+			e = entries[ key ];
+		}
+		entry.store( e, std::memory_order_release );
+	}
+
+	e->waits ++;
+	e->waitCycles += waitCycles;
+	if(waitCycles > e->maxWaitCycles){
+		e->maxWaitCycles = waitCycles;
+	}
+	if(holder == NULL){
+		holder = "(unknown)";
+	}
+	if(e->holders.count( holder ) == 0 && e->holders.size() >= LOCKPROFILE_MAX_HOLDERS){
+		holder = "(other)";
+	}
+	LockProfileHolderCount& h = e->holders[ holder ];
+	h.waits ++;
+	h.waitCycles += waitCycles;
+}
+
+vector<LockProfileStats> LockProfile::Profiles(void)
+{
+	vector<LockProfileStats> ret;
+	{
+		std::lock_guard<std::mutex> theLock( lockprofile_mutex() );
+		map<twine, LockProfileEntry*>& entries = lockprofile_entries();
+		for(auto it = entries.begin(); it != entries.end(); it++){
+			LockProfileEntry* e = it->second;
+			if(e->waits == 0){
+				continue;
+			}
+			LockProfileStats s;
+			s.name = e->name;
+			s.waits = e->waits;
+			s.totalWaitNs = (double)e->waitCycles;
+			s.maxWaitNs = (double)e->maxWaitCycles;
+			for(auto h = e->holders.begin(); h != e->holders.end(); h++){
+				LockProfileHolder lph;
+				lph.site = h->first;
+				lph.waits = h->second.waits;
+				lph.waitNs = (double)h->second.waitCycles;
+				s.holders.push_back( lph );
+			}
+			ret.push_back( s );
+		}
+	}
+
+	// Convert to nanoseconds outside of the lock, since the first conversion calibrates the clock.
+	for(size_t i = 0; i < ret.size(); i++){
+		ret[ i ].totalWaitNs = Timer::CyclesToNs( ret[ i ].totalWaitNs );
+		ret[ i ].maxWaitNs = Timer::CyclesToNs( ret[ i ].maxWaitNs );
+		for(size_t j = 0; j < ret[ i ].holders.size(); j++){
+			ret[ i ].holders[ j ].waitNs = Timer::CyclesToNs( ret[ i ].holders[ j ].waitNs );
+		}
+		std::sort( ret[ i ].holders.begin(), ret[ i ].holders.end(),
+			[](const LockProfileHolder& a, const LockProfileHolder& b) { return a.waits > b.waits; } );
+	}
+	std::sort( ret.begin(), ret.end(),
+		[](const LockProfileStats& a, const LockProfileStats& b) { return a.totalWaitNs > b.totalWaitNs; } );
+	return ret;
+}
+
+void LockProfile::Reset(void)
+{
+	std::lock_guard<std::mutex> theLock( lockprofile_mutex() );
+	map<twine, LockProfileEntry*>& entries = lockprofile_entries();
+	for(auto it = entries.begin(); it != entries.end(); it++){
+		it->second->waits = 0;
+		it->second->waitCycles = 0;
+		it->second->maxWaitCycles = 0;
+		it->second->holders.clear();
+	}
+}
+
+void LockProfile::PrintReport(twine& output)
+{
+	twine tmp;
+	vector<LockProfileStats> profiles = Profiles();
+	tmp.format("%40s\t%12s\t%16s\t%16s\t%16s\n",
+		"Lock Name",
+		"Waits",
+		"Average ns",
+		"Max ns",
+		"Total ns");
+	output += tmp;
+	tmp.format("%40s\t%12s\t%16s\t%16s\t%16s\n",
+		"=========",
+		"==========",
+		"==============",
+		"==========",
+		"============");
+	output += tmp;
+	for(size_t i = 0; i < profiles.size(); i++){
+		LockProfileStats& s = profiles[ i ];
+		tmp.format("%40s\t%12llu\t%16.2f\t%16.2f\t%16.2f\n",
+			s.name(), (unsigned long long)s.waits,
+			s.totalWaitNs / (double)s.waits,
+			s.maxWaitNs,
+			s.totalWaitNs
+		);
+		output += tmp;
+		for(size_t j = 0; j < s.holders.size(); j++){
+			tmp.format("\tHeld by %s for %llu waits, %.2f ns\n", s.holders[ j ].site(),
+				(unsigned long long)s.holders[ j ].waits, s.holders[ j ].waitNs );
+			output += tmp;
+		}
+	}
+}
+
+void LockProfile::RecordReport(xmlNodePtr node)
+{
+	twine tmp;
+	vector<LockProfileStats> profiles = Profiles();
+
+	for(size_t i = 0; i < profiles.size(); i++){
+		LockProfileStats& s = profiles[ i ];
+		xmlNodePtr child = xmlNewChild(node, NULL, (const xmlChar*)"LockProfile", NULL);
+		xmlSetProp(child, (const xmlChar*)"LockName", (const xmlChar*)s.name());
+		tmp.format("%llu", (unsigned long long)s.waits);
+		xmlSetProp(child, (const xmlChar*)"Waits", tmp);
+		tmp.format("%ld", (long)s.maxWaitNs);
+		xmlSetProp(child, (const xmlChar*)"MaxNs", tmp);
+		tmp.format("%ld", (long)s.totalWaitNs);
+		xmlSetProp(child, (const xmlChar*)"TotalNs", tmp);
+		for(size_t j = 0; j < s.holders.size(); j++){
+			xmlNodePtr holder = xmlNewChild(child, NULL, (const xmlChar*)"Holder", NULL);
+			xmlSetProp(holder, (const xmlChar*)"Site", (const xmlChar*)s.holders[ j ].site());
+			tmp.format("%llu", (unsigned long long)s.holders[ j ].waits);
+			xmlSetProp(holder, (const xmlChar*)"Waits", tmp);
+			tmp.format("%ld", (long)s.holders[ j ].waitNs);
+			xmlSetProp(holder, (const xmlChar*)"TotalNs", tmp);
+		}
+	}
+}
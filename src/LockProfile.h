@@ -0,0 +1,129 @@
+#ifndef LOCKPROFILE_H
+#define LOCKPROFILE_H
+ /*
+  * Copyright (c) 2001,2002 Steven M. Cherry. All rights reserved.
+  *
+  * This file is a part of slib - a c++ utility library
+  *
+  * The slib project, including all files needed to compile
+  * it, is free software; you can redistribute it and/or use it and/or modify
+  * it under the terms of the GNU Lesser General Public License as published by
+  * the Free Software Foundation.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program.  See file COPYING for details.
+  */
+
+#ifdef _WIN32
+#	ifndef DLLEXPORT
+#		define DLLEXPORT __declspec(dllexport)
+#	endif
+#else
+#	define DLLEXPORT
+#endif
+
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+using namespace std;
+
+#include "twine.h"
+#include "xmlinc.h"
+
+namespace SLib {
+
+/// The most distinct holder call sites we keep for each mutex.  Others are counted as "(other)".
+#define LOCKPROFILE_MAX_HOLDERS 32
+
+/// The counters for one lock.  Defined in LockProfile.cpp.
+struct LockProfileEntry;
+
+/// How often one call site was holding a lock that someone else had to wait for
+struct LockProfileHolder {
+	/// The EnEx method name that was holding the lock, or "(unknown)"
+	twine site;
+
+	/// The number of waits it caused
+	uint64_t waits;
+
+	/// The total time those waits took, in nanoseconds
+	double waitNs;
+};
+
+/// Everything the profiler knows about one lock, as returned by LockProfile::Profiles
+struct LockProfileStats {
+	/// The lock's name, or where it was first waited for if it wasn't given one
+	twine name;
+
+	/// The number of times someone had to wait for the lock
+	uint64_t waits;
+
+	/// The total and longest time spent waiting, in nanoseconds
+	double totalWaitNs;
+	double maxWaitNs;
+
+	/// Who was holding the lock during those waits, most waits first
+	vector<LockProfileHolder> holders;
+};
+
+/**
+  * An opt-in profiler for the time threads spend waiting on Mutex, RWMutex and
+  * AdaptiveMutex.  While it is on, every lock that has to wait records how long it waited
+  * and which EnEx method was holding the lock at the time, so that PrintReport shows which
+  * locks are hot and which code is holding them.  Locks that never have to wait cost one
+  * extra load and a note of who is holding them.
+  * <P>
+  * Locks are reported by the name they were given when they were created.  A lock without
+  * a name is reported by the EnEx method that first had to wait for it, so every unnamed
+  * lock that is contended in the same place is added up together, in the same way that
+  * EnEx adds up every call to a method.
+  *
+  * @author Steven M. Cherry
+  */
+class DLLEXPORT LockProfile
+{
+	public:
+		/// Turns the profiler on or off.  It is off by default.
+		static void SetProfiling(bool onoff);
+
+		/// Returns true if the profiler is on.
+		static bool ProfilingOn(void) {
+			return m_on.load( std::memory_order_relaxed );
+		}
+
+		/// Returns what we know about every lock that has been waited for, longest total wait first.
+		static vector<LockProfileStats> Profiles(void);
+
+		/// Clears every counter.  Locks keep their names.
+		static void Reset(void);
+
+		/// Formats Profiles as a table, in the style of EnterExit::PrintGlobalHitMap.
+		static void PrintReport(twine& output);
+
+		/// Adds a LockProfile child node to the given node for each lock.
+		static void RecordReport(xmlNodePtr node);
+
+		/** Records one wait on a lock.  entry is where the lock caches its counters, and
+		  * starts out NULL.  name is the lock's name, or NULL.  waitCycles is in
+		  * Timer::GetRawCycleCount units, and holder is the EnEx method that was holding the
+		  * lock, or NULL if we don't know.
+		  */
+		static void RecordWait(std::atomic<LockProfileEntry*>& entry, const char* name,
+			uint64_t waitCycles, const char* holder);
+
+		/** Returns the EnEx method the current thread is in, which is what a lock notes as
+		  * its holder.  NULL if there isn't one.
+		  */
+		static const char* CurrentSite(void);
+
+	private:
+		static std::atomic<bool> m_on;
+};
+
+} // End Namespace SLib
+
+#endif // LOCKPROFILE_H Defined
@@ -30,14 +30,32 @@
 #	include <sys/time.h>
 #endif
 
+#include <atomic>
+#include <chrono>
+
 #include "Thread.h"
 #include "Log.h"
 #include "twine.h"
 #include "LogMsg.h"
 #include "MsgQueue.h"
+#include "LogShipper.h"
+#include "Lock.h"
+#include "TimerWheel.h"
 
 using namespace SLib;
 
+/// The number of log channels (PANIC through SQLTRACE)
+#define LOG_CHANNEL_COUNT 7
+
+/// The number of call sites we track for rate limiting and duplicate suppression.  Power of 2.
+#define LOG_SITE_SLOTS 4096
+
+/// How far we probe for a free call site slot before giving up and letting the message through
+#define LOG_SITE_PROBE 16
+
+/// How often we log the summaries for call sites that have gone quiet while dropping messages
+#define LOG_SUMMARY_MS 1000
+
 // Some variables necessary to handle the logging.
 static FILE *logout = stdout;
 static int loginit = 0;
@@ -49,9 +67,225 @@ static bool debugon = false;
 static bool traceon = false;
 static bool sqltraceon = false;
 static bool lazy_on = false;
+static LogShipper* log_shipper = NULL;
 
 static MsgQueue<LogMsg*>* log_queue = NULL;
 
+// Rate limiting and duplicate suppression settings by channel.  These can be changed while
+// other threads are logging, so they are atomics.  Static storage starts them all at 0/false.
+static std::atomic<int> rate_per_sec[LOG_CHANNEL_COUNT];
+static std::atomic<int> rate_burst[LOG_CHANNEL_COUNT];
+static std::atomic<bool> dup_suppress[LOG_CHANNEL_COUNT];
+static std::atomic<bool> filter_on;
+
+// Is the timer that logs the summaries for quiet call sites running?  Both guarded by log_summary_mutex.
+static bool log_summaries_on = false;
+static TimerId log_summary_timer;
+
+/**
+  * The state we keep for each call site.  Everything is updated with atomics so that the
+  * logging threads never wait on each other to decide whether to drop a message.
+  */
+struct LogSite {
+	/// A hash of file, line and channel.  0 means the slot is free.
+	std::atomic<uint64_t> key;
+
+	/// Token bucket: high 32 bits are the last refill time in ms, low 32 bits are milli-tokens
+	std::atomic<uint64_t> bucket;
+
+	/// A hash of the last message text from this call site
+	std::atomic<uint64_t> lastMsg;
+
+	/// How many duplicates of lastMsg we have dropped
+	std::atomic<uint32_t> repeated;
+
+	/// How many messages we have dropped because of the rate limit
+	std::atomic<uint32_t> dropped;
+
+	/// The last message we dropped, kept so that we can log the summary even if this
+	/// call site never logs again.  We own it.
+	std::atomic<LogMsg*> held;
+};
+
+static LogSite log_sites[LOG_SITE_SLOTS];
+
+static uint64_t log_fnv1a(uint64_t h, const char* data, size_t len)
+{
+	for(size_t i = 0; i < len; i++){
+		h ^= (unsigned char)data[i];
+		h *= 1099511628211ULL;
+	}
+	return h;
+}
+
+static uint32_t log_now_ms()
+{
+	// Only differences matter, so wrapping around every 49 days is fine.
+	return (uint32_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static LogSite* log_find_site(LogMsg* lm)
+{
+	uint64_t key = log_fnv1a( 14695981039346656037ULL, lm->file(), lm->file.length() );
+	key = log_fnv1a( key, (const char*)&lm->line, sizeof(lm->line) );
+	key = log_fnv1a( key, (const char*)&lm->channel, sizeof(lm->channel) );
+	if(key == 0) key = 1;
+
+	for(size_t i = 0; i < LOG_SITE_PROBE; i++){
+		LogSite* site = &log_sites[ (key + i) & (LOG_SITE_SLOTS - 1) ];
+		uint64_t current = site->key.load( std::memory_order_acquire );
+		if(current == key){
+			return site;
+		}
+		if(current == 0){
+			uint64_t expected = 0;
+			if(site->key.compare_exchange_strong( expected, key, std::memory_order_acq_rel )){
+				return site;
+			}
+			if(expected == key){
+				return site; // someone else claimed it for the same call site
+			}
+		}
+	}
+	return NULL; // table is full around here - don't filter this call site
+}
+
+/// Takes a token from the call site's bucket.  Returns false if the bucket is empty.
+static bool log_take_token(LogSite* site, int perSec, int burst)
+{
+	uint64_t maxTokens = (uint64_t)burst * 1000;
+	uint32_t now = log_now_ms();
+	uint64_t old = site->bucket.load( std::memory_order_relaxed );
+	while(true){
+		uint64_t tokens;
+		if(old == 0){
+			tokens = maxTokens; // first use of this call site starts with a full bucket
+		} else {
+			uint32_t last = (uint32_t)(old >> 32);
+			tokens = (old & 0xFFFFFFFF) + (uint64_t)(uint32_t)(now - last) * perSec;
+			if(tokens > maxTokens){
+				tokens = maxTokens;
+			}
+		}
+		bool allowed = tokens >= 1000;
+		if(allowed){
+			tokens -= 1000;
+		}
+		uint64_t updated = ((uint64_t)now << 32) | tokens;
+		if(updated == 0) updated = 1; // 0 is reserved for a fresh bucket
+		if(site->bucket.compare_exchange_weak( old, updated, std::memory_order_relaxed )){
+			return allowed;
+		}
+	}
+}
+
+static void log_write(LogMsg* lm);
+
+/// Writes a summary line for messages we dropped, from the same call site as lm
+static void log_write_summary(LogMsg* lm, const char* fmt, uint32_t count)
+{
+	LogMsg* summary = new LogMsg( *lm );
+	summary->msg.format( fmt, (int)count );
+	summary->msg_static = false;
+	log_write( summary );
+}
+
+static Mutex* log_summary_mutex(void)
+{
+	// Never deleted, so that it is still there for anything that logs during exit.
+	static Mutex* mut = new Mutex();
+	return mut;
+}
+
+/// Starts the timer that logs the summaries, if it isn't already running
+static void log_start_summaries(void)
+{
+	Lock theLock( log_summary_mutex() );
+	if(!log_summaries_on){
+		log_summary_timer = TimerWheel::Global().SchedulePeriodic( LOG_SUMMARY_MS, []() { Log::FlushSummaries(); } );
+		log_summaries_on = true;
+	}
+}
+
+/// Keeps lm as the call site's example of what it has dropped, for FlushSummaries
+static void log_hold(LogSite* site, LogMsg* lm)
+{
+	delete site->held.exchange( lm, std::memory_order_acq_rel );
+}
+
+/// Takes ownership of lm if it is dropped, and returns true.  Returns false if it should be written.
+static bool log_filter(LogMsg* lm)
+{
+	if(lm->channel < 0 || lm->channel >= LOG_CHANNEL_COUNT){
+		return false;
+	}
+	int perSec = rate_per_sec[ lm->channel ].load( std::memory_order_relaxed );
+	bool dups = dup_suppress[ lm->channel ].load( std::memory_order_relaxed );
+	if(perSec == 0 && !dups){
+		return false;
+	}
+	LogSite* site = log_find_site( lm );
+	if(site == NULL){
+		return false;
+	}
+
+	if(dups){
+		uint64_t h = log_fnv1a( 14695981039346656037ULL, lm->msg(), lm->msg.length() );
+		if(site->lastMsg.exchange( h, std::memory_order_relaxed ) == h){
+			site->repeated.fetch_add( 1, std::memory_order_relaxed );
+			log_hold( site, lm );
+			return true;
+		}
+		uint32_t repeated = site->repeated.exchange( 0, std::memory_order_relaxed );
+		if(repeated != 0){
+			log_write_summary( lm, "Last message repeated %d times", repeated );
+		}
+	}
+
+	if(perSec != 0){
+		if(!log_take_token( site, perSec, rate_burst[ lm->channel ].load( std::memory_order_relaxed ) )){
+			site->dropped.fetch_add( 1, std::memory_order_relaxed );
+			log_hold( site, lm );
+			return true;
+		}
+		uint32_t dropped = site->dropped.exchange( 0, std::memory_order_relaxed );
+		if(dropped != 0){
+			log_write_summary( lm, "%d messages from here were dropped by the rate limit", dropped );
+		}
+	}
+
+	// Anything we held is summarized now, so the timer doesn't need it.
+	if(site->held.load( std::memory_order_relaxed ) != NULL){
+		delete site->held.exchange( NULL, std::memory_order_acq_rel );
+	}
+	return false;
+}
+
+void Log::FlushSummaries(void)
+{
+	for(size_t i = 0; i < LOG_SITE_SLOTS; i++){
+		LogSite* site = &log_sites[ i ];
+		if(site->held.load( std::memory_order_relaxed ) == NULL){
+			continue;
+		}
+		LogMsg* lm = site->held.exchange( NULL, std::memory_order_acq_rel );
+		if(lm == NULL){
+			continue; // the call site logged again and summarized it itself
+		}
+		// Droppers count before they hold, so whatever we hold is covered by the counts.
+		uint32_t repeated = site->repeated.exchange( 0, std::memory_order_relaxed );
+		if(repeated != 0){
+			log_write_summary( lm, "Last message repeated %d times", repeated );
+		}
+		uint32_t dropped = site->dropped.exchange( 0, std::memory_order_relaxed );
+		if(dropped != 0){
+			log_write_summary( lm, "%d messages from here were dropped by the rate limit", dropped );
+		}
+		delete lm;
+	}
+}
+
 void Log::TimeStamp(twine& t)
 {
 	t.reserve(64);
@@ -116,6 +350,14 @@ void Log::Init(const char *filename)
 	
 void Log::Fini(void)
 {
+	{
+		Lock theLock( log_summary_mutex() );
+		if(log_summaries_on){
+			TimerWheel::Global().Cancel( log_summary_timer );
+			log_summaries_on = false;
+		}
+	}
+	FlushSummaries();
 	Init("stdout");
 }
 
@@ -134,6 +376,11 @@ bool Log::LazyOn(void)
 	return lazy_on;
 }
 
+void Log::SetShipper(LogShipper* shipper)
+{
+	log_shipper = shipper;
+}
+
 MsgQueue<LogMsg*>& Log::GetLogQueue(void)
 {
 	if(log_queue == NULL){
@@ -142,10 +389,66 @@ MsgQueue<LogMsg*>& Log::GetLogQueue(void)
 	return *log_queue;
 }
 
+void Log::SetRateLimit(int channel, int perSecond, int burst)
+{
+	if(channel < 0 || channel >= LOG_CHANNEL_COUNT){
+		return;
+	}
+	if(perSecond < 0) perSecond = 0;
+	if(burst < 1) burst = 1;
+	rate_burst[ channel ] = burst;
+	rate_per_sec[ channel ] = perSecond;
+	filter_on = true;
+	log_start_summaries();
+}
+
+void Log::SetDuplicateSuppression(int channel, bool onoff)
+{
+	if(channel < 0 || channel >= LOG_CHANNEL_COUNT){
+		return;
+	}
+	dup_suppress[ channel ] = onoff;
+	filter_on = true;
+	log_start_summaries();
+}
+
+bool Log::ChannelOn(int channel)
+{
+	switch(channel){
+		case 0: return panicon;
+		case 1: return erroron;
+		case 2: return warnon;
+		case 3: return infoon;
+		case 4: return debugon;
+		case 5: return traceon;
+		case 6: return sqltraceon;
+	}
+	return false;
+}
+
 void Log::Persist(LogMsg* lm)
 {
-	if(lazy_on){
-		GetLogQueue().AddMsg(lm);
+	if(filter_on.load( std::memory_order_relaxed ) && log_filter(lm)){
+		return; // dropped - log_filter has kept it for the summary
+	}
+	log_write(lm);
+}
+
+/// The message text, with any structured fields on the end
+static twine log_text(LogMsg* lm)
+{
+	if(lm->fields.size() == 0){
+		return lm->msg;
+	}
+	return lm->msg + " {" + lm->FieldsAsText() + "}";
+}
+
+static void log_write(LogMsg* lm)
+{
+	if(log_shipper != NULL){
+		log_shipper->Ship(lm);
+	} else if(lazy_on){
+		Log::GetLogQueue().AddMsg(lm);
 	} else {
 		char local_tmp[32];
 		memset(local_tmp, 0, 32);
@@ -159,7 +462,7 @@ void Log::Persist(LogMsg* lm)
 			lm->file(),
 			lm->line,
 			lm->channel,
-			lm->msg());
+			log_text(lm)());
 #else
 		strftime(local_tmp, 32, "%Y/%m/%d %H:%M:%S",
 			localtime(&(lm->timestamp.tv_sec)));
@@ -169,7 +472,7 @@ void Log::Persist(LogMsg* lm)
 			lm->file(),
 			lm->line,
 			lm->channel,
-			lm->msg());
+			log_text(lm)());
 #endif
 		delete lm;
 	}
@@ -507,3 +810,60 @@ void Log::SqlTrace(const twine& appSession, const char *file, int line, const ch
 	lm->channel = 6; // SqlTrace
 	Persist(lm);
 }	
+
+LogEntry::LogEntry(const char* file, int line, int channel)
+{
+	m_lm = NULL;
+	if(Log::ChannelOn( channel )){
+		m_lm = new LogMsg(file, line);
+		m_lm->channel = channel;
+	}
+}
+
+LogEntry::~LogEntry()
+{
+	if(m_lm != NULL){
+		delete m_lm;
+	}
+}
+
+LogEntry& LogEntry::Session(const twine& appSession)
+{
+	if(m_lm != NULL){
+		m_lm->appSession = appSession;
+	}
+	return *this;
+}
+
+LogEntry& LogEntry::Field(const char* name, const twine& value)
+{
+	if(m_lm != NULL){
+		m_lm->Field( name, value );
+	}
+	return *this;
+}
+
+LogEntry& LogEntry::Field(const char* name, int64_t value)
+{
+	if(m_lm != NULL){
+		m_lm->Field( name, value );
+	}
+	return *this;
+}
+
+void LogEntry::Write(const char* msg, ...)
+{
+	if(m_lm == NULL) return;
+
+	va_list ap;
+	va_start(ap, msg);
+	m_lm->msg.format(msg, ap);
+	if(m_lm->msg.length() == strlen(msg)){
+		m_lm->msg_static = true;
+	}
+	va_end(ap);
+
+	LogMsg* lm = m_lm;
+	m_lm = NULL; // Persist owns it now
+	Log::Persist(lm);
+}
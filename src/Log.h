@@ -33,6 +33,8 @@
 
 namespace SLib {
 
+class LogShipper;
+
 /**
   * @memo This class encapsulates our logging functions.
   * @doc  This class encapsulates our logging functions.  All of the logging
@@ -79,6 +81,16 @@ class DLLEXPORT Log {
 		  */
 		static bool LazyOn(void);
 
+		/**
+		  * Sends every log message to the given LogShipper, which
+		  * batches them up and ships them to a LogCollector, instead
+		  * of writing them out here.  This takes priority over lazy
+		  * logging.  Pass NULL to turn shipping off again.  We do not
+		  * take ownership of the shipper, and it must outlive any
+		  * logging that goes through it.
+		  */
+		static void SetShipper(LogShipper* shipper);
+
 		/**
 		  * This returns a reference to our lazy logging queue.
 		  * Use this to implement your own log writer that has
@@ -90,7 +102,8 @@ class DLLEXPORT Log {
 		  * This method allows you to flush the logs and
 		  * close the current log file without opening another
 		  * one up.  This is equivalent to calling Init with
-		  * the filename of "stdout"
+		  * the filename of "stdout", after logging the summaries
+		  * of anything that was dropped (see FlushSummaries).
 		  */
 		static void Fini(void);
 
@@ -244,14 +257,102 @@ class DLLEXPORT Log {
 		  */
 		static void TimeStamp(twine& t);
 
+		/**
+		  * Limits the number of messages from any one call site (file
+		  * and line) on the given channel to perSecond messages per
+		  * second, with bursts of up to burst messages.  Messages over
+		  * the limit are dropped and counted, and the count is logged
+		  * from that call site once it is allowed to log again, or
+		  * by FlushSummaries if that doesn't happen first.  A
+		  * perSecond of 0 turns limiting off, which is the default for
+		  * every channel.
+		  */
+		static void SetRateLimit(int channel, int perSecond, int burst);
+
+		/**
+		  * Turns on (or off) duplicate suppression for the given
+		  * channel.  When on, a message that is identical to the
+		  * previous one from the same call site is dropped, and
+		  * "Last message repeated N times" is logged from that call
+		  * site when it next logs something different, or by
+		  * FlushSummaries if that doesn't happen first.  By default
+		  * duplicate suppression is off.
+		  */
+		static void SetDuplicateSuppression(int channel, bool onoff);
+
+		/**
+		  * Logs the "repeated" and "dropped" summaries for every call
+		  * site that has dropped messages since it last logged.  This
+		  * runs once a second on TimerWheel::Global while messages are
+		  * being dropped, and from Fini, so a summary is never lost
+		  * because its call site went quiet.
+		  */
+		static void FlushSummaries(void);
+
+		/**
+		  * Returns true if the given channel (0 = Panic through
+		  * 6 = SqlTrace) is turned on.
+		  */
+		static bool ChannelOn(int channel);
+
 		/**
 		  * This function makes the decision to write the log message
 		  * out to the disk or just add it to our log queue in memory.
+		  * Messages that are rate limited or duplicates are dropped
+		  * here.
 		  */
 		static void Persist(LogMsg* lm);
 
 };
 
+/**
+  * @memo Builds a log message with structured fields.
+  * @doc  Builds a log message with structured key/value fields attached,
+  *       for example:
+  *       <pre>
+  *       LogEntry(FL, 3).Session(sess).Field("request_id", id)
+  *           .Field("latency_ms", ms).Write("Request complete");
+  *       </pre>
+  *       The fields are stored alongside the message rather than being
+  *       formatted into it, so that they can be filtered and aggregated
+  *       later.  If the channel is turned off, nothing is allocated and
+  *       every call returns straight away.
+  * @author Steven M. Cherry
+  * @copyright 2002 Steven M. Cherry
+  */
+class DLLEXPORT LogEntry {
+
+	private:
+		/// copy constructor is private to prevent use
+		LogEntry(const LogEntry& c) {}
+
+		/// assignmet operator is private to prevent use
+		LogEntry& operator=(const LogEntry& c) { return *this; }
+
+	public:
+		/// Starts a message for the given channel (0 = Panic through 6 = SqlTrace)
+		LogEntry(const char* file, int line, int channel);
+
+		/// Standard destructor.  Anything not written is thrown away.
+		virtual ~LogEntry();
+
+		/// Sets the application session for this message
+		LogEntry& Session(const twine& appSession);
+
+		/// Attaches a text field
+		LogEntry& Field(const char* name, const twine& value);
+
+		/// Attaches an integer field
+		LogEntry& Field(const char* name, int64_t value);
+
+		/// Formats the message text and hands the message to Log::Persist
+		void Write(const char* msg, ...);
+
+	private:
+		/// The message being built, or NULL if the channel is off
+		LogMsg* m_lm;
+};
+
 } // End namespace
 
 #ifndef FL
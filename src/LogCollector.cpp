@@ -0,0 +1,269 @@
+ /*
+  * Copyright (c) 2001,2002 Steven M. Cherry. All rights reserved.
+  *
+  * This file is a part of slib - a c++ utility library
+  *
+  * The slib project, including all files needed to compile
+  * it, is free software; you can redistribute it and/or use it and/or modify
+  * it under the terms of the GNU Lesser General Public License as published by
+  * the Free Software Foundation.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program.  See file COPYING for details.
+  */
+
+#include "LogCollector.h"
+#include "LogShipper.h"
+#include "AnException.h"
+#include "MemBuf.h"
+#include "Lock.h"
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#else
+#include <winsock2.h>
+#endif
+
+using namespace SLib;
+
+/// How often our threads wake up to see if we have been stopped, in milliseconds
+#define LOGCOLLECT_POLL 250
+
+LogCollector::LogCollector(int port, LogFile2& lf) : m_lf(lf)
+{
+	m_port = port;
+	m_listener = NULL;
+	m_thread = NULL;
+	m_stop = false;
+	m_received = 0;
+	m_mutex = new Mutex();
+	m_writeMutex = new Mutex();
+}
+
+LogCollector::~LogCollector()
+{
+	Stop();
+	delete m_writeMutex;
+	delete m_mutex;
+}
+
+void LogCollector::Start()
+{
+	Lock theLock(m_mutex);
+	if(m_thread != NULL){
+		return; // already running
+	}
+	m_stop = false;
+	m_listener = new Socket( m_port );
+	m_thread = new Thread();
+	try {
+		m_thread->start( LogCollector::listenStart, this );
+	} catch (AnException&){
+		delete m_thread;
+		m_thread = NULL;
+		delete m_listener;
+		m_listener = NULL;
+		throw;
+	}
+}
+
+void LogCollector::Stop()
+{
+	{
+		Lock theLock(m_mutex);
+		if(m_thread == NULL){
+			return;
+		}
+		m_stop = true;
+	}
+
+	m_thread->join();
+	delete m_thread;
+	m_thread = NULL;
+	delete m_listener;
+	m_listener = NULL;
+
+	reapConnections( true );
+}
+
+size_t LogCollector::Received()
+{
+	Lock theLock(m_mutex);
+	return m_received;
+}
+
+void* LogCollector::listenStart(void* arg)
+{
+	((LogCollector*)arg)->listenLoop();
+	return NULL;
+}
+
+void* LogCollector::connStart(void* arg)
+{
+	LogCollectorConn* conn = (LogCollectorConn*)arg;
+	conn->owner->handleConnection( conn );
+	return NULL;
+}
+
+void LogCollector::listenLoop()
+{
+	while(true){
+		{
+			Lock theLock(m_mutex);
+			if(m_stop){
+				break;
+			}
+		}
+		reapConnections( false );
+
+		Socket* sock;
+		try {
+			sock = (Socket*)m_listener->Listen( LOGCOLLECT_POLL );
+		} catch (AnException& e){
+			printf("Error accepting log shipper connection: %s\n", e.Msg() );
+			continue;
+		}
+		if(sock == NULL){
+			continue; // timed out - check for stop
+		}
+		// A shipper that has given up on its ACK mustn't take the process down with SIGPIPE.
+		sock->SetNoSigPipe( true );
+
+		LogCollectorConn* conn = new LogCollectorConn();
+		conn->owner = this;
+		conn->sock = sock;
+		conn->done = false;
+		conn->thread = new Thread();
+		try {
+			conn->thread->start( LogCollector::connStart, conn );
+		} catch (AnException& e){
+			printf("Error starting log collector thread: %s\n", e.Msg() );
+			delete conn->thread;
+			delete conn->sock;
+			delete conn;
+			continue;
+		}
+		Lock theLock(m_mutex);
+		m_conns.push_back( conn );
+	}
+}
+
+void LogCollector::reapConnections( bool all )
+{
+	vector<LogCollectorConn*> finished;
+	{
+		Lock theLock(m_mutex);
+		for(size_t i = 0; i < m_conns.size(); ){
+			if(all || m_conns[i]->done){
+				finished.push_back( m_conns[i] );
+				m_conns.erase( m_conns.begin() + i );
+			} else {
+				i++;
+			}
+		}
+	}
+
+	for(size_t i = 0; i < finished.size(); i++){
+		finished[i]->thread->join();
+		delete finished[i]->thread;
+		delete finished[i]->sock;
+		delete finished[i];
+	}
+}
+
+bool LogCollector::readFully( Socket* sock, char* buf, size_t len )
+{
+	size_t got = 0;
+	while(got < len){
+		int n;
+		try {
+			n = sock->TimedGetRawData( buf + got, (int)(len - got), LOGCOLLECT_POLL );
+		} catch (ReadTimeout&){
+			Lock theLock(m_mutex);
+			if(m_stop){
+				return false;
+			}
+			continue;
+		}
+		if(n <= 0){
+			return false; // the shipper went away
+		}
+		got += (size_t)n;
+	}
+	return true;
+}
+
+void LogCollector::handleConnection( LogCollectorConn* conn )
+{
+	vector<LogMsg*> messages;
+	try {
+		while(true){
+			char header[LOGSHIP_HEADER_SIZE];
+			if(!readFully( conn->sock, header, LOGSHIP_HEADER_SIZE )){
+				break;
+			}
+			uint32_t len, count;
+			memcpy( &len, header + 4, 4 );
+			memcpy( &count, header + 8, 4 );
+			len = ntohl( len );
+			count = ntohl( count );
+			if(memcmp( header, LOGSHIP_MAGIC, 4 ) != 0){
+				throw AnException(0, FL, "Invalid log frame header.");
+			}
+			if(len > LOGSHIP_MAX_FRAME){
+				throw AnException(0, FL, "Log frame of %d bytes is too large.", (int)len );
+			}
+
+			MemBuf payload( (size_t)len );
+			if(len != 0 && !readFully( conn->sock, payload.data(), len )){
+				break;
+			}
+
+			size_t pos = 0;
+			for(uint32_t i = 0; i < count; i++){
+				LogMsg* lm = new LogMsg();
+				if(!lm->Decode( payload.data(), payload.size(), pos )){
+					delete lm;
+					throw AnException(0, FL, "Invalid log record %d of %d in frame.", (int)i, (int)count );
+				}
+				messages.push_back( lm );
+			}
+
+			// Only acknowledge once the whole batch is committed to the log file.  If anything
+			// failed to be written, drop the connection without an ACK so that the shipper
+			// sends the batch again.
+			bool written;
+			{
+				Lock theLock(m_writeMutex);
+				m_lf.writeMsg( &messages );
+				written = m_lf.flush();
+				if(written){
+					Lock statsLock(m_mutex);
+					m_received += count;
+				}
+			}
+			for(size_t i = 0; i < messages.size(); i++){
+				delete messages[i];
+			}
+			messages.clear();
+			if(!written){
+				throw AnException(0, FL, "Error writing a batch of %d log messages - not acknowledging it.", (int)count );
+			}
+
+			uint32_t ack = htonl( count );
+			conn->sock->SendData( (char*)&ack, 4 );
+		}
+	} catch (AnException& e){
+		printf("Error reading from log shipper: %s\n", e.Msg() );
+	}
+
+	for(size_t i = 0; i < messages.size(); i++){
+		delete messages[i];
+	}
+	Lock theLock(m_mutex);
+	conn->done = true;
+}
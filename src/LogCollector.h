@@ -0,0 +1,136 @@
+#ifndef LOGCOLLECTOR_H
+#define LOGCOLLECTOR_H
+ /*
+  * Copyright (c) 2001,2002 Steven M. Cherry. All rights reserved.
+  *
+  * This file is a part of slib - a c++ utility library
+  *
+  * The slib project, including all files needed to compile
+  * it, is free software; you can redistribute it and/or use it and/or modify
+  * it under the terms of the GNU Lesser General Public License as published by
+  * the Free Software Foundation.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program.  See file COPYING for details.
+  */
+
+#ifdef _WIN32
+#	ifndef DLLEXPORT
+#		define DLLEXPORT __declspec(dllexport)
+#	endif
+#else
+#	define DLLEXPORT
+#endif
+
+#include <vector>
+using namespace std;
+
+#include "twine.h"
+#include "Mutex.h"
+#include "Thread.h"
+#include "Socket.h"
+#include "LogFile2.h"
+
+namespace SLib {
+
+class LogCollector;
+
+/// What we keep for each LogShipper that is connected to us
+struct LogCollectorConn {
+	LogCollector* owner;
+	Socket* sock;
+	Thread* thread;
+	bool done;
+};
+
+/**
+  * This class is the receiving end of LogShipper.  It listens on a port, and every batch of
+  * messages that arrives is written to our LogFile2 as a single transaction before it is
+  * acknowledged to the shipper.  Each connection is handled by its own thread, and LogFile2
+  * takes care of serializing the writes between them.
+  *
+  * @author Steven M. Cherry
+  */
+class DLLEXPORT LogCollector
+{
+	private:
+		/// copy constructor is private to prevent use
+		LogCollector(const LogCollector& c) : m_lf(c.m_lf) {}
+
+		/// assignmet operator is private to prevent use
+		LogCollector& operator=(const LogCollector& c) { return *this;}
+
+	public:
+		/// Standard constructor.  Messages received on the port are written to lf.
+		LogCollector(int port, LogFile2& lf);
+
+		/// Standard destructor - stops everything if it is still running.
+		virtual ~LogCollector();
+
+		/// Starts listening for shippers.  Throws an AnException if we can't listen on our port.
+		void Start();
+
+		/// Stops listening, and closes every connection once the batch it is on is written.
+		void Stop();
+
+		/// The number of messages we have written to our log file
+		size_t Received();
+
+	protected:
+
+		/// Reads exactly len bytes.  Returns false if the connection closes or we are stopped.
+		bool readFully( Socket* sock, char* buf, size_t len );
+
+		/// Reads frames from one shipper until it goes away
+		void handleConnection( LogCollectorConn* conn );
+
+		/// Accepts connections until we are stopped
+		void listenLoop();
+
+		/// Cleans up connections whose threads have finished.  Pass true to wait for all of them.
+		void reapConnections( bool all );
+
+		/// The entry point for our listening thread
+		static void* listenStart(void* arg);
+
+		/// The entry point for our connection threads
+		static void* connStart(void* arg);
+
+	private:
+
+		/** Held while a batch is written and flushed, so that the result of each flush is about
+		  * that connection's batch and no other.
+		  */
+		Mutex* m_writeMutex;
+
+		/// Protects everything below
+		Mutex* m_mutex;
+
+		/// Where the messages go
+		LogFile2& m_lf;
+
+		/// The port we listen on
+		int m_port;
+
+		/// Our listening socket and thread
+		Socket* m_listener;
+		Thread* m_thread;
+
+		/// Tells all of our threads to exit
+		bool m_stop;
+
+		/// Everyone connected to us
+		vector<LogCollectorConn*> m_conns;
+
+		/// Statistics
+		size_t m_received;
+
+};
+
+} // End Namespace SLib
+
+#endif // LOGCOLLECTOR_H Defined
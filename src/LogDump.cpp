@@ -346,7 +346,9 @@ int main(int argc, char** argv)
 			1024 * 1024 * 1, // 1M string table
 			1024 * 10, // 10K strings
 			false, // don't re-use
-			false // don't clear at startup
+			false, // don't clear at startup
+			false, // not memory mapped
+			true // read only - we never change the writer's file
 		);
 
 		//printf("Dumping Index stats and String table:\n");
@@ -381,25 +383,49 @@ int main(int argc, char** argv)
 
 		lf.close();
 
+		// In watch mode we map the log file into memory and follow the writer through the
+		// mapping.  Checking for new messages only reads the index header from the mapping,
+		// so we can check often without any system calls or locking, and only re-read the
+		// index when something has been written.  If nothing shows up for a while, we re-open
+		// the file in case it was rolled over to a new one.  The mapping is read only, so we
+		// never extend or write to the writer's file.
+		dptr<LogFile> lfWatch;
+		int idleLoops = 0;
 		if(m_watch_mode){ while(1){
-			Tools::msleep( 500 );
-			LogFile lfWatch(logFileName,
-				1024 * 1024 * 10, // 10M max
-				10000, // entries max
-				1024 * 1024 * 1, // 1M string table
-				1024 * 10, // 10K strings
-				false, // don't re-use
-				false // don't clear at startup
-			);
-			int new_newest = lfWatch.getNewestMessageID();
+			Tools::msleep( 50 );
+			if(lfWatch == NULL || idleLoops >= 200){
+				try {
+					lfWatch = new LogFile(logFileName,
+						1024 * 1024 * 10, // 10M max
+						10000, // entries max
+						1024 * 1024 * 1, // 1M string table
+						1024 * 10, // 10K strings
+						false, // don't re-use
+						false, // don't clear at startup
+						true, // memory mapped
+						true // read only
+					);
+				} catch (AnException&){
+					// The file is in the middle of being rolled over.  Try again shortly.
+					lfWatch = NULL;
+					continue;
+				}
+				idleLoops = 0;
+			} else if(lfWatch->peekNewestMessageID() > newest){
+				lfWatch->refresh();
+			}
+			int new_newest = lfWatch->getNewestMessageID();
 			if(new_newest > newest){
 				for(int i = newest + 1; i <= new_newest; i++){
-					dptr<LogMsg> lm; lm = lfWatch.getMessage(i);
+					dptr<LogMsg> lm; lm = lfWatch->getMessage(i);
 					if(lm == NULL) continue;
 					filterAndPrint( lm );
 				}
 
 				newest = new_newest;
+				idleLoops = 0;
+			} else {
+				idleLoops++;
 			}
 		} }
 
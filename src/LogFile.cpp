@@ -2,6 +2,12 @@
 #include "Date.h"
 using namespace SLib;
 
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
 /// The size of our LogFile signature = 8.
 static int SIGNATURE_SIZE = 8;
 
@@ -91,7 +97,8 @@ int LogMsgStripped::length()
 
 
 
-LogFile::LogFile(twine FileName, int max_size, bool reuse, bool clear_at_startup)
+LogFile::LogFile(twine FileName, int max_size, bool reuse, bool clear_at_startup,
+	bool memory_mapped, bool read_only)
 {
 	m_signature = (char*)"3141ZEDL";
 	m_mutex = new Mutex();
@@ -100,6 +107,16 @@ LogFile::LogFile(twine FileName, int max_size, bool reuse, bool clear_at_startup
 	m_reuse = reuse;
 	m_log = NULL;
 	m_clear_at_startup = clear_at_startup;
+#ifdef _WIN32
+	m_mmap = false;
+#else
+	m_mmap = memory_mapped;
+#endif
+	m_map = NULL;
+	m_map_size = 0;
+	m_map_pos = 0;
+	m_unsynced = 0;
+	m_readonly = read_only;
 
 	m_indexes = NULL;
 	m_log_ids = NULL;
@@ -143,13 +160,16 @@ LogFile::LogFile(twine FileName, int max_size, bool reuse, bool clear_at_startup
 
 	// Create the file brand new if not and initialize it
 	if (m_log == NULL) {
+		if (m_readonly) {
+			throw AnException(0, FL, "Log file %s does not exist.", m_file_name() );
+		}
 		createFile();
 	}
 }
 
 LogFile::LogFile(twine FileName, int max_size, int max_entries,
 		int string_table_size, int max_strings, bool reuse,
-		bool clear_at_startup)
+		bool clear_at_startup, bool memory_mapped, bool read_only)
 {
 	m_signature = (char*)"3141ZEDL";
 	m_mutex = new Mutex();
@@ -161,6 +181,16 @@ LogFile::LogFile(twine FileName, int max_size, int max_entries,
 	m_reuse = reuse;
 	m_log = NULL;
 	m_clear_at_startup = clear_at_startup;
+#ifdef _WIN32
+	m_mmap = false;
+#else
+	m_mmap = memory_mapped;
+#endif
+	m_map = NULL;
+	m_map_size = 0;
+	m_map_pos = 0;
+	m_unsynced = 0;
+	m_readonly = read_only;
 
 	m_indexes = NULL;
 	m_log_ids = NULL;
@@ -173,6 +203,9 @@ LogFile::LogFile(twine FileName, int max_size, int max_entries,
 
 	// Create the file brand new if not and initialize it
 	if (m_log == NULL) {
+		if (m_readonly) {
+			throw AnException(0, FL, "Log file %s does not exist.", m_file_name() );
+		}
 		createFile();
 	}
 }
@@ -203,6 +236,10 @@ void LogFile::writeMsg(LogMsg& msg)
 {
 	Lock theLock(m_mutex);
 
+	if(m_readonly){
+		throw AnException(0, FL, "Log file %s was opened read only.", m_file_name() );
+	}
+
 	int start_of_messages = 
 		SIGNATURE_SIZE + 
 		INDEX_HEADER_SIZE + 
@@ -235,10 +272,12 @@ void LogFile::writeMsg(LogMsg& msg)
 		m_index_header.newest_entry = 0;
 		(*m_log_ids)[our_index->id] = our_index;
 
-		writeIndexHeader(); // Write the index header:
-		writeIndexEntry(0); // Write the new index entry
+		// The message goes in first and the index header last, so anyone following
+		// the file never sees an index entry before its data.
 		writeMessageEntry(0, msg2); // Write the new data
-		fflush(m_log);
+		writeIndexEntry(0); // Write the new index entry
+		writeIndexHeader(); // Write the index header:
+		flushMsg();
 
 	} else if (m_index_header.record_count < m_index_header.index_count) {
 		// Still available indexes to be used.
@@ -258,10 +297,10 @@ void LogFile::writeMsg(LogMsg& msg)
 				m_index_header.record_count++;
 				(*m_log_ids)[our_index->id] = our_index;
 
-				writeIndexHeader(); // Write the index header:
-				writeIndexEntry(which_index); // Write the new index entry
 				writeMessageEntry(which_index, msg2); // Write the new data
-				fflush(m_log);
+				writeIndexEntry(which_index); // Write the new index entry
+				writeIndexHeader(); // Write the index header:
+				flushMsg();
 
 			} else {
 				// Not enough space at the end of the file.
@@ -532,12 +571,132 @@ void LogFile::close()
 {
 	Lock theLock(m_mutex);	
 
+	unmapFile();
 	if(m_log != NULL){
 		fclose(m_log);
 	}
 	m_log = NULL;
 }
 
+void LogFile::refresh()
+{
+	Lock theLock(m_mutex);
+
+#ifndef _WIN32
+	// A read only mapping only covers the file as it was.  If the writer has grown it
+	// since, map it again to see the new part.
+	if(m_map != NULL && m_readonly){
+		struct stat st;
+		if(fstat(fileno(m_log), &st) == 0 && (size_t)st.st_size > m_map_size){
+			unmapFile();
+			mapFile();
+		}
+	}
+#endif
+	readLogHeaders();
+}
+
+int LogFile::peekNewestMessageID()
+{
+	Lock theLock(m_mutex);
+
+	// The writer updates the index entry before the header, so the entry the header points
+	// to is always complete.
+	seek( SIGNATURE_SIZE + 12 ); // newest_entry in the index header
+	int newest = readInt();
+	if(newest < 0 || newest >= m_index_header.index_count){
+		return -1;
+	}
+	seek( SIGNATURE_SIZE + INDEX_HEADER_SIZE + (newest * INDEX_ENTRY_SIZE) + 8 ); // the entry's id
+	return readInt();
+}
+
+void LogFile::sync()
+{
+	Lock theLock(m_mutex);
+
+	if(m_map != NULL){
+#ifndef _WIN32
+		msync(m_map, m_map_size, MS_SYNC);
+#endif
+		m_unsynced = 0;
+	} else if(m_log != NULL){
+		fflush(m_log);
+	}
+}
+
+void LogFile::flushMsg()
+{
+	if(m_map == NULL){
+		fflush(m_log);
+		return;
+	}
+
+	// The mapping is shared with the OS page cache, so the message is already safe from
+	// a crash of this process.  Getting it to the disk can be done in batches.
+	m_unsynced++;
+	if(m_unsynced >= LOGFILE_MMAP_SYNC_BATCH){
+#ifndef _WIN32
+		msync(m_map, m_map_size, MS_ASYNC);
+#endif
+		m_unsynced = 0;
+	}
+}
+
+void LogFile::mapFile()
+{
+#ifndef _WIN32
+	if(m_log == NULL){
+		throw AnException(0, FL, "Trying to map a log file that has not been opened.");
+	}
+	int fd = fileno(m_log);
+	struct stat st;
+	if(fstat(fd, &st) != 0){
+		throw AnException(0, FL, "Error reading the size of log file %s", m_file_name() );
+	}
+
+	// Map the whole file.  Writes never go past m_max_size, so make sure the file is at
+	// least that big.  The new space reads as zeros, just like an unused part of the file.
+	// A reader leaves the file alone, and maps only what is there.
+	m_map_size = (size_t)st.st_size;
+	if(m_map_size == 0 && m_readonly){
+		throw AnException(0, FL, "Log file %s is empty", m_file_name() );
+	}
+	if(m_map_size < (size_t)m_max_size && !m_readonly){
+		if(ftruncate(fd, (off_t)m_max_size) != 0){
+			throw AnException(0, FL, "Error extending log file %s to %d bytes",
+				m_file_name(), m_max_size );
+		}
+		m_map_size = (size_t)m_max_size;
+	}
+
+	int prot = m_readonly ? PROT_READ : (PROT_READ | PROT_WRITE);
+	void* addr = mmap(NULL, m_map_size, prot, MAP_SHARED, fd, 0);
+	if(addr == MAP_FAILED){
+		m_map_size = 0;
+		throw AnException(0, FL, "Error mapping log file %s into memory", m_file_name() );
+	}
+	m_map = (char*)addr;
+	m_map_pos = 0;
+	m_unsynced = 0;
+#endif
+}
+
+void LogFile::unmapFile()
+{
+#ifndef _WIN32
+	if(m_map != NULL){
+		if(!m_readonly){
+			msync(m_map, m_map_size, MS_SYNC);
+		}
+		munmap(m_map, m_map_size);
+	}
+#endif
+	m_map = NULL;
+	m_map_size = 0;
+	m_map_pos = 0;
+}
+
 void LogFile::createNewFile()
 {
 	// First close the log file
@@ -559,15 +718,15 @@ void LogFile::createNewFile()
 void LogFile::openFile()
 {
 
-	// Does the file exist?
-	m_log = fopen(m_file_name(), "rb+"); // read and write anywhere in the file.
+	// Does the file exist?  A reader opens it read only, so that it can never change it.
+	m_log = fopen(m_file_name(), m_readonly ? "rb" : "rb+"); // read and write anywhere in the file.
 	if (m_log == NULL) {
 		// File does not exist.
 		m_log = NULL;
 		return;
 	}
 	
-	if( m_clear_at_startup ){
+	if( m_clear_at_startup && !m_readonly ){
 		// zero out the file.
 		fclose(m_log);
 		m_log = fopen(m_file_name(), "wb+"); // read and write anywhere after clearing the file.
@@ -588,6 +747,16 @@ void LogFile::openFile()
 		}
 	}
 
+	if(m_mmap){
+		try {
+			mapFile();
+		} catch (AnException&){
+			fclose(m_log);
+			m_log = NULL;
+			throw;
+		}
+	}
+
 	// Read our structures from it
 	readLogHeaders();
 }
@@ -666,6 +835,7 @@ void LogFile::readLogHeaders()
 
 	} catch (AnException& e) {
 		try {
+			unmapFile();
 			fclose(m_log);
 		} catch (...) {
 			throw;
@@ -685,9 +855,12 @@ void LogFile::createFile()
 		// Somethine went wrong trying to open it.
 		throw AnException(0, FL, "Error opening our new log file.");
 	}
+	if(m_mmap){
+		mapFile();
+	}
 
 	// Write our signature to the file:
-	fwrite(m_signature, 8, 1, m_log);
+	write(m_signature, 8);
 
 	// Figure out how big everything should be
 	// 10M max means:
@@ -721,7 +894,7 @@ void LogFile::createFile()
 		throw AnException(0, FL, "Error allocating memory for the write.");
 	}
 	memset(bytes, 0, len );
-	fwrite( bytes, len, 1, m_log);
+	write( bytes, len );
 	free(bytes);
 
 	// Write our String table
@@ -748,7 +921,7 @@ void LogFile::createFile()
 		throw AnException(0, FL, "Error allocating memory for the write.");
 	}
 	memset(bytes, 0, len );
-	fwrite( bytes, len, 1, m_log);
+	write( bytes, len );
 	free(bytes);
 	
 	// Zero the rest of the string table.
@@ -758,7 +931,7 @@ void LogFile::createFile()
 		throw AnException(0, FL, "Error allocating memory for the write.");
 	}
 	memset(bytes, 0, len );
-	fwrite( bytes, len, 1, m_log);
+	write( bytes, len );
 	free(bytes);
 
 }
@@ -814,11 +987,10 @@ int LogFile::addStringTableEntry(twine str)
 		return -1;
 	}
 
-	// Write out the updated string table header
-	seek(string_table_start);
-	write(m_string_table_header.total_size);
-	write(m_string_table_header.total_indexes);
-	write(m_string_table_header.index_in_use);
+	// Write out the new string itself.  Like messages, the string goes in before the
+	// index and header that point to it.
+	seek(ret->offset);
+	write(str);
 
 	// write out the updated string index
 	seek(string_table_start
@@ -828,9 +1000,11 @@ int LogFile::addStringTableEntry(twine str)
 	write(ret->offset);
 	write(ret->length);
 
-	// Write out the new string itself
-	seek(ret->offset);
-	write(str);
+	// Write out the updated string table header
+	seek(string_table_start);
+	write(m_string_table_header.total_size);
+	write(m_string_table_header.total_indexes);
+	write(m_string_table_header.index_in_use);
 
 	// Add the new string to our string table
 	(*m_string_table)[str] = ret;
@@ -867,7 +1041,23 @@ void LogFile::write(int32_t value)
 	if(m_log == NULL){
 		throw AnException(0, FL, "Trying to write to a log file that has not been opened.");
 	}
-	fwrite( &value, sizeof(int32_t), 1, m_log);
+	if(m_readonly){
+		throw AnException(0, FL, "Trying to write to a log file that was opened read only.");
+	}
+#ifndef _WIN32
+	if(m_map != NULL && (m_map_pos % sizeof(int32_t)) == 0){
+		// All of the index and header fields are aligned.  Storing them atomically with
+		// release ordering means a reader that sees the new value also sees the data we
+		// wrote before it.
+		if(m_map_pos + sizeof(int32_t) > m_map_size){
+			throw AnException(0, FL, "Write past the end of our mapped log file.");
+		}
+		__atomic_store_n( (int32_t*)(m_map + m_map_pos), value, __ATOMIC_RELEASE );
+		m_map_pos += sizeof(int32_t);
+		return;
+	}
+#endif
+	write( &value, sizeof(int32_t) );
 }
 
 int32_t LogFile::readInt()
@@ -876,6 +1066,20 @@ int32_t LogFile::readInt()
 		throw AnException(0, FL, "Trying to write to a log file that has not been opened.");
 	}
 	int ret = 0;
+	if(m_map != NULL){
+		if(m_map_pos + sizeof(int32_t) > m_map_size){
+			throw AnException(0, FL, "Error reading an int from our log file.");
+		}
+#ifndef _WIN32
+		if((m_map_pos % sizeof(int32_t)) == 0){
+			ret = __atomic_load_n( (int32_t*)(m_map + m_map_pos), __ATOMIC_ACQUIRE );
+		} else {
+			memcpy( &ret, m_map + m_map_pos, sizeof(int32_t) );
+		}
+#endif
+		m_map_pos += sizeof(int32_t);
+		return ret;
+	}
 	size_t count = fread ( &ret, sizeof(int32_t), 1, m_log);
 	if(count != 1){
 		throw AnException(0, FL, "Error reading an int from our log file.");
@@ -884,11 +1088,27 @@ int32_t LogFile::readInt()
 }
 
 void LogFile::write(twine& value)
+{
+	write( value.data(), value.length() );
+}
+
+void LogFile::write(const void* data, size_t length)
 {
 	if(m_log == NULL){
 		throw AnException(0, FL, "Trying to write to a log file that has not been opened.");
 	}
-	fwrite( value.data(), value.length(), 1, m_log);
+	if(m_readonly){
+		throw AnException(0, FL, "Trying to write to a log file that was opened read only.");
+	}
+	if(m_map != NULL){
+		if(m_map_pos + length > m_map_size){
+			throw AnException(0, FL, "Write past the end of our mapped log file.");
+		}
+		memcpy( m_map + m_map_pos, data, length );
+		m_map_pos += length;
+		return;
+	}
+	fwrite( data, length, 1, m_log);
 }
 
 twine LogFile::readTwine(size_t length)
@@ -898,6 +1118,15 @@ twine LogFile::readTwine(size_t length)
 	}
 	twine ret;
 	ret.reserve(length);
+	if(m_map != NULL){
+		if(m_map_pos + length > m_map_size){
+			throw AnException(0, FL, "Error reading a twine from our log file.");
+		}
+		memcpy( ret.data(), m_map + m_map_pos, length );
+		m_map_pos += length;
+		ret.check_size();
+		return ret;
+	}
 	size_t count = fread ( ret.data(), length, 1, m_log);
 	if(count != 1){
 		throw AnException(0, FL, "Error reading a twine from our log file.");
@@ -926,6 +1155,10 @@ void LogFile::seek(long offsetFromStart)
 	if(m_log == NULL){
 		throw AnException(0, FL, "Trying to write to a log file that has not been opened.");
 	}
+	if(m_map != NULL){
+		m_map_pos = (size_t)offsetFromStart;
+		return;
+	}
 	fseek(m_log, offsetFromStart, SEEK_SET);
 }
 
@@ -14,6 +14,9 @@ using namespace SLib;
 
 namespace SLib {
 
+/// In memory mapped mode, we ask the OS to write the mapping to disk after this many messages.
+#define LOGFILE_MMAP_SYNC_BATCH 256
+
 class LogFile;
 
 /** A typical LogMsg has strings for machine, application, file, and
@@ -74,6 +77,19 @@ class DLLEXPORT LogMsgStripped : public LogMsg {
  * This is all done using a random access file structure on the disk. Each time
  * we write to the file, we ensure that it has been flushed to the disk so that
  * when we return from the writeMsg() call, the file has been saved.
+ *
+ * When memory_mapped is given to the constructor, the whole file is mapped into
+ * memory instead, using the same layout.  Writes become copies into the mapped
+ * region and the index is updated with atomic stores after the message itself,
+ * so another process that maps the same file read only (see refresh()) can follow
+ * it without any system calls.  The data survives a crash of the writing process as soon as
+ * writeMsg returns.  To also survive a crash of the OS, the mapping is synced in
+ * batches of LOGFILE_MMAP_SYNC_BATCH messages, and whenever you call sync().
+ * Memory mapping is not available on Windows, where the flag is ignored.
+ *
+ * Readers that follow a file someone else is writing, such as LogDump -w, should
+ * pass read_only.  The file is then opened and mapped read only, and is never
+ * extended, truncated or written to.
  * 
  * 
  * @author Steven M. Cherry
@@ -195,20 +211,45 @@ class DLLEXPORT LogFile {
 		/** This is the file handle of our open log file */
 		FILE* m_log;
 
+		/** Are we using a memory mapped view of the file rather than stdio? */
+		bool m_mmap;
+
+		/** The start of our memory mapped view of the file */
+		char* m_map;
+
+		/** The size of our memory mapped view of the file */
+		size_t m_map_size;
+
+		/** Our current read/write position within the memory mapped view */
+		size_t m_map_pos;
+
+		/** How many messages have been written since the mapping was last synced */
+		int m_unsynced;
+
+		/** Are we only reading the file?  A reader never changes the file, so it can follow
+		  * a file that another process is writing to.
+		  */
+		bool m_readonly;
+
 		/** This is the mutex that we use to keep log file access exclusive. */
 		Mutex* m_mutex;
 
 	public:
 
-		/** Standard constructor to open an existing or create a new log file.
+		/** Standard constructor to open an existing or create a new log file.  With
+		 *  read_only set, the file must already exist, and is never written to, extended
+		 *  or cleared.
 		 */
-		LogFile(twine FileName, int max_size, bool reuse, bool clear_at_startup);
+		LogFile(twine FileName, int max_size, bool reuse, bool clear_at_startup,
+			bool memory_mapped = false, bool read_only = false);
 
-		/** Standard constructor to open an existing or create a new log file.
+		/** Standard constructor to open an existing or create a new log file.  With
+		 *  read_only set, the file must already exist, and is never written to, extended
+		 *  or cleared.
 		 */
 		LogFile(twine FileName, int max_size, int max_entries,
 			int string_table_size, int max_strings, bool reuse,
-			bool clear_at_startup);
+			bool clear_at_startup, bool memory_mapped = false, bool read_only = false);
 
 		/** Standard destructor */
 		virtual ~LogFile();
@@ -272,6 +313,25 @@ class DLLEXPORT LogFile {
 		 */
 		void close();
 
+		/** Re-reads the index and string table so that we see messages written to the file
+		 * by someone else since we opened it.  In memory mapped mode this reads straight
+		 * from the mapping, without any system calls unless the file has grown past what
+		 * a read only reader has mapped.
+		 */
+		void refresh();
+
+		/** Returns the id of the newest message in the file as it is right now, reading only
+		 * the index header and one index entry rather than everything that refresh() reads.
+		 * In memory mapped mode this is just a couple of memory reads, so a reader can call
+		 * it often and only refresh() when it changes.
+		 */
+		int peekNewestMessageID();
+
+		/** Ensures everything we have written has been handed to the disk.  In memory
+		 * mapped mode this syncs the mapping, which otherwise happens in batches.
+		 */
+		void sync();
+
 		/**
 		 * This adds a string to our string table and returns the entry.
 		 * 
@@ -327,9 +387,23 @@ class DLLEXPORT LogFile {
 		/** Reads a twine from the current position of our log file stream */
 		twine readTwine(size_t length);
 
+		/** Writes raw bytes out to the current position of our log file stream */
+		void write(const void* data, size_t length);
+
 		/** Seek's in our log file to the position referenced as an offset from the start of the file */
 		void seek(long offsetFromStart);
 
+		/** Called after each message is written - flushes stdio, or syncs the mapping in batches */
+		void flushMsg();
+
+		/** Maps our open log file into memory, extending it to m_max_size if required.  A
+		 *  read only reader maps the file as it is, without extending it.
+		 */
+		void mapFile();
+
+		/** Syncs and removes our memory mapped view of the log file */
+		void unmapFile();
+
 		/** Clear's our indexes vector */
 		void clearIndexes();
 
@@ -23,10 +23,73 @@
 #include "XmlHelpers.h"
 #include "EnEx.h"
 #include "twine.h"
-#include "ZipFile.h"
 #include "File.h"
+#include "Tools.h"
+#include "Lock.h"
+#include "MemBuf.h"
+
+#include <chrono>
 using namespace SLib;
 
+/// We check the actual file size after roughly this fraction of m_maxFileSize has been written.
+#define LOGFILE2_SIZE_CHECK_DIVISOR 50
+
+/// If the cache grows to this many multiples of m_cacheSize, writers flush directly.
+#define LOGFILE2_CACHE_BACKLOG_FACTOR 10
+
+/// Estimated per-row overhead in the database in addition to the text column lengths.
+#define LOGFILE2_ROW_OVERHEAD 48
+
+static uint64_t logfile2_now_ms()
+{
+	return (uint64_t)std::chrono::duration_cast<std::chrono::milliseconds>(
+		std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+/** The field comparisons we allow.  Only these strings ever go into the sql, whatever is in a
+  * LogFieldMatch.  Returns NULL if op isn't one of them.
+  */
+static const char* logfile2_field_op(const twine& op)
+{
+	static const char* ops[] = { "=", "!=", "<", "<=", ">", ">=" };
+	for(size_t i = 0; i < sizeof(ops) / sizeof(ops[0]); i++){
+		if(op == ops[i]){
+			return ops[i];
+		}
+	}
+	return NULL;
+}
+
+LogFilter::LogFilter()
+{
+	afterId = 0;
+	channelMask = LOGFILTER_ALL_CHANNELS;
+	tid = 0;
+	startTime = 0;
+	endTime = 0;
+}
+
+void LogFilter::addField(const twine& name, const twine& op, const twine& value)
+{
+	if(logfile2_field_op( op ) == NULL){
+		throw AnException(0, FL, "Invalid field comparison: %s", op() );
+	}
+	LogFieldMatch m;
+	m.name = name;
+	m.op = op;
+	m.value = value;
+	fields.push_back( m );
+}
+
+LogFieldStats::LogFieldStats()
+{
+	count = 0;
+	min = 0;
+	max = 0;
+	sum = 0;
+	avg = 0.0;
+}
+
 LogFile2::LogFile2(const twine& logFileName, size_t maxFileSize)
 {
 	//printf("LogFile2::LogFile2(const twine& logFileName, size_t maxFileSize)\n");
@@ -40,9 +103,29 @@ LogFile2::LogFile2(const twine& logFileName, size_t maxFileSize)
 	m_stmt_begintran = NULL;
 	m_stmt_committran = NULL;
 	m_stmt_rollbacktran = NULL;
+	m_stmt_pagecount = NULL;
+	m_pageSize = 0;
+	m_bytesSinceCheck = 0;
+	m_walMode = false;
+	m_syncNormal = false;
+	m_useIndexes = false;
+	m_useTextIndex = false;
+	m_hasTextIndex = false;
+	m_hasFields = false;
+	m_schemaVersion = 0;
 	m_mutex = new Mutex();
+	m_cacheMutex = new Mutex();
+#ifndef _WIN32
+	pthread_cond_init( &m_flushCond, NULL );
+#endif
+	m_flushThread = NULL;
+	m_flushThreadStop = false;
 	m_cacheSize = 100;
 	m_cacheTime = 100;
+	m_cacheStart = 0;
+	m_lostMessages = 0;
+	m_rotator = new LogRotator( m_logFileName );
+	m_rotatedSeq = 0;
 
 	try {
 		Setup();
@@ -51,6 +134,8 @@ LogFile2::LogFile2(const twine& logFileName, size_t maxFileSize)
 		//printf("createNewFile\n");
 		createNewFile(); // try to get it out of the way so we can create it from scratch.
 	}
+
+	startFlushThread();
 }
 
 LogFile2::LogFile2(bool readOnly, const twine& logFileName)
@@ -66,9 +151,29 @@ LogFile2::LogFile2(bool readOnly, const twine& logFileName)
 	m_stmt_begintran = NULL;
 	m_stmt_committran = NULL;
 	m_stmt_rollbacktran = NULL;
+	m_stmt_pagecount = NULL;
+	m_pageSize = 0;
+	m_bytesSinceCheck = 0;
+	m_walMode = false;
+	m_syncNormal = false;
+	m_useIndexes = false;
+	m_useTextIndex = false;
+	m_hasTextIndex = false;
+	m_hasFields = false;
+	m_schemaVersion = 0;
 	m_mutex = new Mutex();
+	m_cacheMutex = new Mutex();
+#ifndef _WIN32
+	pthread_cond_init( &m_flushCond, NULL );
+#endif
+	m_flushThread = NULL;
+	m_flushThreadStop = false;
 	m_cacheSize = 100;
 	m_cacheTime = 100;
+	m_cacheStart = 0;
+	m_lostMessages = 0;
+	m_rotator = NULL;
+	m_rotatedSeq = 0;
 
 	Setup(); // any exception trying to open the file is passed back in read-only mode.
 }
@@ -76,6 +181,8 @@ LogFile2::LogFile2(bool readOnly, const twine& logFileName)
 LogFile2::~LogFile2()
 {
 	//printf("LogFile2::~LogFile2()\n");
+	stopFlushThread();
+
 	{ // used for mutex scope
 		Lock theLock(m_mutex);
 
@@ -97,6 +204,10 @@ LogFile2::~LogFile2()
 		if(m_stmt_rollbacktran != NULL){
 			sqlite3_finalize( m_stmt_rollbacktran );
 		}
+		if(m_stmt_pagecount != NULL){
+			sqlite3_finalize( m_stmt_pagecount );
+		}
+		clearQueryCache();
 		if(m_db != NULL){
 			sqlite3_close(m_db);
 		}
@@ -104,6 +215,13 @@ LogFile2::~LogFile2()
 	} // mutex unlocked here
 
 	delete m_mutex;
+	delete m_cacheMutex;
+#ifndef _WIN32
+	pthread_cond_destroy( &m_flushCond );
+#endif
+
+	// This waits for any rotated files that are still being compressed.
+	delete m_rotator;
 
 	// that's it.
 }
@@ -111,6 +229,8 @@ LogFile2::~LogFile2()
 void LogFile2::close()
 {
 	//printf("LogFile2::close()\n");
+	stopFlushThread();
+
 	Lock theLock(m_mutex);
 
 	flushInternal(); // anything left in the cache goes to the disk
@@ -136,6 +256,11 @@ void LogFile2::close()
 		sqlite3_finalize( m_stmt_rollbacktran );
 		m_stmt_rollbacktran = NULL;
 	}
+	if(m_stmt_pagecount != NULL){
+		sqlite3_finalize( m_stmt_pagecount );
+		m_stmt_pagecount = NULL;
+	}
+	clearQueryCache();
 	if(m_db != NULL){
 		sqlite3_close(m_db);
 		m_db = NULL;
@@ -189,7 +314,8 @@ void LogFile2::Setup(void)
 			"appName varchar(10), "
 			"machineName varchar(10), "
 			"appSession varchar(10), "
-			"msg varchar(10) "
+			"msg varchar(10), "
+			"fields blob "
 			");"
 		);
 		check_err( "prepare - create log table",
@@ -202,6 +328,171 @@ void LogFile2::Setup(void)
 		sqlite3_finalize( m_stmt );
 		m_stmt = NULL;
 	}
+
+	registerFunctions();
+	checkSchema();
+	if(!m_readOnly){
+		applyPragmas();
+		applyIndexes();
+	}
+	m_pageSize = 0;
+	m_bytesSinceCheck = 0;
+}
+
+void LogFile2::applyPragmas()
+{
+	if(m_db == NULL){
+		return;
+	}
+
+	// Both of these pragmas return a row, so let sqlite3_exec step through everything.  We only
+	// touch the settings that have been turned on, so files are opened exactly as before otherwise.
+	if(m_walMode){
+		twine sql = "pragma journal_mode=WAL;";
+		check_err( sql, sqlite3_exec( m_db, sql(), NULL, NULL, NULL ) );
+	}
+	if(m_syncNormal){
+		twine sql = "pragma synchronous=NORMAL;";
+		check_err( sql, sqlite3_exec( m_db, sql(), NULL, NULL, NULL ) );
+	}
+}
+
+bool LogFile2::objectExists(const twine& type, const twine& name)
+{
+	sqlite3_stmt* stmt = getCachedStmt( "select count(1) from sqlite_master where type = ? and name = ?;" );
+	sqlite3_reset( stmt );
+	check_err( "bind type", sqlite3_bind_text( stmt, 1, type(), (int)type.length(), SQLITE_STATIC ) );
+	check_err( "bind name", sqlite3_bind_text( stmt, 2, name(), (int)name.length(), SQLITE_STATIC ) );
+	check_err( "objectExists", sqlite3_step( stmt ) );
+	int count = sqlite3_column_int( stmt, 0 );
+	sqlite3_reset( stmt );
+	return count > 0;
+}
+
+void LogFile2::checkSchema()
+{
+	if(objectExists( "table", "logschema" )){
+		sqlite3_stmt* stmt = getCachedStmt( "select max(version) from logschema;" );
+		sqlite3_reset( stmt );
+		check_err( "read schema version", sqlite3_step( stmt ) );
+		m_schemaVersion = sqlite3_column_int( stmt, 0 );
+		sqlite3_reset( stmt );
+	} else {
+		// Either a brand new file, whose logtable we have just created in the current layout,
+		// or one written before we kept a schema version, which is version 1.  Treat both as
+		// version 1 and let the upgrade below work out what is missing.
+		m_schemaVersion = 1;
+	}
+
+	m_hasFields = columnExists( "logtable", "fields" );
+	if(!m_readOnly && m_schemaVersion < LOGFILE2_SCHEMA_VERSION){
+		// Bring the file up to date before we stamp the new version on it, all in one transaction
+		// so that a failure part way through leaves the file as it was.  Older files don't have
+		// anywhere to put the structured fields.  Existing rows just have no fields.
+		twine sql = "begin transaction; ";
+		if(!objectExists( "table", "logschema" )){
+			sql.append( "create table logschema ( version int ); " );
+		}
+		if(!m_hasFields){
+			sql.append( "alter table logtable add column fields blob; " );
+		}
+		twine stamp; stamp.format( "insert into logschema ( version ) values ( %d ); ", LOGFILE2_SCHEMA_VERSION );
+		sql.append( stamp );
+		sql.append( "commit transaction;" );
+		char* errmsg = NULL;
+		if(sqlite3_exec( m_db, sql(), NULL, NULL, &errmsg ) != SQLITE_OK){
+			twine err = errmsg == NULL ? sqlite3_errmsg( m_db ) : errmsg;
+			sqlite3_free( errmsg );
+			sqlite3_exec( m_db, "rollback transaction;", NULL, NULL, NULL );
+			throw AnException(0, FL, "Error upgrading %s from schema version %d: %s",
+				m_logFileName(), m_schemaVersion, err() );
+		}
+		m_hasFields = true;
+		m_schemaVersion = LOGFILE2_SCHEMA_VERSION;
+	}
+
+	m_hasTextIndex = objectExists( "table", "logtext" );
+}
+
+bool LogFile2::columnExists(const twine& table, const twine& column)
+{
+	// pragma statements can't take bound parameters, and their results depend on the schema,
+	// so this one isn't cached.
+	twine sql = "pragma table_info(" + table + ");";
+	sqlite3_stmt* stmt = NULL;
+	check_err( sql, sqlite3_prepare_v2( m_db, sql(), (int)sql.length(), &stmt, NULL ) );
+	bool found = false;
+	while(sqlite3_step( stmt ) == SQLITE_ROW){
+		const char* name = (const char*)sqlite3_column_text( stmt, 1 );
+		if(name != NULL && column == name){
+			found = true;
+			break;
+		}
+	}
+	sqlite3_finalize( stmt );
+	return found;
+}
+
+/// The logfield( fields, name ) sql function - returns the named field as an integer or text.
+static void logfile2_logfield(sqlite3_context* ctx, int argc, sqlite3_value** argv)
+{
+	const char* data = (const char*)sqlite3_value_blob( argv[0] );
+	size_t len = (size_t)sqlite3_value_bytes( argv[0] );
+	const char* name = (const char*)sqlite3_value_text( argv[1] );
+	LogField field;
+	if(data == NULL || name == NULL || !LogMsg::FindEncodedField( data, len, name, field )){
+		sqlite3_result_null( ctx );
+	} else if(field.isInt){
+		sqlite3_result_int64( ctx, field.intValue );
+	} else {
+		sqlite3_result_text( ctx, field.text(), (int)field.text.length(), SQLITE_TRANSIENT );
+	}
+}
+
+void LogFile2::registerFunctions()
+{
+	check_err( "register logfield",
+		sqlite3_create_function( m_db, "logfield", 2, SQLITE_UTF8, NULL, logfile2_logfield, NULL, NULL )
+	);
+}
+
+twine LogFile2::selectColumns()
+{
+	twine ret = "id, file, line, tid, timestamp_a, timestamp_b, channel, appName, machineName, appSession, msg";
+	if(m_hasFields){
+		ret.append( ", fields" );
+	}
+	return ret;
+}
+
+void LogFile2::applyIndexes()
+{
+	if(m_db == NULL){
+		return;
+	}
+
+	if(m_useIndexes){
+		twine sql =
+			"create index if not exists logtable_channel_ts on logtable ( channel, timestamp_a ); "
+			"create index if not exists logtable_tid on logtable ( tid ); "
+			"create index if not exists logtable_appsession on logtable ( appSession ); "
+		;
+		check_err( "create logtable indexes", sqlite3_exec( m_db, sql(), NULL, NULL, NULL ) );
+	}
+
+	if(m_useTextIndex && !m_hasTextIndex){
+		// The text index shares its content with logtable so we don't store the messages twice.
+		// The rebuild picks up anything that was already in the file.
+		twine sql =
+			"create virtual table logtext using fts4 ( content=\"logtable\", msg ); "
+			"create trigger logtext_insert after insert on logtable begin "
+			"  insert into logtext ( docid, msg ) values ( new.id, new.msg ); "
+			"end; "
+			"insert into logtext ( logtext ) values ( 'rebuild' ); "
+		;
+		check_err( "create logtext", sqlite3_exec( m_db, sql(), NULL, NULL, NULL ) );
+		m_hasTextIndex = true;
+	}
 }
 
 int LogFile2::check_err(const twine& doingWhat, int rc)
@@ -222,15 +513,19 @@ int LogFile2::check_err(const twine& doingWhat, int rc)
 	throw AnException(0, FL, "Sqlite3 Error doing: %s: %s", doingWhat(), sqlite3_errmsg( m_db ) );
 }
 
-void LogFile2::flush()
+bool LogFile2::flush()
 {
 	Lock theLock(m_mutex);
 	flushInternal();
+	bool ok = m_lostMessages == 0;
+	m_lostMessages = 0;
+	return ok;
 }
 
 void LogFile2::setCacheSize( size_t cacheSize )
 {
 	if(cacheSize >= 0 && cacheSize <= 10000){
+		Lock cacheLock(m_cacheMutex);
 		m_cacheSize = cacheSize;
 	} 
 }
@@ -238,24 +533,233 @@ void LogFile2::setCacheSize( size_t cacheSize )
 void LogFile2::setCacheTime( size_t cacheTime )
 {
 	if(cacheTime >= 0 && cacheTime <= 1000){
+		Lock cacheLock(m_cacheMutex);
 		m_cacheTime = cacheTime;
 	}
 }
 
-void LogFile2::flushInternal()
+void LogFile2::setWALMode( bool onoff )
 {
-	if(m_cache.size() != 0 && m_db != NULL){
+	if(m_readOnly){
+		throw AnException(0, FL, "setWALMode is not allowed in readonly mode.");
+	}
+	Lock theLock(m_mutex);
+	flushInternal();
+	m_walMode = onoff;
+	if(m_walMode){
+		applyPragmas();
+	} else if(m_db != NULL){
+		twine sql = "pragma journal_mode=DELETE;";
+		check_err( sql, sqlite3_exec( m_db, sql(), NULL, NULL, NULL ) );
+	}
+}
+
+void LogFile2::setSyncNormal( bool onoff )
+{
+	if(m_readOnly){
+		throw AnException(0, FL, "setSyncNormal is not allowed in readonly mode.");
+	}
+	Lock theLock(m_mutex);
+	m_syncNormal = onoff;
+	if(m_syncNormal){
+		applyPragmas();
+	} else if(m_db != NULL){
+		twine sql = "pragma synchronous=FULL;";
+		check_err( sql, sqlite3_exec( m_db, sql(), NULL, NULL, NULL ) );
+	}
+}
+
+void LogFile2::setIndexes( bool onoff )
+{
+	if(m_readOnly){
+		throw AnException(0, FL, "setIndexes is not allowed in readonly mode.");
+	}
+	Lock theLock(m_mutex);
+	m_useIndexes = onoff;
+	if(m_useIndexes){
+		applyIndexes();
+	} else if(m_db != NULL){
+		twine sql =
+			"drop index if exists logtable_channel_ts; "
+			"drop index if exists logtable_tid; "
+			"drop index if exists logtable_appsession; "
+		;
+		clearQueryCache();
+		check_err( "drop logtable indexes", sqlite3_exec( m_db, sql(), NULL, NULL, NULL ) );
+	}
+}
+
+void LogFile2::setTextIndex( bool onoff )
+{
+	if(m_readOnly){
+		throw AnException(0, FL, "setTextIndex is not allowed in readonly mode.");
+	}
+	Lock theLock(m_mutex);
+	flushInternal();
+	m_useTextIndex = onoff;
+	if(m_useTextIndex){
+		applyIndexes();
+	} else if(m_db != NULL && m_hasTextIndex){
+		twine sql =
+			"drop trigger if exists logtext_insert; "
+			"drop table if exists logtext; "
+		;
+		clearQueryCache();
+		check_err( "drop logtext", sqlite3_exec( m_db, sql(), NULL, NULL, NULL ) );
+		m_hasTextIndex = false;
+	}
+}
+
+bool LogFile2::hasTextIndex()
+{
+	Lock theLock(m_mutex);
+	return m_hasTextIndex;
+}
+
+int LogFile2::getSchemaVersion()
+{
+	Lock theLock(m_mutex);
+	return m_schemaVersion;
+}
+
+sqlite3_stmt* LogFile2::getCachedStmt(const twine& sql)
+{
+	map<twine, sqlite3_stmt*>::iterator it = m_queryCache.find( sql );
+	if(it != m_queryCache.end()){
+		return it->second;
+	}
+
+	// Use the _v2 interface so that sqlite re-prepares these for us if the schema changes.
+	sqlite3_stmt* stmt = NULL;
+	check_err( sql, sqlite3_prepare_v2( m_db, sql(), (int)sql.length(), &stmt, NULL) );
+	m_queryCache[ sql ] = stmt;
+	return stmt;
+}
+
+void LogFile2::clearQueryCache()
+{
+	map<twine, sqlite3_stmt*>::iterator it;
+	for(it = m_queryCache.begin(); it != m_queryCache.end(); it++){
+		sqlite3_finalize( it->second );
+	}
+	m_queryCache.clear();
+}
+
+void LogFile2::startFlushThread()
+{
+	m_flushThreadStop = false;
+	m_flushThread = new Thread();
+	try {
+		m_flushThread->start( LogFile2::flushThreadStart, this );
+	} catch (AnException& e){
+		// Without the thread we fall back to flushing on the writer threads.
+		printf("Error starting LogFile2 flush thread: %s\n", e.Msg() );
+		delete m_flushThread;
+		m_flushThread = NULL;
+	}
+}
+
+void LogFile2::stopFlushThread()
+{
+	// Writers check m_flushThread under m_cacheMutex, so it is cleared under it too.  From
+	// then on they flush for themselves.
+	Thread* flushThread;
+	m_cacheMutex->lock();
+	flushThread = m_flushThread;
+	m_flushThread = NULL;
+	m_flushThreadStop = true;
+#ifndef _WIN32
+	pthread_cond_signal( &m_flushCond );
+#endif
+	m_cacheMutex->unlock();
+
+	if(flushThread == NULL){
+		return;
+	}
+	flushThread->join();
+	delete flushThread;
+}
+
+void* LogFile2::flushThreadStart(void* arg)
+{
+	((LogFile2*)arg)->flushThreadLoop();
+	return NULL;
+}
+
+void LogFile2::flushThreadLoop()
+{
+	m_cacheMutex->lock();
+	while(!m_flushThreadStop){
+		// Figure out how long we can sleep before the oldest cached message is due.  Writers
+		// signal us when the cache stops being empty, but never sleep longer than a cache time
+		// in case that signal is missed.
+		uint64_t waitMs = m_cacheTime;
+		if(m_cache.size() != 0){
+			uint64_t age = logfile2_now_ms() - m_cacheStart;
+			waitMs = (age >= m_cacheTime) ? 0 : (m_cacheTime - age);
+		}
+
+		bool due = m_cache.size() != 0 && (waitMs == 0 || m_cache.size() >= m_cacheSize);
+		if(!due){
+#ifdef _WIN32
+			m_cacheMutex->unlock();
+			Tools::msleep( (int)(waitMs > 10 ? 10 : waitMs) );
+			m_cacheMutex->lock();
+#else
+			struct timespec abs_time;
+			clock_gettime( CLOCK_REALTIME, &abs_time );
+			abs_time.tv_sec += (time_t)(waitMs / 1000);
+			abs_time.tv_nsec += (long)( waitMs % 1000 ) * 1000000;
+			if(abs_time.tv_nsec >= 1000000000){
+				abs_time.tv_sec ++;
+				abs_time.tv_nsec -= 1000000000;
+			}
+			pthread_cond_timedwait( &m_flushCond, m_cacheMutex->internalMutex(), &abs_time );
+#endif
+			continue; // re-evaluate everything after waking up
+		}
+
+		// The cache is either full or old enough to be written.  m_mutex has to be taken
+		// before the cache mutex, so let go of the cache while we flush.
+		m_cacheMutex->unlock();
 		try {
-			begin_transaction();
-		} catch(AnException&){
-			// If we hit an error beginning the transaction - there is probably something else
-			// outstanding that was not committed properly.  Roll it back, and start the new one.
-			rollback_transaction();
-			begin_transaction();
+			Lock theLock(m_mutex);
+			flushInternal();
+		} catch (AnException& e){
+			printf("Error flushing log messages to database: %s\n", e.Msg() );
 		}
+		m_cacheMutex->lock();
+	}
+	m_cacheMutex->unlock();
+}
+
+void LogFile2::flushInternal()
+{
+	if(m_db == NULL){
+		return;
+	}
+
+	// Take everything out of the cache so that writers are not blocked while we hit the disk.
+	{ // used for mutex scope
+		Lock cacheLock(m_cacheMutex);
+		m_flushBatch.swap( m_cache );
+	}
+
+	if(m_flushBatch.size() != 0){
 		try {
-			for(size_t i = 0; i < m_cache.size(); i++){
-				writeOneMsg( m_cache[i] );
+			try {
+				begin_transaction();
+			} catch(AnException&){
+				// If we hit an error beginning the transaction - there is probably something else
+				// outstanding that was not committed properly.  Roll it back, and start the new one.
+				rollback_transaction();
+				begin_transaction();
+			}
+			for(size_t i = 0; i < m_flushBatch.size(); i++){
+				LogMsg& lm = m_flushBatch[i];
+				writeOneMsg( lm );
+				m_bytesSinceCheck += LOGFILE2_ROW_OVERHEAD + lm.file.length() + lm.appName.length() +
+					lm.machineName.length() + lm.appSession.length() + lm.msg.length();
 			}
 			bool commitSuccess = false;
 			int commitTries = 0;
@@ -287,43 +791,52 @@ void LogFile2::flushInternal()
 			}
 		} catch (AnException& e){
 			// If we hit an error during the insert, we have little choice but to say something
-			// about it with printf and then rollback the transaction.
-			printf("Error writing (%d) messages to database: %s\n", (int)m_cache.size(), e.Msg() );
-			rollback_transaction();
+			// about it with printf and then rollback the transaction.  flush() reports the loss
+			// to its caller.
+			printf("Error writing (%d) messages to database: %s\n", (int)m_flushBatch.size(), e.Msg() );
+			m_lostMessages += m_flushBatch.size();
+			try {
+				rollback_transaction();
+			} catch (AnException&){
+				// There may be no transaction to roll back if we failed to begin one.
+			}
+		}
+		m_flushBatch.clear();
+
+		// Only look at the real file size once we have written enough to possibly matter.
+		if(m_bytesSinceCheck >= m_maxFileSize / LOGFILE2_SIZE_CHECK_DIVISOR){
+			m_bytesSinceCheck = 0;
+			CheckSize();
 		}
-		m_cache.clear();
-		CheckSize();
 	}
 }
 
-void LogFile2::checkFlushCache()
+bool LogFile2::checkFlushCache(bool wasEmpty)
 {
-	if(m_cache.size() >= m_cacheSize){ // Is the cache large enough to be written?
-		flushInternal();
-	} else {
-		if(m_cache.size() > 1) { // more than one message
-			// Check the time difference between the newest and oldest messages in the cache
-			LogMsg& lm1 = m_cache[ m_cache.size() - 1 ]; // most recent log message.
-			LogMsg& lm2 = m_cache[ 0 ];                  // oldest log message.
-#ifdef _WIN32
-			if(lm1.timestamp.time > lm2.timestamp.time){
-				// If the seconds are greater at all, then flush the cache.
-				flushInternal();
-			} else if(lm1.timestamp.millitm >= (lm2.timestamp.millitm + m_cacheTime)){
-				// seconds are the same, but milliseconds have elapsed more than m_cacheTime
-				flushInternal();
-			}
-#else
-			if(lm1.timestamp.tv_sec > lm2.timestamp.tv_sec){
-				// If the seconds are greater at all, then flush the cache.
-				flushInternal();
-			} else if(lm1.timestamp.tv_usec >= (lm2.timestamp.tv_usec + (m_cacheTime * 1000) )){
-				// seconds are the same, but milliseconds have elapsed more than m_cacheTime
-				flushInternal();
-			}
+	if(m_flushThread != NULL){
+		if(m_cache.size() >= m_cacheSize * LOGFILE2_CACHE_BACKLOG_FACTOR){
+			// The flush thread can't keep up - make the writer do some of the work.
+			return true;
+		}
+		if(wasEmpty || m_cache.size() >= m_cacheSize){
+			// Either the cache is full, or the flush thread needs to start timing the
+			// oldest message.
+#ifndef _WIN32
+			pthread_cond_signal( &m_flushCond );
 #endif
 		}
+		// Time based flushing is handled by the flush thread.
+		return false;
+	}
+
+	if(m_cache.size() >= m_cacheSize){ // Is the cache large enough to be written?
+		return true;
 	}
+	if(m_cache.size() > 1 && (logfile2_now_ms() - m_cacheStart) >= m_cacheTime){
+		// The oldest message has been waiting longer than m_cacheTime
+		return true;
+	}
+	return false;
 }
 
 void LogFile2::writeMsg(LogMsg& msg)
@@ -332,11 +845,21 @@ void LogFile2::writeMsg(LogMsg& msg)
 	if(m_readOnly){
 		throw AnException(0, FL, "writeMsg is not allowed in readonly mode.");
 	}
-	Lock theLock(m_mutex);
+	bool flushNow = false;
+	{ // used for mutex scope
+		Lock cacheLock(m_cacheMutex);
+		bool wasEmpty = m_cache.size() == 0;
+		if(wasEmpty){
+			m_cacheStart = logfile2_now_ms();
+		}
+		m_cache.push_back( msg );
+		flushNow = checkFlushCache( wasEmpty );
+	}
 
-	LogMsg msgCopy( msg );
-	m_cache.push_back( msgCopy );
-	checkFlushCache();
+	if(flushNow){
+		Lock theLock(m_mutex);
+		flushInternal();
+	}
 }
 
 void LogFile2::writeMsg(vector<LogMsg*>* messages)
@@ -345,14 +868,23 @@ void LogFile2::writeMsg(vector<LogMsg*>* messages)
 	if(m_readOnly){
 		throw AnException(0, FL, "writeMsg is not allowed in readonly mode.");
 	}
-	Lock theLock(m_mutex);
-
-	for(size_t i = 0; i < messages->size(); i++){
-		LogMsg msgCopy( *messages->at( i ) );
-		m_cache.push_back( msgCopy );
+	bool flushNow = false;
+	{ // used for mutex scope
+		Lock cacheLock(m_cacheMutex);
+		bool wasEmpty = m_cache.size() == 0;
+		if(wasEmpty){
+			m_cacheStart = logfile2_now_ms();
+		}
+		for(size_t i = 0; i < messages->size(); i++){
+			m_cache.push_back( *messages->at( i ) );
+		}
+		flushNow = checkFlushCache( wasEmpty && m_cache.size() != 0 );
 	}
 
-	checkFlushCache();
+	if(flushNow){
+		Lock theLock(m_mutex);
+		flushInternal();
+	}
 }
 
 void LogFile2::writeOneMsg(LogMsg& msg)
@@ -365,9 +897,9 @@ void LogFile2::writeOneMsg(LogMsg& msg)
 	if(m_insert_stmt == NULL){
 		twine sql = 
 			"insert into logtable (file, line, tid, timestamp_a, timestamp_b, channel, "
-			" appName, machineName, appSession, msg ) "
+			" appName, machineName, appSession, msg, fields ) "
 			" values ( ?, ?, ?, ?, ?, ?, "
-			" ?, ?, ?, ? ) "
+			" ?, ?, ?, ?, ? ) "
 		;
 		check_err( "prepare insert",
 			sqlite3_prepare( m_db, sql(), (int)sql.length(), &m_insert_stmt, NULL)
@@ -415,6 +947,15 @@ void LogFile2::writeOneMsg(LogMsg& msg)
 	check_err( "bind parm 10",
 		sqlite3_bind_text(m_insert_stmt, 10, msg.msg(), (int)msg.msg.length(), SQLITE_STATIC)
 	);
+	MemBuf fields;
+	if(msg.fields.size() == 0){
+		check_err( "bind parm 11", sqlite3_bind_null(m_insert_stmt, 11) );
+	} else {
+		msg.EncodeFields( fields );
+		check_err( "bind parm 11",
+			sqlite3_bind_blob(m_insert_stmt, 11, fields.data(), (int)fields.size(), SQLITE_STATIC)
+		);
+	}
 
 	// Run the insert.
 	check_err( "exec insert", sqlite3_step( m_insert_stmt ));
@@ -482,34 +1023,43 @@ void LogFile2::rollback_transaction()
 
 void LogFile2::CheckSize()
 {
-	//printf("LogFile2::messageCount()\n");
-	
-	size_t page_size = 0, page_count = 0;
-	sqlite3_stmt* stmt;
-	try {
-		twine sql = "pragma page_size;";
-		check_err( sql, sqlite3_prepare( m_db, sql(), (int)sql.length(), &stmt, NULL));
-		check_err( sql, sqlite3_step( stmt ));
-		page_size = sqlite3_column_int( stmt, 0 );
-		sqlite3_finalize(stmt);
-
-		sql = "pragma page_count;";
-		check_err( sql, sqlite3_prepare( m_db, sql(), (int)sql.length(), &stmt, NULL));
-		check_err( sql, sqlite3_step( stmt ));
-		page_count = sqlite3_column_int( stmt, 0 );
-		sqlite3_finalize(stmt);
+	//printf("LogFile2::CheckSize()\n");
 
-		size_t total_size = page_size * page_count;
-		if(total_size > m_maxFileSize){
-			createNewFile();
+	if(m_pageSize == 0){
+		// The page size is fixed for the life of the file, so we only need to ask once.
+		sqlite3_stmt* stmt = NULL;
+		try {
+			twine sql = "pragma page_size;";
+			check_err( sql, sqlite3_prepare( m_db, sql(), (int)sql.length(), &stmt, NULL));
+			check_err( sql, sqlite3_step( stmt ));
+			m_pageSize = sqlite3_column_int( stmt, 0 );
+			sqlite3_finalize(stmt);
+		} catch (AnException& e){
+			if(stmt != NULL){
+				sqlite3_finalize( stmt );
+				stmt = NULL;
+			}
+			throw e;
 		}
+	}
 
-	} catch (AnException& e){
-		if(stmt != NULL){
-			sqlite3_finalize( stmt );
-			stmt = NULL;
-		}
-		throw e;
+	if(m_stmt_pagecount == NULL){
+		// Pragma statements are expired by sqlite after each write transaction.  Use the _v2
+		// interface here so that sqlite re-prepares it for us rather than returning SQLITE_SCHEMA.
+		twine sql = "pragma page_count;";
+		check_err( sql,
+			sqlite3_prepare_v2( m_db, sql(), (int)sql.length(), &m_stmt_pagecount, NULL)
+		);
+	} else {
+		sqlite3_reset( m_stmt_pagecount );
+	}
+	check_err( "pragma page_count;", sqlite3_step( m_stmt_pagecount ));
+	size_t page_count = sqlite3_column_int( m_stmt_pagecount, 0 );
+	sqlite3_reset( m_stmt_pagecount );
+
+	size_t total_size = m_pageSize * page_count;
+	if(total_size > m_maxFileSize){
+		createNewFile();
 	}
 }
 
@@ -570,10 +1120,9 @@ LogMsg* LogFile2::getMessage(int id)
 	sqlite3_stmt* stmt;
 	try {
 		twine sql; sql.format(
-			"select id, file, line, tid, timestamp_a, timestamp_b, channel, "
-			"       appName, machineName, appSession, msg "
+			"select %s "
 			"from logtable "
-			"where id = %d;", id);
+			"where id = %d;", selectColumns()(), id);
 		check_err( sql,
 			sqlite3_prepare( m_db, sql(), (int)sql.length(), &stmt, NULL)
 		);
@@ -585,35 +1134,14 @@ LogMsg* LogFile2::getMessage(int id)
 		} else {
 			// Ensure we have a sane list of columns:
 			int colCount = sqlite3_column_count(stmt);
-			if(colCount != 11){
+			if(colCount < 11){
 				WARN(FL, "We don't understand the layout of logtable table in the current log file.");
 				sqlite3_finalize( stmt );
 				return NULL;
 			}
 
 			// Pick up all of the columns:
-			dptr<LogMsg> ret = new LogMsg();
-			ret->id = sqlite3_column_int( stmt, 0 );
-			ret->file.set( 
-				(const char*)sqlite3_column_text(stmt, 1), (size_t)sqlite3_column_bytes(stmt, 1) );
-			ret->line = sqlite3_column_int( stmt, 2 );
-			ret->tid = sqlite3_column_int( stmt, 3 );
-#ifdef _WIN32
-			ret->timestamp.time = sqlite3_column_int( stmt, 4 );
-			ret->timestamp.millitm = (unsigned short)sqlite3_column_int( stmt, 5 );
-#else
-			ret->timestamp.tv_sec = sqlite3_column_int( stmt, 4 );
-			ret->timestamp.tv_usec = sqlite3_column_int( stmt, 5 );
-#endif
-			ret->channel = sqlite3_column_int( stmt, 6 );
-			ret->appName.set( 
-				(const char*)sqlite3_column_text(stmt, 7), (size_t)sqlite3_column_bytes(stmt, 7) );
-			ret->machineName.set( 
-				(const char*)sqlite3_column_text(stmt, 8), (size_t)sqlite3_column_bytes(stmt, 8) );
-			ret->appSession.set( 
-				(const char*)sqlite3_column_text(stmt, 9), (size_t)sqlite3_column_bytes(stmt, 9) );
-			ret->msg.set( 
-				(const char*)sqlite3_column_text(stmt, 10), (size_t)sqlite3_column_bytes(stmt, 10) );
+			dptr<LogMsg> ret = readMsgRow( stmt );
 
 			sqlite3_finalize( stmt );
 			return ret.release();
@@ -636,10 +1164,10 @@ vector<LogMsg*>* LogFile2::getMessages(const twine& whereClause, int limit, int
 	sqlite3_stmt* stmt;
 	try {
 		twine sql; sql.format(
-			"select id, file, line, tid, timestamp_a, timestamp_b, channel, appName, machineName, appSession, msg "
+			"select %s "
 			"from logtable "
 			" %s ",
-			whereClause()
+			selectColumns()(), whereClause()
 		);
 		if(limit != 0){
 			twine limitClause; limitClause.format(" limit %d offset %d ", limit, offset);
@@ -656,38 +1184,14 @@ vector<LogMsg*>* LogFile2::getMessages(const twine& whereClause, int limit, int
 		} else {
 			// Ensure we have a sane list of columns:
 			int colCount = sqlite3_column_count(stmt);
-			if(colCount != 11){
+			if(colCount < 11){
 				WARN(FL, "We don't understand the layout of logtable table in the current log file.");
 				sqlite3_finalize( stmt );
 				return ret;
 			}
 
 			while(rc != 0){
-				// Pick up all of the columns:
-				dptr<LogMsg> msg = new LogMsg();
-				msg->id = sqlite3_column_int( stmt, 0 );
-				msg->file.set( 
-					(const char*)sqlite3_column_text(stmt, 1), (size_t)sqlite3_column_bytes(stmt, 1) );
-				msg->line = sqlite3_column_int( stmt, 2 );
-				msg->tid = sqlite3_column_int( stmt, 3 );
-#ifdef _WIN32
-				msg->timestamp.time = sqlite3_column_int( stmt, 4 );
-				msg->timestamp.millitm = (unsigned short)sqlite3_column_int( stmt, 5 );
-#else
-				msg->timestamp.tv_sec = sqlite3_column_int( stmt, 4 );
-				msg->timestamp.tv_usec = sqlite3_column_int( stmt, 5 );
-#endif
-				msg->channel = sqlite3_column_int( stmt, 6 );
-				msg->appName.set( 
-					(const char*)sqlite3_column_text(stmt, 7), (size_t)sqlite3_column_bytes(stmt, 7) );
-				msg->machineName.set( 
-					(const char*)sqlite3_column_text(stmt, 8), (size_t)sqlite3_column_bytes(stmt, 8) );
-				msg->appSession.set( 
-					(const char*)sqlite3_column_text(stmt, 9), (size_t)sqlite3_column_bytes(stmt, 9) );
-				msg->msg.set( 
-					(const char*)sqlite3_column_text(stmt, 10), (size_t)sqlite3_column_bytes(stmt, 10) );
-
-				ret->push_back( msg.release() );
+				ret->push_back( readMsgRow( stmt ) );
 
 				// Fetch the next row:
 				rc = check_err( "getMessages-next", sqlite3_step ( stmt ) );
@@ -711,6 +1215,393 @@ vector<LogMsg*>* LogFile2::getMessages(const twine& whereClause, int limit, int
 	}
 }
 
+/// Turns a "contains" value into a like pattern - escaping anything that like would interpret.
+static twine logfile2_like_pattern(const twine& value)
+{
+	twine ret = "%";
+	for(size_t i = 0; i < value.length(); i++){
+		char c = value[i];
+		if(c == '%' || c == '_' || c == '\\'){
+			ret.append( "\\" );
+		}
+		ret.append( &c, 1 );
+	}
+	ret.append( "%" );
+	return ret;
+}
+
+/// Is the value a whole number, so that it should be compared as an integer?
+static bool logfile2_is_integer(const twine& value)
+{
+	size_t i = 0;
+	if(value.length() > 1 && value[0] == '-'){
+		i = 1;
+	}
+	if(i == value.length()){
+		return false;
+	}
+	for(; i < value.length(); i++){
+		if(value[i] < '0' || value[i] > '9'){
+			return false;
+		}
+	}
+	return true;
+}
+
+twine LogFile2::buildFilterWhere(const LogFilter& filter)
+{
+	vector<twine> conditions;
+
+	if(filter.afterId != 0){
+		conditions.push_back( "id > :afterId" );
+	}
+	if((filter.channelMask & LOGFILTER_ALL_CHANNELS) != LOGFILTER_ALL_CHANNELS){
+		// The channel numbers go directly into the sql.  There are few enough combinations
+		// that the statement cache still works well, and it lets sqlite use the channel index.
+		twine channels;
+		for(int i = 0; i < 7; i++){
+			if(filter.channelMask & (1 << i)){
+				twine tmp; tmp.format( "%s%d", channels.length() == 0 ? "" : ", ", i );
+				channels.append( tmp );
+			}
+		}
+		if(channels.length() == 0){
+			conditions.push_back( "0 = 1" );
+		} else {
+			conditions.push_back( "channel in ( " + channels + " )" );
+		}
+	}
+	if(filter.tid != 0){
+		conditions.push_back( "tid = :tid" );
+	}
+	if(filter.appName.length() != 0){
+		conditions.push_back( "appName like :appName escape '\\'" );
+	}
+	if(filter.machineName.length() != 0){
+		conditions.push_back( "machineName like :machineName escape '\\'" );
+	}
+	if(filter.appSession.length() != 0){
+		conditions.push_back( "appSession = :appSession" );
+	}
+	if(filter.msgText.length() != 0){
+		conditions.push_back( "msg like :msgText escape '\\'" );
+	}
+	if(filter.msgMatch.length() != 0){
+		if(!m_hasTextIndex){
+			throw AnException(0, FL, "Log file %s does not have a text index.", m_logFileName() );
+		}
+		conditions.push_back( "id in ( select docid from logtext where logtext match :msgMatch )" );
+	}
+	if(filter.startTime != 0){
+		conditions.push_back( "timestamp_a >= :startTime" );
+	}
+	if(filter.endTime != 0){
+		conditions.push_back( "timestamp_a <= :endTime" );
+	}
+	for(size_t i = 0; i < filter.fields.size(); i++){
+		if(!m_hasFields){
+			conditions.push_back( "0 = 1" ); // nothing in this file has fields
+			break;
+		}
+		// fields is public, so check the operator here rather than trusting addField.
+		const char* op = logfile2_field_op( filter.fields[i].op );
+		if(op == NULL){
+			throw AnException(0, FL, "Invalid field comparison: %s", filter.fields[i].op() );
+		}
+		twine tmp; tmp.format( "logfield( fields, :fn%d ) %s :fv%d", (int)i, op, (int)i );
+		conditions.push_back( tmp );
+	}
+
+	twine ret;
+	for(size_t i = 0; i < conditions.size(); i++){
+		ret.append( i == 0 ? " where " : " and " );
+		ret.append( conditions[i] );
+	}
+	return ret;
+}
+
+void LogFile2::bindFilter(sqlite3_stmt* stmt, const LogFilter& filter)
+{
+	int idx;
+	if((idx = sqlite3_bind_parameter_index( stmt, ":afterId" )) != 0){
+		check_err( "bind afterId", sqlite3_bind_int( stmt, idx, filter.afterId ) );
+	}
+	if((idx = sqlite3_bind_parameter_index( stmt, ":tid" )) != 0){
+		check_err( "bind tid", sqlite3_bind_int( stmt, idx, (int)filter.tid ) );
+	}
+	if((idx = sqlite3_bind_parameter_index( stmt, ":appName" )) != 0){
+		twine pattern = logfile2_like_pattern( filter.appName );
+		check_err( "bind appName",
+			sqlite3_bind_text( stmt, idx, pattern(), (int)pattern.length(), SQLITE_TRANSIENT ) );
+	}
+	if((idx = sqlite3_bind_parameter_index( stmt, ":machineName" )) != 0){
+		twine pattern = logfile2_like_pattern( filter.machineName );
+		check_err( "bind machineName",
+			sqlite3_bind_text( stmt, idx, pattern(), (int)pattern.length(), SQLITE_TRANSIENT ) );
+	}
+	if((idx = sqlite3_bind_parameter_index( stmt, ":appSession" )) != 0){
+		check_err( "bind appSession",
+			sqlite3_bind_text( stmt, idx, filter.appSession(), (int)filter.appSession.length(), SQLITE_TRANSIENT ) );
+	}
+	if((idx = sqlite3_bind_parameter_index( stmt, ":msgText" )) != 0){
+		twine pattern = logfile2_like_pattern( filter.msgText );
+		check_err( "bind msgText",
+			sqlite3_bind_text( stmt, idx, pattern(), (int)pattern.length(), SQLITE_TRANSIENT ) );
+	}
+	if((idx = sqlite3_bind_parameter_index( stmt, ":msgMatch" )) != 0){
+		check_err( "bind msgMatch",
+			sqlite3_bind_text( stmt, idx, filter.msgMatch(), (int)filter.msgMatch.length(), SQLITE_TRANSIENT ) );
+	}
+	if((idx = sqlite3_bind_parameter_index( stmt, ":startTime" )) != 0){
+		check_err( "bind startTime", sqlite3_bind_int( stmt, idx, (int)filter.startTime ) );
+	}
+	if((idx = sqlite3_bind_parameter_index( stmt, ":endTime" )) != 0){
+		check_err( "bind endTime", sqlite3_bind_int( stmt, idx, (int)filter.endTime ) );
+	}
+	for(size_t i = 0; i < filter.fields.size(); i++){
+		const LogFieldMatch& m = filter.fields[i];
+		twine tmp; tmp.format( ":fn%d", (int)i );
+		if((idx = sqlite3_bind_parameter_index( stmt, tmp() )) != 0){
+			check_err( "bind field name",
+				sqlite3_bind_text( stmt, idx, m.name(), (int)m.name.length(), SQLITE_TRANSIENT ) );
+		}
+		tmp.format( ":fv%d", (int)i );
+		if((idx = sqlite3_bind_parameter_index( stmt, tmp() )) != 0){
+			if(logfile2_is_integer( m.value )){
+				check_err( "bind field value",
+					sqlite3_bind_int64( stmt, idx, (sqlite3_int64)strtoll( m.value(), NULL, 10 ) ) );
+			} else {
+				check_err( "bind field value",
+					sqlite3_bind_text( stmt, idx, m.value(), (int)m.value.length(), SQLITE_TRANSIENT ) );
+			}
+		}
+	}
+}
+
+LogMsg* LogFile2::readMsgRow(sqlite3_stmt* stmt)
+{
+	dptr<LogMsg> msg = new LogMsg();
+	readMsgRow( stmt, *msg );
+	return msg.release();
+}
+
+void LogFile2::readMsgRow(sqlite3_stmt* stmt, LogMsg& msg)
+{
+	msg.id = sqlite3_column_int( stmt, 0 );
+	msg.file.set( 
+		(const char*)sqlite3_column_text(stmt, 1), (size_t)sqlite3_column_bytes(stmt, 1) );
+	msg.line = sqlite3_column_int( stmt, 2 );
+	msg.tid = sqlite3_column_int( stmt, 3 );
+#ifdef _WIN32
+	msg.timestamp.time = sqlite3_column_int( stmt, 4 );
+	msg.timestamp.millitm = (unsigned short)sqlite3_column_int( stmt, 5 );
+#else
+	msg.timestamp.tv_sec = sqlite3_column_int( stmt, 4 );
+	msg.timestamp.tv_usec = sqlite3_column_int( stmt, 5 );
+#endif
+	msg.channel = sqlite3_column_int( stmt, 6 );
+	msg.appName.set( 
+		(const char*)sqlite3_column_text(stmt, 7), (size_t)sqlite3_column_bytes(stmt, 7) );
+	msg.machineName.set( 
+		(const char*)sqlite3_column_text(stmt, 8), (size_t)sqlite3_column_bytes(stmt, 8) );
+	msg.appSession.set( 
+		(const char*)sqlite3_column_text(stmt, 9), (size_t)sqlite3_column_bytes(stmt, 9) );
+	msg.msg.set( 
+		(const char*)sqlite3_column_text(stmt, 10), (size_t)sqlite3_column_bytes(stmt, 10) );
+	if(sqlite3_column_count(stmt) > 11 && sqlite3_column_type(stmt, 11) == SQLITE_BLOB){
+		msg.DecodeFields(
+			(const char*)sqlite3_column_blob(stmt, 11), (size_t)sqlite3_column_bytes(stmt, 11) );
+	} else {
+		msg.fields.clear();
+	}
+}
+
+int LogFile2::messageCount(const LogFilter& filter)
+{
+	//printf("LogFile2::messageCount(const LogFilter& filter)\n");
+	Lock theLock(m_mutex);
+
+	twine sql = "select count(1) from logtable" + buildFilterWhere( filter ) + ";";
+	sqlite3_stmt* stmt = getCachedStmt( sql );
+	try {
+		sqlite3_reset( stmt );
+		sqlite3_clear_bindings( stmt );
+		bindFilter( stmt, filter );
+		check_err( "messageCount-exec", sqlite3_step( stmt ) );
+		int rc = sqlite3_column_int( stmt, 0 );
+		sqlite3_reset( stmt );
+		return rc;
+	} catch (AnException& e){
+		sqlite3_reset( stmt );
+		throw e;
+	}
+}
+
+vector<LogMsg*>* LogFile2::getMessages(const LogFilter& filter, int limit)
+{
+	//printf("LogFile2::getMessages(const LogFilter& filter, int limit)\n");
+	Lock theLock(m_mutex);
+
+	twine sql = "select " + selectColumns() + " from logtable" + buildFilterWhere( filter ) + " order by id";
+	if(limit != 0){
+		sql.append( " limit :limit" );
+	}
+	sql.append( ";" );
+
+	vector<LogMsg*>* ret = new vector<LogMsg*>();
+	sqlite3_stmt* stmt = getCachedStmt( sql );
+	try {
+		sqlite3_reset( stmt );
+		sqlite3_clear_bindings( stmt );
+		bindFilter( stmt, filter );
+		if(limit != 0){
+			check_err( "bind limit",
+				sqlite3_bind_int( stmt, sqlite3_bind_parameter_index( stmt, ":limit" ), limit ) );
+		}
+
+		int rc = check_err( "getMessages-exec", sqlite3_step( stmt ));
+		while(rc != 0){
+			ret->push_back( readMsgRow( stmt ) );
+			rc = check_err( "getMessages-next", sqlite3_step( stmt ) );
+		}
+
+		// Reset right away so that we don't hold a read lock on the file.
+		sqlite3_reset( stmt );
+		return ret;
+	} catch (AnException& e){
+		sqlite3_reset( stmt );
+		for(size_t i = 0; i < ret->size(); i++){
+			delete ret->at( i );
+		}
+		delete ret;
+		throw e;
+	}
+}
+
+int LogFile2::forEachMessage(LogFilter& filter, LogMsgCallback callback, void* data, int batchSize)
+{
+	//printf("LogFile2::forEachMessage(LogFilter& filter, LogMsgCallback callback, void* data, int batchSize)\n");
+	if(batchSize <= 0){
+		batchSize = 1000;
+	}
+
+	// One LogMsg is re-used for every row, so streaming doesn't allocate per message.
+	LogMsg msg;
+	int total = 0;
+	while(true){
+		int count = 0;
+		{
+			Lock theLock(m_mutex);
+
+			// Once afterId is set, every batch is the same statement from our cache.
+			twine sql = "select " + selectColumns() + " from logtable" + buildFilterWhere( filter ) +
+				" order by id limit :limit;";
+			sqlite3_stmt* stmt = getCachedStmt( sql );
+			try {
+				sqlite3_reset( stmt );
+				sqlite3_clear_bindings( stmt );
+				bindFilter( stmt, filter );
+				check_err( "bind limit",
+					sqlite3_bind_int( stmt, sqlite3_bind_parameter_index( stmt, ":limit" ), batchSize ) );
+
+				int rc = check_err( "forEachMessage-exec", sqlite3_step( stmt ));
+				while(rc != 0){
+					readMsgRow( stmt, msg );
+					filter.afterId = msg.id;
+					count++;
+					total++;
+					if(!callback( msg, data )){
+						sqlite3_reset( stmt );
+						return total;
+					}
+					rc = check_err( "forEachMessage-next", sqlite3_step( stmt ) );
+				}
+				sqlite3_reset( stmt );
+			} catch (AnException& e){
+				sqlite3_reset( stmt );
+				throw e;
+			}
+		}
+		if(count < batchSize){
+			break;
+		}
+	}
+	return total;
+}
+
+LogFieldStats LogFile2::fieldStats(const LogFilter& filter, const twine& fieldName)
+{
+	//printf("LogFile2::fieldStats(const LogFilter& filter, const twine& fieldName)\n");
+	Lock theLock(m_mutex);
+
+	LogFieldStats ret;
+	if(!m_hasFields){
+		return ret;
+	}
+
+	twine sql =
+		"select count(v), min(v), max(v), sum(v), avg(v) from ( "
+		"select logfield( fields, :aggField ) as v from logtable" + buildFilterWhere( filter ) +
+		" ) where v is not null;";
+	sqlite3_stmt* stmt = getCachedStmt( sql );
+	try {
+		sqlite3_reset( stmt );
+		sqlite3_clear_bindings( stmt );
+		bindFilter( stmt, filter );
+		check_err( "bind aggField",
+			sqlite3_bind_text( stmt, sqlite3_bind_parameter_index( stmt, ":aggField" ),
+				fieldName(), (int)fieldName.length(), SQLITE_TRANSIENT ) );
+		check_err( "fieldStats-exec", sqlite3_step( stmt ) );
+		ret.count = sqlite3_column_int( stmt, 0 );
+		ret.min = sqlite3_column_int64( stmt, 1 );
+		ret.max = sqlite3_column_int64( stmt, 2 );
+		ret.sum = sqlite3_column_int64( stmt, 3 );
+		ret.avg = sqlite3_column_double( stmt, 4 );
+		sqlite3_reset( stmt );
+		return ret;
+	} catch (AnException& e){
+		sqlite3_reset( stmt );
+		throw e;
+	}
+}
+
+map<twine, int> LogFile2::fieldCounts(const LogFilter& filter, const twine& fieldName)
+{
+	//printf("LogFile2::fieldCounts(const LogFilter& filter, const twine& fieldName)\n");
+	Lock theLock(m_mutex);
+
+	map<twine, int> ret;
+	if(!m_hasFields){
+		return ret;
+	}
+
+	twine sql =
+		"select v, count(1) from ( "
+		"select logfield( fields, :aggField ) as v from logtable" + buildFilterWhere( filter ) +
+		" ) where v is not null group by v;";
+	sqlite3_stmt* stmt = getCachedStmt( sql );
+	try {
+		sqlite3_reset( stmt );
+		sqlite3_clear_bindings( stmt );
+		bindFilter( stmt, filter );
+		check_err( "bind aggField",
+			sqlite3_bind_text( stmt, sqlite3_bind_parameter_index( stmt, ":aggField" ),
+				fieldName(), (int)fieldName.length(), SQLITE_TRANSIENT ) );
+		int rc = check_err( "fieldCounts-exec", sqlite3_step( stmt ) );
+		while(rc != 0){
+			twine value;
+			value.set( (const char*)sqlite3_column_text( stmt, 0 ), (size_t)sqlite3_column_bytes( stmt, 0 ) );
+			ret[ value ] = sqlite3_column_int( stmt, 1 );
+			rc = check_err( "fieldCounts-next", sqlite3_step( stmt ) );
+		}
+		sqlite3_reset( stmt );
+		return ret;
+	} catch (AnException& e){
+		sqlite3_reset( stmt );
+		throw e;
+	}
+}
+
 int LogFile2::getOldestMessageID()
 {
 	//printf("LogFile2::getOldestMessageID()\n");
@@ -769,6 +1660,11 @@ void LogFile2::createNewFile()
 		throw AnException(0, FL, "createNewFile is not allowed in readonly mode.");
 	}
 
+	// Make sure everything in the write-ahead-log is in the main file before we move it.
+	if(m_walMode && m_db != NULL){
+		sqlite3_exec( m_db, "pragma wal_checkpoint(RESTART);", NULL, NULL, NULL );
+	}
+
 	// Close off our log file
 	if(m_stmt != NULL){
 		sqlite3_finalize( m_stmt );
@@ -790,29 +1686,59 @@ void LogFile2::createNewFile()
 		sqlite3_finalize( m_stmt_rollbacktran );
 		m_stmt_rollbacktran = NULL;
 	}
+	if(m_stmt_pagecount != NULL){
+		sqlite3_finalize( m_stmt_pagecount );
+		m_stmt_pagecount = NULL;
+	}
+	clearQueryCache();
 	if(m_db != NULL){
 		sqlite3_close(m_db);
 		m_db = NULL;
 	}
 
-	// Then move it to a new name:
+	// Then move it to a new name.  We can roll over more than once a second, so make sure
+	// we don't collide with an earlier file that is still waiting to be compressed.
 	Date d;
 	twine newName = m_logFileName + "." + d.GetValue("%Y%m%d%H%M%S");
+	// Retention may have removed earlier files from this second, so keep counting up from the
+	// last one we used rather than re-using a lower number that would sort as older.
+	if(newName == m_lastRotatedBase){
+		m_rotatedSeq ++;
+	} else {
+		m_lastRotatedBase = newName;
+		m_rotatedSeq = 0;
+	}
+	while(true){
+		if(m_rotatedSeq != 0){
+			// zero padded so the names still sort in order
+			newName.format( "%s_%04d", m_lastRotatedBase(), m_rotatedSeq );
+		}
+		if(!File::Exists( newName ) && !File::Exists( newName + ".zip" )){
+			break;
+		}
+		m_rotatedSeq ++;
+	}
 	int res = rename( m_logFileName(), newName() );
 	if(res){
 		Setup(); // don't leave us without a log file
 		throw AnException(0, FL, "Error renaming existing log file %s to %s",
 			m_logFileName(), newName() );
 	}
-	// Then zip it up to save space
-	ZipFile zf( newName + ".zip" );
-	zf.AddFile( newName );
-	zf.Close();
-
-	// Remove the unzipped version
-	File::Delete( newName );
 
-	// Then create our new log file:
+	// Create our new log file first, so the writers can carry on:
 	Setup();
+
+	// Then hand the old one off to be compressed in the background.
+	if(m_rotator != NULL){
+		m_rotator->Rotated( newName );
+	}
+}
+
+LogRotator& LogFile2::rotator()
+{
+	if(m_rotator == NULL){
+		throw AnException(0, FL, "The log rotator is not available in readonly mode.");
+	}
+	return *m_rotator;
 }
 
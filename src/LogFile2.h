@@ -31,16 +31,132 @@
 
 #include <vector>
 #include <utility>
+#include <map>
 using namespace std;
 
 #include "sqlite3.h"
 #include "twine.h"
 #include "sptr.h"
 #include "Mutex.h"
+#include "Thread.h"
 #include "LogMsg.h"
+#include "LogRotator.h"
 
 namespace SLib {
 
+/** The schema version we write into new log files.  Files without a logschema table are version 1.
+  * Version 3 added the fields column that holds the structured fields of each message.
+  */
+#define LOGFILE2_SCHEMA_VERSION 3
+
+/// Channel mask that includes every log channel (PANIC through SQLTRACE)
+#define LOGFILTER_ALL_CHANNELS 0x7F
+
+/** The callback used by LogFile2::forEachMessage.  Return false to stop the scan.  The message
+  * is only valid for the duration of the call.
+  */
+typedef bool (*LogMsgCallback)(LogMsg& msg, void* data);
+
+/**
+  * A condition on one of the structured fields of a log message, like latency_ms > 100.  If the
+  * value is a whole number it is compared as an integer, otherwise as text.
+  *
+  * @author Steven M. Cherry
+  */
+class DLLEXPORT LogFieldMatch
+{
+	public:
+		/// The name of the field
+		twine name;
+
+		/// One of =, !=, <, <=, >, >=
+		twine op;
+
+		/// The value to compare against
+		twine value;
+};
+
+/**
+  * Summary statistics for an integer field, as returned by LogFile2::fieldStats.
+  *
+  * @author Steven M. Cherry
+  */
+class DLLEXPORT LogFieldStats
+{
+	public:
+		/// Standard constructor - everything is zero
+		LogFieldStats();
+
+		/// The number of messages that have the field
+		int count;
+
+		/// The smallest value
+		int64_t min;
+
+		/// The largest value
+		int64_t max;
+
+		/// The total of all values
+		int64_t sum;
+
+		/// The average value
+		double avg;
+};
+
+/**
+  * This class holds the filter settings used by LogFile2::getMessages and LogFile2::messageCount.
+  * Any member left at its default value does not take part in the query.  The values are passed
+  * to SQLite as bound parameters, so the same shape of filter re-uses the same prepared statement.
+  *
+  * @author Steven M. Cherry
+  */
+class DLLEXPORT LogFilter
+{
+	public:
+		/// Standard constructor - everything matches
+		LogFilter();
+
+		/// Only return messages with an id greater than this.  Use 0 to start at the beginning.
+		int afterId;
+
+		/// Bit N set means log channel N is included.  Defaults to LOGFILTER_ALL_CHANNELS.
+		int channelMask;
+
+		/// Only return messages from this thread id.  Use 0 for all threads.
+		uint32_t tid;
+
+		/// Application name contains this value
+		twine appName;
+
+		/// Machine name contains this value
+		twine machineName;
+
+		/// Application session is exactly this value
+		twine appSession;
+
+		/// Message text contains this value
+		twine msgText;
+
+		/** A full text search match expression for the message text, like "connection AND refused".
+		  * This requires the log file to have a text index (see LogFile2::setTextIndex).
+		  */
+		twine msgMatch;
+
+		/// Only return messages at or after this time.  Use 0 for no lower bound.
+		time_t startTime;
+
+		/// Only return messages at or before this time.  Use 0 for no upper bound.
+		time_t endTime;
+
+		/// Conditions on the structured fields of the message.  All of them must match.
+		vector<LogFieldMatch> fields;
+
+		/** Adds a condition on a structured field.  Throws an exception if op isn't one of
+		  * =, !=, <, <=, >, >=.
+		  */
+		void addField(const twine& name, const twine& op, const twine& value);
+};
+
 /**
   * This class is responsible for handling the storage and retrieval of mainframe log 
   * messages.  We do this by wrapping a sqlite3 database and using it to store all of
@@ -95,9 +211,37 @@ class DLLEXPORT LogFile2
 		/** Retrieves a single log message by message ID */
 		LogMsg* getMessage(int id);
 
+		/** Returns the number of messages in our file that match the given filter. */
+		int messageCount(const LogFilter& filter);
+
 		/** Retrieves log messages by free-form query - pass us the where clause. */
 		vector<LogMsg*>* getMessages( const twine& whereClause, int limit = 0, int offset = 0);
 
+		/** Retrieves log messages that match the given filter in id order.  If limit is not zero,
+		  * at most limit messages are returned.  To page through the results, set filter.afterId
+		  * to the id of the last message returned and call this again.
+		  */
+		vector<LogMsg*>* getMessages( const LogFilter& filter, int limit = 0);
+
+		/** Streams the messages that match the filter to the callback in id order, without building
+		  * a list of them first.  Messages are read in batches of batchSize using the message id to
+		  * pick up where the last batch left off, so each batch is an index seek rather than a
+		  * rescan, and our lock is released between batches.  The callback must not call back into
+		  * this LogFile2.  Returns the number of messages passed to the callback.  When this
+		  * returns, filter.afterId holds the id of the last message passed to the callback.
+		  */
+		int forEachMessage( LogFilter& filter, LogMsgCallback callback, void* data, int batchSize = 1000 );
+
+		/** Returns count, min, max, sum and average of the given integer field over the messages
+		  * that match the filter.  Messages without the field are skipped.
+		  */
+		LogFieldStats fieldStats( const LogFilter& filter, const twine& fieldName );
+
+		/** Returns the number of messages for each distinct value of the given field, over the
+		  * messages that match the filter.  Messages without the field are skipped.
+		  */
+		map<twine, int> fieldCounts( const LogFilter& filter, const twine& fieldName );
+
 		/** Returns the ID of the oldest message in our log */
 		int getOldestMessageID();
 
@@ -105,7 +249,8 @@ class DLLEXPORT LogFile2
 		int getNewestMessageID();
 
 		/** This will close our log file and move it to a new name so that we can
-		 * re-open a new log file.
+		 * re-open a new log file.  The old file is handed to our rotator to be compressed
+		 * in the background.
 		 */
 		void createNewFile();
 
@@ -122,18 +267,60 @@ class DLLEXPORT LogFile2
 		void setCacheSize( size_t cacheSize );
 
 		/** When we are caching messages, we also check to see how long it has been since we last
-		  * accepted a message into the cache.  If the newest message in the cache is older than
+		  * accepted a message into the cache.  If the oldest message in the cache is older than
 		  * the cache timeout, we'll write everything to the disk now - even if there is less than
-		  * cacheSize entries in the cache.  This ensures that messages don't linger in the cache
-		  * for too long. This value is set in milliseconds.
+		  * cacheSize entries in the cache.  Our background flush thread enforces this even when
+		  * no new messages are arriving, so messages don't linger in the cache for too long.
+		  * This value is set in milliseconds.
 		  */
 		void setCacheTime( size_t cacheTime );
 
 		/** This method allows you to force us to write anything in our cache out to the disk.
 		  * If you know that no messages are forthcomming for a while, this is a good thing to 
-		  * do.
+		  * do.  Returns false if any messages failed to be written since the last call to flush,
+		  * whether by this call, a writer, or our flush thread.  Those messages are gone, so a
+		  * caller that has to know its messages are on the disk should check this.
+		  */
+		bool flush();
+
+		/** Turns on (or off) the SQLite write-ahead-log journal mode for our log file.  WAL mode
+		  * lets readers like SLogDump work without blocking our commits, and turns each commit
+		  * into a sequential append.  This is off by default.  The setting is remembered and
+		  * re-applied whenever we roll over to a new log file.
+		  */
+		void setWALMode( bool onoff );
+
+		/** Turns on (or off) synchronous=NORMAL for our log file.  With this on, SQLite does not
+		  * fsync on every commit (in WAL mode it only syncs at checkpoints).  A power failure
+		  * may lose the most recent commits, but the file will not be corrupted.  This is off
+		  * by default.
+		  */
+		void setSyncNormal( bool onoff );
+
+		/** Turns on (or off) the secondary indexes on logtable.  These are on (channel, timestamp),
+		  * tid, and appSession, and make filtered reads of large log files much faster at the cost of
+		  * some insert speed.  This is off by default, and is re-applied whenever we roll over to a
+		  * new log file.
+		  */
+		void setIndexes( bool onoff );
+
+		/** Turns on (or off) the full text index over the message text.  This is an FTS4 table that
+		  * shares its content with logtable and is kept up to date by an insert trigger.  When
+		  * turned on for a file with existing messages, the index is rebuilt from them.  This is
+		  * off by default, and is re-applied whenever we roll over to a new log file.
+		  */
+		void setTextIndex( bool onoff );
+
+		/** Returns true if the current log file has a full text index over the message text. */
+		bool hasTextIndex();
+
+		/** Returns the schema version of the current log file. */
+		int getSchemaVersion();
+
+		/** Returns the rotation manager that looks after our old log files.  Use this to adjust
+		  * compression and the retention limits.  Only available in read-write mode.
 		  */
-		void flush();
+		LogRotator& rotator();
 
 	protected:
 
@@ -161,14 +348,96 @@ class DLLEXPORT LogFile2
 		/// Flushes the internal cache.
 		void flushInternal();
 
-		/// Checks to see if the internal cache is ready to be written to disk - if so flushes the cache.
-		void checkFlushCache();
+		/** Checks to see if the internal cache is ready to be written to disk.  If it is, or if
+		  * wasEmpty says the cache has just gone from empty to non-empty, this will wake up our
+		  * flush thread so that it can time the oldest message.  Returns true if the caller should flush the cache directly
+		  * because there is no flush thread, or because the flush thread has fallen too far behind.
+		  * The cache mutex must be held when calling this.
+		  */
+		bool checkFlushCache(bool wasEmpty);
+
+		/// Starts our background flush thread
+		void startFlushThread();
+
+		/// Stops our background flush thread and waits for it to exit
+		void stopFlushThread();
+
+		/// The main loop of our background flush thread
+		void flushThreadLoop();
+
+		/// The entry point for our background flush thread
+		static void* flushThreadStart(void* arg);
+
+		/// Applies our journal mode and synchronous settings to the open database
+		void applyPragmas();
+
+		/** Reads or creates the logschema table and checks for our optional indexes.  In read-write
+		  * mode older files are upgraded to our schema version.
+		  */
+		void checkSchema();
+
+		/// Returns true if the given table has the given column
+		bool columnExists(const twine& table, const twine& column);
+
+		/// Registers the logfield( fields, name ) sql function that reads one structured field
+		void registerFunctions();
+
+		/// Returns the list of logtable columns that readMsgRow expects
+		twine selectColumns();
+
+		/// Creates or drops the secondary indexes and the text index to match our settings
+		void applyIndexes();
+
+		/// Returns true if the given table, index or trigger exists in the current file
+		bool objectExists(const twine& type, const twine& name);
+
+		/// Returns a cached prepared statement for the given sql - preparing it if required
+		sqlite3_stmt* getCachedStmt(const twine& sql);
+
+		/// Finalizes all of our cached query statements
+		void clearQueryCache();
+
+		/// Builds the where clause that matches the given filter
+		twine buildFilterWhere(const LogFilter& filter);
+
+		/// Binds the values of the given filter to a statement built with buildFilterWhere
+		void bindFilter(sqlite3_stmt* stmt, const LogFilter& filter);
+
+		/// Reads a LogMsg from the current row of the given statement
+		LogMsg* readMsgRow(sqlite3_stmt* stmt);
+
+		/// Reads the current row of the given statement into an existing LogMsg
+		void readMsgRow(sqlite3_stmt* stmt, LogMsg& msg);
 
 	private:
 
 		/// Our mutex to ensure single-threadded access to our database
 		Mutex* m_mutex;
 
+		/// Our mutex to protect the message cache.  If both are needed, m_mutex is locked first.
+		Mutex* m_cacheMutex;
+
+#ifndef _WIN32
+		/// Used to wake up the flush thread when the cache is full or we are shutting down
+		pthread_cond_t m_flushCond;
+#endif
+
+		/// Our background flush thread
+		Thread* m_flushThread;
+
+		/// Compresses and cleans up our rotated log files in the background
+		LogRotator* m_rotator;
+
+		/// The timestamped name of the last file we rotated, and how many times we have used it
+		twine m_lastRotatedBase;
+		int m_rotatedSeq;
+
+		/// Tells our background flush thread to exit
+		bool m_flushThreadStop;
+
+		/// How many messages we have failed to write since the last call to flush.  Guarded by m_mutex.
+		size_t m_lostMessages;
+
 		/// Are we in read-only mode?
 		bool m_readOnly;
 
@@ -190,6 +459,39 @@ class DLLEXPORT LogFile2
 		/// Our SQLite statement handle for rolling back a transaction
 		sqlite3_stmt* m_stmt_rollbacktran;
 
+		/// Our SQLite statement handle for reading the database page count
+		sqlite3_stmt* m_stmt_pagecount;
+
+		/// The database page size - this doesn't change once the file is created
+		size_t m_pageSize;
+
+		/// The number of bytes we have written since the last time we checked the file size
+		size_t m_bytesSinceCheck;
+
+		/// Are we using WAL journal mode?
+		bool m_walMode;
+
+		/// Are we using synchronous=NORMAL?
+		bool m_syncNormal;
+
+		/// Should we maintain the secondary indexes?
+		bool m_useIndexes;
+
+		/// Should we maintain the full text index?
+		bool m_useTextIndex;
+
+		/// Does the current file have a full text index?
+		bool m_hasTextIndex;
+
+		/// Does the current file have the fields column?
+		bool m_hasFields;
+
+		/// The schema version of the current file
+		int m_schemaVersion;
+
+		/// Our prepared statements for filtered queries - keyed by their sql
+		map<twine, sqlite3_stmt*> m_queryCache;
+
 		/// The Log file name
 		twine m_logFileName;
 
@@ -205,6 +507,12 @@ class DLLEXPORT LogFile2
 		/// Our log message cache:
 		vector<LogMsg> m_cache;
 
+		/// The cache is swapped into this while we write it to disk.  Protected by m_mutex.
+		vector<LogMsg> m_flushBatch;
+
+		/// When the oldest message in the cache arrived (in milliseconds)
+		uint64_t m_cacheStart;
+
 };
 
 } // End Namespace SLib
@@ -92,6 +92,7 @@ LogMsg::LogMsg(const LogMsg& c)
 	appSession = c.appSession;
 	msg = c.msg;
 	msg_static = c.msg_static;
+	fields = c.fields;
 }
 
 LogMsg& LogMsg::operator=(const LogMsg& c)
@@ -107,6 +108,7 @@ LogMsg& LogMsg::operator=(const LogMsg& c)
 	appSession = c.appSession;
 	msg = c.msg;
 	msg_static = c.msg_static;
+	fields = c.fields;
 	return *this;
 }
 
@@ -185,3 +187,270 @@ twine LogMsg::GetTimestamp(void)
 
 	return ret;
 }
+
+twine LogField::value() const
+{
+	if(!isInt){
+		return text;
+	}
+	twine ret; ret.format( "%lld", (long long)intValue );
+	return ret;
+}
+
+LogMsg& LogMsg::Field(const char* name, const twine& value)
+{
+	LogField f;
+	f.name = name;
+	f.isInt = false;
+	f.intValue = 0;
+	f.text = value;
+	fields.push_back( f );
+	return *this;
+}
+
+LogMsg& LogMsg::Field(const char* name, int64_t value)
+{
+	LogField f;
+	f.name = name;
+	f.isInt = true;
+	f.intValue = value;
+	fields.push_back( f );
+	return *this;
+}
+
+const LogField* LogMsg::GetField(const char* name) const
+{
+	for(size_t i = 0; i < fields.size(); i++){
+		if(fields[i].name == name){
+			return &fields[i];
+		}
+	}
+	return NULL;
+}
+
+twine LogMsg::FieldsAsText(void) const
+{
+	twine ret;
+	for(size_t i = 0; i < fields.size(); i++){
+		if(i != 0){
+			ret.append( " " );
+		}
+		ret.append( fields[i].name );
+		ret.append( "=" );
+		ret.append( fields[i].value() );
+	}
+	return ret;
+}
+
+static void logmsg_put_varint(MemBuf& out, uint64_t v)
+{
+	char buf[10];
+	size_t n = 0;
+	while(v >= 0x80){
+		buf[n++] = (char)((v & 0x7F) | 0x80);
+		v >>= 7;
+	}
+	buf[n++] = (char)v;
+	out.append( buf, n );
+}
+
+static bool logmsg_get_varint(const char* data, size_t len, size_t& pos, uint64_t& v)
+{
+	v = 0;
+	for(int shift = 0; shift < 64; shift += 7){
+		if(pos >= len){
+			return false;
+		}
+		unsigned char c = (unsigned char)data[pos++];
+		v |= (uint64_t)(c & 0x7F) << shift;
+		if((c & 0x80) == 0){
+			return true;
+		}
+	}
+	return false;
+}
+
+/// Reads the field at pos.  If nameOnly is set, the value is skipped rather than copied.
+static bool logmsg_get_field(const char* data, size_t len, size_t& pos, LogField& f,
+	const char*& name, size_t& nameLen, bool nameOnly)
+{
+	uint64_t n;
+	if(!logmsg_get_varint( data, len, pos, n ) || n >= len - pos){ // the name and the type byte
+		return false;
+	}
+	name = data + pos;
+	nameLen = (size_t)n;
+	pos += (size_t)n;
+	f.isInt = data[pos++] == 0;
+	if(!logmsg_get_varint( data, len, pos, n )){
+		return false;
+	}
+	if(f.isInt){
+		f.intValue = (int64_t)((n >> 1) ^ (~(n & 1) + 1)); // undo the zigzag
+		return true;
+	}
+	if(n > len - pos){
+		return false;
+	}
+	if(!nameOnly){
+		f.text.set( data + pos, (size_t)n );
+	}
+	pos += (size_t)n;
+	return true;
+}
+
+void LogMsg::EncodeFields(MemBuf& out) const
+{
+	out.clear();
+	if(fields.size() == 0){
+		return;
+	}
+	logmsg_put_varint( out, fields.size() );
+	for(size_t i = 0; i < fields.size(); i++){
+		const LogField& f = fields[i];
+		logmsg_put_varint( out, f.name.length() );
+		out.append( f.name(), f.name.length() );
+		char type = f.isInt ? 0 : 1;
+		out.append( &type, 1 );
+		if(f.isInt){
+			// zigzag so that small negative numbers stay small
+			logmsg_put_varint( out, ((uint64_t)f.intValue << 1) ^ (uint64_t)(f.intValue >> 63) );
+		} else {
+			logmsg_put_varint( out, f.text.length() );
+			out.append( f.text(), f.text.length() );
+		}
+	}
+}
+
+void LogMsg::DecodeFields(const char* data, size_t len)
+{
+	fields.clear();
+	size_t pos = 0;
+	uint64_t count;
+	if(data == NULL || !logmsg_get_varint( data, len, pos, count )){
+		return;
+	}
+	for(uint64_t i = 0; i < count; i++){
+		LogField f;
+		const char* name;
+		size_t nameLen;
+		if(!logmsg_get_field( data, len, pos, f, name, nameLen, false )){
+			return; // keep what we could read
+		}
+		f.name.set( name, nameLen );
+		if(f.isInt){
+			f.text.erase();
+		} else {
+			f.intValue = 0;
+		}
+		fields.push_back( f );
+	}
+}
+
+bool LogMsg::FindEncodedField(const char* data, size_t len, const char* name, LogField& field)
+{
+	size_t pos = 0;
+	uint64_t count;
+	if(data == NULL || !logmsg_get_varint( data, len, pos, count )){
+		return false;
+	}
+	size_t wantLen = strlen( name );
+	for(uint64_t i = 0; i < count; i++){
+		size_t start = pos;
+		const char* fname;
+		size_t fnameLen;
+		if(!logmsg_get_field( data, len, pos, field, fname, fnameLen, true )){
+			return false;
+		}
+		if(fnameLen == wantLen && memcmp( fname, name, wantLen ) == 0){
+			if(!field.isInt){
+				// Go back and pick up the text this time.
+				pos = start;
+				logmsg_get_field( data, len, pos, field, fname, fnameLen, false );
+			}
+			field.name = name;
+			return true;
+		}
+	}
+	return false;
+}
+
+static void logmsg_put_string(MemBuf& out, const twine& value)
+{
+	logmsg_put_varint( out, value.length() );
+	out.append( value(), value.length() );
+}
+
+static bool logmsg_get_string(const char* data, size_t len, size_t& pos, twine& value)
+{
+	uint64_t n;
+	if(!logmsg_get_varint( data, len, pos, n ) || n > len - pos){
+		return false;
+	}
+	value.set( data + pos, (size_t)n );
+	pos += (size_t)n;
+	return true;
+}
+
+void LogMsg::Encode(MemBuf& out) const
+{
+	logmsg_put_varint( out, (uint32_t)line );
+	logmsg_put_varint( out, tid );
+	// The fraction of a second is always sent in microseconds, whatever the platform.
+#ifdef _WIN32
+	logmsg_put_varint( out, (uint64_t)timestamp.time );
+	logmsg_put_varint( out, (uint64_t)timestamp.millitm * 1000 );
+#else
+	logmsg_put_varint( out, (uint64_t)timestamp.tv_sec );
+	logmsg_put_varint( out, (uint64_t)timestamp.tv_usec );
+#endif
+	logmsg_put_varint( out, (uint32_t)channel );
+	logmsg_put_string( out, file );
+	logmsg_put_string( out, appName );
+	logmsg_put_string( out, machineName );
+	logmsg_put_string( out, appSession );
+	logmsg_put_string( out, msg );
+
+	MemBuf encoded;
+	EncodeFields( encoded );
+	logmsg_put_varint( out, encoded.size() );
+	if(encoded.size() != 0){
+		out.append( encoded.data(), encoded.size() );
+	}
+}
+
+bool LogMsg::Decode(const char* data, size_t len, size_t& pos)
+{
+	uint64_t v[5];
+	for(int i = 0; i < 5; i++){
+		if(!logmsg_get_varint( data, len, pos, v[i] )){
+			return false;
+		}
+	}
+	line = (int)v[0];
+	tid = (uint32_t)v[1];
+#ifdef _WIN32
+	timestamp.time = (time_t)v[2];
+	timestamp.millitm = (unsigned short)(v[3] / 1000);
+#else
+	timestamp.tv_sec = (time_t)v[2];
+	timestamp.tv_usec = (suseconds_t)v[3];
+#endif
+	channel = (int)v[4];
+	if(!logmsg_get_string( data, len, pos, file ) ||
+		!logmsg_get_string( data, len, pos, appName ) ||
+		!logmsg_get_string( data, len, pos, machineName ) ||
+		!logmsg_get_string( data, len, pos, appSession ) ||
+		!logmsg_get_string( data, len, pos, msg )
+	){
+		return false;
+	}
+
+	uint64_t n;
+	if(!logmsg_get_varint( data, len, pos, n ) || n > len - pos){
+		return false;
+	}
+	DecodeFields( data + pos, (size_t)n );
+	pos += (size_t)n;
+	return true;
+}
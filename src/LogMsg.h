@@ -27,10 +27,13 @@
 #endif
 
 #include "twine.h"
+#include "MemBuf.h"
 #include "Thread.h"
 #include "Date.h"
 
 #include <stdint.h>
+#include <vector>
+using namespace std;
 
 #ifdef _WIN32
 #	include <sys/types.h>
@@ -41,6 +44,30 @@
 
 namespace SLib {
 
+/**
+  * A single structured field attached to a log message, like request_id or latency_ms.
+  * Fields are either integers or text.
+  *
+  * @author Steven M. Cherry
+  */
+class DLLEXPORT LogField {
+	public:
+		/// The name of the field
+		twine name;
+
+		/// Is this an integer field?  If not, the value is in text.
+		bool isInt;
+
+		/// The value of an integer field
+		int64_t intValue;
+
+		/// The value of a text field
+		twine text;
+
+		/// Returns the value as text, whatever the type
+		twine value() const;
+};
+
 /**
   * This class represents a single log message.  All of the fields that
   * we log are here as member variables.  This allows us to store log messages
@@ -108,6 +135,46 @@ class DLLEXPORT LogMsg {
 		/// Whether this message is a static string or not.
 		bool msg_static;
 
+		/// Structured fields attached to this message
+		vector<LogField> fields;
+
+		/// Attaches a text field to this message
+		LogMsg& Field(const char* name, const twine& value);
+
+		/// Attaches an integer field to this message
+		LogMsg& Field(const char* name, int64_t value);
+
+		/// Returns the named field, or NULL if this message doesn't have it
+		const LogField* GetField(const char* name) const;
+
+		/// Returns the fields formatted as name=value pairs separated by spaces
+		twine FieldsAsText(void) const;
+
+		/** Encodes our fields in a compact binary form.  This is a varint count, then for each
+		  * field the varint length and bytes of the name, a type byte, and either a zigzag varint
+		  * integer or the varint length and bytes of the text.
+		  */
+		void EncodeFields(MemBuf& out) const;
+
+		/// Replaces our fields with the ones in the given buffer made by EncodeFields
+		void DecodeFields(const char* data, size_t len);
+
+		/** Looks for the named field in a buffer made by EncodeFields without decoding the whole
+		  * thing.  Returns false if the field isn't there.
+		  */
+		static bool FindEncodedField(const char* data, size_t len, const char* name, LogField& field);
+
+		/** Appends this message to out as a compact binary record, for shipping it to another
+		  * process.  Everything but the id is included, and the timestamp is kept to the
+		  * microsecond on every platform, so that Windows and POSIX processes can talk.
+		  */
+		void Encode(MemBuf& out) const;
+
+		/** Reads a record made by Encode starting at pos in data, and moves pos past it.  Returns
+		  * false if the record is truncated or damaged.
+		  */
+		bool Decode(const char* data, size_t len, size_t& pos);
+
 		/// Sets our timestamp value to now
 		void SetTimestamp(void);
 
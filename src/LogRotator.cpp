@@ -0,0 +1,310 @@
+ /*
+  * Copyright (c) 2001,2002 Steven M. Cherry. All rights reserved.
+  *
+  * This file is a part of slib - a c++ utility library
+  *
+  * The slib project, including all files needed to compile
+  * it, is free software; you can redistribute it and/or use it and/or modify
+  * it under the terms of the GNU Lesser General Public License as published by
+  * the Free Software Foundation.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program.  See file COPYING for details.
+  */
+
+#include "LogRotator.h"
+#include "AnException.h"
+#include "ZipFile.h"
+#include "File.h"
+#include "Date.h"
+#include "Tools.h"
+#include "Lock.h"
+
+#include <algorithm>
+using namespace SLib;
+
+LogRotator::LogRotator(const twine& logFileName)
+{
+	m_logFileName = logFileName;
+	m_maxFiles = 0;
+	m_maxTotalSize = 0;
+	m_compress = true;
+	m_stop = false;
+	m_busy = false;
+	m_mutex = new Mutex();
+#ifndef _WIN32
+	pthread_cond_init( &m_cond, NULL );
+#endif
+
+	m_thread = new Thread();
+	try {
+		m_thread->start( LogRotator::threadStart, this );
+	} catch (AnException& e){
+		// Without the thread, Rotated does the work on the caller's thread.
+		printf("Error starting LogRotator thread: %s\n", e.Msg() );
+		delete m_thread;
+		m_thread = NULL;
+	}
+}
+
+LogRotator::~LogRotator()
+{
+	if(m_thread != NULL){
+		m_mutex->lock();
+		m_stop = true;
+#ifndef _WIN32
+		pthread_cond_broadcast( &m_cond );
+#endif
+		m_mutex->unlock();
+
+		m_thread->join(); // the thread finishes everything queued before it exits
+		delete m_thread;
+		m_thread = NULL;
+	}
+
+	delete m_mutex;
+#ifndef _WIN32
+	pthread_cond_destroy( &m_cond );
+#endif
+}
+
+void LogRotator::setMaxFiles( size_t maxFiles )
+{
+	Lock theLock(m_mutex);
+	m_maxFiles = maxFiles;
+}
+
+void LogRotator::setMaxAge( const Interval& maxAge )
+{
+	Lock theLock(m_mutex);
+	m_maxAge = maxAge;
+}
+
+void LogRotator::setMaxTotalSize( size_t maxTotalSize )
+{
+	Lock theLock(m_mutex);
+	m_maxTotalSize = maxTotalSize;
+}
+
+void LogRotator::setCompress( bool onoff )
+{
+	Lock theLock(m_mutex);
+	m_compress = onoff;
+}
+
+void LogRotator::Rotated( const twine& fileName )
+{
+	if(m_thread == NULL){
+		try {
+			Compress( fileName );
+			EnforceRetention();
+		} catch (AnException& e){
+			printf("Error rotating log file %s: %s\n", fileName(), e.Msg() );
+		}
+		return;
+	}
+
+	m_mutex->lock();
+	m_pending.push_back( fileName );
+#ifndef _WIN32
+	pthread_cond_broadcast( &m_cond );
+#endif
+	m_mutex->unlock();
+}
+
+void LogRotator::Wait()
+{
+	m_mutex->lock();
+	while(m_thread != NULL && (m_pending.size() != 0 || m_busy)){
+#ifdef _WIN32
+		m_mutex->unlock();
+		Tools::msleep( 10 );
+		m_mutex->lock();
+#else
+		pthread_cond_wait( &m_cond, m_mutex->internalMutex() );
+#endif
+	}
+	m_mutex->unlock();
+}
+
+void LogRotator::threadLoop()
+{
+	m_mutex->lock();
+	while(true){
+		if(m_pending.size() == 0){
+			if(m_stop){
+				break;
+			}
+#ifdef _WIN32
+			m_mutex->unlock();
+			Tools::msleep( 10 );
+			m_mutex->lock();
+#else
+			pthread_cond_wait( &m_cond, m_mutex->internalMutex() );
+#endif
+			continue; // re-evaluate everything after waking up
+		}
+
+		twine fileName = m_pending.front();
+		m_pending.pop_front();
+		m_busy = true;
+		m_mutex->unlock();
+
+		try {
+			Compress( fileName );
+			EnforceRetention();
+		} catch (AnException& e){
+			printf("Error rotating log file %s: %s\n", fileName(), e.Msg() );
+		}
+
+		m_mutex->lock();
+		m_busy = false;
+#ifndef _WIN32
+		pthread_cond_broadcast( &m_cond ); // let anyone in Wait() know
+#endif
+	}
+	m_mutex->unlock();
+}
+
+void* LogRotator::threadStart(void* arg)
+{
+	((LogRotator*)arg)->threadLoop();
+	return NULL;
+}
+
+void LogRotator::Compress( const twine& fileName )
+{
+	bool compress;
+	{
+		Lock theLock(m_mutex);
+		compress = m_compress;
+	}
+	if(!compress || !File::Exists( fileName )){
+		return;
+	}
+
+	// Write to a hidden name first, so that nobody sees a partial archive.  ZipFile always
+	// wants the name to end in .zip.
+	twine dir = File::Directory( fileName );
+	twine zipName = fileName + ".zip";
+	twine partName = "." + File::FileName( zipName );
+	if(!dir.empty()){
+		partName = File::PathCombine( dir, partName );
+	}
+	try {
+		ZipFile zf( partName );
+		zf.SetRootFolder( dir );
+		zf.AddFile( File::FileName( fileName ) );
+		zf.Close();
+	} catch (AnException&){
+		File::Delete( partName );
+		throw; // leave the rotated file where it is
+	}
+
+	if(rename( partName(), zipName() )){
+		File::Delete( partName );
+		throw AnException(0, FL, "Error renaming %s to %s", partName(), zipName() );
+	}
+
+	// Remove the uncompressed version
+	File::Delete( fileName );
+}
+
+vector<twine> LogRotator::Archives()
+{
+	bool compress;
+	{
+		Lock theLock(m_mutex);
+		compress = m_compress;
+	}
+
+	twine dir = File::Directory( m_logFileName );
+	twine prefix = File::FileName( m_logFileName ) + ".";
+
+	vector<twine> ret;
+	vector<twine> files = File::listFiles( dir.empty() ? twine(".") : dir );
+	for(size_t i = 0; i < files.size(); i++){
+		if(!files[i].startsWith( prefix ) || files[i].length() <= prefix.length()){
+			continue;
+		}
+		if(compress){
+			if(!files[i].endsWith( ".zip" )){
+				continue; // not compressed yet, or something else entirely
+			}
+		} else {
+			if(files[i].endsWith( ".zip" ) || files[i].endsWith( "-wal" ) ||
+				files[i].endsWith( "-shm" ) || files[i].endsWith( "-journal" )
+			){
+				continue;
+			}
+		}
+		ret.push_back( dir.empty() ? files[i] : File::PathCombine( dir, files[i] ) );
+	}
+
+	// The timestamp in the name sorts oldest first
+	std::sort( ret.begin(), ret.end() );
+	return ret;
+}
+
+void LogRotator::EnforceRetention()
+{
+	size_t maxFiles;
+	size_t maxTotalSize;
+	int maxAge;
+	deque<twine> pending;
+	{
+		Lock theLock(m_mutex);
+		maxFiles = m_maxFiles;
+		maxTotalSize = m_maxTotalSize;
+		maxAge = m_maxAge.Sec();
+		pending = m_pending;
+	}
+	if(maxFiles == 0 && maxTotalSize == 0 && maxAge == 0){
+		return; // nothing to enforce
+	}
+
+	vector<twine> archives = Archives();
+	vector<twine> keep;
+	vector<size_t> sizes;
+	time_t cutoff = time(NULL) - maxAge;
+	for(size_t i = 0; i < archives.size(); i++){
+		if(std::find( pending.begin(), pending.end(), archives[i] ) != pending.end()){
+			continue; // still waiting to be compressed - leave it alone
+		}
+		time_t modified;
+		size_t size;
+		{ // close the file before we try to delete it
+			File f( archives[i] );
+			modified = f.lastModified().Epoch();
+			size = (size_t)f.size();
+		}
+		if(maxAge != 0 && modified < cutoff){
+			File::Delete( archives[i] );
+			continue;
+		}
+		keep.push_back( archives[i] );
+		sizes.push_back( size );
+	}
+
+	size_t total = 0;
+	for(size_t i = 0; i < sizes.size(); i++){
+		total += sizes[i];
+	}
+
+	// Drop the oldest until we are within both the count and size limits
+	size_t count = keep.size();
+	for(size_t i = 0; i < keep.size(); i++){
+		bool tooMany = maxFiles != 0 && count > maxFiles;
+		bool tooBig = maxTotalSize != 0 && total > maxTotalSize;
+		if(!tooMany && !tooBig){
+			break;
+		}
+		File::Delete( keep[i] );
+		count--;
+		total -= sizes[i];
+	}
+}
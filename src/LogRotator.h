@@ -0,0 +1,153 @@
+#ifndef LOGROTATOR_H
+#define LOGROTATOR_H
+ /*
+  * Copyright (c) 2001,2002 Steven M. Cherry. All rights reserved.
+  *
+  * This file is a part of slib - a c++ utility library
+  *
+  * The slib project, including all files needed to compile
+  * it, is free software; you can redistribute it and/or use it and/or modify
+  * it under the terms of the GNU Lesser General Public License as published by
+  * the Free Software Foundation.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program.  See file COPYING for details.
+  */
+
+#ifdef _WIN32
+#	ifndef DLLEXPORT
+#		define DLLEXPORT __declspec(dllexport)
+#	endif
+#else
+#	define DLLEXPORT
+#endif
+
+#include <vector>
+#include <deque>
+using namespace std;
+
+#include "twine.h"
+#include "Mutex.h"
+#include "Thread.h"
+#include "Interval.h"
+
+namespace SLib {
+
+/**
+  * This class looks after the files that LogFile2 leaves behind when it rolls over to a new
+  * log file.  Rotated files are handed to us with Rotated(), which only queues the name and
+  * returns.  Our background thread then compresses each file into a zip archive next to it,
+  * and enforces the retention limits on all of the archives for the log file.  Archives are
+  * named logFileName.YYYYmmddHHMMSS.zip, so sorting them by name puts them oldest first.
+  *
+  * @author Steven M. Cherry
+  */
+class DLLEXPORT LogRotator
+{
+	private:
+		/// copy constructor is private to prevent use
+		LogRotator(const LogRotator& c) {}
+
+		/// assignmet operator is private to prevent use
+		LogRotator& operator=(const LogRotator& c) { return *this;}
+
+	public:
+		/// Standard constructor.  Pass in the name of the active log file.
+		LogRotator(const twine& logFileName);
+
+		/// Standard destructor - finishes any queued work and stops our thread.
+		virtual ~LogRotator();
+
+		/** Keep at most this many archives.  The oldest ones are removed first.  Use 0 for no
+		  * limit, which is the default.
+		  */
+		void setMaxFiles( size_t maxFiles );
+
+		/** Remove archives older than this.  Use an empty Interval for no limit, which is the
+		  * default.
+		  */
+		void setMaxAge( const Interval& maxAge );
+
+		/** Keep the total size of all archives under this many bytes.  The oldest ones are removed
+		  * first.  Use 0 for no limit, which is the default.
+		  */
+		void setMaxTotalSize( size_t maxTotalSize );
+
+		/** Turns compression of rotated files on (or off).  This is on by default.  With it off,
+		  * rotated files are left as they are, and the retention limits apply to them instead.
+		  */
+		void setCompress( bool onoff );
+
+		/** LogFile2 calls this after it has renamed the active log file to fileName.  This only
+		  * queues the file for our background thread, so it is safe to call from the flush path.
+		  */
+		void Rotated( const twine& fileName );
+
+		/** Waits until everything that has been queued with Rotated has been compressed and the
+		  * retention limits have been applied.
+		  */
+		void Wait();
+
+		/// Removes archives as required to bring us within our retention limits.
+		void EnforceRetention();
+
+		/// Returns the full path of all archives of our log file, oldest first.
+		vector<twine> Archives();
+
+	protected:
+
+		/// Compresses a single rotated file into fileName.zip and removes the original
+		void Compress( const twine& fileName );
+
+		/// The main loop of our background thread
+		void threadLoop();
+
+		/// The entry point for our background thread
+		static void* threadStart(void* arg);
+
+	private:
+
+		/// Protects everything below
+		Mutex* m_mutex;
+
+#ifndef _WIN32
+		/// Signalled when work is queued, when work is finished, and when we are shutting down
+		pthread_cond_t m_cond;
+#endif
+
+		/// Our background thread
+		Thread* m_thread;
+
+		/// Tells our background thread to exit
+		bool m_stop;
+
+		/// Is our background thread working on something right now?
+		bool m_busy;
+
+		/// Rotated files waiting to be compressed
+		deque<twine> m_pending;
+
+		/// The active log file name
+		twine m_logFileName;
+
+		/// Maximum number of archives
+		size_t m_maxFiles;
+
+		/// Maximum age of archives
+		Interval m_maxAge;
+
+		/// Maximum total size of all archives
+		size_t m_maxTotalSize;
+
+		/// Should we compress rotated files?
+		bool m_compress;
+
+};
+
+} // End Namespace SLib
+
+#endif // LOGROTATOR_H Defined
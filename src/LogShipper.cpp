@@ -0,0 +1,440 @@
+ /*
+  * Copyright (c) 2001,2002 Steven M. Cherry. All rights reserved.
+  *
+  * This file is a part of slib - a c++ utility library
+  *
+  * The slib project, including all files needed to compile
+  * it, is free software; you can redistribute it and/or use it and/or modify
+  * it under the terms of the GNU Lesser General Public License as published by
+  * the Free Software Foundation.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program.  See file COPYING for details.
+  */
+
+#include "LogShipper.h"
+#include "AnException.h"
+#include "File.h"
+#include "Tools.h"
+#include "Lock.h"
+
+#ifndef _WIN32
+#include <arpa/inet.h>
+#else
+#include <winsock2.h>
+#endif
+
+using namespace SLib;
+
+/// How long we wait for the collector to acknowledge a frame
+#define LOGSHIP_ACK_TIMEOUT 30000
+
+/// The longest we wait between attempts to connect to the collector, in seconds
+#define LOGSHIP_MAX_BACKOFF 30
+
+LogShipper::LogShipper(const twine& host, int port, const twine& spoolFileName)
+{
+	m_host = host;
+	m_port = port;
+	m_spoolFileName = spoolFileName;
+	m_batchSize = 500;
+	m_batchTime = 250;
+	m_maxQueue = 10000;
+	m_maxBlock = 1000;
+	m_sent = 0;
+	m_spooled = 0;
+	m_dropped = 0;
+	m_sock = NULL;
+	m_nextConnect = 0;
+	m_backoff = 1;
+	m_stop = false;
+	m_busy = false;
+	m_mutex = new Mutex();
+#ifndef _WIN32
+	pthread_cond_init( &m_cond, NULL );
+#endif
+
+	m_thread = new Thread();
+	if(m_thread->start( LogShipper::threadStart, this ) != 0){
+		delete m_thread;
+		delete m_mutex;
+#ifndef _WIN32
+		pthread_cond_destroy( &m_cond );
+#endif
+		throw AnException(0, FL, "Unable to start the LogShipper thread.");
+	}
+}
+
+LogShipper::~LogShipper()
+{
+	m_mutex->lock();
+	m_stop = true;
+#ifndef _WIN32
+	pthread_cond_broadcast( &m_cond );
+#endif
+	m_mutex->unlock();
+
+	m_thread->join(); // the thread handles everything queued before it exits
+	delete m_thread;
+
+	if(m_sock != NULL){
+		delete m_sock;
+	}
+	delete m_mutex;
+#ifndef _WIN32
+	pthread_cond_destroy( &m_cond );
+#endif
+}
+
+void LogShipper::setBatchSize( size_t batchSize )
+{
+	Lock theLock(m_mutex);
+	m_batchSize = batchSize == 0 ? 1 : batchSize;
+}
+
+void LogShipper::setBatchTime( size_t batchTime )
+{
+	Lock theLock(m_mutex);
+	m_batchTime = batchTime;
+}
+
+void LogShipper::setMaxQueue( size_t maxQueue )
+{
+	Lock theLock(m_mutex);
+	m_maxQueue = maxQueue == 0 ? 1 : maxQueue;
+}
+
+void LogShipper::setMaxBlock( size_t maxBlock )
+{
+	Lock theLock(m_mutex);
+	m_maxBlock = maxBlock;
+}
+
+size_t LogShipper::Sent()
+{
+	Lock theLock(m_mutex);
+	return m_sent;
+}
+
+size_t LogShipper::Spooled()
+{
+	Lock theLock(m_mutex);
+	return m_spooled;
+}
+
+size_t LogShipper::Dropped()
+{
+	Lock theLock(m_mutex);
+	return m_dropped;
+}
+
+/// Waits on the condition for up to ms milliseconds.  The mutex must be locked.
+#ifndef _WIN32
+static void logshipper_wait(pthread_cond_t* cond, Mutex* mutex, size_t ms)
+{
+	struct timespec abs_time;
+	clock_gettime( CLOCK_REALTIME, &abs_time );
+	abs_time.tv_sec += (time_t)(ms / 1000);
+	abs_time.tv_nsec += (long)( ms % 1000 ) * 1000000;
+	if(abs_time.tv_nsec >= 1000000000){
+		abs_time.tv_sec ++;
+		abs_time.tv_nsec -= 1000000000;
+	}
+	pthread_cond_timedwait( cond, mutex->internalMutex(), &abs_time );
+}
+#endif
+
+void LogShipper::Ship( LogMsg* lm )
+{
+	m_mutex->lock();
+
+	// Backpressure: hold the producer up while the queue is full.
+	size_t waited = 0;
+	while(m_queue.size() >= m_maxQueue && !m_stop){
+		if(m_maxBlock != 0 && waited >= m_maxBlock){
+			m_dropped++;
+			m_mutex->unlock();
+			delete lm;
+			return;
+		}
+#ifdef _WIN32
+		m_mutex->unlock();
+		Tools::msleep( 10 );
+		m_mutex->lock();
+#else
+		logshipper_wait( &m_cond, m_mutex, 10 );
+#endif
+		waited += 10;
+	}
+
+	m_queue.push_back( lm );
+#ifndef _WIN32
+	if(m_queue.size() >= m_batchSize){
+		pthread_cond_broadcast( &m_cond );
+	}
+#endif
+	m_mutex->unlock();
+}
+
+void LogShipper::Flush()
+{
+	m_mutex->lock();
+	while(m_queue.size() != 0 || m_busy){
+#ifdef _WIN32
+		m_mutex->unlock();
+		Tools::msleep( 10 );
+		m_mutex->lock();
+#else
+		pthread_cond_broadcast( &m_cond ); // don't wait for the batch to fill up
+		logshipper_wait( &m_cond, m_mutex, 10 );
+#endif
+	}
+	m_mutex->unlock();
+}
+
+void* LogShipper::threadStart(void* arg)
+{
+	((LogShipper*)arg)->threadLoop();
+	return NULL;
+}
+
+void LogShipper::threadLoop()
+{
+	m_mutex->lock();
+	while(true){
+		if(m_queue.size() == 0){
+			if(m_stop){
+				break;
+			}
+#ifdef _WIN32
+			m_mutex->unlock();
+			Tools::msleep( 10 );
+			m_mutex->lock();
+#else
+			logshipper_wait( &m_cond, m_mutex, m_batchTime );
+#endif
+			if(m_queue.size() == 0){
+				// Nothing to do - a good time to catch up on anything we spooled.
+				m_mutex->unlock();
+				if(File::Exists( m_spoolFileName ) && connect()){
+					replaySpool();
+				}
+				m_mutex->lock();
+			}
+			continue; // re-evaluate everything after waking up
+		}
+
+		// Give a partial batch a little time to fill up.
+		if(m_queue.size() < m_batchSize && !m_stop){
+#ifdef _WIN32
+			m_mutex->unlock();
+			Tools::msleep( (int)m_batchTime );
+			m_mutex->lock();
+#else
+			logshipper_wait( &m_cond, m_mutex, m_batchTime );
+#endif
+		}
+
+		vector<LogMsg*> batch;
+		while(m_queue.size() != 0 && batch.size() < m_batchSize){
+			batch.push_back( m_queue.front() );
+			m_queue.pop_front();
+		}
+		m_busy = true;
+#ifndef _WIN32
+		pthread_cond_broadcast( &m_cond ); // there is room in the queue now
+#endif
+		m_mutex->unlock();
+
+		// Header first, then the records, then fill in the payload length.
+		MemBuf frame;
+		frame.append( LOGSHIP_MAGIC, 4 );
+		uint32_t tmp = 0;
+		frame.append( (const char*)&tmp, 4 );
+		tmp = htonl( (uint32_t)batch.size() );
+		frame.append( (const char*)&tmp, 4 );
+		for(size_t i = 0; i < batch.size(); i++){
+			batch[i]->Encode( frame );
+			delete batch[i];
+		}
+		tmp = htonl( (uint32_t)(frame.size() - LOGSHIP_HEADER_SIZE) );
+		memcpy( frame.data() + 4, &tmp, 4 );
+
+		deliver( frame, (uint32_t)batch.size() );
+
+		m_mutex->lock();
+		m_busy = false;
+#ifndef _WIN32
+		pthread_cond_broadcast( &m_cond ); // let anyone in Flush() know
+#endif
+	}
+	m_mutex->unlock();
+}
+
+void LogShipper::deliver( MemBuf& frame, uint32_t count )
+{
+	// Anything in the spool file goes first, so the collector sees things in order.
+	if(connect() && replaySpool() && sendFrame( frame.data(), frame.size(), count )){
+		return;
+	}
+	spool( frame.data(), frame.size(), count );
+}
+
+bool LogShipper::connect()
+{
+	if(m_sock != NULL){
+		return true;
+	}
+	if(time(NULL) < m_nextConnect){
+		return false; // still backing off
+	}
+	try {
+		m_sock = new Socket( (char*)m_host(), m_port );
+		m_sock->SetNoDelay( true );
+		// If the collector goes away while we are writing to it, we want an error from the
+		// write rather than having the whole process killed.
+		m_sock->SetNoSigPipe( true );
+		m_backoff = 1;
+		return true;
+	} catch (AnException&){
+		disconnect(); // cleans up m_sock if we got as far as creating it
+		return false;
+	}
+}
+
+void LogShipper::disconnect()
+{
+	if(m_sock != NULL){
+		delete m_sock;
+		m_sock = NULL;
+	}
+	m_nextConnect = time(NULL) + m_backoff;
+	m_backoff *= 2;
+	if(m_backoff > LOGSHIP_MAX_BACKOFF){
+		m_backoff = LOGSHIP_MAX_BACKOFF;
+	}
+}
+
+bool LogShipper::sendFrame( const char* frame, size_t len, uint32_t count )
+{
+	if(m_sock == NULL){
+		return false;
+	}
+	try {
+		m_sock->SendData( (char*)frame, (int)len );
+
+		// Wait for the collector to tell us the records are in its log file.
+		char ack[4];
+		size_t got = 0;
+		while(got < sizeof(ack)){
+			int n = m_sock->TimedGetRawData( ack + got, (int)(sizeof(ack) - got), LOGSHIP_ACK_TIMEOUT );
+			if(n <= 0){
+				throw AnException(0, FL, "Log collector closed the connection.");
+			}
+			got += (size_t)n;
+		}
+		uint32_t acked;
+		memcpy( &acked, ack, 4 );
+		if(ntohl( acked ) != count){
+			throw AnException(0, FL, "Log collector acknowledged the wrong number of messages.");
+		}
+	} catch (AnException&){
+		disconnect();
+		return false;
+	}
+
+	Lock theLock(m_mutex);
+	m_sent += count;
+	return true;
+}
+
+void LogShipper::spool( const char* frame, size_t len, uint32_t count )
+{
+	FILE* fp = fopen( m_spoolFileName(), "ab" );
+	if(fp == NULL){
+		printf("Error opening log spool file %s - dropping %d messages\n", m_spoolFileName(), (int)count );
+		Lock theLock(m_mutex);
+		m_dropped += count;
+		return;
+	}
+	size_t written = fwrite( frame, 1, len, fp );
+	fclose( fp );
+
+	Lock theLock(m_mutex);
+	if(written == len){
+		m_spooled += count;
+	} else {
+		m_dropped += count;
+	}
+}
+
+bool LogShipper::replaySpool()
+{
+	if(!File::Exists( m_spoolFileName )){
+		return true;
+	}
+	FILE* fp = fopen( m_spoolFileName(), "rb" );
+	if(fp == NULL){
+		return false;
+	}
+
+	MemBuf frame;
+	bool ok = true;
+	long frameStart = 0;
+	while(true){
+		frameStart = ftell( fp );
+		char header[LOGSHIP_HEADER_SIZE];
+		if(fread( header, 1, LOGSHIP_HEADER_SIZE, fp ) != LOGSHIP_HEADER_SIZE){
+			break; // all done - a partial header is the tail of an interrupted write
+		}
+		uint32_t len, count;
+		memcpy( &len, header + 4, 4 );
+		memcpy( &count, header + 8, 4 );
+		len = ntohl( len );
+		count = ntohl( count );
+		if(memcmp( header, LOGSHIP_MAGIC, 4 ) != 0 || len > LOGSHIP_MAX_FRAME){
+			printf("Log spool file %s is damaged - discarding the rest of it\n", m_spoolFileName() );
+			break;
+		}
+		frame.clear();
+		frame.append( header, LOGSHIP_HEADER_SIZE );
+		MemBuf payload( (size_t)len );
+		if(len != 0 && fread( payload.data(), 1, len, fp ) != len){
+			break; // the tail of an interrupted write
+		}
+		frame.append( payload );
+		if(!sendFrame( frame.data(), frame.size(), count )){
+			ok = false;
+			break;
+		}
+	}
+
+	if(ok){
+		fclose( fp );
+		File::Delete( m_spoolFileName );
+		return true;
+	}
+
+	// Keep whatever we didn't get to, from the frame that failed on.
+	twine restName = m_spoolFileName + ".rest";
+	FILE* rest = fopen( restName(), "wb" );
+	if(rest != NULL){
+		fseek( fp, frameStart, SEEK_SET );
+		char buf[ 64 * 1024 ];
+		size_t n;
+		while((n = fread( buf, 1, sizeof(buf), fp )) != 0){
+			fwrite( buf, 1, n, rest );
+		}
+		fclose( rest );
+	}
+	fclose( fp );
+	if(rest != NULL){
+		File::Delete( m_spoolFileName );
+		rename( restName(), m_spoolFileName() );
+	}
+	return false;
+}
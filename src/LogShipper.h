@@ -0,0 +1,195 @@
+#ifndef LOGSHIPPER_H
+#define LOGSHIPPER_H
+ /*
+  * Copyright (c) 2001,2002 Steven M. Cherry. All rights reserved.
+  *
+  * This file is a part of slib - a c++ utility library
+  *
+  * The slib project, including all files needed to compile
+  * it, is free software; you can redistribute it and/or use it and/or modify
+  * it under the terms of the GNU Lesser General Public License as published by
+  * the Free Software Foundation.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program.  See file COPYING for details.
+  */
+
+#ifdef _WIN32
+#	ifndef DLLEXPORT
+#		define DLLEXPORT __declspec(dllexport)
+#	endif
+#else
+#	define DLLEXPORT
+#endif
+
+#include <deque>
+using namespace std;
+
+#include "twine.h"
+#include "MemBuf.h"
+#include "Mutex.h"
+#include "Thread.h"
+#include "Socket.h"
+#include "LogMsg.h"
+
+namespace SLib {
+
+/** Every frame sent to a LogCollector starts with these 4 bytes, followed by the payload length
+  * and the record count as 4 byte network order integers, and then the records themselves as
+  * written by LogMsg::Encode.  The collector answers each frame with the record count once the
+  * records are safely in its log file.
+  */
+#define LOGSHIP_MAGIC "SLG1"
+
+/// The size of the frame header
+#define LOGSHIP_HEADER_SIZE 12
+
+/// The largest frame payload we will accept
+#define LOGSHIP_MAX_FRAME (64 * 1024 * 1024)
+
+/**
+  * This class is a log sink that ships log messages over a Socket to a LogCollector process,
+  * rather than each process writing its own log file.  Messages handed to Ship() are queued
+  * and our background thread sends them in batches, each encoded as one binary frame.  A batch
+  * is only forgotten once the collector has acknowledged it.
+  * <P>
+  * If the collector can't be reached, batches are appended to a local spool file and sent
+  * ahead of anything new once the collector comes back.  If messages arrive faster than we can
+  * get rid of them, Ship() blocks for a while when the queue is full, which slows the
+  * producers down rather than letting the queue grow without limit.
+  * <P>
+  * To send everything that is logged through here, use Log::SetShipper().
+  *
+  * @author Steven M. Cherry
+  */
+class DLLEXPORT LogShipper
+{
+	private:
+		/// copy constructor is private to prevent use
+		LogShipper(const LogShipper& c) {}
+
+		/// assignmet operator is private to prevent use
+		LogShipper& operator=(const LogShipper& c) { return *this;}
+
+	public:
+		/** Standard constructor.  Pass in where the collector is listening, and the name of
+		  * the file to spool to when it can't be reached.
+		  */
+		LogShipper(const twine& host, int port, const twine& spoolFileName);
+
+		/** Standard destructor - sends (or spools) everything that is queued, and stops our
+		  * thread.
+		  */
+		virtual ~LogShipper();
+
+		/// The most messages we put into one frame.  The default is 500.
+		void setBatchSize( size_t batchSize );
+
+		/// How long (in milliseconds) a message may wait for a batch to fill up.  The default is 250.
+		void setBatchTime( size_t batchTime );
+
+		/// The most messages we hold in memory.  The default is 10,000.
+		void setMaxQueue( size_t maxQueue );
+
+		/** How long (in milliseconds) Ship() will wait for room in a full queue.  After that
+		  * the message is dropped and counted.  Use 0 to wait forever.  The default is 1000.
+		  */
+		void setMaxBlock( size_t maxBlock );
+
+		/// Queues a message to be sent.  We take ownership of the message.
+		void Ship( LogMsg* lm );
+
+		/// Waits until everything queued so far has been sent to the collector or spooled.
+		void Flush();
+
+		/// The number of messages the collector has acknowledged
+		size_t Sent();
+
+		/// The number of messages written to the spool file
+		size_t Spooled();
+
+		/// The number of messages dropped because the queue was full
+		size_t Dropped();
+
+	protected:
+
+		/// Connects to the collector if we are not connected.  Returns false if we can't.
+		bool connect();
+
+		/// Drops our connection, and waits a while before trying again.
+		void disconnect();
+
+		/// Sends one frame and waits for it to be acknowledged.  Returns false on any failure.
+		bool sendFrame( const char* frame, size_t len, uint32_t count );
+
+		/// Sends a frame to the collector, after anything in the spool file.  Spools it if that fails.
+		void deliver( MemBuf& frame, uint32_t count );
+
+		/// Sends everything in the spool file.  Returns false if we could not send all of it.
+		bool replaySpool();
+
+		/// Appends a frame to the spool file
+		void spool( const char* frame, size_t len, uint32_t count );
+
+		/// The main loop of our background thread
+		void threadLoop();
+
+		/// The entry point for our background thread
+		static void* threadStart(void* arg);
+
+	private:
+
+		/// Protects everything below that our thread and Ship() share
+		Mutex* m_mutex;
+
+#ifndef _WIN32
+		/// Signalled when messages are queued, when room is made in the queue, and when we stop
+		pthread_cond_t m_cond;
+#endif
+
+		/// Our background thread
+		Thread* m_thread;
+
+		/// Tells our background thread to exit
+		bool m_stop;
+
+		/// Is our background thread working on a batch right now?
+		bool m_busy;
+
+		/// Messages waiting to be sent
+		deque<LogMsg*> m_queue;
+
+		/// Batching and backpressure settings
+		size_t m_batchSize;
+		size_t m_batchTime;
+		size_t m_maxQueue;
+		size_t m_maxBlock;
+
+		/// Statistics
+		size_t m_sent;
+		size_t m_spooled;
+		size_t m_dropped;
+
+		/// Where the collector is listening
+		twine m_host;
+		int m_port;
+
+		/// Where we spool batches that we can't send
+		twine m_spoolFileName;
+
+		/// Our connection to the collector - only used by our thread
+		Socket* m_sock;
+
+		/// When we may next try to connect, and how long to wait after the next failure
+		time_t m_nextConnect;
+		int m_backoff;
+
+};
+
+} // End Namespace SLib
+
+#endif // LOGSHIPPER_H Defined
@@ -0,0 +1,157 @@
+ /*
+  * Copyright (c) 2001,2002 Steven M. Cherry. All rights reserved.
+  *
+  * This file is a part of slib - a c++ utility library
+  *
+  * The slib project, including all files needed to compile
+  * it, is free software; you can redistribute it and/or use it and/or modify
+  * it under the terms of the GNU Lesser General Public License as published by
+  * the Free Software Foundation.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program.  See file COPYING for details.
+  */
+
+#include "LogWatcher.h"
+#include "File.h"
+#include "Tools.h"
+
+#ifdef __linux__
+#include <sys/inotify.h>
+#include <poll.h>
+#include <unistd.h>
+#include <time.h>
+#include <sys/stat.h>
+#endif
+
+using namespace SLib;
+
+LogWatcher::LogWatcher(const twine& logFileName)
+{
+	m_dir = File::Directory( logFileName );
+	if(m_dir.empty()){
+		m_dir = ".";
+	}
+	m_name = File::FileName( logFileName );
+	m_fd = -1;
+	m_wd = -1;
+	m_ino = 0;
+
+#ifdef __linux__
+	m_fd = inotify_init1( IN_NONBLOCK | IN_CLOEXEC );
+	if(m_fd >= 0){
+		// Watch the directory rather than the file, so that we see the -wal file and
+		// the log file being rotated out from under us.
+		m_wd = inotify_add_watch( m_fd, m_dir(),
+			IN_MODIFY | IN_CLOSE_WRITE | IN_CREATE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE );
+		if(m_wd < 0){
+			close( m_fd );
+			m_fd = -1;
+		}
+	}
+	replaced(); // remember the file we are starting with
+#endif
+}
+
+LogWatcher::~LogWatcher()
+{
+#ifdef __linux__
+	if(m_fd >= 0){
+		close( m_fd ); // this removes the watch as well
+	}
+#endif
+}
+
+bool LogWatcher::Native()
+{
+	return m_fd >= 0;
+}
+
+bool LogWatcher::replaced()
+{
+#ifdef __linux__
+	struct stat st;
+	twine path = File::PathCombine( m_dir, m_name );
+	unsigned long ino = 0;
+	if(stat( path(), &st ) == 0){
+		ino = (unsigned long)st.st_ino;
+	}
+	if(ino == m_ino){
+		return false;
+	}
+	m_ino = ino;
+	return true;
+#else
+	return false;
+#endif
+}
+
+#ifdef __linux__
+static long logwatcher_now_ms()
+{
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC, &ts );
+	return (long)ts.tv_sec * 1000 + ts.tv_nsec / 1000000;
+}
+#endif
+
+int LogWatcher::Wait(int timeout)
+{
+	if(m_fd < 0){
+		Tools::msleep( timeout );
+		return LOGWATCH_CHANGED;
+	}
+
+#ifdef __linux__
+	twine wal = m_name + "-wal";
+	twine journal = m_name + "-journal";
+	long deadline = logwatcher_now_ms() + timeout;
+	int ret = LOGWATCH_TIMEOUT;
+	while(ret == LOGWATCH_TIMEOUT){
+		long remaining = deadline - logwatcher_now_ms();
+		if(remaining <= 0){
+			break;
+		}
+		struct pollfd pfd;
+		pfd.fd = m_fd;
+		pfd.events = POLLIN;
+		pfd.revents = 0;
+		if(poll( &pfd, 1, (int)remaining ) <= 0){
+			continue; // timed out or interrupted - the deadline check sorts it out
+		}
+
+		// Read everything that is waiting, so one batch of writes only wakes us once.
+		char buf[4096] __attribute__ ((aligned(__alignof__(struct inotify_event))));
+		ssize_t len;
+		while((len = read( m_fd, buf, sizeof(buf) )) > 0){
+			for(char* p = buf; p < buf + len; ){
+				struct inotify_event* ev = (struct inotify_event*)p;
+				p += sizeof(struct inotify_event) + ev->len;
+				if(ev->len == 0){
+					continue;
+				}
+				if(m_name == ev->name){
+					if(ev->mask & (IN_CREATE | IN_MOVED_FROM | IN_MOVED_TO | IN_DELETE)){
+						if(replaced()){
+							ret = LOGWATCH_REPLACED;
+						}
+					} else if(ret == LOGWATCH_TIMEOUT){
+						ret = LOGWATCH_CHANGED;
+					}
+				} else if((wal == ev->name || journal == ev->name) && ret == LOGWATCH_TIMEOUT){
+					if(ev->mask & (IN_MODIFY | IN_CLOSE_WRITE)){
+						ret = LOGWATCH_CHANGED;
+					}
+				}
+			}
+		}
+	}
+	return ret;
+#else
+	return LOGWATCH_CHANGED;
+#endif
+}
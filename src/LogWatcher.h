@@ -0,0 +1,102 @@
+#ifndef LOGWATCHER_H
+#define LOGWATCHER_H
+ /*
+  * Copyright (c) 2001,2002 Steven M. Cherry. All rights reserved.
+  *
+  * This file is a part of slib - a c++ utility library
+  *
+  * The slib project, including all files needed to compile
+  * it, is free software; you can redistribute it and/or use it and/or modify
+  * it under the terms of the GNU Lesser General Public License as published by
+  * the Free Software Foundation.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program.  See file COPYING for details.
+  */
+
+#ifdef _WIN32
+#	ifndef DLLEXPORT
+#		define DLLEXPORT __declspec(dllexport)
+#	endif
+#else
+#	define DLLEXPORT
+#endif
+
+#include "twine.h"
+
+namespace SLib {
+
+/// LogWatcher::Wait timed out without seeing anything
+#define LOGWATCH_TIMEOUT 0
+
+/// The log file (or its write-ahead-log) was written to
+#define LOGWATCH_CHANGED 1
+
+/// The log file was renamed, deleted or re-created - re-open it to keep following it.  This is
+/// only reported once for each new file.
+#define LOGWATCH_REPLACED 2
+
+/**
+  * This class lets a reader like SLogDump sleep until a LogFile2 log file is written to,
+  * rather than polling the database.  On Linux we use inotify on the directory that holds
+  * the log file, and wake up for writes to the file or its -wal and -journal files, and when
+  * the file is rotated.  On other platforms Wait() simply sleeps for the timeout and reports
+  * a change, so the caller behaves the way a polling loop would.
+  *
+  * @author Steven M. Cherry
+  */
+class DLLEXPORT LogWatcher
+{
+	private:
+		/// copy constructor is private to prevent use
+		LogWatcher(const LogWatcher& c) {}
+
+		/// assignmet operator is private to prevent use
+		LogWatcher& operator=(const LogWatcher& c) { return *this;}
+
+	public:
+		/// Standard constructor.  Pass in the name of the log file to watch.
+		LogWatcher(const twine& logFileName);
+
+		/// Standard destructor
+		virtual ~LogWatcher();
+
+		/** Waits up to timeout milliseconds for the log file to change.  Returns one of
+		  * LOGWATCH_TIMEOUT, LOGWATCH_CHANGED or LOGWATCH_REPLACED.
+		  */
+		int Wait(int timeout);
+
+		/// Returns true if we are being woken up by the OS, rather than just sleeping.
+		bool Native();
+
+	private:
+
+		/// The directory that holds the log file
+		twine m_dir;
+
+		/// The file name of the log file, without the directory
+		twine m_name;
+
+		/// Our inotify descriptor, or -1
+		int m_fd;
+
+		/// Our inotify watch on m_dir, or -1
+		int m_wd;
+
+		/// The inode of the log file when we last looked, or 0 if it wasn't there
+		unsigned long m_ino;
+
+		/** Checks whether the log file is a different file than it was the last time we
+		  * looked, and remembers the one that is there now.
+		  */
+		bool replaced();
+
+};
+
+} // End Namespace SLib
+
+#endif // LOGWATCHER_H Defined
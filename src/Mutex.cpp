@@ -21,8 +21,30 @@
 #include "Mutex.h"
 #include "Log.h"
 #include "AnException.h"
+#include "Timer.h"
 using namespace SLib;
 
+void Mutex::profiledLock(void) {
+	const char* site = LockProfile::CurrentSite();
+#ifdef _WIN32
+	bool got = WaitForSingleObject(m_mut, 0) == WAIT_OBJECT_0;
+#else
+	bool got = pthread_mutex_trylock(&m_mut) == 0;
+#endif
+	if(!got){
+		// Whoever noted themselves as the holder last is most likely holding it now.
+		const char* holder = m_holder.load(std::memory_order_relaxed);
+		uint64_t start = Timer::GetRawCycleCount();
+#ifdef _WIN32
+		WaitForSingleObject(m_mut, INFINITE);
+#else
+		pthread_mutex_lock(&m_mut);
+#endif
+		LockProfile::RecordWait(m_profile, m_name, Timer::GetRawCycleCount() - start, holder);
+	}
+	m_holder.store(site, std::memory_order_relaxed);
+}
+
 
 void Mutex::lock(long timeout) {
 #ifdef _WIN32
@@ -26,7 +26,10 @@
 #	define DLLEXPORT 
 #endif
 
+#include <atomic>
+
 #include "Thread.h"
+#include "LockProfile.h"
 
 namespace SLib {
 
@@ -44,6 +47,10 @@ namespace SLib {
   *       As much as possible has been in-lined in this class so that
   *       we get the benefits of a common abstraction interface without
   *       any extra overhead.
+  *       <P>
+  *       When LockProfile is turned on, every lock that has to wait is
+  *       timed and recorded there under the name given to the constructor,
+  *       along with the EnEx method that was holding the mutex.
   * @author Steven M. Cherry
   * @version $Revision: 1.1.1.1 $
   * @copyright 2002 Steven M. Cherry
@@ -60,11 +67,18 @@ class DLLEXPORT Mutex
 		  *       was compiled for.
 		  */
 		Mutex() {
-#ifdef _WIN32
-			m_mut = CreateMutex(NULL, FALSE, NULL);
-#else
-			pthread_mutex_init(&m_mut, NULL);
-#endif
+			init(NULL);
+		}
+
+		/**
+		  * @memo This constructor also gives the mutex a name, which
+		  *       is what LockProfile reports it as.
+		  * @doc  This constructor also gives the mutex a name, which
+		  *       is what LockProfile reports it as.  The name is not
+		  *       copied, so it should be a string literal.
+		  */
+		Mutex(const char* name) {
+			init(name);
 		}
 
 		/**
@@ -90,6 +104,10 @@ class DLLEXPORT Mutex
 		  * @doc  This function will lock the mutex.
 		  */
 		void lock(void) {
+			if(LockProfile::ProfilingOn()){
+				profiledLock();
+				return;
+			}
 #ifdef _WIN32
 			WaitForSingleObject(m_mut, INFINITE);
 #else
@@ -116,6 +134,14 @@ class DLLEXPORT Mutex
 #endif
 		}
 
+		/**
+		  * @memo Returns the name given to the constructor, or NULL.
+		  * @doc  Returns the name given to the constructor, or NULL.
+		  */
+		const char* name(void) {
+			return m_name;
+		}
+
 		/** Direct access to the mutex itself.
 		  */
 #ifdef _WIN32
@@ -128,12 +154,36 @@ class DLLEXPORT Mutex
 
 	private:
 
+		/// Shared by both constructors
+		void init(const char* name) {
+			m_name = name;
+			m_holder.store(NULL, std::memory_order_relaxed);
+			m_profile.store(NULL, std::memory_order_relaxed);
+#ifdef _WIN32
+			m_mut = CreateMutex(NULL, FALSE, NULL);
+#else
+			pthread_mutex_init(&m_mut, NULL);
+#endif
+		}
+
+		/// The version of lock that is used while LockProfile is on
+		void profiledLock(void);
+
 #ifdef _WIN32
 		HANDLE m_mut;
 #else
 		pthread_mutex_t m_mut;
 #endif
 
+		/// Our name for LockProfile, or NULL
+		const char* m_name;
+
+		/// The EnEx method that last locked us while LockProfile was on
+		std::atomic<const char*> m_holder;
+
+		/// Where LockProfile keeps our counters
+		std::atomic<LockProfileEntry*> m_profile;
+
 };
 				  
 } // End namespace
@@ -0,0 +1,114 @@
+ /*
+  * Copyright (c) 2001,2002 Steven M. Cherry. All rights reserved.
+  *
+  * This file is a part of slib - a c++ utility library
+  *
+  * The slib project, including all files needed to compile
+  * it, is free software; you can redistribute it and/or use it and/or modify
+  * it under the terms of the GNU Lesser General Public License as published by
+  * the Free Software Foundation.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program.  See file COPYING for details.
+  */
+
+#include <atomic>
+#include <exception>
+#include <memory>
+
+#include "Parallel.h"
+#include "AnException.h"
+#include "EventCount.h"
+
+using namespace SLib;
+
+/** What the threads working on one parallel_chunks call share.  Pool tasks that start after
+  * every chunk has been handed out may still look at this after the call returns, so it is
+  * reference counted.  They never touch body unless they got a chunk, and the call doesn't
+  * return until every chunk that was handed out is finished.
+  */
+struct ParallelState {
+	size_t chunks;
+	const std::function<void(size_t)>* body;
+
+	/// The next chunk to hand out, and the number that are finished
+	std::atomic<size_t> next;
+	std::atomic<size_t> done;
+
+	/// The first exception thrown by a chunk
+	std::atomic<bool> failed;
+	std::exception_ptr error;
+
+	/// Where the caller waits for the last chunks to finish
+	EventCount finished;
+};
+
+/// Runs chunks until there are none left to hand out.
+static void parallel_work(ParallelState* s)
+{
+	while(true){
+		size_t chunk = s->next.fetch_add( 1 );
+		if(chunk >= s->chunks){
+			return;
+		}
+		if(!s->failed.load()){
+			try {
+				(*s->body)( chunk );
+			} catch (...){
+				bool expected = false;
+				if(s->failed.compare_exchange_strong( expected, true )){
+					s->error = std::current_exception();
+				}
+			}
+		}
+		if(s->done.fetch_add( 1 ) + 1 == s->chunks){
+			s->finished.notifyAll();
+		}
+	}
+}
+
+void SLib::parallel_chunks(size_t chunks, const std::function<void(size_t)>& body, ThreadPool& pool)
+{
+	if(chunks == 0){
+		return;
+	}
+	if(chunks == 1){
+		body( 0 );
+		return;
+	}
+
+	std::shared_ptr<ParallelState> s( new ParallelState() );
+	s->chunks = chunks;
+	s->body = &body;
+	s->next.store( 0 );
+	s->done.store( 0 );
+	s->failed.store( false );
+
+	// The calling thread takes chunks too, so we only need help with the rest.
+	size_t helpers = std::min( chunks - 1, pool.Size() );
+	for(size_t i = 0; i < helpers; i++){
+		try {
+			pool.execute( [s]() { parallel_work( s.get() ); } );
+		} catch (AnException&){
+			break; // the pool is shutting down - we'll do the rest ourselves
+		}
+	}
+	parallel_work( s.get() );
+
+	while(s->done.load() < chunks){
+		uint32_t key = s->finished.prepareWait();
+		if(s->done.load() >= chunks){
+			s->finished.cancelWait();
+			break;
+		}
+		s->finished.wait( key );
+	}
+
+	if(s->failed.load()){
+		std::rethrow_exception( s->error );
+	}
+}
@@ -0,0 +1,168 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+ /*
+  * Copyright (c) 2001,2002 Steven M. Cherry. All rights reserved.
+  *
+  * This file is a part of slib - a c++ utility library
+  *
+  * The slib project, including all files needed to compile
+  * it, is free software; you can redistribute it and/or use it and/or modify
+  * it under the terms of the GNU Lesser General Public License as published by
+  * the Free Software Foundation.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program.  See file COPYING for details.
+  */
+
+#ifdef _WIN32
+#	ifndef DLLEXPORT
+#		define DLLEXPORT __declspec(dllexport)
+#	endif
+#else
+#	define DLLEXPORT
+#endif
+
+#include <stddef.h>
+#include <vector>
+#include <algorithm>
+#include <iterator>
+#include <functional>
+using namespace std;
+
+#include "ThreadPool.h"
+
+/**
+  * Parallel versions of the simple loops we write all the time.  Each one splits its range
+  * into chunks of grain items, and runs the chunks on a ThreadPool - ThreadPool::Global()
+  * unless another pool is given.
+  * <P>
+  * The calling thread works through chunks alongside the pool, so these can be called from
+  * inside a pool task without tying up a worker waiting for the others.  If any chunk throws,
+  * the chunks that haven't started yet are skipped, and the first exception is rethrown to
+  * the caller once the chunks that had started are finished.
+  * <P>
+  * Choose a grain that makes each chunk worth at least a few microseconds of work.  For
+  * example, to count the lines in a list of files:
+  * <pre>
+  *    size_t lines = parallel_reduce( 0, files.size(), 1, (size_t)0,
+  *        [&](size_t lo, size_t hi) {
+  *            size_t n = 0;
+  *            for(size_t i = lo; i < hi; i++) n += File( files[i] ).readLines().size();
+  *            return n;
+  *        },
+  *        [](size_t a, size_t b) { return a + b; }
+  *    );
+  * </pre>
+  */
+
+namespace SLib {
+
+/** Runs body( chunk ) for every chunk from 0 to chunks - 1, on the pool and the calling
+  * thread together, and returns once they have all finished.  This is what the templates
+  * below are built on.
+  */
+DLLEXPORT void parallel_chunks(size_t chunks, const std::function<void(size_t)>& body, ThreadPool& pool);
+
+/** Calls fn( i ) for every i from begin up to (but not including) end.
+  */
+template <class F>
+void parallel_for(size_t begin, size_t end, size_t grain, F fn, ThreadPool& pool = ThreadPool::Global())
+{
+	if(end <= begin){
+		return;
+	}
+	if(grain == 0){
+		grain = 1;
+	}
+	size_t chunks = (end - begin + grain - 1) / grain;
+	parallel_chunks( chunks, [&](size_t chunk) {
+		size_t lo = begin + chunk * grain;
+		size_t hi = std::min( end, lo + grain );
+		for(size_t i = lo; i < hi; i++){
+			fn( i );
+		}
+	}, pool );
+}
+
+/** Calls fn( lo, hi ) for each chunk of the range, and combines what they return.  Each chunk's
+  * result is kept in place, and they are combined in order on the calling thread once every
+  * chunk is done, so for a given grain the answer is exactly the same on every run, however
+  * many threads there are and whichever of them ran each chunk.  That matters for floating
+  * point sums, where the order of the additions changes the result.
+  */
+template <class T, class F, class C>
+T parallel_reduce(size_t begin, size_t end, size_t grain, T identity, F fn, C combine,
+	ThreadPool& pool = ThreadPool::Global())
+{
+	if(end <= begin){
+		return identity;
+	}
+	if(grain == 0){
+		grain = 1;
+	}
+	size_t chunks = (end - begin + grain - 1) / grain;
+	vector<T> partials( chunks, identity );
+	parallel_chunks( chunks, [&](size_t chunk) {
+		size_t lo = begin + chunk * grain;
+		size_t hi = std::min( end, lo + grain );
+		partials[ chunk ] = fn( lo, hi );
+	}, pool );
+
+	T ret = identity;
+	for(size_t i = 0; i < chunks; i++){
+		ret = combine( ret, partials[ i ] );
+	}
+	return ret;
+}
+
+/** Sorts the range with comp.  Chunks of grain items are sorted at the same time, and then
+  * merged together in pairs, with the pairs in each round also merged at the same time.
+  * Like std::sort, this is not a stable sort.
+  */
+template <class RandomIt, class Compare>
+void parallel_sort(RandomIt first, RandomIt last, Compare comp, size_t grain = 16384,
+	ThreadPool& pool = ThreadPool::Global())
+{
+	size_t count = (size_t)std::distance( first, last );
+	if(grain == 0){
+		grain = 1;
+	}
+	if(count <= grain){
+		std::sort( first, last, comp );
+		return;
+	}
+	size_t chunks = (count + grain - 1) / grain;
+	parallel_chunks( chunks, [&](size_t chunk) {
+		size_t lo = chunk * grain;
+		size_t hi = std::min( count, lo + grain );
+		std::sort( first + lo, first + hi, comp );
+	}, pool );
+
+	for(size_t width = grain; width < count; width *= 2){
+		size_t pairs = (count + 2 * width - 1) / (2 * width);
+		parallel_chunks( pairs, [&](size_t pair) {
+			size_t lo = pair * 2 * width;
+			size_t mid = std::min( count, lo + width );
+			size_t hi = std::min( count, lo + 2 * width );
+			if(mid < hi){
+				std::inplace_merge( first + lo, first + mid, first + hi, comp );
+			}
+		}, pool );
+	}
+}
+
+/// Sorts the range with operator<
+template <class RandomIt>
+void parallel_sort(RandomIt first, RandomIt last)
+{
+	typedef typename std::iterator_traits<RandomIt>::value_type V;
+	parallel_sort( first, last, std::less<V>() );
+}
+
+} // End Namespace SLib
+
+#endif // PARALLEL_H Defined
@@ -22,10 +22,11 @@
 #include "Lock.h"
 #include "Log.h"
 #include "AnException.h"
+#include "Timer.h"
 using namespace SLib;
 
-template <class DataType, class PoolInfo, class NewDataType, class FreeDataType>
-Pool<DataType, PoolInfo, NewDataType, FreeDataType>::
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType, class ValidDataType>
+Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>::
 Pool()
 {
 	TRACE(FL, "Enter Pool::Pool()");
@@ -34,8 +35,41 @@ Pool()
 	m_grow_by = 5;
 	m_max_size = 100;
 
-	// Now actually create the lists:
-	m_pool = new vector < pair <DataType, int> * > ;
+	// Now actually create the slots and the free list:
+	for(int i = 0; i < POOL_MAX_CHUNKS; i++){
+		m_chunks[i].store(NULL);
+	}
+	m_count.store(0);
+	m_free_head.store(0);
+
+	// And the index that Release uses to find things:
+	m_index.store(NULL);
+	m_index_readers.store(0);
+	IndexRebuild(m_max_size);
+
+	m_in_use.store(0);
+	m_peak_in_use.store(0);
+	m_acquires.store(0);
+	m_waits.store(0);
+	m_timeouts.store(0);
+	m_wait_cycles.store(0);
+	m_max_wait_cycles.store(0);
+	m_idle_evictions.store(0);
+	m_expired.store(0);
+	m_invalid.store(0);
+	m_prewarmed.store(0);
+	m_live.store(0);
+
+	// The background thread isn't started until something needs it.
+	m_idle_timeout.store(0);
+	m_max_lifetime.store(0);
+	m_validate_acquire.store(false);
+	m_validate_idle.store(false);
+	m_prewarm_pct.store(0);
+	m_interval.store(1000);
+	m_thread = NULL;
+	m_prewarm.store(false);
+	m_stop.store(false);
 
 	// Initialize the mutex:
 	m_mut = new Mutex();
@@ -43,215 +77,469 @@ Pool()
 	TRACE(FL, "Exit Pool::Pool()");
 }
 
-template <class DataType, class PoolInfo, class NewDataType, class FreeDataType>
-Pool<DataType, PoolInfo, NewDataType, FreeDataType>::
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType, class ValidDataType>
+Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>::
 ~Pool()
 {
 	TRACE(FL, "Enter Pool::~Pool()");
 
-	for(int i = 0; i < (int)m_pool->size(); i++){
-		m_free((*m_pool)[i]->first);
-		delete (*m_pool)[i];
+	if(m_thread != NULL){
+		m_stop.store(true);
+		m_wake.notifyAll();
+		m_thread->join();
+		delete m_thread;
+	}
+
+	for(int i = 0; i < m_count.load(); i++){
+		if(Slot(i)->state.load() != 2){
+			m_free(Slot(i)->obj);
+		}
+	}
+	for(int i = 0; i < POOL_MAX_CHUNKS; i++){
+		delete [] m_chunks[i].load();
+	}
+	m_retired.push_back(m_index.load());
+	for(size_t i = 0; i < m_retired.size(); i++){
+		delete [] m_retired[i]->keys;
+		delete [] m_retired[i]->slots;
+		delete m_retired[i];
 	}
-	delete m_pool;
 	delete m_mut;
 
 	TRACE(FL, "Exit Pool::~Pool()");
 }
 
-template <class DataType, class PoolInfo, class NewDataType, class FreeDataType>
-void Pool<DataType, PoolInfo, NewDataType, FreeDataType>::
-CreateNewObj(int locked)
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType, class ValidDataType>
+PoolSlot<DataType>* Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>::
+Slot(int idx)
 {
-	pair < DataType, int > *apair;
-	int i;
-	Lock the_lock;
+	return m_chunks[idx / POOL_CHUNK_SIZE].load(std::memory_order_acquire) +
+		(idx % POOL_CHUNK_SIZE);
+}
 
-	TRACE(FL, "Enter Pool::CreateNewObj()");
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType, class ValidDataType>
+int Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>::
+PopFree(void)
+{
+	uint64_t head = m_free_head.load(std::memory_order_acquire);
+	while(true){
+		uint32_t top = (uint32_t)head;
+		if(top == 0){
+			return -1;
+		}
+		// Slots are never freed, so reading next is safe even if someone
+		// beats us to this one.  The tag in the high bits catches that.
+		uint64_t next = ((head >> 32) + 1) << 32 |
+			Slot(top - 1)->next.load(std::memory_order_relaxed);
+		if(m_free_head.compare_exchange_weak(head, next,
+			std::memory_order_acquire, std::memory_order_acquire)
+		){
+			Slot(top - 1)->state.store(1, std::memory_order_relaxed);
+			return (int)top - 1;
+		}
+	}
+}
 
-	// Acquire the mutex
-	if(locked == 0)
-		the_lock.SetMutex(m_mut);
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType, class ValidDataType>
+void Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>::
+PushFree(int idx)
+{
+	PoolSlot<DataType>* slot = Slot(idx);
+	slot->state.store(0, std::memory_order_relaxed);
+	uint64_t head = m_free_head.load(std::memory_order_relaxed);
+	while(true){
+		slot->next.store((uint32_t)head, std::memory_order_relaxed);
+		uint64_t next = ((head >> 32) + 1) << 32 | (uint64_t)(idx + 1);
+		if(m_free_head.compare_exchange_weak(head, next,
+			std::memory_order_release, std::memory_order_relaxed)
+		){
+			return;
+		}
+	}
+}
 
-	// Check to see if we have any destroyed obj's that we can re-build
-	for(i = 0; i < (int)m_pool->size(); i ++) {
-		if ( (*m_pool)[i]->second == 2) {
-			try {
-				(*m_pool)[i]->first = m_new(m_init_info);
-				(*m_pool)[i]->second = 0;
-			} catch (AnException e) {
-				e.AddMsg("Pool Caught exception creating object");
-				TRACE(FL, "Exit Pool::CreateNewObj()");
-				throw;
-			}
-			return ;
+/// Spreads pointer values out over the buckets of a PoolIndex
+static inline size_t pool_hash(uintptr_t key)
+{
+	return (size_t)((uint64_t)(key >> 3) * 0x9E3779B97F4A7C15ULL >> 16);
+}
+
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType, class ValidDataType>
+int Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>::
+FindSlot(DataType dt)
+{
+	uintptr_t key = (uintptr_t)dt;
+	int ret = -1;
+
+	// IndexRebuild won't free an index while we are counted here.
+	m_index_readers.fetch_add(1);
+	PoolIndex* index = m_index.load();
+	for(size_t b = pool_hash(key) & index->mask; ; b = (b + 1) & index->mask){
+		uintptr_t k = index->keys[b].load(std::memory_order_acquire);
+		if(k == 0){
+			break;
+		}
+		if(k == key){
+			ret = index->slots[b].load(std::memory_order_relaxed);
+			break;
 		}
 	}
-				
-	// Last, if we are still under the max cap, then
-	// add a brand new DB to the list:
-	if((int)m_pool->size() >= m_max_size){
-		throw AnException(0, FL,
-				  "No more pool objects available.  Reached "
-				  "Pool max of %d", m_max_size);
+	m_index_readers.fetch_sub(1);
+	return ret;
+}
+
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType, class ValidDataType>
+void Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>::
+IndexAdd(DataType dt, int idx)
+{
+	PoolIndex* index = m_index.load();
+	if((index->used + 1) * 2 > index->mask + 1){
+		IndexRebuild(m_count.load() + 1);
+		index = m_index.load();
 	}
-		
-	for(i = 0; i < m_grow_by; i++){
-		if((int)m_pool->size() >= m_max_size)
-			break;	
-		try {
-			apair = new pair < DataType , int>;
-			DEBUG(FL, "calling m_new");
-			apair->first = m_new(m_init_info);
-			apair->second = 0;
-			DEBUG(FL, "adding new obj to m_pool");
-			m_pool->push_back(apair);
-		} catch (AnException e) {
-			e.AddMsg("Pool Caught exception creating object");
-			TRACE(FL, "Exit Pool::CreateNewObj()");
-			throw;
+	uintptr_t key = (uintptr_t)dt;
+	for(size_t b = pool_hash(key) & index->mask; ; b = (b + 1) & index->mask){
+		uintptr_t k = index->keys[b].load(std::memory_order_relaxed);
+		if(k == 0 || k == 1){
+			if(k == 0){
+				index->used ++;
+			}
+			index->slots[b].store(idx, std::memory_order_relaxed);
+			index->keys[b].store(key, std::memory_order_release);
+			return;
 		}
 	}
+}
 
-	TRACE(FL, "Exit Pool::CreateNewObj()");
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType, class ValidDataType>
+void Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>::
+IndexRemove(DataType dt)
+{
+	PoolIndex* index = m_index.load();
+	uintptr_t key = (uintptr_t)dt;
+	for(size_t b = pool_hash(key) & index->mask; ; b = (b + 1) & index->mask){
+		uintptr_t k = index->keys[b].load(std::memory_order_relaxed);
+		if(k == 0){
+			return;
+		}
+		if(k == key){
+			// Leave a marker, so that lookups for keys further along keep going.
+			index->keys[b].store(1, std::memory_order_release);
+			return;
+		}
+	}
 }
 
-template <class DataType, class PoolInfo, class NewDataType, class FreeDataType>
-DataType Pool<DataType, PoolInfo, NewDataType, FreeDataType>::
-Acquire(void)
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType, class ValidDataType>
+void Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>::
+IndexRebuild(size_t count)
+{
+	// Keep the index at most a quarter full after a rebuild.
+	size_t buckets = 64;
+	while(buckets < count * 4){
+		buckets *= 2;
+	}
+	PoolIndex* index = new PoolIndex();
+	index->mask = buckets - 1;
+	index->used = 0;
+	index->keys = new std::atomic<uintptr_t>[ buckets ];
+	index->slots = new std::atomic<int>[ buckets ];
+	for(size_t b = 0; b < buckets; b++){
+		index->keys[b].store(0, std::memory_order_relaxed);
+		index->slots[b].store(-1, std::memory_order_relaxed);
+	}
+
+	PoolIndex* old = m_index.load();
+	if(old != NULL){
+		for(size_t b = 0; b <= old->mask; b++){
+			uintptr_t key = old->keys[b].load(std::memory_order_relaxed);
+			if(key < 2){
+				continue;
+			}
+			size_t nb = pool_hash(key) & index->mask;
+			while(index->keys[nb].load(std::memory_order_relaxed) != 0){
+				nb = (nb + 1) & index->mask;
+			}
+			index->slots[nb].store(old->slots[b].load(std::memory_order_relaxed), std::memory_order_relaxed);
+			index->keys[nb].store(key, std::memory_order_relaxed);
+			index->used ++;
+		}
+		m_retired.push_back(old);
+	}
+	m_index.store(index);
+
+	// Anyone who starts a lookup after the store above sees the new index,
+	// so if nobody is in the middle of one, the old ones can go.
+	if(m_index_readers.load() == 0){
+		for(size_t i = 0; i < m_retired.size(); i++){
+			delete [] m_retired[i]->keys;
+			delete [] m_retired[i]->slots;
+			delete m_retired[i];
+		}
+		m_retired.clear();
+	}
+}
+
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType, class ValidDataType>
+void Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>::
+CountInUse(void)
 {
-	int i;
+	int now = m_in_use.fetch_add(1, std::memory_order_relaxed) + 1;
+	int peak = m_peak_in_use.load(std::memory_order_relaxed);
+	while(now > peak && !m_peak_in_use.compare_exchange_weak(peak, now,
+		std::memory_order_relaxed)
+	){
+		// peak was re-loaded by the failed exchange
+	}
+	m_acquires.fetch_add(1, std::memory_order_relaxed);
+}
 
-	TRACE(FL, "Enter Pool::Acquire()");
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType, class ValidDataType>
+void Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>::
+CountWait(uint64_t startCycles)
+{
+	uint64_t waited = Timer::GetRawCycleCount() - startCycles;
+	m_waits.fetch_add(1, std::memory_order_relaxed);
+	m_wait_cycles.fetch_add(waited, std::memory_order_relaxed);
+	uint64_t most = m_max_wait_cycles.load(std::memory_order_relaxed);
+	while(waited > most && !m_max_wait_cycles.compare_exchange_weak(most, waited,
+		std::memory_order_relaxed)
+	){
+		// most was re-loaded by the failed exchange
+	}
+}
 
-	// Acquire the mutex:
-	Lock the_lock(m_mut);
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType, class ValidDataType>
+bool Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>::
+Grow(void)
+{
+	TRACE(FL, "Enter Pool::Grow()");
 
-	// Walk the list and find an available connection
-	for(i=0; i < (int)m_pool->size(); i++){
-		if( (*m_pool)[i]->second == 0 ){
-			(*m_pool)[i]->second = 1;
-			TRACE(FL, "Exit Pool::Acquire()");
-			return (*m_pool)[i]->first;
+	// Check to see if we have any destroyed obj's that we can re-build
+	if(!m_destroyed.empty()){
+		int idx = m_destroyed.back();
+		try {
+			Slot(idx)->obj = m_new(m_init_info);
+		} catch (AnException& e) {
+			e.AddMsg("Pool Caught exception creating object");
+			TRACE(FL, "Exit Pool::Grow()");
+			throw;
 		}
+		m_destroyed.pop_back();
+		Slot(idx)->createdNs = Timer::NowNs();
+		Slot(idx)->releasedNs.store(Slot(idx)->createdNs);
+		IndexAdd(Slot(idx)->obj, idx);
+		m_live.fetch_add(1);
+		PushFree(idx);
+		TRACE(FL, "Exit Pool::Grow()");
+		return true;
 	}
 
-	// If that didn't work, then try and create a new connection:
-	CreateNewObj(1);	
-
-	// CreateNewDB will throw an exception if we've reached our max
-	// db connection limit.  So if we get here, then there should be
-	// an available db in the list now.
+	// Last, if we are still under the max cap, then
+	// add brand new objects to the list:
+	if(m_count.load() >= m_max_size){
+		TRACE(FL, "Exit Pool::Grow()");
+		return false;
+	}
 
-	// Walk the list and find an available connection
-	for(i=0; i < (int)m_pool->size(); i++){
-		if( (*m_pool)[i]->second == 0 ){
-			(*m_pool)[i]->second = 1;
-			TRACE(FL, "Exit Pool::Acquire()");
-			return (*m_pool)[i]->first;
+	for(int i = 0; i < m_grow_by || i == 0; i++){
+		int idx = m_count.load();
+		if(idx >= m_max_size)
+			break;
+		if(m_chunks[idx / POOL_CHUNK_SIZE].load() == NULL){
+			m_chunks[idx / POOL_CHUNK_SIZE].store(new PoolSlot<DataType>[ POOL_CHUNK_SIZE ]);
 		}
+		PoolSlot<DataType>* slot = Slot(idx);
+		try {
+			DEBUG(FL, "calling m_new");
+			slot->obj = m_new(m_init_info);
+		} catch (AnException& e) {
+			e.AddMsg("Pool Caught exception creating object");
+			TRACE(FL, "Exit Pool::Grow()");
+			throw;
+		}
+		DEBUG(FL, "adding new obj to the pool");
+		slot->state.store(0);
+		slot->next.store(0);
+		slot->createdNs = Timer::NowNs();
+		slot->releasedNs.store(slot->createdNs);
+		IndexAdd(slot->obj, idx);
+		m_count.store(idx + 1);
+		m_live.fetch_add(1);
+		PushFree(idx);
 	}
 
-	// If we get to here, then our logic has failed and the programmer
-	// needs to be slapped, or get some sleep.  either one. ;-)
-	throw AnException(0, FL, "Could not find available DB "
-		"connection. Logic problem.");
+	TRACE(FL, "Exit Pool::Grow()");
+	return true;
 }
 
-template <class DataType, class PoolInfo, class NewDataType, class FreeDataType>
-void Pool<DataType, PoolInfo, NewDataType, FreeDataType>::
-Release(DataType dt)
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType, class ValidDataType>
+void Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>::
+CreateNewObj(int locked)
 {
+	Lock the_lock;
+
+	TRACE(FL, "Enter Pool::CreateNewObj()");
+
 	// Acquire the mutex
-	DEBUG(FL, "Acquiring mutex.");
-	Lock the_lock(m_mut);
+	if(locked == 0)
+		the_lock.SetMutex(m_mut);
 
-	int i;
+	if(!Grow()){
+		throw AnException(0, FL,
+				  "No more pool objects available.  Reached "
+				  "Pool max of %d", m_max_size);
+	}
 
-	TRACE(FL, "Enter Pool::Release(DataType dt)");
+	TRACE(FL, "Exit Pool::CreateNewObj()");
+}
 
-	// Walk the list and find a matching connection
-	for(i=0; i < (int)m_pool->size(); i++){
-		if( ( (*m_pool)[i]->second == 1 ) && 
-		    ( (*(*m_pool)[i]->first) == (*dt) ) )
-		{
-			(*m_pool)[i]->second = 0;
-			TRACE(FL, "Exit Pool::Release()");
-			return;
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType, class ValidDataType>
+DataType Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>::
+Acquire(void)
+{
+	while(true){
+		int idx = PopFree();
+		if(idx < 0){
+			// If that didn't work, then try and create a new object.  Someone
+			// else may have done that while we waited for the lock.
+			Lock the_lock(m_mut);
+			idx = PopFree();
+			if(idx < 0){
+				// CreateNewObj will throw an exception if we've reached our max
+				// object limit.  Otherwise there is something on the free list
+				// now, unless another thread takes it first.
+				CreateNewObj(1);
+				continue;
+			}
+		}
+		if(CheckOut(idx)){
+			return Slot(idx)->obj;
 		}
 	}
+}
 
-	// If we get here then the object given to us was not in our pool.
-	// That's a caller error:
-	throw AnException(0, FL, "The Object given was not in our pool.");
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType, class ValidDataType>
+DataType Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>::
+Acquire(int timeout)
+{
+	uint64_t start = 0;
+	bool waited = false;
+
+	while(true){
+		int idx = PopFree();
+		if(idx < 0){
+			Lock the_lock(m_mut);
+			idx = PopFree();
+			if(idx < 0 && Grow()){
+				continue;
+			}
+		}
+		if(idx < 0){
+			// We are at our max, so wait for a Release or a Remove.
+			if(!waited){
+				waited = true;
+				start = Timer::GetRawCycleCount();
+			}
+			uint32_t key = m_avail.prepareWait();
+			idx = PopFree();
+			if(idx >= 0){
+				m_avail.cancelWait();
+			} else {
+				bool canGrow;
+				{
+					// A Remove or SetMaxSize since we looked lets us build one.
+					Lock the_lock(m_mut);
+					canGrow = !m_destroyed.empty() || m_count.load() < m_max_size;
+				}
+				if(canGrow){
+					m_avail.cancelWait();
+					continue;
+				}
+				double left = (double)timeout -
+					Timer::CyclesToNs((double)(Timer::GetRawCycleCount() - start)) / 1000000.0;
+				if(left <= 0.0){
+					m_avail.cancelWait();
+					m_timeouts.fetch_add(1, std::memory_order_relaxed);
+					CountWait(start);
+					return NULL;
+				}
+				m_avail.wait(key, (int)left + 1);
+				continue;
+			}
+		}
+		if(CheckOut(idx)){
+			if(waited){
+				CountWait(start);
+			}
+			return Slot(idx)->obj;
+		}
+	}
 }
 
-template <class DataType, class PoolInfo, class NewDataType, class FreeDataType>
-void Pool<DataType, PoolInfo, NewDataType, FreeDataType>::
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType, class ValidDataType>
+void Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>::
+Release(DataType dt)
+{
+	int idx = FindSlot(dt);
+	int inuse = 1;
+	if(idx < 0 || !Slot(idx)->state.compare_exchange_strong(inuse, 0)){
+		// If we get here then the object given to us was not in our pool,
+		// or it was not handed out.  That's a caller error:
+		throw AnException(0, FL, "The Object given was not in our pool.");
+	}
+	m_in_use.fetch_sub(1, std::memory_order_relaxed);
+
+	uint64_t now = Timer::NowNs();
+	if(Expired(idx, now)){
+		Lock the_lock(m_mut);
+		Destroy(idx);
+		m_expired.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	Slot(idx)->releasedNs.store(now, std::memory_order_relaxed);
+	PushFree(idx);
+	m_avail.notifyOne();
+}
+
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType, class ValidDataType>
+void Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>::
 Remove(DataType dt)
 {
 	// Acquire the mutex
 	DEBUG(FL, "Acquiring mutex.");
 	Lock the_lock(m_mut);
 
-	int i;
-
 	TRACE(FL, "Enter Pool::Remove(DataType dt)");
 
-	// Walk the list and find a matching connection
-	for(i=0; i < (int)m_pool->size(); i++){
-		if( ( (*m_pool)[i]->second == 1 ) && 
-		    ( (*(*m_pool)[i]->first) == (*dt) ) )
-		{
-			TRACE(FL, "Calling m_free in Pool::Remove()");
-			m_free((*m_pool)[i]->first);
-			TRACE(FL, "Back from m_free in Pool::Remove()");
-			(*m_pool)[i]->second = 2;
-			(*m_pool)[i]->first = NULL;
-			TRACE(FL, "Exit Pool::Remove()");
-			return;
-		}
+	int idx = FindSlot(dt);
+	int inuse = 1;
+	if(idx < 0 || !Slot(idx)->state.compare_exchange_strong(inuse, 2)){
+		// If we get here then the object given to us was not in our pool.
+		// That's a caller error:
+		throw AnException(0, FL, "The Object given was not in our pool.");
 	}
-
-	// If we get here then the object given to us was not in our pool.
-	// That's a caller error:
-	throw AnException(0, FL, "The Object given was not in our pool.");
+	m_in_use.fetch_sub(1, std::memory_order_relaxed);
+	Destroy(idx);
+	TRACE(FL, "Exit Pool::Remove()");
 }
 
-template <class DataType, class PoolInfo, class NewDataType, class FreeDataType>
-int Pool<DataType, PoolInfo, NewDataType, FreeDataType>::
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType, class ValidDataType>
+int Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>::
 GetPoolSize(void)
 {
-	// Acquire the mutex
-	DEBUG(FL, "Acquiring mutex.");
-	Lock the_lock(m_mut);
-	return (int)m_pool->size();
+	return m_live.load();
 }
 
-template <class DataType, class PoolInfo, class NewDataType, class FreeDataType>
-int Pool<DataType, PoolInfo, NewDataType, FreeDataType>::
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType, class ValidDataType>
+int Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>::
 GetInUseSize(void)
 {
-	int i;
-	int count;
-
-	// Acquire the mutex
-	DEBUG(FL, "Acquiring mutex.");
-	Lock the_lock(m_mut);
-
-	count = 0;
-	// Walk the list and find an available connection
-	for(i=0; i < (int)m_pool->size(); i++){
-		if( (*m_pool)[i]->second == 1 ){
-			count ++;
-		}
-	}
-
-	return count;
+	return m_in_use.load();
 }
 
-template <class DataType, class PoolInfo, class NewDataType, class FreeDataType>
-void Pool<DataType, PoolInfo, NewDataType, FreeDataType>::
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType, class ValidDataType>
+void Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>::
 SetMinSize(int newmin)
 {
 	TRACE(FL, "Enter Pool::SetMinSize(int newmin)");
@@ -261,18 +549,16 @@ SetMinSize(int newmin)
 	}
 
 	Lock the_lock(m_mut);
-	if(newmin > (int)m_pool->size()){
-		do {
-			CreateNewObj(1);
-		} while (newmin > (int)m_pool->size());
+	while(newmin > m_live.load()){
+		CreateNewObj(1);
 	}
 
 	m_min_size = newmin;
 	TRACE(FL, "Exit Pool::SetMinSize(int newmin)");
 }
 
-template <class DataType, class PoolInfo, class NewDataType, class FreeDataType>
-void Pool<DataType, PoolInfo, NewDataType, FreeDataType>::
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType, class ValidDataType>
+void Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>::
 SetGrowthFactor(int newgrowth)
 {
 	TRACE(FL, "Enter Pool::SetGrowthFactor(int newgrowth)");
@@ -281,19 +567,354 @@ SetGrowthFactor(int newgrowth)
 	TRACE(FL, "Exit Pool::SetGrowthFactor(int newgrowth)");
 }
 	
-template <class DataType, class PoolInfo, class NewDataType, class FreeDataType>
-void Pool<DataType, PoolInfo, NewDataType, FreeDataType>::
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType, class ValidDataType>
+void Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>::
 SetMaxSize(int newmax)
 {
 	TRACE(FL, "Enter Pool::SetMaxSize(int newmax)");
 
-	if(newmax < (int)m_pool->size()){
+	if(newmax < m_count.load()){
 		throw AnException(0, FL, "New max is smaller than current pool "
 			"size.  Refusing to change max value of %d.", 
 			m_max_size);
 	}
+	if(newmax > POOL_MAX_CHUNKS * POOL_CHUNK_SIZE){
+		throw AnException(0, FL, "New max is larger than the largest "
+			"pool size of %d.", POOL_MAX_CHUNKS * POOL_CHUNK_SIZE);
+	}
 
 	Lock the_lock(m_mut);
 	m_max_size = newmax;
+
+	// Anyone waiting in Acquire may be able to build an object now.
+	m_avail.notifyAll();
 	TRACE(FL, "Exit Pool::SetMaxSize(int newmax)");
 }
+
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType, class ValidDataType>
+PoolStats Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>::
+GetStats(void)
+{
+	PoolStats ret;
+	ret.acquires = m_acquires.load();
+	ret.waits = m_waits.load();
+	ret.timeouts = m_timeouts.load();
+	ret.totalWaitNs = Timer::CyclesToNs((double)m_wait_cycles.load());
+	ret.maxWaitNs = Timer::CyclesToNs((double)m_max_wait_cycles.load());
+	ret.size = m_live.load();
+	ret.inUse = m_in_use.load();
+	ret.peakInUse = m_peak_in_use.load();
+	ret.utilization = m_max_size > 0 ? (double)ret.inUse / (double)m_max_size : 0.0;
+	ret.idleEvictions = m_idle_evictions.load();
+	ret.expired = m_expired.load();
+	ret.invalid = m_invalid.load();
+	ret.prewarmed = m_prewarmed.load();
+	return ret;
+}
+
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType, class ValidDataType>
+bool Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>::
+CheckOut(int idx)
+{
+	if(Expired(idx, Timer::NowNs())){
+		Lock the_lock(m_mut);
+		Destroy(idx);
+		m_expired.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+	if(m_validate_acquire.load(std::memory_order_relaxed) && !m_valid(Slot(idx)->obj)){
+		DEBUG(FL, "Pool validator rejected an object on Acquire");
+		Lock the_lock(m_mut);
+		Destroy(idx);
+		m_invalid.fetch_add(1, std::memory_order_relaxed);
+		return false;
+	}
+	CountInUse();
+	CheckPrewarm();
+	return true;
+}
+
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType, class ValidDataType>
+void Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>::
+Destroy(int idx)
+{
+	DataType obj = Unlink(idx);
+
+	TRACE(FL, "Calling m_free in Pool::Destroy()");
+	m_free(obj);
+	TRACE(FL, "Back from m_free in Pool::Destroy()");
+
+	// Anyone waiting for an object can build a new one in its place.
+	m_avail.notifyOne();
+}
+
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType, class ValidDataType>
+DataType Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>::
+Unlink(int idx)
+{
+	PoolSlot<DataType>* slot = Slot(idx);
+	DataType obj = slot->obj;
+	slot->state.store(2);
+	IndexRemove(obj);
+	slot->obj = NULL;
+	m_destroyed.push_back(idx);
+	m_live.fetch_sub(1);
+	return obj;
+}
+
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType, class ValidDataType>
+bool Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>::
+TakeFree(int idx)
+{
+	// The free list is a stack, so take everything down to idx off it, and put
+	// the others back in the order they were in.
+	vector<int> above;
+	int top;
+	while((top = PopFree()) >= 0 && top != idx){
+		above.push_back(top);
+	}
+	for(int i = (int)above.size() - 1; i >= 0; i--){
+		PushFree(above[i]);
+	}
+	return top == idx;
+}
+
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType, class ValidDataType>
+bool Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>::
+Expired(int idx, uint64_t now)
+{
+	int lifetime = m_max_lifetime.load(std::memory_order_relaxed);
+	return lifetime > 0 && now - Slot(idx)->createdNs > (uint64_t)lifetime * 1000000;
+}
+
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType, class ValidDataType>
+void Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>::
+CheckPrewarm(void)
+{
+	int pct = m_prewarm_pct.load(std::memory_order_relaxed);
+	if(pct == 0){
+		return;
+	}
+	int live = m_live.load(std::memory_order_relaxed);
+	if(m_in_use.load(std::memory_order_relaxed) * 100 >= pct * live && live < m_max_size &&
+		!m_prewarm.exchange(true)
+	){
+		m_wake.notifyOne();
+	}
+}
+
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType, class ValidDataType>
+void Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>::
+SetIdleTimeout(int ms)
+{
+	Lock the_lock(m_mut);
+	m_idle_timeout.store(ms);
+	if(ms > 0){
+		StartMaintenance();
+	}
+}
+
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType, class ValidDataType>
+void Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>::
+SetMaxLifetime(int ms)
+{
+	Lock the_lock(m_mut);
+	m_max_lifetime.store(ms);
+	if(ms > 0){
+		StartMaintenance();
+	}
+}
+
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType, class ValidDataType>
+void Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>::
+SetValidateOnAcquire(bool validate)
+{
+	m_validate_acquire.store(validate);
+}
+
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType, class ValidDataType>
+void Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>::
+SetValidateIdle(bool validate)
+{
+	Lock the_lock(m_mut);
+	m_validate_idle.store(validate);
+	if(validate){
+		StartMaintenance();
+	}
+}
+
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType, class ValidDataType>
+void Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>::
+SetPrewarmThreshold(double fraction)
+{
+	Lock the_lock(m_mut);
+	m_prewarm_pct.store((int)(fraction * 100.0 + 0.5));
+	if(fraction > 0.0){
+		StartMaintenance();
+	}
+}
+
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType, class ValidDataType>
+void Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>::
+SetMaintenanceInterval(int ms)
+{
+	if(ms <= 0){
+		throw AnException(0, FL, "Maintenance interval must be positive, not %d.", ms);
+	}
+	m_interval.store(ms);
+	m_wake.notifyOne();
+}
+
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType, class ValidDataType>
+void Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>::
+StartMaintenance(void)
+{
+	if(m_thread != NULL){
+		return;
+	}
+	m_thread = new Thread();
+	if(m_thread->start(MaintenanceStart, this) != 0){
+		delete m_thread;
+		m_thread = NULL;
+		throw AnException(0, FL, "Unable to start the Pool maintenance thread.");
+	}
+}
+
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType, class ValidDataType>
+void* Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>::
+MaintenanceStart(void* arg)
+{
+	((Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>*)arg)->Maintain();
+	return NULL;
+}
+
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType, class ValidDataType>
+void Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>::
+Maintain(void)
+{
+	uint64_t lastSweep = Timer::NowNs();
+	while(!m_stop.load()){
+		uint32_t key = m_wake.prepareWait();
+		if(m_stop.load() || m_prewarm.load()){
+			m_wake.cancelWait();
+		} else {
+			uint64_t due = lastSweep + (uint64_t)m_interval.load() * 1000000;
+			uint64_t now = Timer::NowNs();
+			if(now < due){
+				m_wake.wait(key, (int)((due - now) / 1000000) + 1);
+			} else {
+				m_wake.cancelWait();
+			}
+		}
+		if(m_stop.load()){
+			break;
+		}
+
+		try {
+			if(m_prewarm.load()){
+				Lock the_lock(m_mut);
+				int before = m_live.load();
+				while(m_live.load() - before < m_grow_by && Grow()){
+				}
+				if(m_live.load() > before){
+					m_prewarmed.fetch_add(m_live.load() - before, std::memory_order_relaxed);
+					m_avail.notifyAll();
+				}
+				m_prewarm.store(false);
+			}
+			if(Timer::NowNs() >= lastSweep + (uint64_t)m_interval.load() * 1000000){
+				Sweep();
+				lastSweep = Timer::NowNs();
+			}
+		} catch (AnException& e){
+			ERRORL(FL, "Pool maintenance caught an exception: %s", e.Msg());
+			m_prewarm.store(false);
+			lastSweep = Timer::NowNs();
+		}
+	}
+}
+
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType, class ValidDataType>
+void Pool<DataType, PoolInfo, NewDataType, FreeDataType, ValidDataType>::
+Sweep(void)
+{
+	TRACE(FL, "Enter Pool::Sweep()");
+
+	int idle = m_idle_timeout.load();
+	bool validate = m_validate_idle.load();
+	uint64_t now = Timer::NowNs();
+
+	// Unlink the objects that are done for, and note the ones the validator has
+	// to look at.  Everything else stays on the free list.
+	vector<DataType> doomed;
+	vector<int> check;
+	{
+		Lock the_lock(m_mut);
+		int spare = m_live.load() - m_min_size;
+		vector<int> keep;
+		int idx;
+		while((idx = PopFree()) >= 0){
+			PoolSlot<DataType>* slot = Slot(idx);
+			if(Expired(idx, now)){
+				doomed.push_back(Unlink(idx));
+				m_expired.fetch_add(1, std::memory_order_relaxed);
+				spare--;
+			} else if(idle > 0 && spare > 0 &&
+				now - slot->releasedNs.load() > (uint64_t)idle * 1000000
+			){
+				doomed.push_back(Unlink(idx));
+				m_idle_evictions.fetch_add(1, std::memory_order_relaxed);
+				spare--;
+			} else {
+				keep.push_back(idx);
+				if(validate){
+					check.push_back(idx);
+				}
+			}
+		}
+		for(int i = (int)keep.size() - 1; i >= 0; i--){
+			PushFree(keep[i]);
+		}
+	}
+	if(!doomed.empty()){
+		m_avail.notifyAll(); // their slots can be re-built now
+	}
+
+	// The validator may be slow, so it runs without our lock, on one object at a
+	// time, while the others stay available to Acquire.
+	for(size_t i = 0; i < check.size(); i++){
+		{
+			Lock the_lock(m_mut);
+			if(!TakeFree(check[i])){
+				continue; // in use, so it isn't idle any more
+			}
+		}
+		if(m_valid(Slot(check[i])->obj)){
+			PushFree(check[i]);
+			m_avail.notifyOne();
+		} else {
+			DEBUG(FL, "Pool validator rejected an idle object");
+			Lock the_lock(m_mut);
+			doomed.push_back(Unlink(check[i]));
+			m_invalid.fetch_add(1, std::memory_order_relaxed);
+			m_avail.notifyOne();
+		}
+	}
+
+	// Nobody can reach these any more, so they are freed without our lock.
+	TRACE(FL, "Calling m_free in Pool::Sweep()");
+	for(size_t i = 0; i < doomed.size(); i++){
+		m_free(doomed[i]);
+	}
+	TRACE(FL, "Back from m_free in Pool::Sweep()");
+
+	{
+		Lock the_lock(m_mut);
+
+		// Replace anything we threw away that takes us below our minimum.
+		while(m_live.load() < m_min_size && Grow()){
+		}
+	}
+	m_avail.notifyAll();
+	TRACE(FL, "Exit Pool::Sweep()");
+}
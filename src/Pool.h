@@ -18,14 +18,121 @@
  * along with this program.  See file COPYING for details.
  */
 
+#include <stdint.h>
 #include <vector>
 #include <utility>
+#include <atomic>
 using namespace std;
 
 #include "Mutex.h"
+#include "Thread.h"
+#include "EventCount.h"
 
 namespace SLib {
 
+/// The number of pooled objects in each block of slots that a Pool allocates
+#define POOL_CHUNK_SIZE 64
+
+/// The most blocks of slots a Pool can have, which caps the max size of any pool
+#define POOL_MAX_CHUNKS 1024
+
+/**
+  * @memo One entry in a Pool: the pooled object and what it is doing.
+  * @doc  One entry in a Pool: the pooled object and what it is doing.
+  *       Slots are never freed or moved until the pool is, so an index
+  *       into them stays good for the life of the pool.
+  */
+template <class DataType>
+struct PoolSlot {
+	/// The pooled object
+	DataType obj;
+
+	/// 0 = available, 1 = in use, 2 = destroyed and waiting to be re-built
+	std::atomic<int> state;
+
+	/// The index of the next slot on the free list, plus one.  0 ends the list.
+	std::atomic<uint32_t> next;
+
+	/// When obj was created, from Timer::NowNs
+	uint64_t createdNs;
+
+	/// When obj was last given back to the pool, from Timer::NowNs
+	std::atomic<uint64_t> releasedNs;
+};
+
+/**
+  * @memo The validator a Pool uses when it isn't given one.
+  * @doc  The validator a Pool uses when it isn't given one.  It says that
+  *       every object is fine.
+  */
+struct PoolNoValidator {
+	template <class DataType>
+	bool operator()(DataType) { return true; }
+};
+
+/**
+  * @memo The table a Pool uses to find the slot that holds a given object.
+  * @doc  The table a Pool uses to find the slot that holds a given object.
+  *       This is an open addressing hash keyed by the object's pointer
+  *       value.  Only the pool mutex holder writes to it, but Release
+  *       reads it without any lock.
+  */
+struct PoolIndex {
+	/// The number of buckets minus one.  The number of buckets is a power of 2.
+	size_t mask;
+
+	/// The buckets that are not empty, including the ones that have been removed
+	size_t used;
+
+	/// 0 = empty, 1 = removed, anything else is the pointer value of an object
+	std::atomic<uintptr_t>* keys;
+
+	/// The slot index that goes with each key
+	std::atomic<int>* slots;
+};
+
+/**
+  * @memo Statistics about how a Pool is being used.
+  * @doc  Statistics about how a Pool is being used.  The counts are since
+  *       the pool was created.
+  */
+struct PoolStats {
+	/// The number of objects handed out by Acquire
+	uint64_t acquires;
+
+	/// The number of Acquire calls that had to wait for an object
+	uint64_t waits;
+
+	/// The number of Acquire calls that gave up waiting
+	uint64_t timeouts;
+
+	/// The total and longest time spent waiting in Acquire, in nanoseconds
+	double totalWaitNs;
+	double maxWaitNs;
+
+	/// The number of objects in the pool, and how many are in use right now
+	int size;
+	int inUse;
+
+	/// The most objects that have been in use at the same time
+	int peakInUse;
+
+	/// The number of objects destroyed because they sat idle too long
+	uint64_t idleEvictions;
+
+	/// The number of objects destroyed because they reached their max lifetime
+	uint64_t expired;
+
+	/// The number of objects destroyed because the validator rejected them
+	uint64_t invalid;
+
+	/// The number of objects created in the background ahead of demand
+	uint64_t prewarmed;
+
+	/// inUse as a fraction of the max size of the pool
+	double utilization;
+};
+
 /**
   * @memo This is the template class for all pools.  It implements all of the
   *       fundamental pooling mechanisms without being specific to the type
@@ -47,15 +154,10 @@ namespace SLib {
   *       To use this pool template, you must do the following:
   *       <ul>
   *         <li>First decide on the object that you need to have pools of.
-  *             This object must at a minimum support the comparison == 
-  *             operator.  This is what is used to find the object when
-  *             it is returned to the pool.  The pool is designed to
-  *             store pointers to these objects.  So when the comparison
-  *             is applied, it is done with the code:
-  *             <pre>
-  *                   (*obj1) == (*obj2)
-  *             </pre>
-  *             </li>
+  *             The pool is designed to store pointers to these objects,
+  *             and it finds an object that is returned to it by its
+  *             pointer value.  So the pointer given to Release or Remove
+  *             must be the same one that Acquire handed out.</li>
   *         <li>Second decide on the data that is necessary to initialize
   *             those objects.  Encapsulate this data in a single object with
   *             the capability of providing that data during the object
@@ -66,8 +168,13 @@ namespace SLib {
   *         <li>Design a function object whose application () operator will
   *             accept a pooled object and handle the destruction of that
   *             object.</li>
+  *         <li>Optionally, design a function object whose application ()
+  *             operator will accept a pooled object and return false if
+  *             it is no longer any good, such as a database connection
+  *             that the server has closed.  If you leave this out, every
+  *             object is assumed to be fine.</li>
   *       </ul>
-  *       Take these four objects and pass them in as parameters to the
+  *       Take these objects and pass them in as parameters to the
   *       instantiation of this pool template and everything else will be
   *       handled for you.
   *       <P>
@@ -147,12 +254,21 @@ namespace SLib {
   *       create and delete PooledObjects.  It will hand them out one at
   *       a time and accept them back when the caller is finished with them.
   *       Using this approach, any type of object may be pooled for use.
+  *       <P>
+  *       Acquire and Release don't take any locks unless the pool has to
+  *       grow.  The available objects are kept on a lock-free stack, and
+  *       Release finds the slot for an object through a hash table, so
+  *       both take the same time however big the pool is.  Acquire with a
+  *       timeout waits for someone to release an object when the pool is
+  *       at its max size, instead of throwing.  GetStats reports how long
+  *       callers have waited and how much of the pool is in use.
   *
   * @author Steven M. Cherry
   * @version $Revision: 1.1.1.1 $
   * @copyright 2002 Steven M. Cherry
   */
-template <class DataType, class PoolInfo, class NewDataType, class FreeDataType>
+template <class DataType, class PoolInfo, class NewDataType, class FreeDataType,
+	class ValidDataType = PoolNoValidator>
 class Pool
 {
 	public:
@@ -184,6 +300,14 @@ class Pool
 		  */
 		virtual DataType Acquire(void);
 
+		/**
+		  * @memo Requests a new object from the pool, waiting up to
+		  *       timeout milliseconds for one if the pool is at its max.
+		  * @doc  Requests a new object from the pool, waiting up to
+		  *       timeout milliseconds for one if the pool is at its max.
+		  *       Returns NULL if no object became available in time.
+		  */
+		virtual DataType Acquire(int timeout);
 
 		/**
 		  * @memo This is the method that programmers will use to
@@ -251,7 +375,69 @@ class Pool
 		  *       size of the pool, then an Exception will be thrown.
 		  */
 		virtual void SetMaxSize(int newmax);
-		
+
+		/**
+		  * @memo Returns the wait time and utilization statistics for
+		  *       this pool.
+		  * @doc  Returns the wait time and utilization statistics for
+		  *       this pool.
+		  */
+		virtual PoolStats GetStats(void);
+
+		/**
+		  * @memo Destroys objects that have been idle for longer than
+		  *       ms milliseconds, down to the min size.
+		  * @doc  Destroys objects that have been idle for longer than
+		  *       ms milliseconds, down to the min size.  0 turns this
+		  *       off, which is the default.
+		  */
+		virtual void SetIdleTimeout(int ms);
+
+		/**
+		  * @memo Destroys objects once they are ms milliseconds old.
+		  * @doc  Destroys objects once they are ms milliseconds old.
+		  *       Idle objects are destroyed in the background, and
+		  *       objects that are in use are destroyed when they are
+		  *       released or acquired.  0 turns this off, which is the
+		  *       default.
+		  */
+		virtual void SetMaxLifetime(int ms);
+
+		/**
+		  * @memo Turns on running the validator for every object
+		  *       before Acquire hands it out.
+		  * @doc  Turns on running the validator for every object
+		  *       before Acquire hands it out.  Objects that fail are
+		  *       destroyed and Acquire moves on to another one.
+		  */
+		virtual void SetValidateOnAcquire(bool validate);
+
+		/**
+		  * @memo Turns on running the validator over idle objects in
+		  *       the background.
+		  * @doc  Turns on running the validator over idle objects in
+		  *       the background.  Objects that fail are destroyed, and
+		  *       replaced if that takes us below the min size.
+		  */
+		virtual void SetValidateIdle(bool validate);
+
+		/**
+		  * @memo Creates more objects in the background once the given
+		  *       fraction of the pool is in use.
+		  * @doc  Creates more objects in the background once the given
+		  *       fraction of the pool is in use.  Each time, up to the
+		  *       growth factor are created, within the max size.  0 turns
+		  *       this off, which is the default.
+		  */
+		virtual void SetPrewarmThreshold(double fraction);
+
+		/**
+		  * @memo Sets how often the background thread checks the idle
+		  *       objects, in milliseconds.
+		  * @doc  Sets how often the background thread checks the idle
+		  *       objects, in milliseconds.  The default is 1000.
+		  */
+		virtual void SetMaintenanceInterval(int ms);
 
 	protected:
 
@@ -265,6 +451,165 @@ class Pool
 		  */
 		void CreateNewObj(int locked=0);
 
+		/**
+		  * @memo Re-builds a destroyed object, or adds up to m_grow_by
+		  *       new ones.  Returns false if we are at our max already.
+		  * @doc  Re-builds a destroyed object, or adds up to m_grow_by
+		  *       new ones, and puts them on the free list.  Returns false
+		  *       if we are at our max already.  The caller must hold
+		  *       m_mut.
+		  */
+		bool Grow(void);
+
+		/**
+		  * @memo Takes a slot off the free list and marks it in use.
+		  * @doc  Takes a slot off the free list and marks it in use.
+		  *       Returns -1 if the free list is empty.
+		  */
+		int PopFree(void);
+
+		/**
+		  * @memo Puts a slot back on the free list.
+		  * @doc  Puts a slot back on the free list.
+		  */
+		void PushFree(int idx);
+
+		/**
+		  * @memo Returns the slot with the given index.
+		  * @doc  Returns the slot with the given index.
+		  */
+		PoolSlot<DataType>* Slot(int idx);
+
+		/**
+		  * @memo Returns the index of the slot that holds dt, or -1.
+		  * @doc  Returns the index of the slot that holds dt, or -1 if
+		  *       it isn't one of ours.  This is safe to call without
+		  *       holding m_mut.
+		  */
+		int FindSlot(DataType dt);
+
+		/**
+		  * @memo Adds dt to our index.  The caller must hold m_mut.
+		  * @doc  Adds dt to our index, making the index bigger if it is
+		  *       getting full.  The caller must hold m_mut.
+		  */
+		void IndexAdd(DataType dt, int idx);
+
+		/**
+		  * @memo Takes dt out of our index.  The caller must hold m_mut.
+		  * @doc  Takes dt out of our index.  The caller must hold m_mut.
+		  */
+		void IndexRemove(DataType dt);
+
+		/**
+		  * @memo Replaces our index with a new one that has room for at
+		  *       least count objects.  The caller must hold m_mut.
+		  * @doc  Replaces our index with a new one that has room for at
+		  *       least count objects, and without any removed buckets.
+		  *       The old one is freed as soon as nobody can be reading
+		  *       it.  The caller must hold m_mut.
+		  */
+		void IndexRebuild(size_t count);
+
+		/**
+		  * @memo Notes that one more object is in use.
+		  * @doc  Notes that one more object is in use, and keeps
+		  *       m_peak_in_use up to date.
+		  */
+		void CountInUse(void);
+
+		/**
+		  * @memo Checks an object that was just taken off the free list.
+		  * @doc  Checks an object that was just taken off the free list
+		  *       against the max lifetime and, if asked, the validator.
+		  *       If it fails, it is destroyed and this returns false.
+		  *       Otherwise it is counted as in use.
+		  */
+		bool CheckOut(int idx);
+
+		/**
+		  * @memo Destroys the object in a slot that nobody else is using.
+		  * @doc  Destroys the object in a slot that nobody else is using,
+		  *       and leaves the slot for Grow to re-build.  The caller must
+		  *       hold m_mut.
+		  */
+		void Destroy(int idx);
+
+		/**
+		  * @memo Takes the object out of a slot without freeing it.
+		  * @doc  Takes the object out of a slot that nobody else is
+		  *       using, and leaves the slot for Grow to re-build straight
+		  *       away.  Returns the object, which the caller must pass to
+		  *       m_free, with or without the lock.  The caller must hold
+		  *       m_mut.
+		  */
+		DataType Unlink(int idx);
+
+		/**
+		  * @memo Takes the given slot off the free list.
+		  * @doc  Takes the given slot off the free list, leaving the
+		  *       rest of the list as it was.  Returns false if the slot
+		  *       isn't on it, because someone has acquired it.  The
+		  *       caller must hold m_mut.
+		  */
+		bool TakeFree(int idx);
+
+		/**
+		  * @memo Returns true if the object in a slot is past its max
+		  *       lifetime.
+		  * @doc  Returns true if the object in a slot is past its max
+		  *       lifetime.
+		  */
+		bool Expired(int idx, uint64_t now);
+
+		/**
+		  * @memo Asks the background thread to create more objects if
+		  *       enough of the pool is in use.
+		  * @doc  Asks the background thread to create more objects if
+		  *       enough of the pool is in use.
+		  */
+		void CheckPrewarm(void);
+
+		/**
+		  * @memo Starts the background thread if it isn't running.
+		  * @doc  Starts the background thread if it isn't running.  The
+		  *       caller must hold m_mut.
+		  */
+		void StartMaintenance(void);
+
+		/**
+		  * @memo The entry point for the background thread.
+		  * @doc  The entry point for the background thread.
+		  */
+		static void* MaintenanceStart(void* arg);
+
+		/**
+		  * @memo The loop that the background thread runs until the
+		  *       pool is destroyed.
+		  * @doc  The loop that the background thread runs until the
+		  *       pool is destroyed.
+		  */
+		void Maintain(void);
+
+		/**
+		  * @memo Checks every idle object for eviction, expiry and
+		  *       validity.
+		  * @doc  Checks every idle object for eviction, expiry and
+		  *       validity, and then tops the pool back up to its min
+		  *       size.  m_mut is only held while the free list is
+		  *       sorted and the index is updated.  The validator checks
+		  *       one object at a time without the lock, while the rest
+		  *       stay on the free list, and m_free runs without the lock
+		  *       too, so that Acquire and Release carry on meanwhile.
+		  */
+		void Sweep(void);
+
+		/**
+		  * @memo Records how long an Acquire call waited.
+		  * @doc  Records how long an Acquire call waited.
+		  */
+		void CountWait(uint64_t startCycles);
+
 		/**
 		  * @memo This is the minimum number of pooled objects.  This
 		  *       many objects will be initialized at startup.
@@ -302,16 +647,88 @@ class Pool
 		Mutex *m_mut;
 
 		/**
-		  * @memo This is the list of pooled objects.
-		  * @doc  This is the list of pooled objects.  The integer
-		  *       member of the pair indicates whether the obj is in
-		  *       use by someone or not.  
-		  *       0 = available.
-		  *       1 = in use.
-		  *       2 = Destroyed object.  Will be re-built,
-		  *           but do not use when in this status.
+		  * @memo These are the slots that hold our pooled objects.
+		  * @doc  These are the slots that hold our pooled objects, in
+		  *       blocks of POOL_CHUNK_SIZE.  Blocks are only added, under
+		  *       m_mut, and never move, so the slots can be read without
+		  *       any lock.
 		  */
-		vector < pair < DataType , int> * > *m_pool;
+		std::atomic<PoolSlot<DataType>*> m_chunks[ POOL_MAX_CHUNKS ];
+
+		/**
+		  * @memo This is the number of slots that we have handed out.
+		  * @doc  This is the number of slots that we have handed out,
+		  *       including the ones holding destroyed objects.
+		  */
+		std::atomic<int> m_count;
+
+		/**
+		  * @memo This is the top of our lock-free stack of available
+		  *       slots.
+		  * @doc  This is the top of our lock-free stack of available
+		  *       slots.  The low 32 bits are the slot index plus one, and
+		  *       the high 32 bits are bumped on every change so that a
+		  *       slot that is popped and pushed back while someone else is
+		  *       looking at the top can't fool them.
+		  */
+		std::atomic<uint64_t> m_free_head;
+
+		/**
+		  * @memo These are the slots whose objects were destroyed by
+		  *       Remove.
+		  * @doc  These are the slots whose objects were destroyed by
+		  *       Remove, and which Grow re-builds before it adds new
+		  *       slots.  Protected by m_mut.
+		  */
+		vector<int> m_destroyed;
+
+		/**
+		  * @memo This is the index we use to find the slot for an
+		  *       object.
+		  * @doc  This is the index we use to find the slot for an
+		  *       object.
+		  */
+		std::atomic<PoolIndex*> m_index;
+
+		/**
+		  * @memo These are old indexes that someone may still be reading.
+		  * @doc  These are old indexes that someone may still be reading.
+		  *       Protected by m_mut.
+		  */
+		vector<PoolIndex*> m_retired;
+
+		/**
+		  * @memo This is the number of threads that are looking at our
+		  *       index without holding m_mut.
+		  * @doc  This is the number of threads that are looking at our
+		  *       index without holding m_mut.
+		  */
+		std::atomic<int> m_index_readers;
+
+		/**
+		  * @memo This is where Acquire waits for an object to be
+		  *       released when the pool is at its max.
+		  * @doc  This is where Acquire waits for an object to be
+		  *       released when the pool is at its max.
+		  */
+		EventCount m_avail;
+
+		/**
+		  * @memo These are the counters behind GetStats.
+		  * @doc  These are the counters behind GetStats.  The wait times
+		  *       are kept in Timer::GetRawCycleCount units.
+		  */
+		std::atomic<int> m_in_use;
+		std::atomic<int> m_peak_in_use;
+		std::atomic<uint64_t> m_acquires;
+		std::atomic<uint64_t> m_waits;
+		std::atomic<uint64_t> m_timeouts;
+		std::atomic<uint64_t> m_wait_cycles;
+		std::atomic<uint64_t> m_max_wait_cycles;
+		std::atomic<uint64_t> m_idle_evictions;
+		std::atomic<uint64_t> m_expired;
+		std::atomic<uint64_t> m_invalid;
+		std::atomic<uint64_t> m_prewarmed;
 
 		/**
 		  * @memo This is the initialization data that is given
@@ -333,6 +750,56 @@ class Pool
 		  */
 		FreeDataType m_free;	
 
+		/**
+		  * @memo This is our instance of the validator function object.
+		  * @doc  This is our instance of the validator function object.
+		  */
+		ValidDataType m_valid;
+
+		/**
+		  * @memo This is the number of live objects in the pool.
+		  * @doc  This is the number of live objects in the pool, which is
+		  *       m_count less the destroyed slots.
+		  */
+		std::atomic<int> m_live;
+
+		/**
+		  * @memo These are the settings for the background thread.
+		  * @doc  These are the settings for the background thread.
+		  *       Times are in milliseconds, and 0 means off.  The prewarm
+		  *       threshold is a percentage.
+		  */
+		std::atomic<int> m_idle_timeout;
+		std::atomic<int> m_max_lifetime;
+		std::atomic<bool> m_validate_acquire;
+		std::atomic<bool> m_validate_idle;
+		std::atomic<int> m_prewarm_pct;
+		std::atomic<int> m_interval;
+
+		/**
+		  * @memo This is our background thread, or NULL if it hasn't
+		  *       been needed yet.
+		  * @doc  This is our background thread, or NULL if it hasn't
+		  *       been needed yet.
+		  */
+		Thread* m_thread;
+
+		/**
+		  * @memo This is where the background thread sleeps.
+		  * @doc  This is where the background thread sleeps between
+		  *       sweeps, and is woken for a prewarm or to stop.
+		  */
+		EventCount m_wake;
+
+		/**
+		  * @memo Set when a prewarm has been asked for, and when the
+		  *       pool is being destroyed.
+		  * @doc  Set when a prewarm has been asked for, and when the
+		  *       pool is being destroyed.
+		  */
+		std::atomic<bool> m_prewarm;
+		std::atomic<bool> m_stop;
+
 };
 
 } // End namespace
@@ -0,0 +1,76 @@
+ /*
+  * Copyright (c) 2001,2002 Steven M. Cherry. All rights reserved.
+  *
+  * This file is a part of slib - a c++ utility library
+  *
+  * The slib project, including all files needed to compile
+  * it, is free software; you can redistribute it and/or use it and/or modify
+  * it under the terms of the GNU Lesser General Public License as published by
+  * the Free Software Foundation.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program.  See file COPYING for details.
+  */
+
+#include "RWMutex.h"
+#include "Timer.h"
+using namespace SLib;
+
+RWMutex::RWMutex(const char* name)
+{
+	m_name = name;
+	m_holder.store( NULL );
+	m_profile.store( NULL );
+#ifdef _WIN32
+	InitializeSRWLock( &m_lock );
+#else
+	pthread_rwlockattr_t attr;
+	pthread_rwlockattr_init( &attr );
+#	ifdef __GLIBC__
+	// glibc lets readers in ahead of waiting writers unless we ask it not to.
+	pthread_rwlockattr_setkind_np( &attr, PTHREAD_RWLOCK_PREFER_WRITER_NONRECURSIVE_NP );
+#	endif
+	pthread_rwlock_init( &m_lock, &attr );
+	pthread_rwlockattr_destroy( &attr );
+#endif
+}
+
+RWMutex::~RWMutex()
+{
+#ifndef _WIN32
+	pthread_rwlock_destroy( &m_lock );
+#endif
+}
+
+void RWMutex::profiledLock(bool write)
+{
+	const char* site = LockProfile::CurrentSite();
+#ifdef _WIN32
+	bool got = write ? TryAcquireSRWLockExclusive( &m_lock ) != 0 : TryAcquireSRWLockShared( &m_lock ) != 0;
+#else
+	bool got = (write ? pthread_rwlock_trywrlock( &m_lock ) : pthread_rwlock_tryrdlock( &m_lock )) == 0;
+#endif
+	if(!got){
+		const char* holder = m_holder.load( std::memory_order_relaxed );
+		uint64_t start = Timer::GetRawCycleCount();
+#ifdef _WIN32
+		if(write){
+			AcquireSRWLockExclusive( &m_lock );
+		} else {
+			AcquireSRWLockShared( &m_lock );
+		}
+#else
+		if(write){
+			pthread_rwlock_wrlock( &m_lock );
+		} else {
+			pthread_rwlock_rdlock( &m_lock );
+		}
+#endif
+		LockProfile::RecordWait( m_profile, m_name, Timer::GetRawCycleCount() - start, holder );
+	}
+	m_holder.store( site, std::memory_order_relaxed );
+}
@@ -0,0 +1,209 @@
+#ifndef RWMUTEX_H
+#define RWMUTEX_H
+ /*
+  * Copyright (c) 2001,2002 Steven M. Cherry. All rights reserved.
+  *
+  * This file is a part of slib - a c++ utility library
+  *
+  * The slib project, including all files needed to compile
+  * it, is free software; you can redistribute it and/or use it and/or modify
+  * it under the terms of the GNU Lesser General Public License as published by
+  * the Free Software Foundation.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program.  See file COPYING for details.
+  */
+
+#ifdef _WIN32
+#	ifndef DLLEXPORT
+#		define DLLEXPORT __declspec(dllexport)
+#	endif
+#else
+#	define DLLEXPORT
+#endif
+
+#include <atomic>
+
+#include "Thread.h"
+#include "LockProfile.h"
+
+namespace SLib {
+
+/**
+  * A reader-writer mutex, for structures that are read far more often than they are changed.
+  * Any number of threads can hold it for reading at the same time, but a thread that holds
+  * it for writing holds it alone.  Use ReadLock and WriteLock rather than calling the lock
+  * methods directly.
+  * <P>
+  * A thread that is waiting to write holds up new readers, so that a steady stream of
+  * readers can't keep writers out forever.  That means a thread must not take a read lock
+  * on a mutex that it already holds for reading, since a writer could arrive in between
+  * and leave both of them waiting on each other.
+  * <P>
+  * This is a pthread_rwlock_t everywhere but Windows, where it is an SRWLOCK.  While
+  * LockProfile is on, waits are recorded there in the same way as for Mutex.
+  *
+  * @author Steven M. Cherry
+  */
+class DLLEXPORT RWMutex
+{
+	private:
+		/// copy constructor is private to prevent use
+		RWMutex(const RWMutex& c) {}
+
+		/// assignmet operator is private to prevent use
+		RWMutex& operator=(const RWMutex& c) { return *this;}
+
+	public:
+		/// Standard constructor.  The name is what LockProfile reports us as, and is not copied.
+		RWMutex(const char* name = NULL);
+
+		/// Standard destructor
+		virtual ~RWMutex();
+
+		/// Waits until no one is writing, and then holds the mutex for reading.
+		void readLock(void) {
+			if(LockProfile::ProfilingOn()){
+				profiledLock(false);
+				return;
+			}
+#ifdef _WIN32
+			AcquireSRWLockShared(&m_lock);
+#else
+			pthread_rwlock_rdlock(&m_lock);
+#endif
+		}
+
+		/// Gives up a read lock.
+		void readUnlock(void) {
+#ifdef _WIN32
+			ReleaseSRWLockShared(&m_lock);
+#else
+			pthread_rwlock_unlock(&m_lock);
+#endif
+		}
+
+		/// Waits until no one is reading or writing, and then holds the mutex for writing.
+		void writeLock(void) {
+			if(LockProfile::ProfilingOn()){
+				profiledLock(true);
+				return;
+			}
+#ifdef _WIN32
+			AcquireSRWLockExclusive(&m_lock);
+#else
+			pthread_rwlock_wrlock(&m_lock);
+#endif
+		}
+
+		/// Gives up a write lock.
+		void writeUnlock(void) {
+#ifdef _WIN32
+			ReleaseSRWLockExclusive(&m_lock);
+#else
+			pthread_rwlock_unlock(&m_lock);
+#endif
+		}
+
+	private:
+
+		/// The versions of the lock methods that are used while LockProfile is on
+		void profiledLock(bool write);
+
+#ifdef _WIN32
+		SRWLOCK m_lock;
+#else
+		pthread_rwlock_t m_lock;
+#endif
+
+		/// Our name for LockProfile, or NULL
+		const char* m_name;
+
+		/// The EnEx method that last locked us while LockProfile was on
+		std::atomic<const char*> m_holder;
+
+		/// Where LockProfile keeps our counters
+		std::atomic<LockProfileEntry*> m_profile;
+};
+
+/**
+  * Holds an RWMutex for reading for as long as this object exists, in the same way that
+  * Lock holds a Mutex.
+  */
+class ReadLock
+{
+	private:
+		/// copy constructor is private to prevent use
+		ReadLock(const ReadLock& c) {}
+
+		/// assignmet operator is private to prevent use
+		ReadLock& operator=(const ReadLock& c) { return *this;}
+
+	public:
+		/// Takes a read lock on the given mutex straight away.
+		ReadLock(RWMutex* the_mutex) {
+			m_mut = the_mutex;
+			m_mut->readLock();
+		}
+
+		/// Gives up the read lock, if we still have it.
+		virtual ~ReadLock() {
+			UnLock();
+		}
+
+		/// Gives up the read lock early.
+		void UnLock() {
+			if(m_mut != NULL){
+				m_mut->readUnlock();
+				m_mut = NULL;
+			}
+		}
+
+	private:
+		RWMutex* m_mut;
+};
+
+/**
+  * Holds an RWMutex for writing for as long as this object exists, in the same way that
+  * Lock holds a Mutex.
+  */
+class WriteLock
+{
+	private:
+		/// copy constructor is private to prevent use
+		WriteLock(const WriteLock& c) {}
+
+		/// assignmet operator is private to prevent use
+		WriteLock& operator=(const WriteLock& c) { return *this;}
+
+	public:
+		/// Takes a write lock on the given mutex straight away.
+		WriteLock(RWMutex* the_mutex) {
+			m_mut = the_mutex;
+			m_mut->writeLock();
+		}
+
+		/// Gives up the write lock, if we still have it.
+		virtual ~WriteLock() {
+			UnLock();
+		}
+
+		/// Gives up the write lock early.
+		void UnLock() {
+			if(m_mut != NULL){
+				m_mut->writeUnlock();
+				m_mut = NULL;
+			}
+		}
+
+	private:
+		RWMutex* m_mut;
+};
+
+} // End Namespace SLib
+
+#endif // RWMUTEX_H Defined
@@ -0,0 +1,379 @@
+#ifndef RINGQUEUE_H
+#define RINGQUEUE_H
+ /*
+  * Copyright (c) 2001,2002 Steven M. Cherry. All rights reserved.
+  *
+  * This file is a part of slib - a c++ utility library
+  *
+  * The slib project, including all files needed to compile
+  * it, is free software; you can redistribute it and/or use it and/or modify
+  * it under the terms of the GNU Lesser General Public License as published by
+  * the Free Software Foundation.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program.  See file COPYING for details.
+  */
+
+#include <stdint.h>
+#include <stddef.h>
+#include <atomic>
+#include <utility>
+#include <thread>
+
+#include "EventCount.h"
+
+namespace SLib {
+
+/// The size we pad to, to keep data written by different threads off the same cache line
+#define SLIB_CACHE_LINE 64
+
+/**
+  * A bounded queue that any number of threads can push to and pop from at once, without
+  * locks.  This is Dmitry Vyukov's bounded MPMC queue: each slot carries a sequence number
+  * that tells producers and consumers whether it is their turn to use it, so a push or pop
+  * is one compare-and-swap on the shared position plus a store to the slot.  Nothing is
+  * allocated after construction.
+  * <P>
+  * The capacity is rounded up to a power of 2.  try_push and try_pop never wait - wrap the
+  * queue in a BlockingRing to have threads sleep when it is full or empty.
+  *
+  * @author Steven M. Cherry
+  */
+template <typename Data>
+class MPMCQueue
+{
+	public:
+		typedef Data value_type;
+
+		/// Standard constructor
+		MPMCQueue(size_t capacity)
+		{
+			m_size = 2;
+			while(m_size < capacity){
+				m_size <<= 1;
+			}
+			m_mask = m_size - 1;
+			m_cells = new Cell[ m_size ];
+			for(size_t i = 0; i < m_size; i++){
+				m_cells[ i ].sequence.store( i, std::memory_order_relaxed );
+			}
+			m_enqueuePos.store( 0, std::memory_order_relaxed );
+			m_dequeuePos.store( 0, std::memory_order_relaxed );
+		}
+
+		/// Standard destructor
+		virtual ~MPMCQueue()
+		{
+			delete [] m_cells;
+		}
+
+		/// Adds an item to the queue.  Returns false if the queue is full.
+		bool try_push(Data const& data)
+		{
+			size_t pos = m_enqueuePos.load( std::memory_order_relaxed );
+			Cell* cell;
+			while(true){
+				cell = &m_cells[ pos & m_mask ];
+				size_t seq = cell->sequence.load( std::memory_order_acquire );
+				intptr_t diff = (intptr_t)seq - (intptr_t)pos;
+				if(diff == 0){
+					// This slot is free - try to claim it.
+					if(m_enqueuePos.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed )){
+						break;
+					}
+				} else if(diff < 0){
+					return false; // the slot still holds an item from a lap ago
+				} else {
+					pos = m_enqueuePos.load( std::memory_order_relaxed );
+				}
+			}
+			cell->data = data;
+			cell->sequence.store( pos + 1, std::memory_order_release );
+			return true;
+		}
+
+		/// Moves the oldest item into out.  Returns false if the queue is empty.
+		bool try_pop(Data& out)
+		{
+			size_t pos = m_dequeuePos.load( std::memory_order_relaxed );
+			Cell* cell;
+			while(true){
+				cell = &m_cells[ pos & m_mask ];
+				size_t seq = cell->sequence.load( std::memory_order_acquire );
+				intptr_t diff = (intptr_t)seq - (intptr_t)(pos + 1);
+				if(diff == 0){
+					if(m_dequeuePos.compare_exchange_weak( pos, pos + 1, std::memory_order_relaxed )){
+						break;
+					}
+				} else if(diff < 0){
+					return false; // nothing has been pushed into this slot yet
+				} else {
+					pos = m_dequeuePos.load( std::memory_order_relaxed );
+				}
+			}
+			out = std::move( cell->data );
+			cell->sequence.store( pos + m_mask + 1, std::memory_order_release );
+			return true;
+		}
+
+		/// The number of items in the queue.  Only a guess while other threads are using it.
+		size_t size_approx(void) const
+		{
+			size_t in = m_enqueuePos.load( std::memory_order_relaxed );
+			size_t out = m_dequeuePos.load( std::memory_order_relaxed );
+			return in > out ? in - out : 0;
+		}
+
+		/// The most items the queue will hold
+		size_t capacity(void) const
+		{
+			return m_size;
+		}
+
+	private:
+		/// copy constructor is private to prevent use
+		MPMCQueue(const MPMCQueue& c) {}
+
+		/// assignment operator is private to prevent use
+		MPMCQueue& operator=(const MPMCQueue& c) { return *this; }
+
+		struct Cell {
+			std::atomic<size_t> sequence;
+			Data data;
+		};
+
+		char m_pad0[ SLIB_CACHE_LINE ];
+		Cell* m_cells;
+		size_t m_size;
+		size_t m_mask;
+		char m_pad1[ SLIB_CACHE_LINE ];
+		std::atomic<size_t> m_enqueuePos;
+		char m_pad2[ SLIB_CACHE_LINE ];
+		std::atomic<size_t> m_dequeuePos;
+		char m_pad3[ SLIB_CACHE_LINE ];
+};
+
+/**
+  * A bounded queue for exactly one producer thread and one consumer thread.  Both sides are
+  * wait-free: a push or pop is a few loads and one release store, with no read-modify-write
+  * at all.  Each side keeps a cached copy of the other side's position, so it only touches
+  * the other side's cache line when the queue looks full (or empty).
+  * <P>
+  * The capacity is rounded up to a power of 2.  Using this from more than one producer or
+  * more than one consumer at a time will lose items - use MPMCQueue for that.
+  *
+  * @author Steven M. Cherry
+  */
+template <typename Data>
+class SPSCQueue
+{
+	public:
+		typedef Data value_type;
+
+		/// Standard constructor
+		SPSCQueue(size_t capacity)
+		{
+			m_size = 2;
+			while(m_size < capacity){
+				m_size <<= 1;
+			}
+			m_mask = m_size - 1;
+			m_slots = new Data[ m_size ];
+			m_head.store( 0, std::memory_order_relaxed );
+			m_tail.store( 0, std::memory_order_relaxed );
+			m_headCache = 0;
+			m_tailCache = 0;
+		}
+
+		/// Standard destructor
+		virtual ~SPSCQueue()
+		{
+			delete [] m_slots;
+		}
+
+		/// Adds an item to the queue.  Only call this from the producer thread.
+		bool try_push(Data const& data)
+		{
+			size_t tail = m_tail.load( std::memory_order_relaxed );
+			if(tail - m_headCache >= m_size){
+				m_headCache = m_head.load( std::memory_order_acquire );
+				if(tail - m_headCache >= m_size){
+					return false; // full
+				}
+			}
+			m_slots[ tail & m_mask ] = data;
+			m_tail.store( tail + 1, std::memory_order_release );
+			return true;
+		}
+
+		/// Moves the oldest item into out.  Only call this from the consumer thread.
+		bool try_pop(Data& out)
+		{
+			size_t head = m_head.load( std::memory_order_relaxed );
+			if(head == m_tailCache){
+				m_tailCache = m_tail.load( std::memory_order_acquire );
+				if(head == m_tailCache){
+					return false; // empty
+				}
+			}
+			out = std::move( m_slots[ head & m_mask ] );
+			m_head.store( head + 1, std::memory_order_release );
+			return true;
+		}
+
+		/// The number of items in the queue.  Only a guess while other threads are using it.
+		size_t size_approx(void) const
+		{
+			size_t tail = m_tail.load( std::memory_order_relaxed );
+			size_t head = m_head.load( std::memory_order_relaxed );
+			return tail > head ? tail - head : 0;
+		}
+
+		/// The most items the queue will hold
+		size_t capacity(void) const
+		{
+			return m_size;
+		}
+
+	private:
+		/// copy constructor is private to prevent use
+		SPSCQueue(const SPSCQueue& c) {}
+
+		/// assignment operator is private to prevent use
+		SPSCQueue& operator=(const SPSCQueue& c) { return *this; }
+
+		char m_pad0[ SLIB_CACHE_LINE ];
+		Data* m_slots;
+		size_t m_size;
+		size_t m_mask;
+
+		/// Written by the consumer, along with its cached copy of the tail
+		char m_pad1[ SLIB_CACHE_LINE ];
+		std::atomic<size_t> m_head;
+		size_t m_tailCache;
+
+		/// Written by the producer, along with its cached copy of the head
+		char m_pad2[ SLIB_CACHE_LINE ];
+		std::atomic<size_t> m_tail;
+		size_t m_headCache;
+		char m_pad3[ SLIB_CACHE_LINE ];
+};
+
+/// How many times BlockingRing retries, yielding the CPU in between, before it goes to sleep
+#define SLIB_RING_SPINS 64
+
+/**
+  * Adds blocking push and pop to an MPMCQueue or SPSCQueue.  A thread that finds the queue
+  * full (or empty) retries briefly, giving up its time slice between tries so the other side
+  * can run.  Then it sleeps on an EventCount until the other side makes room (or adds
+  * something), so idle consumers don't burn a CPU.  The other side only pays for a wakeup
+  * when someone is actually asleep.
+  * <P>
+  * The try_ versions never wait, and are as cheap as those of the underlying queue plus a
+  * check for sleepers.
+  *
+  * @author Steven M. Cherry
+  */
+template <class Ring>
+class BlockingRing
+{
+	public:
+		typedef typename Ring::value_type Data;
+
+		/// Standard constructor
+		BlockingRing(size_t capacity) : m_ring( capacity ) {}
+
+		/// Standard destructor
+		virtual ~BlockingRing() {}
+
+		/// Adds an item, waiting for room if the queue is full.
+		void push(Data const& data)
+		{
+			for(int i = 0; i < SLIB_RING_SPINS; i++){
+				if(try_push( data )){
+					return;
+				}
+				std::this_thread::yield();
+			}
+			while(true){
+				uint32_t key = m_notFull.prepareWait();
+				if(m_ring.try_push( data )){
+					m_notFull.cancelWait();
+					break;
+				}
+				m_notFull.wait( key );
+			}
+			m_notEmpty.notifyOne();
+		}
+
+		/// Moves the oldest item into out, waiting for one if the queue is empty.
+		void pop(Data& out)
+		{
+			for(int i = 0; i < SLIB_RING_SPINS; i++){
+				if(try_pop( out )){
+					return;
+				}
+				std::this_thread::yield();
+			}
+			while(true){
+				uint32_t key = m_notEmpty.prepareWait();
+				if(m_ring.try_pop( out )){
+					m_notEmpty.cancelWait();
+					break;
+				}
+				m_notEmpty.wait( key );
+			}
+			m_notFull.notifyOne();
+		}
+
+		/// Adds an item if there is room for it.  Returns false if the queue is full.
+		bool try_push(Data const& data)
+		{
+			if(!m_ring.try_push( data )){
+				return false;
+			}
+			m_notEmpty.notifyOne();
+			return true;
+		}
+
+		/// Moves the oldest item into out if there is one.  Returns false if the queue is empty.
+		bool try_pop(Data& out)
+		{
+			if(!m_ring.try_pop( out )){
+				return false;
+			}
+			m_notFull.notifyOne();
+			return true;
+		}
+
+		/// The number of items in the queue.  Only a guess while other threads are using it.
+		size_t size_approx(void) const
+		{
+			return m_ring.size_approx();
+		}
+
+		/// The most items the queue will hold
+		size_t capacity(void) const
+		{
+			return m_ring.capacity();
+		}
+
+	private:
+		/// copy constructor is private to prevent use
+		BlockingRing(const BlockingRing& c) {}
+
+		/// assignment operator is private to prevent use
+		BlockingRing& operator=(const BlockingRing& c) { return *this; }
+
+		Ring m_ring;
+		EventCount m_notEmpty;
+		EventCount m_notFull;
+};
+
+} // End Namespace SLib
+
+#endif // RINGQUEUE_H Defined
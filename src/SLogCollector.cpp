@@ -0,0 +1,77 @@
+/* ***************************************************************************
+
+   Copyright (c): 2008 - 2012 Viaserv, Inc.
+
+   License: Restricted
+
+   Authors: Steven M. Cherry, Stephen D. Sager
+
+*************************************************************************** */
+
+#include <stdlib.h>
+#include <stdio.h>
+#ifndef _WIN32
+#include <signal.h>
+#endif
+
+#include "twine.h"
+#include "Tools.h"
+#include "LogFile2.h"
+#include "LogCollector.h"
+using namespace SLib;
+
+static volatile bool m_stop = false;
+
+#ifndef _WIN32
+static void handleSignal(int sig)
+{
+	m_stop = true;
+}
+#endif
+
+void printUsage(char* appName)
+{
+	printf( "Usage: %s port logFile\n", appName);
+	printf(
+	"Listens on the given port for processes that use a LogShipper, and writes\n"
+	"everything they send to the given log file.  Use SLogDump to read it.\n"
+	"Stop it with Ctrl-C.\n"
+	);
+}
+
+int main(int argc, char** argv)
+{
+	if(argc != 3){
+		printUsage(argv[0]);
+		return 0;
+	}
+
+#ifndef _WIN32
+	// A shipper that goes away while we are acknowledging it should not kill us.
+	signal( SIGPIPE, SIG_IGN );
+	signal( SIGINT, handleSignal );
+	signal( SIGTERM, handleSignal );
+#endif
+
+	try {
+		twine port( argv[1] );
+		twine logFileName( argv[2] );
+		LogFile2 lf( logFileName );
+		LogCollector collector( (int)port.get_int(), lf );
+		collector.Start();
+		printf("Collecting log messages on port %s into %s\n", argv[1], argv[2] );
+
+		while(!m_stop){
+			Tools::msleep( 250 );
+		}
+
+		collector.Stop();
+		lf.flush();
+		printf("Received %d messages\n", (int)collector.Received() );
+	} catch (AnException& e){
+		printf("Error: %s\n", e.Msg() );
+		return 1;
+	}
+
+	return 0;
+}
@@ -19,13 +19,28 @@
 #include "dptr.h"
 #include "Timer.h"
 #include "LogFile2.h"
+#include "ZipFile.h"
+#include "TmpFile.h"
+#include "LogWatcher.h"
+#include "File.h"
+#include "Lock.h"
+#include "EventCount.h"
+
+#include <algorithm>
+#include <thread>
 using namespace SLib;
 
+/// The size of our output buffers
+#define SLOGDUMP_OUTBUF (1024 * 1024)
+
 twine m_machineName;
 twine m_appName;
 twine m_threadID;
 int matchThreadID;
 twine m_message;
+twine m_match;
+twine m_fromTime;
+twine m_untilTime;
 bool m_panic;
 bool m_error;
 bool m_warn;
@@ -45,16 +60,29 @@ bool m_display_appsession;
 bool m_show_stringtable;
 bool m_dump_data;
 bool m_watch_mode;
+bool m_rotated;
+int m_jobs;
+vector<twine> m_logFiles;
+vector<twine> m_fieldFilters;
+twine m_statsField;
+twine m_countsField;
 
 void printUsage(char* appName)
 {
-	printf( "Usage: %s logFile <options>\n", appName);
+	printf( "Usage: %s logFile [logFile ...] <options>\n", appName);
 	printf(
 	"Where options include the following:\n"
 	"\t-m MachineName Use this to filter on MachineName\n"
 	"\t-a AppName     Use this to filter on Application Name\n"
 	"\t-t ThreadID    Use this to filter on a thread ID\n"
 	"\t-s Message     Use this to filter on message text\n"
+	"\t-S Expression  Use this to full text search messages (log file needs a text index)\n"
+	"\t-F name<op>value Use this to filter on a structured field, op is one of = != < <= > >=\n"
+	"\t               (may be repeated, e.g. -F latency_ms>100 -F status=500)\n"
+	"\t-A Field       Use this to show count/min/max/sum/avg of a field instead of messages\n"
+	"\t-G Field       Use this to show the message count for each value of a field instead of messages\n"
+	"\t-f \"YYYY/MM/DD HH:MM:SS\" Use this to show messages from this time on\n"
+	"\t-u \"YYYY/MM/DD HH:MM:SS\" Use this to show messages up until this time\n"
 	"\t-c*            Use this to include all log channels (default behaviour)\n"
 	"\t-c0            Use this to include the PANIC log channel\n"
 	"\t-c1            Use this to include the ERROR log channel\n"
@@ -77,6 +105,11 @@ void printUsage(char* appName)
 	"\t-b             Use this to display the string table\n"
 	"\t-x             Use this to export a dump of the message data directly\n"
 	"\t-w             Use this to Watch for new messages\n"
+	"\t-r             Use this to include all of the rotated archives of the logFile\n"
+	"\t-j Jobs        Use this to set how many log files are scanned at once (default is one per CPU)\n"
+	"\n"
+	"More than one logFile may be given, and they are shown in the order given.  A logFile\n"
+	"may also be a rotated archive (logFile.YYYYmmddHHMMSS.zip).\n"
 	"\n");
 }
 
@@ -103,8 +136,38 @@ void getArgs(int argc, char** argv)
 				i++;
 				m_message = argv[i];
 				continue;
+			} else if(argv[i][1] == 'S'){
+				i++;
+				m_match = argv[i];
+				continue;
+			} else if(argv[i][1] == 'F'){
+				i++;
+				m_fieldFilters.push_back( argv[i] );
+				continue;
+			} else if(argv[i][1] == 'A'){
+				i++;
+				m_statsField = argv[i];
+				continue;
+			} else if(argv[i][1] == 'G'){
+				i++;
+				m_countsField = argv[i];
+				continue;
+			} else if(argv[i][1] == 'f'){
+				i++;
+				m_fromTime = argv[i];
+				continue;
+			} else if(argv[i][1] == 'u'){
+				i++;
+				m_untilTime = argv[i];
+				continue;
 			} else if(argv[i][1] == 'w'){
 				m_watch_mode = true;
+			} else if(argv[i][1] == 'r'){
+				m_rotated = true;
+			} else if(argv[i][1] == 'j'){
+				i++;
+				m_jobs = (int)twine(argv[i]).get_int();
+				continue;
 			} else if(argv[i][1] == 'b'){
 				m_show_stringtable = true;
 			} else if(argv[i][1] == 'x'){
@@ -172,56 +235,59 @@ void getArgs(int argc, char** argv)
 				exit(0);
 			}
 		} else {
-			printf("invalid argument: %s\n", argv[i]);
-			printUsage(argv[0]);
-			exit(0);
+			m_logFiles.push_back( argv[i] );
 		}
 	}
 }
 
-void printMessage(LogMsg* lm)
+void printMessage(FILE* out, LogMsg* lm)
 {
 	char local_tmp[32];
 	memset(local_tmp, 0, 32);
 
-	if(m_display_id) printf("%d|", lm->id);
+	if(m_display_id) fprintf(out, "%d|", lm->id);
 
 	if(m_display_date){
 #ifdef _WIN32
 		strftime(local_tmp, 32, "%Y/%m/%d %H:%M:%S", localtime(&(lm->timestamp.time)));
-		printf("%s.%.3d|",
+		fprintf(out, "%s.%.3d|",
 			local_tmp, (int)lm->timestamp.millitm
 		);
 #else
-		strftime(local_tmp, 32, "%Y/%m/%d %H:%M:%S", localtime(&(lm->timestamp.tv_sec)));
-		printf("%s.%.3d|",
+		struct tm local_tm; // several threads may be printing at once
+		strftime(local_tmp, 32, "%Y/%m/%d %H:%M:%S", localtime_r(&(lm->timestamp.tv_sec), &local_tm));
+		fprintf(out, "%s.%.3d|",
 			local_tmp, (int)lm->timestamp.tv_usec
 		);
 #endif
 	}
 
-	if(m_display_machine) printf("%s|", lm->machineName());
-	if(m_display_app) printf("%s|", lm->appName());
-	if(m_display_appsession) printf("%s|", lm->appSession());
-	if(m_display_thread) printf("%ld|", (intptr_t)lm->tid);
-	if(m_display_file) printf("%s|", lm->file());
-	if(m_display_line) printf("%d|", lm->line);
+	if(m_display_machine) fprintf(out, "%s|", lm->machineName());
+	if(m_display_app) fprintf(out, "%s|", lm->appName());
+	if(m_display_appsession) fprintf(out, "%s|", lm->appSession());
+	if(m_display_thread) fprintf(out, "%ld|", (intptr_t)lm->tid);
+	if(m_display_file) fprintf(out, "%s|", lm->file());
+	if(m_display_line) fprintf(out, "%d|", lm->line);
 	if(m_display_channel) {
 		switch(lm->channel){
-			case 0: printf("PANIC|"); break;
-			case 1: printf("ERROR|"); break;
-			case 2: printf("WARN|"); break;
-			case 3: printf("INFO|"); break;
-			case 4: printf("DEBUG|"); break;
-			case 5: printf("TRACE|"); break;
-			case 6: printf("SQLTRACE|"); break;
+			case 0: fprintf(out, "PANIC|"); break;
+			case 1: fprintf(out, "ERROR|"); break;
+			case 2: fprintf(out, "WARN|"); break;
+			case 3: fprintf(out, "INFO|"); break;
+			case 4: fprintf(out, "DEBUG|"); break;
+			case 5: fprintf(out, "TRACE|"); break;
+			case 6: fprintf(out, "SQLTRACE|"); break;
 		}
 	}
-	printf("%s\n", lm->msg() );
+	if(lm->fields.size() == 0){
+		fprintf(out, "%s\n", lm->msg() );
+	} else {
+		fprintf(out, "%s {%s}\n", lm->msg(), lm->FieldsAsText()() );
+	}
 
 }
 
-void filterAndPrint(LogMsg* lm)
+void filterAndPrint(FILE* out, LogMsg* lm)
 {
 	bool filtersMatch = true;
 
@@ -282,9 +348,226 @@ void filterAndPrint(LogMsg* lm)
 	}
 
 	if(filtersMatch){
-		printMessage(lm);
+		printMessage(out, lm);
+	}
+
+}
+
+LogFilter buildFilter(void)
+{
+	// Hand as much of the filtering as we can to the database, so that it can use
+	// the indexes in the log file.  filterAndPrint still checks everything.
+	LogFilter filter;
+	filter.channelMask = 0;
+	if(m_panic) filter.channelMask |= 1 << 0;
+	if(m_error) filter.channelMask |= 1 << 1;
+	if(m_warn) filter.channelMask |= 1 << 2;
+	if(m_info) filter.channelMask |= 1 << 3;
+	if(m_debug) filter.channelMask |= 1 << 4;
+	if(m_trace) filter.channelMask |= 1 << 5;
+	if(m_sqltrace) filter.channelMask |= 1 << 6;
+	filter.tid = (uint32_t)matchThreadID;
+	filter.appName = m_appName;
+	filter.machineName = m_machineName;
+	filter.msgText = m_message;
+	filter.msgMatch = m_match;
+	if(m_fromTime.length() != 0){
+		Date d; d.SetValue( m_fromTime );
+		filter.startTime = d.Epoch();
+	}
+	if(m_untilTime.length() != 0){
+		Date d; d.SetValue( m_untilTime );
+		filter.endTime = d.Epoch();
+	}
+	for(size_t i = 0; i < m_fieldFilters.size(); i++){
+		// Split name<op>value on the first operator character.
+		const twine& f = m_fieldFilters[i];
+		size_t pos = 0;
+		while(pos < f.length() && f[pos] != '=' && f[pos] != '!' && f[pos] != '<' && f[pos] != '>'){
+			pos++;
+		}
+		size_t end = pos;
+		while(end < f.length() && (f[end] == '=' || f[end] == '!' || f[end] == '<' || f[end] == '>')){
+			end++;
+		}
+		filter.addField( f.substr( 0, pos ), f.substr( pos, end - pos ), f.substr( end ) );
+	}
+	return filter;
+}
+
+/// Our LogFile2::forEachMessage callback - data is the FILE* we are writing to
+bool printCallback(LogMsg& msg, void* data)
+{
+	filterAndPrint( (FILE*)data, &msg );
+	return true;
+}
+
+/** Prints everything that matches the filter with an id above filter.afterId.  Returns the
+  * id of the last message we looked at.
+  */
+int printMatching(LogFile2& lf, LogFilter& filter, FILE* out)
+{
+	lf.forEachMessage( filter, printCallback, out );
+	return filter.afterId;
+}
+
+/** Returns the rotated archives of the given log file, oldest first.  These are both the
+  * compressed ones and any that have not been compressed (yet).
+  */
+vector<twine> rotatedFiles(const twine& logFileName)
+{
+	twine dir = File::Directory( logFileName );
+	twine prefix = File::FileName( logFileName ) + ".";
+
+	vector<twine> ret;
+	vector<twine> files = File::listFiles( dir.empty() ? twine(".") : dir );
+	for(size_t i = 0; i < files.size(); i++){
+		if(!files[i].startsWith( prefix ) || files[i].length() <= prefix.length() ||
+			files[i].endsWith( "-wal" ) || files[i].endsWith( "-shm" ) || files[i].endsWith( "-journal" )
+		){
+			continue;
+		}
+		ret.push_back( dir.empty() ? files[i] : File::PathCombine( dir, files[i] ) );
+	}
+	std::sort( ret.begin(), ret.end() );
+	return ret;
+}
+
+/** Opens a log file in read-only mode.  SQLite can't read from inside a zip archive, so a
+  * rotated log file is streamed out to a temporary file that goes away with unzipped.
+  */
+LogFile2* openLog(const twine& logFileName, dptr<TmpFile>& unzipped)
+{
+	twine dbFileName = logFileName;
+	if(logFileName.endsWith(".zip")){
+		unzipped = new TmpFile();
+		ZipFile::ExtractFirstFile( logFileName, *unzipped );
+		dbFileName = unzipped->name();
+	}
+	return new LogFile2(true, dbFileName);
+}
+
+/// One log file to be scanned by our worker threads
+struct ScanJob {
+	twine fileName;
+	FILE* spool;
+	twine error;
+	bool done;
+};
+
+vector<ScanJob> m_scanJobs;
+size_t m_nextJob;
+Mutex m_jobMutex;
+LogFilter m_jobFilter;
+EventCount m_jobDone; ///< Signalled each time a worker finishes a job
+
+/** Each worker picks up the next log file that nobody is working on, and writes what it
+  * finds to its own spool file.  The main thread copies the spool files to stdout in order.
+  */
+void* scanWorker(void* arg)
+{
+	while(true){
+		size_t idx;
+		{
+			Lock theLock(&m_jobMutex);
+			if(m_nextJob >= m_scanJobs.size()){
+				break;
+			}
+			idx = m_nextJob++;
+		}
+
+		ScanJob& job = m_scanJobs[idx];
+		twine error;
+		try {
+			dptr<TmpFile> unzipped;
+			dptr<LogFile2> lf = openLog( job.fileName, unzipped );
+			LogFilter filter = m_jobFilter;
+			printMatching( *lf, filter, job.spool );
+		} catch (AnException& e){
+			error = e.Msg();
+		}
+
+		{
+			Lock theLock(&m_jobMutex);
+			job.error = error;
+			job.done = true;
+		}
+		m_jobDone.notifyAll();
+	}
+	return NULL;
+}
+
+/// Returns true once a worker has finished the given job
+bool jobDone(ScanJob& job)
+{
+	Lock theLock(&m_jobMutex);
+	return job.done;
+}
+
+/// Scans all of our log files, several at a time, and prints the results in order.
+void scanAll(const LogFilter& filter)
+{
+	m_jobFilter = filter;
+	m_nextJob = 0;
+	m_scanJobs.resize( m_logFiles.size() );
+	for(size_t i = 0; i < m_logFiles.size(); i++){
+		m_scanJobs[i].fileName = m_logFiles[i];
+		m_scanJobs[i].done = false;
+		m_scanJobs[i].spool = tmpfile();
+		if(m_scanJobs[i].spool == NULL){
+			throw AnException(0, FL, "Error creating a temporary file for %s", m_logFiles[i]() );
+		}
+		setvbuf( m_scanJobs[i].spool, NULL, _IOFBF, SLOGDUMP_OUTBUF );
+	}
+
+	int jobs = m_jobs;
+	if(jobs <= 0){
+		jobs = (int)std::thread::hardware_concurrency();
+	}
+	if(jobs <= 0){
+		jobs = 4;
+	}
+	if(jobs > (int)m_scanJobs.size()){
+		jobs = (int)m_scanJobs.size();
+	}
+	vector<Thread*> workers;
+	for(int i = 0; i < jobs; i++){
+		Thread* t = new Thread();
+		t->start( scanWorker, NULL );
+		workers.push_back( t );
+	}
+
+	// Print each file as soon as it is finished, in the order they were given.
+	char* buf = (char*)malloc( SLOGDUMP_OUTBUF );
+	for(size_t i = 0; i < m_scanJobs.size(); i++){
+		ScanJob& job = m_scanJobs[i];
+		while(!jobDone( job )){
+			uint32_t key = m_jobDone.prepareWait();
+			if(jobDone( job )){
+				m_jobDone.cancelWait();
+				break;
+			}
+			m_jobDone.wait( key );
+		}
+		if(!job.error.empty()){
+			fflush( stdout );
+			printf("Exception caught reading log file (%s):\n%s\n", job.fileName(), job.error() );
+		}
+		fflush( job.spool );
+		rewind( job.spool );
+		size_t len;
+		while((len = fread( buf, 1, SLOGDUMP_OUTBUF, job.spool )) != 0){
+			fwrite( buf, 1, len, stdout );
+		}
+		fclose( job.spool );
+		job.spool = NULL;
 	}
+	free( buf );
 
+	for(size_t i = 0; i < workers.size(); i++){
+		workers[i]->join();
+		delete workers[i];
+	}
 }
 
 int main(int argc, char** argv)
@@ -294,6 +577,9 @@ int main(int argc, char** argv)
 	m_appName = "";
 	m_threadID = "";
 	m_message = "";
+	m_match = "";
+	m_fromTime = "";
+	m_untilTime = "";
 	m_panic = m_error = m_warn = m_info = m_debug = m_trace = m_sqltrace = true;
 	m_display_id = m_display_date = m_display_machine = m_display_app = 
 		m_display_appsession = 
@@ -301,6 +587,8 @@ int main(int argc, char** argv)
 	m_show_stringtable = false;
 	m_dump_data = false;
 	m_watch_mode = false;
+	m_rotated = false;
+	m_jobs = 0;
 
 	if(argc == 1){
 		printUsage(argv[0]);
@@ -311,6 +599,19 @@ int main(int argc, char** argv)
 	getArgs(argc, argv);
 	matchThreadID = (int)m_threadID.get_int();
 
+	// Put our main log file in the right place among the others.  With -r its rotated
+	// archives go in front of it, oldest first.
+	if(m_rotated){
+		vector<twine> archives = rotatedFiles( logFileName );
+		archives.push_back( logFileName );
+		m_logFiles.insert( m_logFiles.begin(), archives.begin(), archives.end() );
+	} else {
+		m_logFiles.insert( m_logFiles.begin(), logFileName );
+	}
+
+	// Everything we print goes through one large buffer rather than a write per message.
+	setvbuf( stdout, NULL, _IOFBF, SLOGDUMP_OUTBUF );
+
 	printf("=============================================\n");
 
 	if(m_panic) printf("Including Log Channel: PANIC\n");
@@ -324,7 +625,11 @@ int main(int argc, char** argv)
 	if(m_machineName.length() != 0 ||
 		m_appName.length() != 0 ||
 		matchThreadID != 0 ||
-		m_message.length() != 0
+		m_message.length() != 0 ||
+		m_match.length() != 0 ||
+		m_fromTime.length() != 0 ||
+		m_untilTime.length() != 0 ||
+		m_fieldFilters.size() != 0
 	){
 		printf("Filtering on:\n");
 		if(m_machineName.length() != 0){
@@ -339,6 +644,18 @@ int main(int argc, char** argv)
 		if(m_message.length() != 0){
 			printf("Log Message contains: %s\n", m_message() );
 		}
+		if(m_match.length() != 0){
+			printf("Log Message matches: %s\n", m_match() );
+		}
+		if(m_fromTime.length() != 0){
+			printf("Log Time from: %s\n", m_fromTime() );
+		}
+		if(m_untilTime.length() != 0){
+			printf("Log Time until: %s\n", m_untilTime() );
+		}
+		for(size_t i = 0; i < m_fieldFilters.size(); i++){
+			printf("Field: %s\n", m_fieldFilters[i]() );
+		}
 	} else {
 		printf("No filtering applied.\n");
 	}
@@ -346,57 +663,92 @@ int main(int argc, char** argv)
 	printf("=============================================\n");
 
 	try {
-		//printf("Opening log file: %s\n", logFileName() );
-		//printf("=============================================\n");
-		LogFile2 lf(true, logFileName); // open in read-only mode
-
-		//printf("Dumping Index stats and String table:\n");
-		//printf("=============================================\n");
-		if(m_show_stringtable){
-		}
-
-		int oldest = lf.getOldestMessageID();
-		int newest = lf.getNewestMessageID();
-		if(m_watch_mode && ( (newest - oldest) > 20 )){
-			oldest = newest - 20; // only print the last 20 messages
-			if(oldest < 0){
-				oldest = 0;
+		LogFilter filter = buildFilter();
+		if(m_statsField.length() != 0){
+			LogFieldStats stats;
+			for(size_t i = 0; i < m_logFiles.size(); i++){
+				dptr<TmpFile> unzipped;
+				dptr<LogFile2> lf = openLog( m_logFiles[i], unzipped );
+				LogFieldStats one = lf->fieldStats( filter, m_statsField );
+				if(one.count == 0){
+					continue;
+				}
+				if(stats.count == 0 || one.min < stats.min) stats.min = one.min;
+				if(stats.count == 0 || one.max > stats.max) stats.max = one.max;
+				stats.count += one.count;
+				stats.sum += one.sum;
+			}
+			if(stats.count != 0){
+				stats.avg = (double)stats.sum / stats.count;
 			}
+			printf("%s: count=%d min=%lld max=%lld sum=%lld avg=%.3f\n", m_statsField(),
+				stats.count, (long long)stats.min, (long long)stats.max, (long long)stats.sum, stats.avg );
+			return 0;
 		}
-		//printf("Looping over messages %d to %d:\n", oldest, newest);
-		//printf("=============================================\n");
-		for(int i = oldest; i <= newest; i++){
-			//printf("Looking for message: %d\n", i);
-			dptr<LogMsg> lm; lm = lf.getMessage(i);
-			if(lm == NULL) {
-				//printf("\tmessage %d not found!\n", i);
-				continue;
+		if(m_countsField.length() != 0){
+			map<twine, int> counts;
+			for(size_t i = 0; i < m_logFiles.size(); i++){
+				dptr<TmpFile> unzipped;
+				dptr<LogFile2> lf = openLog( m_logFiles[i], unzipped );
+				map<twine, int> one = lf->fieldCounts( filter, m_countsField );
+				for(map<twine, int>::iterator it = one.begin(); it != one.end(); it++){
+					counts[ it->first ] += it->second;
+				}
+			}
+			for(map<twine, int>::iterator it = counts.begin(); it != counts.end(); it++){
+				printf("%s=%s|%d\n", m_countsField(), it->first(), it->second );
 			}
-			filterAndPrint( lm );
-		}			
+			return 0;
+		}
 
-		if(m_dump_data){
+		if(!m_watch_mode){
+			scanAll( filter );
+			fflush( stdout );
+			return 0;
 		}
 
-		if(m_watch_mode){ while(1){
-			Tools::msleep( 100 );
+		// Watch mode only follows the last log file given.  Rather than polling the database,
+		// which takes locks that the writer has to wait for, we sleep until the file is written.
+		logFileName = m_logFiles[ m_logFiles.size() - 1 ];
+		dptr<TmpFile> unzipped;
+		dptr<LogFile2> lf = openLog( logFileName, unzipped );
+		LogWatcher watcher( logFileName );
+
+		int newest = lf->getNewestMessageID();
+		filter.afterId = newest - 21; // only print the last 20 messages
+		if(filter.afterId < 0){
+			filter.afterId = 0;
+		}
+		printMatching( *lf, filter, stdout );
+		fflush( stdout );
+
+		bool reopen = false;
+		while(1){
+			int what = watcher.Wait( 1000 );
+			if(what == LOGWATCH_REPLACED){
+				reopen = true;
+			} else if(what == LOGWATCH_TIMEOUT && !reopen){
+				continue;
+			}
 			try {
-				int new_newest = lf.getNewestMessageID();
-				if(new_newest > newest){
-					for(int i = newest + 1; i <= new_newest; i++){
-						dptr<LogMsg> lm; lm = lf.getMessage(i);
-						if(lm == NULL) continue;
-						filterAndPrint( lm );
-					}
-
-					newest = new_newest;
+				if(reopen){
+					// The log file was rotated.  Pick up anything that was committed to the old
+					// one since we last looked, then follow the new one from the start.  Until
+					// the writer has created it, this throws and we try again next time around.
+					printMatching( *lf, filter, stdout );
+					lf = openLog( logFileName, unzipped );
+					filter.afterId = 0;
+					reopen = false;
 				}
+				printMatching( *lf, filter, stdout );
+				fflush( stdout );
 			} catch (AnException&){
 				// These are because of database locking.  ignore them.
 			}
-		} }
+		}
 
 	} catch (AnException& e){
+		fflush( stdout );
 		printf("Exception caught opening log file (%s):\n%s\n", logFileName(),
 			e.Msg() );
 	}
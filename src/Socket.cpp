@@ -83,6 +83,7 @@ Socket::Socket()
 	/* by another socket class.  It will handle populating   */
 	/* our data for us.                                      */
 	/* ***************************************************** */
+	m_noSigPipe = false;
 }
 
 /* ********************************************************* */
@@ -94,6 +95,7 @@ Socket::Socket()
 Socket::Socket(int port)
 {
 	int err;
+	m_noSigPipe = false;
 
 
 #ifdef _WIN32
@@ -110,10 +112,12 @@ Socket::Socket(int port)
 
 #ifdef _WIN32
 	BOOL reuseaddr = true;
+#else
+	int reuseaddr = 1; // so that a restarted server doesn't have to wait out TIME_WAIT
+#endif
 	if( 0 != setsockopt( the_socket, SOL_SOCKET, SO_REUSEADDR, (char*)&reuseaddr, sizeof(reuseaddr) ) ){
 		throw AnException(0, FL, "Error setting SO_REUSEADDR on socket.");
 	}
-#endif
 
 	SetNoDelay( true );
 
@@ -228,6 +232,7 @@ Socket::Socket(int port)
 Socket::Socket(int port, bool useUDP, char *localipaddr)
 {
 	int err;
+	m_noSigPipe = false;
 
 
 #ifdef _WIN32
@@ -378,6 +383,7 @@ Socket::Socket(int port, bool useUDP, char *localipaddr)
 Socket::Socket(char *machine, int port)
 {
 	struct hostent * that_host;
+	m_noSigPipe = false;
 
 
 #ifdef _WIN32
@@ -450,6 +456,7 @@ Socket::Socket(char *machine, int port, bool useUDP, char *localipaddr)
 {
 	struct hostent * that_host;
 	int err;
+	m_noSigPipe = false;
 
 	DEBUG(FL,"Client socket on machine %s, port %d, UDP %d, local ip %s",
 		machine, port, useUDP, localipaddr);
@@ -717,8 +724,10 @@ int Socket::SendData(char *buffer, int size)
 	do {
 #ifdef _WIN32
 		err = send(the_socket, buffer + cnt, size - cnt, 0);
+#elif defined(MSG_NOSIGNAL)
+		err = send(the_socket, buffer + cnt, size - cnt, m_noSigPipe ? MSG_NOSIGNAL : 0);
 #else
-		err = write(the_socket, buffer + cnt, size - cnt);
+		err = write(the_socket, buffer + cnt, size - cnt); // SO_NOSIGPIPE covers this one
 #endif
 		if (err < 0 ) {
 			throw AnException(0, FL,
@@ -899,6 +908,18 @@ void Socket::SetNoDelay( bool tf )
 	}
 }
 
+void Socket::SetNoSigPipe( bool tf )
+{
+	m_noSigPipe = tf;
+#ifdef SO_NOSIGPIPE
+	int optnosigpipe = tf ? 1 : 0;
+	int rc = setsockopt( the_socket, SOL_SOCKET, SO_NOSIGPIPE, (char*)&optnosigpipe, sizeof(optnosigpipe) );
+	if(rc != 0){
+		throw AnException(0, FL, "Error setting SO_NOSIGPIPE on socket: %d", errno);
+	}
+#endif
+}
+
 unsigned short Socket::GetLocalPort(void)
 {
 	SOCKADDR_IN localad;
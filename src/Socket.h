@@ -228,6 +228,12 @@ class DLLEXPORT Socket : public GSocket
 		  */
 		virtual void SetNoDelay( bool tf );
 
+		/** Turn off (or on) SIGPIPE for writes to our socket.  With it off, writing to a socket
+		  * whose other end has gone away makes SendData throw rather than killing the process.
+		  * Unlike ignoring SIGPIPE, this only affects this socket.
+		  */
+		virtual void SetNoSigPipe( bool tf );
+
 		/** Returns the local port to which we are bound - this is more useful for client
 		  * sockets than server sockets, as you should already know the local port for a server
 		  * socket.
@@ -267,6 +273,9 @@ class DLLEXPORT Socket : public GSocket
 		  */
 		int SocketType;                    // 0 = Server 1 = Client;
 
+		/** Do we stop writes to our socket from raising SIGPIPE?  See SetNoSigPipe. */
+		bool m_noSigPipe;
+
 }
 ;
 
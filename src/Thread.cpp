@@ -23,11 +23,84 @@
 #endif
 
 #include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <stdio.h>
+#ifndef _WIN32
+#include <unistd.h>
+#include <limits.h>
+#include <dirent.h>
+#include <sched.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#endif
+
+#include <map>
+#include <deque>
+#include <mutex>
+#include <thread>
 
 #include "Log.h"
 #include "AnException.h"
 using namespace SLib;
 
+/// What a thread started with options needs to get going
+struct ThreadStart {
+	void *(*jmp)(void *);
+	void *argList;
+	ThreadOptions options;
+};
+
+/// Guards thread_names and thread_exited_names.  Never deleted, so that threads can still exit during static destruction.
+static std::mutex& thread_names_lock(void)
+{
+	static std::mutex* lock = new std::mutex();
+	return *lock;
+}
+
+/// The names of the named threads that are running, by log id
+static map<uint32_t, twine>& thread_names(void)
+{
+	static map<uint32_t, twine>* names = new map<uint32_t, twine>();
+	return *names;
+}
+
+/// The last THREAD_EXITED_NAMES named threads to exit, oldest first, for traces taken after they have gone
+static deque<pair<uint32_t, twine> >& thread_exited_names(void)
+{
+	static deque<pair<uint32_t, twine> >* names = new deque<pair<uint32_t, twine> >();
+	return *names;
+}
+
+/// The calling thread's name, which moves it from thread_names to thread_exited_names when the thread exits
+struct ThreadName {
+	twine name;
+	uint32_t id;
+
+	~ThreadName() {
+		if(!name.empty()){
+			std::lock_guard<std::mutex> theLock( thread_names_lock() );
+			thread_names().erase( id );
+			thread_exited_names().push_back( make_pair( id, name ) );
+			if(thread_exited_names().size() > THREAD_EXITED_NAMES){
+				thread_exited_names().pop_front();
+			}
+		}
+	}
+};
+static thread_local ThreadName thread_name;
+
+/// Applies the options, and then runs the thread's real starting point
+static void* thread_start_with_options(void* arg)
+{
+	ThreadStart* ts = (ThreadStart*)arg;
+	Thread::Apply( ts->options );
+	void *(*jmp)(void *) = ts->jmp;
+	void* argList = ts->argList;
+	delete ts;
+	return jmp( argList );
+}
+
 
 #ifdef _WIN32
 UINT __stdcall internal_thread_start_fcn(void *parms)
@@ -50,8 +123,22 @@ UINT __stdcall internal_thread_start_fcn(void *parms)
 
 	return 0;
 }
+
+UINT __stdcall internal_thread_start_options(void *parms)
+{
+	thread_start_with_options( parms );
+	_endthreadex(0);
+	return 0;
+}
 #endif
 
+ThreadOptions::ThreadOptions()
+{
+	numaNode = -1;
+	stackSize = 0;
+	priority = 0;
+}
+
 Thread::Thread()
 {
 	TRACE(FL, "Enter Thread::Thread()");
@@ -107,6 +194,53 @@ int Thread::start(void *(*jmpPoint)(void *), void *argList, void *attr)
 
 }
 
+int Thread::start(void *(*jmpPoint)(void *), void *argList, const ThreadOptions& options)
+{
+	TRACE(FL, "Enter Thread::start(..., options)");
+
+	ThreadStart* ts = new ThreadStart();
+	ts->jmp = jmpPoint;
+	ts->argList = argList;
+	ts->options = options;
+
+#ifdef _WIN32
+	m_thread = (HANDLE)_beginthreadex(NULL, (unsigned)options.stackSize,
+	                                  internal_thread_start_options, ts, 0, &m_tid);
+
+	if (m_thread != 0) {
+		m_status = 1;
+	} else {
+		delete ts;
+		m_status = -1;
+		throw AnException(0, FL, "Error starting thread.");
+	}
+#else
+	pthread_attr_t attr;
+	pthread_attr_init(&attr);
+	if (options.stackSize != 0) {
+		size_t size = options.stackSize < (size_t)PTHREAD_STACK_MIN ? (size_t)PTHREAD_STACK_MIN : options.stackSize;
+		if (pthread_attr_setstacksize(&attr, size) != 0) {
+			pthread_attr_destroy(&attr);
+			delete ts;
+			throw AnException(0, FL, "Invalid thread stack size %d", (int)options.stackSize);
+		}
+	}
+
+	int err = pthread_create(&m_thread, &attr, thread_start_with_options, ts);
+	pthread_attr_destroy(&attr);
+	if (err == 0) {
+		m_status = 1;
+	} else {
+		delete ts;
+		m_status = -1;
+		throw AnException(0, FL, "Error starting thread.");
+	}
+#endif
+
+	TRACE(FL, "Exit Thread::start(..., options)");
+	return 0;
+}
+
 int Thread::cancel(void)
 {
 	TRACE(FL, "Enter Thread::cancel()");
@@ -181,3 +315,268 @@ THREAD_ID_TYPE Thread::CurrentThreadId(void)
 {
 	return CURRENT_THREAD_ID;
 }
+
+uint32_t Thread::CurrentLogId(void)
+{
+	return (uint32_t)(intptr_t)CURRENT_THREAD_ID;
+}
+
+void Thread::SetName(const twine& name)
+{
+	uint32_t id = CurrentLogId();
+	{
+		std::lock_guard<std::mutex> theLock( thread_names_lock() );
+		if(name.empty()){
+			thread_names().erase( id );
+		} else {
+			thread_names()[ id ] = name;
+		}
+	}
+	thread_name.name = name;
+	thread_name.id = id;
+
+#if defined(_WIN32)
+	// SetThreadDescription only exists from Windows 10 on.
+	typedef HRESULT (WINAPI *SetThreadDescriptionFn)(HANDLE, PCWSTR);
+	SetThreadDescriptionFn setDescription = (SetThreadDescriptionFn)GetProcAddress(
+		GetModuleHandleA( "kernel32.dll" ), "SetThreadDescription" );
+	if(setDescription != NULL){
+		wchar_t wide[ 256 ];
+		if(MultiByteToWideChar( CP_UTF8, 0, name(), -1, wide, 256 ) != 0){
+			setDescription( GetCurrentThread(), wide );
+		}
+	}
+#elif defined(__APPLE__)
+	pthread_setname_np( name() );
+#elif defined(__linux__)
+	// The kernel only keeps 15 characters.
+	char shortName[ 16 ];
+	strncpy( shortName, name(), 15 );
+	shortName[ 15 ] = '\0';
+	pthread_setname_np( pthread_self(), shortName );
+#endif
+
+}
+
+twine Thread::CurrentName(void)
+{
+	return thread_name.name;
+}
+
+twine Thread::NameOf(uint32_t tid, bool recentlyExited)
+{
+	std::lock_guard<std::mutex> theLock( thread_names_lock() );
+	map<uint32_t, twine>::iterator it = thread_names().find( tid );
+	if(it != thread_names().end()){
+		return it->second;
+	}
+	if(recentlyExited){
+		deque<pair<uint32_t, twine> >& exited = thread_exited_names();
+		for(size_t i = exited.size(); i > 0; i--){
+			if(exited[ i - 1 ].first == tid){
+				return exited[ i - 1 ].second;
+			}
+		}
+	}
+	return twine();
+}
+
+void Thread::SetAffinity(const vector<int>& cpus)
+{
+#if defined(_WIN32)
+	DWORD_PTR mask = 0;
+	for(size_t i = 0; i < cpus.size(); i++){
+		if(cpus[ i ] < 0 || cpus[ i ] >= (int)(sizeof(DWORD_PTR) * 8)){
+			throw AnException(0, FL, "CPU %d is out of range", cpus[ i ] );
+		}
+		mask |= (DWORD_PTR)1 << cpus[ i ];
+	}
+	if(mask == 0){
+		DWORD_PTR system;
+		GetProcessAffinityMask( GetCurrentProcess(), &mask, &system );
+	}
+	if(SetThreadAffinityMask( GetCurrentThread(), mask ) == 0){
+		throw AnException(0, FL, "Error setting thread affinity: %d", (int)GetLastError() );
+	}
+#elif defined(__linux__)
+	cpu_set_t set;
+	CPU_ZERO( &set );
+	for(size_t i = 0; i < cpus.size(); i++){
+		if(cpus[ i ] < 0 || cpus[ i ] >= CPU_SETSIZE){
+			throw AnException(0, FL, "CPU %d is out of range", cpus[ i ] );
+		}
+		CPU_SET( cpus[ i ], &set );
+	}
+	if(cpus.empty()){
+		long count = sysconf( _SC_NPROCESSORS_CONF );
+		for(long i = 0; i < count && i < CPU_SETSIZE; i++){
+			CPU_SET( i, &set );
+		}
+	}
+	int err = pthread_setaffinity_np( pthread_self(), sizeof(set), &set );
+	if(err != 0){
+		throw AnException(0, FL, "Error setting thread affinity: %s", strerror( err ) );
+	}
+#endif
+}
+
+int Thread::NumaNodes(void)
+{
+#if defined(_WIN32)
+	ULONG highest = 0;
+	if(!GetNumaHighestNodeNumber( &highest )){
+		return 1;
+	}
+	return (int)highest + 1;
+#elif defined(__linux__)
+	int count = 0;
+	DIR* dir = opendir( "/sys/devices/system/node" );
+	if(dir != NULL){
+		struct dirent* ent;
+		while((ent = readdir( dir )) != NULL){
+			if(strncmp( ent->d_name, "node", 4 ) == 0 && ent->d_name[ 4 ] >= '0' && ent->d_name[ 4 ] <= '9'){
+				count ++;
+			}
+		}
+		closedir( dir );
+	}
+	return count == 0 ? 1 : count;
+#else
+	return 1;
+#endif
+}
+
+vector<int> Thread::NumaNodeCpus(int node)
+{
+	vector<int> ret;
+	if(node < 0 || node >= NumaNodes()){
+		throw AnException(0, FL, "There is no NUMA node %d", node );
+	}
+#if defined(_WIN32)
+	ULONGLONG mask = 0;
+	if(!GetNumaNodeProcessorMask( (UCHAR)node, &mask )){
+		throw AnException(0, FL, "Error finding the CPUs of NUMA node %d: %d", node, (int)GetLastError() );
+	}
+	for(int i = 0; i < 64; i++){
+		if(mask & ((ULONGLONG)1 << i)){
+			ret.push_back( i );
+		}
+	}
+#elif defined(__linux__)
+	// The list looks like "0-3,8-11".
+	char path[ 64 ];
+	snprintf( path, sizeof(path), "/sys/devices/system/node/node%d/cpulist", node );
+	FILE* fp = fopen( path, "r" );
+	if(fp != NULL){
+		int lo, hi;
+		while(fscanf( fp, "%d", &lo ) == 1){
+			hi = lo;
+			int c = fgetc( fp );
+			if(c == '-'){
+				if(fscanf( fp, "%d", &hi ) != 1){
+					break;
+				}
+				c = fgetc( fp );
+			}
+			for(int i = lo; i <= hi; i++){
+				ret.push_back( i );
+			}
+			if(c != ','){
+				break;
+			}
+		}
+		fclose( fp );
+	}
+#endif
+	if(ret.empty()){
+		// No NUMA information, so this must be the only node.
+		size_t count = std::thread::hardware_concurrency();
+		for(size_t i = 0; i < (count == 0 ? 1 : count); i++){
+			ret.push_back( (int)i );
+		}
+	}
+	return ret;
+}
+
+void Thread::BindToNumaNode(int node)
+{
+	SetAffinity( NumaNodeCpus( node ) );
+
+#if defined(__linux__) && defined(SYS_set_mempolicy)
+	// Prefer the node's memory, falling back to other nodes when it runs out.  Left alone,
+	// Linux already allocates from the node a page is first touched on, so this only matters
+	// for memory the thread touches before it has moved to the node.
+	if(NumaNodes() > 1){
+		unsigned long mask[ 1024 / (8 * sizeof(unsigned long)) ];
+		memset( mask, 0, sizeof(mask) );
+		if(node >= 1024){
+			throw AnException(0, FL, "NUMA node %d is out of range", node );
+		}
+		mask[ node / (8 * sizeof(unsigned long)) ] |= 1UL << (node % (8 * sizeof(unsigned long)));
+		const int MPOL_PREFERRED_MODE = 1; // MPOL_PREFERRED from linux/mempolicy.h
+		if(syscall( SYS_set_mempolicy, MPOL_PREFERRED_MODE, mask, sizeof(mask) * 8 ) != 0){
+			throw AnException(0, FL, "Error setting the memory policy for NUMA node %d: %s", node,
+				strerror( errno ) );
+		}
+	}
+#endif
+}
+
+void Thread::SetPriority(int priority)
+{
+	if(priority < -2){
+		priority = -2;
+	} else if(priority > 2){
+		priority = 2;
+	}
+#if defined(_WIN32)
+	// THREAD_PRIORITY_LOWEST to THREAD_PRIORITY_HIGHEST are -2 to 2.
+	if(!SetThreadPriority( GetCurrentThread(), priority )){
+		throw AnException(0, FL, "Error setting thread priority: %d", (int)GetLastError() );
+	}
+#elif defined(__linux__)
+	// Linux threads each have their own nice value.
+	if(setpriority( PRIO_PROCESS, (id_t)syscall( SYS_gettid ), -5 * priority ) != 0){
+		throw AnException(0, FL, "Error setting thread priority: %s", strerror( errno ) );
+	}
+#else
+	int policy;
+	struct sched_param param;
+	pthread_getschedparam( pthread_self(), &policy, &param );
+	int lo = sched_get_priority_min( policy );
+	int hi = sched_get_priority_max( policy );
+	param.sched_priority = (lo + hi) / 2 + priority * (hi - lo) / 4;
+	int err = pthread_setschedparam( pthread_self(), policy, &param );
+	if(err != 0){
+		throw AnException(0, FL, "Error setting thread priority: %s", strerror( err ) );
+	}
+#endif
+}
+
+void Thread::Apply(const ThreadOptions& options)
+{
+	if(!options.name.empty()){
+		SetName( options.name );
+	}
+	if(options.numaNode >= 0){
+		try {
+			BindToNumaNode( options.numaNode );
+		} catch (AnException& e){
+			WARN(FL, "Couldn't bind thread %s to NUMA node %d: %s", options.name(), options.numaNode, e.Msg() );
+		}
+	}
+	if(!options.cpus.empty()){
+		try {
+			SetAffinity( options.cpus );
+		} catch (AnException& e){
+			WARN(FL, "Couldn't set the CPUs of thread %s: %s", options.name(), e.Msg() );
+		}
+	}
+	if(options.priority != 0){
+		try {
+			SetPriority( options.priority );
+		} catch (AnException& e){
+			WARN(FL, "Couldn't set the priority of thread %s: %s", options.name(), e.Msg() );
+		}
+	}
+}
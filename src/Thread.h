@@ -37,10 +37,20 @@
 #       define THREAD_ID_TYPE pthread_t
 #endif
 
+#include <stddef.h>
+#include <stdint.h>
+#include <vector>
+using namespace std;
+
+#include "twine.h"
+
 
 namespace SLib
 {
 
+/// How many of the most recent named threads to exit Thread::NameOf can still name
+#define THREAD_EXITED_NAMES 64
+
 class Thread;
 
 /**
@@ -59,6 +69,47 @@ typedef struct
 }
 thread_arg;
 
+/**
+  * @memo The options that a thread can be started with.
+  * @doc  Everything defaults to what the operating system would do anyway,
+  *       so set only what you care about and pass this to Thread::start.
+  *       The name, CPUs, NUMA node and priority are applied by the new
+  *       thread itself before it calls your starting point.  If one of them
+  *       can't be applied - raising the priority usually needs extra
+  *       privileges, and macOS has no way to pin a thread to a CPU - a
+  *       warning is logged and the thread runs anyway.
+  * @name ThreadOptions
+  * @author Steven M. Cherry
+  * @copyright 2002 Steven M. Cherry
+  */
+struct DLLEXPORT ThreadOptions
+{
+	/// Standard constructor - sets everything to the defaults
+	ThreadOptions();
+
+	/** The thread's name, which shows up in top, debuggers, the log and EnEx
+	  * traces.  Linux only keeps the first 15 characters for the OS name.
+	  */
+	twine name;
+
+	/// The CPUs that the thread may run on.  Empty means any of them.
+	vector<int> cpus;
+
+	/** The NUMA node to keep the thread on, or -1 for none.  The thread only
+	  * runs on that node's CPUs, and on Linux its memory is allocated from
+	  * that node whenever the node has any free.
+	  */
+	int numaNode;
+
+	/// The size of the thread's stack in bytes, or 0 for the default.
+	size_t stackSize;
+
+	/** The thread's priority, from -2 (lowest) to 2 (highest), with 0 being
+	  * normal.  On Linux each step is 5 levels of nice.
+	  */
+	int priority;
+};
+
 } // End Namespace
 
 /* ******************************************************* */
@@ -110,6 +161,15 @@ class DLLEXPORT Thread
 		int start(void *(*jmpPoint)(void *), void *argList,
 		          void *attr = NULL);
 
+		/**
+		  * @memo This starts a thread going with the given options.
+		  * @doc  The same as start above, except that the thread is
+		  *       named, pinned, bound and prioritized as the options
+		  *       say before jmpPoint is called.
+		  */
+		int start(void *(*jmpPoint)(void *), void *argList,
+		          const ThreadOptions& options);
+
 		/**
 		  * @memo This is how you stop a thread from processing.
 		  */
@@ -137,6 +197,61 @@ class DLLEXPORT Thread
 		 */
 		static THREAD_ID_TYPE CurrentThreadId(void);
 
+		/**
+		  * @memo Names the calling thread.
+		  * @doc  The name is given to the operating system, and remembered
+		  *       against the thread's log id (LogMsg::tid) until the thread
+		  *       exits, so that NameOf can find it when the log or an EnEx
+		  *       report is printed.
+		  */
+		static void SetName(const twine& name);
+
+		/** The name of the calling thread, or an empty twine if it hasn't
+		  * been given one.
+		  */
+		static twine CurrentName(void);
+
+		/** The name of the running thread with the given log id
+		  * (LogMsg::tid), or an empty twine if it hasn't been given one.
+		  * With recentlyExited set, the last THREAD_EXITED_NAMES named
+		  * threads to exit are looked at too, for reports on threads that
+		  * may have gone.  An exited thread's id can be reused, so only ask
+		  * for those when the tid is known to be from the past.
+		  */
+		static twine NameOf(uint32_t tid, bool recentlyExited = false);
+
+		/// The calling thread's log id, which is what LogMsg::tid holds.
+		static uint32_t CurrentLogId(void);
+
+		/**
+		  * @memo Restricts the calling thread to the given CPUs.
+		  * @doc  Throws an AnException if the operating system won't do it.
+		  *       This does nothing on macOS, which has no way to do it.
+		  */
+		static void SetAffinity(const vector<int>& cpus);
+
+		/**
+		  * @memo Keeps the calling thread on the given NUMA node.
+		  * @doc  The thread is restricted to that node's CPUs, and on Linux
+		  *       told to allocate memory from that node first.  Throws an
+		  *       AnException if there is no such node.
+		  */
+		static void BindToNumaNode(int node);
+
+		/// Sets the calling thread's priority, as in ThreadOptions::priority.
+		static void SetPriority(int priority);
+
+		/// The number of NUMA nodes on this machine, which is 1 on most.
+		static int NumaNodes(void);
+
+		/** The CPUs that belong to the given NUMA node.  On a machine
+		  * without NUMA, node 0 has every CPU.
+		  */
+		static vector<int> NumaNodeCpus(int node);
+
+		/// Applies everything in the options, except the stack size, to the calling thread.
+		static void Apply(const ThreadOptions& options);
+
 	protected:
 
 #ifdef _WIN32
@@ -0,0 +1,322 @@
+ /*
+  * Copyright (c) 2001,2002 Steven M. Cherry. All rights reserved.
+  *
+  * This file is a part of slib - a c++ utility library
+  *
+  * The slib project, including all files needed to compile
+  * it, is free software; you can redistribute it and/or use it and/or modify
+  * it under the terms of the GNU Lesser General Public License as published by
+  * the Free Software Foundation.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program.  See file COPYING for details.
+  */
+
+#include <stdio.h>
+#include <string.h>
+#include <thread>
+#include <exception>
+
+#include "ThreadPool.h"
+#include "AnException.h"
+#include "EnEx.h"
+#include "Lock.h"
+#include "Log.h"
+#include "twine.h"
+
+using namespace SLib;
+
+/// The worker the current thread is, if it belongs to a pool
+thread_local ThreadPoolWorker* thread_pool_worker = NULL;
+
+/** Returns the EnEx name to use for the given worker.  EnEx holds on to the names it is
+  * given for good, so these are made once per worker index and never freed.
+  */
+static const char* threadpool_name(size_t index, bool steal)
+{
+	static Mutex* mut = new Mutex();
+	static vector<const char*>* runNames = new vector<const char*>();
+	static vector<const char*>* stealNames = new vector<const char*>();
+
+	Lock theLock(mut);
+	while(runNames->size() <= index){
+		twine name;
+		name.format( "ThreadPool worker %d", (int)runNames->size() );
+		runNames->push_back( strdup( name() ) );
+		name.append( " steal" );
+		stealNames->push_back( strdup( name() ) );
+	}
+	return steal ? stealNames->at( index ) : runNames->at( index );
+}
+
+ThreadPool::ThreadPool(size_t threads)
+{
+	ThreadOptions options;
+	options.name = "pool worker";
+	init( threads, options, false );
+}
+
+ThreadPool::ThreadPool(size_t threads, const ThreadOptions& options, bool pinWorkers)
+{
+	init( threads, options, pinWorkers );
+}
+
+void ThreadPool::init(size_t threads, const ThreadOptions& options, bool pinWorkers)
+{
+	vector<int> cpus;
+	if(pinWorkers){
+		if(!options.cpus.empty()){
+			cpus = options.cpus;
+		} else if(options.numaNode >= 0){
+			cpus = Thread::NumaNodeCpus( options.numaNode );
+		} else {
+			for(size_t i = 0; i < HardwareThreads(); i++){
+				cpus.push_back( (int)i );
+			}
+		}
+		if(threads == 0){
+			threads = cpus.size();
+		}
+	}
+	if(threads == 0){
+		threads = HardwareThreads();
+	}
+	m_mutex = new Mutex();
+	m_pending.store( 0 );
+	m_shutdown.store( false );
+
+	for(size_t i = 0; i < threads; i++){
+		ThreadPoolWorker* w = new ThreadPoolWorker();
+		w->pool = this;
+		w->index = i;
+		w->thread = NULL;
+		w->mutex = new Mutex();
+		w->runName = threadpool_name( i, false );
+		w->stealName = threadpool_name( i, true );
+		w->executed.store( 0 );
+		w->stolen.store( 0 );
+		w->sleeps.store( 0 );
+		m_workers.push_back( w );
+	}
+
+	// Every worker has to exist before any of them start looking for work to steal.
+	for(size_t i = 0; i < m_workers.size(); i++){
+		ThreadOptions workerOptions = options;
+		if(!options.name.empty()){
+			workerOptions.name.format( "%s %d", options.name(), (int)i );
+		}
+		if(pinWorkers){
+			workerOptions.cpus.assign( 1, cpus[ i % cpus.size() ] );
+		}
+		m_workers[ i ]->thread = new Thread();
+		try {
+			m_workers[ i ]->thread->start( ThreadPool::workerStart, m_workers[ i ], workerOptions );
+		} catch (AnException&){
+			delete m_workers[ i ]->thread;
+			m_workers[ i ]->thread = NULL;
+			// Our destructor won't run, so stop the workers that did start and free
+			// everything here.
+			Shutdown();
+			freeWorkers();
+			throw;
+		}
+	}
+}
+
+ThreadPool::~ThreadPool()
+{
+	Shutdown();
+	freeWorkers();
+}
+
+void ThreadPool::freeWorkers(void)
+{
+	for(size_t i = 0; i < m_workers.size(); i++){
+		delete m_workers[ i ]->mutex;
+		delete m_workers[ i ];
+	}
+	m_workers.clear();
+	delete m_mutex;
+	m_mutex = NULL;
+}
+
+void ThreadPool::execute(ThreadPoolTask task, Priority priority)
+{
+	ThreadPoolWorker* w = thread_pool_worker;
+	if(w != NULL && w->pool == this){
+		// One of our own tasks - keep the new one close to home.
+		Lock theLock(w->mutex);
+		w->queues[ priority ].push_back( std::move( task ) );
+		m_pending.fetch_add( 1 );
+	} else {
+		Lock theLock(m_mutex);
+		if(m_shutdown.load()){
+			throw AnException(0, FL, "ThreadPool is shutting down - no new tasks are accepted.");
+		}
+		m_shared[ priority ].push_back( std::move( task ) );
+		m_pending.fetch_add( 1 );
+	}
+	m_idle.notifyOne();
+}
+
+void ThreadPool::Shutdown(void)
+{
+	if(CurrentWorker() >= 0){
+		throw AnException(0, FL, "ThreadPool can't be shut down from one of its own tasks.");
+	}
+	{
+		Lock theLock(m_mutex);
+		m_shutdown.store( true );
+	}
+	m_idle.notifyAll();
+
+	for(size_t i = 0; i < m_workers.size(); i++){
+		if(m_workers[ i ]->thread != NULL){
+			m_workers[ i ]->thread->join();
+			delete m_workers[ i ]->thread;
+			m_workers[ i ]->thread = NULL;
+		}
+	}
+}
+
+size_t ThreadPool::Size(void) const
+{
+	return m_workers.size();
+}
+
+size_t ThreadPool::Pending(void) const
+{
+	return m_pending.load();
+}
+
+vector<ThreadPoolStats> ThreadPool::Stats(void) const
+{
+	vector<ThreadPoolStats> ret;
+	for(size_t i = 0; i < m_workers.size(); i++){
+		ThreadPoolStats s;
+		s.executed = m_workers[ i ]->executed.load();
+		s.stolen = m_workers[ i ]->stolen.load();
+		s.sleeps = m_workers[ i ]->sleeps.load();
+		ret.push_back( s );
+	}
+	return ret;
+}
+
+int ThreadPool::CurrentWorker(void) const
+{
+	ThreadPoolWorker* w = thread_pool_worker;
+	if(w != NULL && w->pool == this){
+		return (int)w->index;
+	}
+	return -1;
+}
+
+size_t ThreadPool::HardwareThreads(void)
+{
+	size_t ret = std::thread::hardware_concurrency();
+	return ret == 0 ? 1 : ret;
+}
+
+ThreadPool& ThreadPool::Global(void)
+{
+	// Never deleted, so that it is still there for anything that runs during exit.
+	static ThreadPool* global = new ThreadPool();
+	return *global;
+}
+
+void* ThreadPool::workerStart(void* arg)
+{
+	ThreadPoolWorker* w = (ThreadPoolWorker*)arg;
+	thread_pool_worker = w;
+	w->pool->workerLoop( w );
+	thread_pool_worker = NULL;
+	return NULL;
+}
+
+void ThreadPool::workerLoop(ThreadPoolWorker* w)
+{
+	while(true){
+		ThreadPoolTask task;
+		if(findTask( w, task )){
+			runTask( w, task );
+			continue;
+		}
+
+		uint32_t key = m_idle.prepareWait();
+		if(m_pending.load() != 0){
+			m_idle.cancelWait(); // something turned up after we looked
+			continue;
+		}
+		if(m_shutdown.load()){
+			m_idle.cancelWait(); // everything is done, and nothing more is coming
+			break;
+		}
+		w->sleeps.fetch_add( 1, std::memory_order_relaxed );
+		m_idle.wait( key );
+	}
+}
+
+bool ThreadPool::findTask(ThreadPoolWorker* w, ThreadPoolTask& task)
+{
+	if(m_pending.load() == 0){
+		return false;
+	}
+	for(int p = 0; p < THREADPOOL_PRIORITIES; p++){
+		// Our own queue first, newest first.
+		{
+			Lock theLock(w->mutex);
+			if(!w->queues[ p ].empty()){
+				task = std::move( w->queues[ p ].back() );
+				w->queues[ p ].pop_back();
+				m_pending.fetch_sub( 1 );
+				return true;
+			}
+		}
+
+		// Then the shared queue, oldest first.
+		{
+			Lock theLock(m_mutex);
+			if(!m_shared[ p ].empty()){
+				task = std::move( m_shared[ p ].front() );
+				m_shared[ p ].pop_front();
+				m_pending.fetch_sub( 1 );
+				return true;
+			}
+		}
+
+		// Then steal the oldest task from someone else, starting with our neighbour so that
+		// the workers don't all go after the same victim.
+		for(size_t i = 1; i < m_workers.size(); i++){
+			ThreadPoolWorker* victim = m_workers[ (w->index + i) % m_workers.size() ];
+			Lock theLock(victim->mutex);
+			if(!victim->queues[ p ].empty()){
+				task = std::move( victim->queues[ p ].front() );
+				victim->queues[ p ].pop_front();
+				m_pending.fetch_sub( 1 );
+				w->stolen.fetch_add( 1, std::memory_order_relaxed );
+				EnEx es( w->stealName );
+				return true;
+			}
+		}
+	}
+	return false;
+}
+
+void ThreadPool::runTask(ThreadPoolWorker* w, ThreadPoolTask& task)
+{
+	EnEx ee( w->runName );
+	try {
+		task();
+	} catch (AnException& e){
+		ERRORL(FL, "Uncaught exception in ThreadPool task: %s", e.Msg() );
+	} catch (std::exception& e){
+		ERRORL(FL, "Uncaught exception in ThreadPool task: %s", e.what() );
+	} catch (...){
+		ERRORL(FL, "Uncaught exception in ThreadPool task.");
+	}
+	w->executed.fetch_add( 1, std::memory_order_relaxed );
+}
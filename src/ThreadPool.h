@@ -0,0 +1,241 @@
+#ifndef THREADPOOL_H
+#define THREADPOOL_H
+ /*
+  * Copyright (c) 2001,2002 Steven M. Cherry. All rights reserved.
+  *
+  * This file is a part of slib - a c++ utility library
+  *
+  * The slib project, including all files needed to compile
+  * it, is free software; you can redistribute it and/or use it and/or modify
+  * it under the terms of the GNU Lesser General Public License as published by
+  * the Free Software Foundation.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program.  See file COPYING for details.
+  */
+
+#ifdef _WIN32
+#	ifndef DLLEXPORT
+#		define DLLEXPORT __declspec(dllexport)
+#	endif
+#else
+#	define DLLEXPORT
+#endif
+
+#include <stdint.h>
+#include <atomic>
+#include <deque>
+#include <vector>
+#include <functional>
+#include <future>
+#include <memory>
+#include <type_traits>
+using namespace std;
+
+#include "Mutex.h"
+#include "Thread.h"
+#include "EventCount.h"
+
+namespace SLib {
+
+/// The number of priority levels a ThreadPool has
+#define THREADPOOL_PRIORITIES 3
+
+/// What ThreadPool keeps for each task
+typedef std::function<void()> ThreadPoolTask;
+
+/// The statistics for one worker thread in a ThreadPool
+struct ThreadPoolStats {
+	/// The number of tasks this worker has run
+	uint64_t executed;
+
+	/// How many of those it took from another worker's queue
+	uint64_t stolen;
+
+	/// The number of times it went to sleep for lack of work
+	uint64_t sleeps;
+};
+
+class ThreadPool;
+
+/// Everything that belongs to one worker thread
+struct ThreadPoolWorker {
+	ThreadPool* pool;
+	size_t index;
+	Thread* thread;
+
+	/// Protects the queues below
+	Mutex* mutex;
+
+	/// Tasks submitted from this worker's own tasks, one queue per priority.  The worker
+	/// takes from the back, and other workers steal from the front.
+	std::deque<ThreadPoolTask> queues[ THREADPOOL_PRIORITIES ];
+
+	/// EnEx names for running and stealing tasks on this worker
+	const char* runName;
+	const char* stealName;
+
+	std::atomic<uint64_t> executed;
+	std::atomic<uint64_t> stolen;
+	std::atomic<uint64_t> sleeps;
+};
+
+/**
+  * A pool of worker threads that run submitted tasks, with work stealing.
+  * <P>
+  * Tasks submitted from outside the pool go on a shared queue.  Tasks submitted by a task
+  * that is running on one of the workers go on that worker's own queue, where that worker
+  * finds them first, newest first, while they are still in its cache.  A worker with
+  * nothing to do takes the oldest task from the shared queue, and failing that steals the
+  * oldest task from another worker, so that work spreads itself out.  Idle workers sleep on
+  * an EventCount, which costs the submitter nothing when every worker is busy.
+  * <P>
+  * There are three priorities.  A worker always runs any High task it can find, wherever it
+  * is, before a Normal one, and a Normal one before a Low one.
+  * <P>
+  * Every task is run inside an EnEx named after the worker that runs it ("ThreadPool worker
+  * 3"), and every steal is counted as a hit on "ThreadPool worker 3 steal", so the profile
+  * reports show how busy each worker is and how evenly the work is spread.  Stats returns
+  * the same numbers directly.  The worker threads themselves are named "pool worker 3" and
+  * so on, unless ThreadOptions say otherwise, so that they can be told apart in the log
+  * and in a debugger.
+  *
+  * @author Steven M. Cherry
+  */
+class DLLEXPORT ThreadPool
+{
+	private:
+		/// copy constructor is private to prevent use
+		ThreadPool(const ThreadPool& c) {}
+
+		/// assignmet operator is private to prevent use
+		ThreadPool& operator=(const ThreadPool& c) { return *this;}
+
+	public:
+		enum Priority {
+			High = 0,
+			Normal = 1,
+			Low = 2
+		};
+
+		/** Starts a pool with the given number of worker threads.  The default of 0 starts
+		  * one for every hardware thread this machine has.
+		  */
+		ThreadPool(size_t threads = 0);
+
+		/** Starts a pool whose workers are started with the given options, each named
+		  * after options.name and its index.  If pinWorkers is set, each worker is pinned to
+		  * a CPU of its own, taken in turn from options.cpus, or failing that the CPUs of
+		  * options.numaNode, or failing that every CPU, and a threads of 0 starts one worker
+		  * for each of those CPUs.  So a pool for each socket of a two socket machine is:
+		  * <pre>
+		  *    ThreadOptions opts;
+		  *    opts.name = "socket 1";
+		  *    opts.numaNode = 1;
+		  *    ThreadPool pool( 0, opts, true );
+		  * </pre>
+		  */
+		ThreadPool(size_t threads, const ThreadOptions& options, bool pinWorkers = false);
+
+		/// Standard destructor - runs everything that is still queued, and then stops.
+		virtual ~ThreadPool();
+
+		/** Queues f to run on one of our workers, and returns a future for whatever it
+		  * returns, or whatever it throws.  Throws an AnException if the pool is shutting
+		  * down, unless this is called from one of our own workers.
+		  */
+		template <class F>
+		std::future<decltype( std::declval<F&>()() )> submit(F f, Priority priority = Normal)
+		{
+			typedef decltype( std::declval<F&>()() ) R;
+			std::shared_ptr<std::packaged_task<R()> > task( new std::packaged_task<R()>( std::move( f ) ) );
+			std::future<R> ret = task->get_future();
+			execute( [task]() { (*task)(); }, priority );
+			return ret;
+		}
+
+		/** Queues a task that nobody waits for.  Exceptions that it throws are caught and
+		  * logged.  Throws an AnException if the pool is shutting down, unless this is called
+		  * from one of our own workers.
+		  */
+		void execute(ThreadPoolTask task, Priority priority = Normal);
+
+		/** Stops taking new tasks, waits for every task already queued to finish, and then
+		  * stops all of the worker threads.  Tasks that are running can still submit more
+		  * tasks while we wait, and those are run too.  Calling this more than once is fine.
+		  * Throws an AnException if called from one of our own tasks, because that worker
+		  * would have to wait for itself to finish.
+		  */
+		void Shutdown(void);
+
+		/// The number of worker threads we have
+		size_t Size(void) const;
+
+		/// The number of tasks that are queued but haven't started yet
+		size_t Pending(void) const;
+
+		/// Statistics for each of our workers
+		vector<ThreadPoolStats> Stats(void) const;
+
+		/** If the current thread is one of our workers, this returns its index.  Otherwise
+		  * this returns -1.
+		  */
+		int CurrentWorker(void) const;
+
+		/// The number of hardware threads on this machine, and at least 1
+		static size_t HardwareThreads(void);
+
+		/** The pool shared by everything in the process that doesn't need its own, such as
+		  * parallel_for.  It is started on first use with one worker per hardware thread, and
+		  * lives until the process exits.
+		  */
+		static ThreadPool& Global(void);
+
+	protected:
+
+		/// Creates and starts our workers, for both constructors
+		void init(size_t threads, const ThreadOptions& options, bool pinWorkers);
+
+		/// The entry point for our worker threads
+		static void* workerStart(void* arg);
+
+		/// Runs tasks until we are shut down
+		void workerLoop(ThreadPoolWorker* w);
+
+		/// Finds the next task for the given worker to run.  Returns false if there aren't any.
+		bool findTask(ThreadPoolWorker* w, ThreadPoolTask& task);
+
+		/// Runs one task, keeping our statistics
+		void runTask(ThreadPoolWorker* w, ThreadPoolTask& task);
+
+		/// Deletes our workers and m_mutex, once every worker thread has been joined
+		void freeWorkers(void);
+
+	private:
+
+		/// Our workers
+		vector<ThreadPoolWorker*> m_workers;
+
+		/// Protects the shared queues and m_shutdown
+		Mutex* m_mutex;
+
+		/// Tasks submitted from outside the pool, one queue per priority
+		std::deque<ThreadPoolTask> m_shared[ THREADPOOL_PRIORITIES ];
+
+		/// The number of tasks queued anywhere
+		std::atomic<size_t> m_pending;
+
+		/// Set once Shutdown has been called
+		std::atomic<bool> m_shutdown;
+
+		/// Where idle workers sleep
+		EventCount m_idle;
+};
+
+} // End Namespace SLib
+
+#endif // THREADPOOL_H Defined
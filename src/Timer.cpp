@@ -17,12 +17,110 @@
  */
 
 #include "Timer.h"
+#include "TimerWheel.h"
 #include <chrono>
+#include <time.h>
+
+#if defined(_WIN32)
+#	include <intrin.h>
+#	define TIMER_HAVE_TSC
+#elif defined(__x86_64__) || defined(__i386__)
+#	include <x86intrin.h>
+#	include <cpuid.h>
+#	define TIMER_HAVE_TSC
+#endif
 
 using namespace SLib;
 
+/// How long we spend calibrating the TSC, in nanoseconds
+#define TIMER_CALIBRATE_NS 10000000
+
+/// How we turn GetRawCycleCount values into nanoseconds
+struct TimerCalibration {
+	bool tsc;
+	double nsPerCycle;
+	uint64_t baseCycles;
+	uint64_t baseNs;
+};
+
+/// Reads the clock we calibrate against, in nanoseconds.
+static uint64_t timer_clock_ns(void)
+{
+#if defined(CLOCK_MONOTONIC_RAW)
+	struct timespec ts;
+	clock_gettime( CLOCK_MONOTONIC_RAW, &ts );
+	return (uint64_t)ts.tv_sec * 1000000000 + (uint64_t)ts.tv_nsec;
+#else
+	auto now = std::chrono::steady_clock::now();
+	return std::chrono::duration_cast<std::chrono::nanoseconds>( now.time_since_epoch() ).count();
+#endif
+}
+
+/// Checks cpuid for a TSC that ticks at a constant rate through power and frequency changes.
+static bool timer_detect_tsc(void)
+{
+#if defined(_WIN32)
+	int regs[4];
+	__cpuid( regs, 0x80000000 );
+	if((unsigned)regs[0] < 0x80000007){
+		return false;
+	}
+	__cpuid( regs, 0x80000007 );
+	return (regs[3] & (1 << 8)) != 0;
+#elif defined(TIMER_HAVE_TSC)
+	unsigned int eax = 0, ebx = 0, ecx = 0, edx = 0;
+	if(__get_cpuid_max( 0x80000000, NULL ) < 0x80000007 ||
+		!__get_cpuid( 0x80000007, &eax, &ebx, &ecx, &edx )
+	){
+		return false;
+	}
+	return (edx & (1 << 8)) != 0;
+#else
+	return false;
+#endif
+}
+
+/// Returns true if GetRawCycleCount reads the TSC.  Decided once, on first use.
+static bool timer_use_tsc(void)
+{
+	static const bool useTsc = timer_detect_tsc();
+	return useTsc;
+}
+
+/// Measures the TSC frequency against the monotonic clock.
+static TimerCalibration timer_calibrate(void)
+{
+	TimerCalibration c;
+	c.tsc = timer_use_tsc();
+	c.nsPerCycle = 1.0;
+	c.baseCycles = 0;
+	c.baseNs = 0;
+	if(!c.tsc){
+		return c; // GetRawCycleCount is already in nanoseconds
+	}
+
+	uint64_t startNs = timer_clock_ns();
+	uint64_t startCycles = Timer::GetRawCycleCount();
+	uint64_t endNs;
+	do {
+		endNs = timer_clock_ns();
+	} while(endNs - startNs < TIMER_CALIBRATE_NS);
+	uint64_t endCycles = Timer::GetRawCycleCount();
+
+	c.nsPerCycle = (double)(endNs - startNs) / (double)(endCycles - startCycles);
+	c.baseCycles = endCycles;
+	c.baseNs = endNs;
+	return c;
+}
+
+static const TimerCalibration& timer_calibration(void)
+{
+	static const TimerCalibration c = timer_calibrate();
+	return c;
+}
+
 Timer::Timer() : 
-	m_start_time(std::chrono::high_resolution_clock::now()),
+	m_start_time(GetRawCycleCount()),
 	m_end_time(m_start_time)
 {
 }
@@ -31,18 +129,20 @@ Timer::~Timer() = default;
 
 void Timer::Start()
 {
-	m_start_time = std::chrono::high_resolution_clock::now();
+	m_start_time = GetRawCycleCount();
 }
 
 void Timer::Finish()
 {
-	m_end_time = std::chrono::high_resolution_clock::now();
+	m_end_time = GetRawCycleCount();
 }
 
 double Timer::Duration() const
 {
-	auto duration = m_end_time - m_start_time;
-	return std::chrono::duration<double>(duration).count();
+	if(m_end_time < m_start_time){
+		return 0.0;
+	}
+	return CyclesToNs( (double)(m_end_time - m_start_time) ) / 1000000000.0;
 }
 
 uint64_t Timer::GetCycleCount()
@@ -52,4 +152,57 @@ uint64_t Timer::GetCycleCount()
 	return std::chrono::duration_cast<std::chrono::microseconds>(duration).count();
 }
 
+uint64_t Timer::GetRawCycleCount()
+{
+#ifdef TIMER_HAVE_TSC
+	if(timer_use_tsc()){
+		return __rdtsc();
+	}
+#endif
+	return timer_clock_ns();
+}
 
+double Timer::CyclesToNs(double cycles)
+{
+	return cycles * timer_calibration().nsPerCycle;
+}
+
+uint64_t Timer::NowNs()
+{
+	const TimerCalibration& c = timer_calibration();
+	if(!c.tsc){
+		return timer_clock_ns();
+	}
+	int64_t delta = (int64_t)(GetRawCycleCount() - c.baseCycles);
+	return c.baseNs + (uint64_t)( (double)delta * c.nsPerCycle );
+}
+
+bool Timer::InvariantTSC()
+{
+	return timer_calibration().tsc;
+}
+
+TimerId Timer::Schedule(uint64_t delayMs, std::function<void()> fn)
+{
+	return TimerWheel::Global().Schedule( delayMs, std::move( fn ) );
+}
+
+TimerId Timer::Schedule(const Interval& delay, std::function<void()> fn)
+{
+	return TimerWheel::Global().Schedule( delay, std::move( fn ) );
+}
+
+TimerId Timer::SchedulePeriodic(uint64_t periodMs, std::function<void()> fn)
+{
+	return TimerWheel::Global().SchedulePeriodic( periodMs, std::move( fn ) );
+}
+
+TimerId Timer::SchedulePeriodic(const Interval& period, std::function<void()> fn)
+{
+	return TimerWheel::Global().SchedulePeriodic( period, std::move( fn ) );
+}
+
+bool Timer::Cancel(TimerId id)
+{
+	return TimerWheel::Global().Cancel( id );
+}
@@ -25,11 +25,17 @@
 #else
 #       define DLLEXPORT
 #endif
-#include <chrono>
+#include <stdint.h>
+#include <functional>
 
 namespace SLib
 {
 
+class Interval;
+
+/// Identifies a callback scheduled with Timer::Schedule or a TimerWheel, so that it can be cancelled
+typedef uint64_t TimerId;
+
 /**
   * This object allows you to time the durations of pieces of code.
   * Instantiate this object, and then call the Start method when you
@@ -76,17 +82,59 @@ class DLLEXPORT Timer
 		  */
 		double Duration(void) const;
 
-		/** Use this method to retrieve a microsecond resolution clock value.
-		  * We use gettimeofday on linux and ftime on windows to implement this. Note,
-		  * ftime on windows only provides millisecond resolution, not microsecond
-		  * resolution.
+		/** Use this method to retrieve a microsecond resolution clock value.  For a
+		  * cheaper clock with a finer resolution, use GetRawCycleCount.
 		  */
 		static uint64_t GetCycleCount(void);
 
+		/** Use this method to retrieve a high resolution clock value as cheaply as
+		  * possible.  On x86 processors with an invariant TSC this is the raw time
+		  * stamp counter.  Everywhere else it is a monotonic clock in nanoseconds.
+		  * Either way, use CyclesToNs to turn the difference between two of these
+		  * into real time.
+		  */
+		static uint64_t GetRawCycleCount(void);
+
+		/** Converts a count of GetRawCycleCount units into nanoseconds.  The first call
+		  * to this (or NowNs) calibrates the TSC against the monotonic clock, which
+		  * takes about 10 milliseconds.
+		  */
+		static double CyclesToNs(double cycles);
+
+		/** Returns a monotonic clock in nanoseconds, at the cost of reading the TSC
+		  * when we can.
+		  */
+		static uint64_t NowNs(void);
+
+		/// Returns true if GetRawCycleCount is reading an invariant TSC.
+		static bool InvariantTSC(void);
+
+		/** Runs fn once, delayMs milliseconds from now, on ThreadPool::Global.  This uses
+		  * TimerWheel::Global, so any number of these can be pending at once cheaply.
+		  * Returns an id for Cancel.
+		  */
+		static TimerId Schedule(uint64_t delayMs, std::function<void()> fn);
+
+		/// Runs fn once, after the given interval, in the same way.
+		static TimerId Schedule(const Interval& delay, std::function<void()> fn);
+
+		/** Runs fn every periodMs milliseconds, starting one period from now, until it is
+		  * cancelled.  Returns an id for Cancel.
+		  */
+		static TimerId SchedulePeriodic(uint64_t periodMs, std::function<void()> fn);
+
+		/// Runs fn every period, starting one period from now, until it is cancelled.
+		static TimerId SchedulePeriodic(const Interval& period, std::function<void()> fn);
+
+		/** Stops a callback from Schedule or SchedulePeriodic from running again.  Returns
+		  * false if it had already run, or was already cancelled.
+		  */
+		static bool Cancel(TimerId id);
+
 	private:
 
-		std::chrono::high_resolution_clock::time_point m_start_time;
-		std::chrono::high_resolution_clock::time_point m_end_time;
+		uint64_t m_start_time;
+		uint64_t m_end_time;
 
 };
 
@@ -0,0 +1,388 @@
+ /*
+  * Copyright (c) 2001,2002 Steven M. Cherry. All rights reserved.
+  *
+  * This file is a part of slib - a c++ utility library
+  *
+  * The slib project, including all files needed to compile
+  * it, is free software; you can redistribute it and/or use it and/or modify
+  * it under the terms of the GNU Lesser General Public License as published by
+  * the Free Software Foundation.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program.  See file COPYING for details.
+  */
+
+#include <string.h>
+
+#include "TimerWheel.h"
+#include "AnException.h"
+#include "Log.h"
+
+using namespace SLib;
+
+namespace SLib {
+
+struct TimerWheelEntry {
+	/// The neighbours in our slot, or the next free entry when we aren't in use
+	TimerWheelEntry* prev;
+	TimerWheelEntry* next;
+
+	/// The tick we are due at
+	uint64_t deadline;
+
+	/// The ticks between runs for a periodic timer, or 0 for a one-shot one
+	uint64_t period;
+
+	/// Where we are in m_chunks
+	uint32_t index;
+
+	/// Bumped every time we are given back, so that an old TimerId can't cancel a new timer
+	uint32_t generation;
+
+	/// The slot we are in, or -1 if we aren't in one
+	int level;
+	int slot;
+
+	std::shared_ptr<std::function<void()> > fn;
+};
+
+} // End Namespace SLib
+
+/// The mask for the slot number within a level
+#define TIMERWHEEL_MASK (TIMERWHEEL_SLOTS - 1)
+
+/// The largest delay, in ticks, that fits in the wheel
+#define TIMERWHEEL_SPAN (((uint64_t)1 << (TIMERWHEEL_LEVELS * TIMERWHEEL_BITS)) - 1)
+
+TimerWheel::TimerWheel(ThreadPool* pool, int tickMs)
+{
+	if(tickMs <= 0){
+		throw AnException(0, FL, "TimerWheel tick must be positive, not %d.", tickMs );
+	}
+	m_pool = pool == NULL ? &ThreadPool::Global() : pool;
+	m_tickNs = (uint64_t)tickMs * 1000000;
+	memset( m_slots, 0, sizeof(m_slots) );
+	memset( m_used, 0, sizeof(m_used) );
+	m_free = NULL;
+	m_count = 0;
+	m_current = nowTicks();
+	m_wakeAt.store( UINT64_MAX );
+	m_stop.store( false );
+
+	m_thread = new Thread();
+	if(m_thread->start( TimerWheel::wheelStart, this ) != 0){
+		delete m_thread;
+		throw AnException(0, FL, "Unable to start the TimerWheel thread.");
+	}
+}
+
+TimerWheel::~TimerWheel()
+{
+	m_stop.store( true );
+	m_wake.notifyAll();
+	m_thread->join();
+	delete m_thread;
+
+	for(size_t i = 0; i < m_chunks.size(); i++){
+		delete [] m_chunks[ i ];
+	}
+}
+
+TimerId TimerWheel::Schedule(uint64_t delayMs, std::function<void()> fn)
+{
+	uint64_t ticks = (delayMs * 1000000 + m_tickNs - 1) / m_tickNs;
+	return add( ticks, 0, fn );
+}
+
+TimerId TimerWheel::Schedule(const Interval& delay, std::function<void()> fn)
+{
+	return Schedule( (uint64_t)delay.Sec() * 1000, fn );
+}
+
+TimerId TimerWheel::SchedulePeriodic(uint64_t periodMs, std::function<void()> fn)
+{
+	uint64_t ticks = (periodMs * 1000000 + m_tickNs - 1) / m_tickNs;
+	if(ticks == 0){
+		throw AnException(0, FL, "TimerWheel period must be positive.");
+	}
+	return add( ticks, ticks, fn );
+}
+
+TimerId TimerWheel::SchedulePeriodic(const Interval& period, std::function<void()> fn)
+{
+	return SchedulePeriodic( (uint64_t)period.Sec() * 1000, fn );
+}
+
+bool TimerWheel::Cancel(TimerId id)
+{
+	uint32_t index = (uint32_t)id;
+	uint32_t generation = (uint32_t)(id >> 32);
+
+	AdaptiveLock theLock( &m_lock );
+	if(index >= m_chunks.size() * TIMERWHEEL_CHUNK){
+		return false;
+	}
+	TimerWheelEntry* e = &m_chunks[ index / TIMERWHEEL_CHUNK ][ index % TIMERWHEEL_CHUNK ];
+	if(e->generation != generation || e->level < 0){
+		return false;
+	}
+	unlink( e );
+	release( e );
+	return true;
+}
+
+size_t TimerWheel::Pending(void)
+{
+	AdaptiveLock theLock( &m_lock );
+	return m_count;
+}
+
+TimerWheel& TimerWheel::Global(void)
+{
+	// Never deleted, so that it is still there for anything that runs during exit.
+	static TimerWheel* global = new TimerWheel();
+	return *global;
+}
+
+uint64_t TimerWheel::nowTicks(void)
+{
+	return Timer::NowNs() / m_tickNs;
+}
+
+TimerId TimerWheel::add(uint64_t delayTicks, uint64_t periodTicks, std::function<void()>& fn)
+{
+	// Build the shared copy of the callback before we take the lock.
+	std::shared_ptr<std::function<void()> > shared( new std::function<void()>( std::move( fn ) ) );
+	// We are part way through the current tick, so count from the next one, or the timer
+	// could fire up to a tick early.
+	uint64_t now = nowTicks() + 1;
+	TimerId ret;
+	uint64_t deadline;
+	{
+		AdaptiveLock theLock( &m_lock );
+		if(m_free == NULL){
+			TimerWheelEntry* chunk = new TimerWheelEntry[ TIMERWHEEL_CHUNK ];
+			uint32_t base = (uint32_t)(m_chunks.size() * TIMERWHEEL_CHUNK);
+			for(int i = TIMERWHEEL_CHUNK - 1; i >= 0; i--){
+				chunk[ i ].index = base + i;
+				chunk[ i ].generation = 0;
+				chunk[ i ].level = -1;
+				chunk[ i ].next = m_free;
+				m_free = &chunk[ i ];
+			}
+			m_chunks.push_back( chunk );
+		}
+		TimerWheelEntry* e = m_free;
+		m_free = e->next;
+
+		// The wheel can be behind the clock while its thread is waking up, so count from
+		// whichever is later.
+		deadline = (now > m_current ? now : m_current) + delayTicks;
+		e->deadline = deadline;
+		e->period = periodTicks;
+		e->fn = shared;
+		insert( e );
+		m_count ++;
+		ret = ((TimerId)e->generation << 32) | e->index;
+	}
+
+	if(deadline < m_wakeAt.load()){
+		m_wake.notifyOne();
+	}
+	return ret;
+}
+
+void TimerWheel::insert(TimerWheelEntry* e)
+{
+	uint64_t deadline = e->deadline < m_current ? m_current : e->deadline;
+	uint64_t delta = deadline - m_current;
+	if(delta > TIMERWHEEL_SPAN){
+		// Too far out for now.  Park it as far along as we can, and it will come back
+		// round and be put somewhere closer later.
+		deadline = m_current + TIMERWHEEL_SPAN;
+		delta = TIMERWHEEL_SPAN;
+	}
+
+	int level = 0;
+	while(level < TIMERWHEEL_LEVELS - 1 && delta >= ((uint64_t)1 << ((level + 1) * TIMERWHEEL_BITS))){
+		level ++;
+	}
+	int slot = (int)((deadline >> (level * TIMERWHEEL_BITS)) & TIMERWHEEL_MASK);
+
+	e->level = level;
+	e->slot = slot;
+	e->prev = NULL;
+	e->next = m_slots[ level ][ slot ];
+	if(e->next != NULL){
+		e->next->prev = e;
+	}
+	m_slots[ level ][ slot ] = e;
+	m_used[ level ][ slot / 64 ] |= (uint64_t)1 << (slot % 64);
+}
+
+void TimerWheel::unlink(TimerWheelEntry* e)
+{
+	if(e->prev != NULL){
+		e->prev->next = e->next;
+	} else {
+		m_slots[ e->level ][ e->slot ] = e->next;
+		if(e->next == NULL){
+			m_used[ e->level ][ e->slot / 64 ] &= ~((uint64_t)1 << (e->slot % 64));
+		}
+	}
+	if(e->next != NULL){
+		e->next->prev = e->prev;
+	}
+	e->level = -1;
+}
+
+void TimerWheel::release(TimerWheelEntry* e)
+{
+	e->fn.reset();
+	e->generation ++;
+	e->level = -1;
+	e->next = m_free;
+	m_free = e;
+	m_count --;
+}
+
+uint64_t TimerWheel::nextEvent(void)
+{
+	// The next time a level has to be moved down is the next multiple of a level 0
+	// revolution, which is m_current itself if we are sitting on one.
+	uint64_t ret = (m_current + TIMERWHEEL_MASK) & ~(uint64_t)TIMERWHEEL_MASK;
+
+	// And level 0 might have something before then.
+	int from = (int)(m_current & TIMERWHEEL_MASK);
+	for(int word = from / 64; word < TIMERWHEEL_SLOTS / 64; word++){
+		uint64_t bits = m_used[ 0 ][ word ];
+		if(word == from / 64){
+			bits &= ~(uint64_t)0 << (from % 64);
+		}
+		if(bits != 0){
+			int slot = word * 64;
+			while((bits & 1) == 0){
+				bits >>= 1;
+				slot ++;
+			}
+			return (m_current & ~(uint64_t)TIMERWHEEL_MASK) + slot;
+		}
+	}
+	return ret;
+}
+
+void TimerWheel::advance(uint64_t now, vector<std::shared_ptr<std::function<void()> > >& due)
+{
+	if(m_count == 0){
+		// Nothing to do, so catch straight up.
+		if(now + 1 > m_current){
+			m_current = now + 1;
+		}
+		return;
+	}
+
+	while(m_current <= now){
+		// Jump over ticks that have nothing in them.
+		uint64_t next = nextEvent();
+		if(next > now){
+			m_current = now + 1;
+			break;
+		}
+		m_current = next;
+
+		// Move timers down from the higher levels whose turn it is, highest first.
+		for(int level = TIMERWHEEL_LEVELS - 1; level > 0; level--){
+			uint64_t below = ((uint64_t)1 << (level * TIMERWHEEL_BITS)) - 1;
+			if((m_current & below) != 0){
+				continue;
+			}
+			int slot = (int)((m_current >> (level * TIMERWHEEL_BITS)) & TIMERWHEEL_MASK);
+			TimerWheelEntry* e = m_slots[ level ][ slot ];
+			m_slots[ level ][ slot ] = NULL;
+			m_used[ level ][ slot / 64 ] &= ~((uint64_t)1 << (slot % 64));
+			while(e != NULL){
+				TimerWheelEntry* next = e->next;
+				insert( e );
+				e = next;
+			}
+		}
+
+		// Then fire everything in this tick's slot.
+		int slot = (int)(m_current & TIMERWHEEL_MASK);
+		TimerWheelEntry* e = m_slots[ 0 ][ slot ];
+		m_slots[ 0 ][ slot ] = NULL;
+		m_used[ 0 ][ slot / 64 ] &= ~((uint64_t)1 << (slot % 64));
+		m_current ++;
+		while(e != NULL){
+			TimerWheelEntry* next = e->next;
+			e->level = -1;
+			due.push_back( e->fn );
+			if(e->period != 0){
+				// Keep to the original schedule, unless we have fallen a whole period behind.
+				e->deadline += e->period;
+				if(e->deadline < m_current){
+					e->deadline = now + e->period;
+				}
+				insert( e );
+			} else {
+				release( e );
+			}
+			e = next;
+		}
+	}
+}
+
+void* TimerWheel::wheelStart(void* arg)
+{
+	((TimerWheel*)arg)->wheelLoop();
+	return NULL;
+}
+
+void TimerWheel::wheelLoop(void)
+{
+	vector<std::shared_ptr<std::function<void()> > > due;
+	while(!m_stop.load()){
+		uint64_t now = nowTicks();
+		uint64_t wakeAt;
+		{
+			AdaptiveLock theLock( &m_lock );
+			advance( now, due );
+			wakeAt = m_count == 0 ? UINT64_MAX : nextEvent();
+		}
+
+		for(size_t i = 0; i < due.size(); i++){
+			std::shared_ptr<std::function<void()> > fn = due[ i ];
+			try {
+				m_pool->execute( [fn]() { (*fn)(); } );
+			} catch (AnException& e){
+				// The pool is shutting down, which means the process is too.
+				ERRORL(FL, "TimerWheel could not queue a callback: %s", e.Msg() );
+			}
+		}
+		due.clear();
+
+		// Sleep until the next thing we have to do, or until add has something sooner.
+		uint32_t key = m_wake.prepareWait();
+		m_wakeAt.store( wakeAt );
+		{
+			// add may have slipped something in before it could see the new m_wakeAt.
+			AdaptiveLock theLock( &m_lock );
+			if(m_count != 0 && nextEvent() < wakeAt){
+				wakeAt = 0;
+			}
+		}
+		now = nowTicks();
+		if(m_stop.load() || wakeAt <= now){
+			m_wake.cancelWait();
+		} else if(wakeAt == UINT64_MAX){
+			m_wake.wait( key );
+		} else {
+			m_wake.wait( key, (int)(((wakeAt - now) * m_tickNs + 999999) / 1000000) );
+		}
+		m_wakeAt.store( 0 );
+	}
+}
@@ -0,0 +1,205 @@
+#ifndef TIMERWHEEL_H
+#define TIMERWHEEL_H
+ /*
+  * Copyright (c) 2001,2002 Steven M. Cherry. All rights reserved.
+  *
+  * This file is a part of slib - a c++ utility library
+  *
+  * The slib project, including all files needed to compile
+  * it, is free software; you can redistribute it and/or use it and/or modify
+  * it under the terms of the GNU Lesser General Public License as published by
+  * the Free Software Foundation.
+  *
+  * This program is distributed in the hope that it will be useful,
+  * but WITHOUT ANY WARRANTY; without even the implied warranty of
+  * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.
+  *
+  * You should have received a copy of the GNU Lesser General Public License
+  * along with this program.  See file COPYING for details.
+  */
+
+#ifdef _WIN32
+#	ifndef DLLEXPORT
+#		define DLLEXPORT __declspec(dllexport)
+#	endif
+#else
+#	define DLLEXPORT
+#endif
+
+#include <stdint.h>
+#include <atomic>
+#include <vector>
+#include <functional>
+#include <memory>
+using namespace std;
+
+#include "Timer.h"
+#include "Interval.h"
+#include "Thread.h"
+#include "ThreadPool.h"
+#include "AdaptiveMutex.h"
+#include "EventCount.h"
+
+namespace SLib {
+
+/// The number of levels in a TimerWheel
+#define TIMERWHEEL_LEVELS 4
+
+/// The number of bits of the tick count that each level covers
+#define TIMERWHEEL_BITS 8
+
+/// The number of slots on each level
+#define TIMERWHEEL_SLOTS (1 << TIMERWHEEL_BITS)
+
+/// The number of timers allocated at once when a TimerWheel needs more
+#define TIMERWHEEL_CHUNK 1024
+
+/// One scheduled callback.  Defined in TimerWheel.cpp.
+struct TimerWheelEntry;
+
+/**
+  * A hashed hierarchical timing wheel, which keeps any number of one-shot and periodic
+  * timers and runs their callbacks on a ThreadPool when they come due.
+  * <P>
+  * Time is counted in ticks, 1 millisecond each by default.  The wheel has four levels of
+  * 256 slots.  The first level has a slot for each of the next 256 ticks, the second a slot
+  * for each of the next 256 blocks of 256 ticks, and so on up to about 49 days at 1
+  * millisecond a tick.  Timers further out than that wait in the last level until they are
+  * close enough.  Each slot is a linked list, so scheduling and cancelling a timer are both
+  * constant time, whatever the number of timers.  As time passes, the timers in a slot of
+  * a higher level are moved down a level when the level below comes round to them, so each
+  * timer is moved at most three times before it fires.
+  * <P>
+  * One thread runs the wheel.  It sleeps until the next slot that has anything in it, or
+  * the next time a level needs to be moved down, and is woken early when a timer is
+  * scheduled that comes due before then.  The callbacks are not run on that thread, but
+  * queued on the ThreadPool, so a slow callback never makes other timers late.  A periodic
+  * timer is scheduled again as soon as it is queued, so two runs of a slow periodic
+  * callback can overlap.
+  * <P>
+  * A timer is at most one tick late, plus however long the ThreadPool takes to get to it.
+  *
+  * @author Steven M. Cherry
+  */
+class DLLEXPORT TimerWheel
+{
+	private:
+		/// copy constructor is private to prevent use
+		TimerWheel(const TimerWheel& c) {}
+
+		/// assignmet operator is private to prevent use
+		TimerWheel& operator=(const TimerWheel& c) { return *this;}
+
+	public:
+		/** Starts a wheel whose callbacks are run on the given pool, which defaults to
+		  * ThreadPool::Global.  tickMs is the length of one tick in milliseconds.
+		  */
+		TimerWheel(ThreadPool* pool = NULL, int tickMs = 1);
+
+		/// Standard destructor - stops the wheel.  Timers that haven't fired yet never will.
+		virtual ~TimerWheel();
+
+		/// Runs fn once, delayMs milliseconds from now.  Returns an id for Cancel.
+		TimerId Schedule(uint64_t delayMs, std::function<void()> fn);
+
+		/// Runs fn once, after the given interval.  Returns an id for Cancel.
+		TimerId Schedule(const Interval& delay, std::function<void()> fn);
+
+		/** Runs fn every periodMs milliseconds, starting one period from now, until it is
+		  * cancelled.  Returns an id for Cancel.
+		  */
+		TimerId SchedulePeriodic(uint64_t periodMs, std::function<void()> fn);
+
+		/// Runs fn every period, starting one period from now.  Returns an id for Cancel.
+		TimerId SchedulePeriodic(const Interval& period, std::function<void()> fn);
+
+		/** Stops a timer from firing again.  Returns false if it had already fired, or was
+		  * already cancelled.  A callback that is already queued on the pool still runs.
+		  */
+		bool Cancel(TimerId id);
+
+		/// The number of timers that haven't fired yet, counting each periodic timer once
+		size_t Pending(void);
+
+		/** The wheel shared by everything in the process that doesn't need its own, which
+		  * is what Timer::Schedule uses.  It runs its callbacks on ThreadPool::Global, is
+		  * started on first use, and lives until the process exits.
+		  */
+		static TimerWheel& Global(void);
+
+	protected:
+
+		/// The entry point for our thread
+		static void* wheelStart(void* arg);
+
+		/// Runs the wheel until we are destroyed
+		void wheelLoop(void);
+
+		/// Adds a timer to the wheel, and wakes our thread if it will be due before the thread wakes up
+		TimerId add(uint64_t delayTicks, uint64_t periodTicks, std::function<void()>& fn);
+
+		/// Puts an entry in the slot its deadline calls for.  m_lock must be held.
+		void insert(TimerWheelEntry* e);
+
+		/// Takes an entry out of its slot.  m_lock must be held.
+		void unlink(TimerWheelEntry* e);
+
+		/// Gives an entry back to the free list.  m_lock must be held.
+		void release(TimerWheelEntry* e);
+
+		/** Moves the wheel forward to the given tick, moving timers down levels and
+		  * gathering the ones that are due.  m_lock must be held.
+		  */
+		void advance(uint64_t now, vector<std::shared_ptr<std::function<void()> > >& due);
+
+		/// The next tick that advance has something to do at.  m_lock must be held.
+		uint64_t nextEvent(void);
+
+		/// The current time in ticks
+		uint64_t nowTicks(void);
+
+	private:
+
+		/// Where callbacks are run
+		ThreadPool* m_pool;
+
+		/// The length of a tick in nanoseconds
+		uint64_t m_tickNs;
+
+		/// Guards everything below
+		AdaptiveMutex m_lock;
+
+		/// The first entry in each slot, or NULL
+		TimerWheelEntry* m_slots[ TIMERWHEEL_LEVELS ][ TIMERWHEEL_SLOTS ];
+
+		/// A bit for each slot that has something in it
+		uint64_t m_used[ TIMERWHEEL_LEVELS ][ TIMERWHEEL_SLOTS / 64 ];
+
+		/// The next tick that hasn't been dealt with yet
+		uint64_t m_current;
+
+		/// Every entry we have ever allocated, in blocks of TIMERWHEEL_CHUNK
+		vector<TimerWheelEntry*> m_chunks;
+
+		/// Entries that aren't in use, linked through their next pointers
+		TimerWheelEntry* m_free;
+
+		/// The number of timers in the wheel
+		size_t m_count;
+
+		/// The tick our thread will next wake up at, so that add knows when to wake it early
+		std::atomic<uint64_t> m_wakeAt;
+
+		/// Where our thread sleeps
+		EventCount m_wake;
+
+		/// Set when we are being destroyed
+		std::atomic<bool> m_stop;
+
+		/// Our thread
+		Thread* m_thread;
+};
+
+} // End Namespace SLib
+
+#endif // TIMERWHEEL_H Defined
@@ -261,14 +261,22 @@ void ZipFile::AddFile(const twine& infile)
 		throw AnException(0, FL, "Error creating %s in zipfile", infile());
 	} 
 
-	// Read the contents from the file
-	MemBuf fullFileContents;
-	inputFile.readContents( fullFileContents );
-
-	// Write the file contents to the zip file.
-	if( zipWriteInFileInZip (m_zf, fullFileContents(), fullFileContents.size() ) < 0 ){
-		throw AnException(0, FL, "Error in writing %s to the zipfile", fullFileName());
+	// Stream the file contents into the zip file a buffer at a time, so large files (like
+	// rotated log files) don't have to fit in memory.
+	FILE* fin = FOPEN_FUNC(fullFileName(), "rb");
+	if(fin == NULL){
+		zipCloseFileInZip(m_zf);
+		throw AnException(0, FL, "Error opening %s to add to the zipfile", fullFileName());
 	}
+	MemBuf buf( WRITEBUFFERSIZE );
+	size_t bytesRead;
+	while( (bytesRead = fread( buf.data(), 1, buf.size(), fin )) > 0 ){
+		if( zipWriteInFileInZip (m_zf, buf(), (unsigned)bytesRead ) < 0 ){
+			fclose(fin);
+			throw AnException(0, FL, "Error in writing %s to the zipfile", fullFileName());
+		}
+	}
+	fclose(fin);
 
 	if( zipCloseFileInZip(m_zf) != ZIP_OK){
 		throw AnException(0, FL, "Error closing %s in the zipfile.", fullFileName() );
@@ -503,3 +511,52 @@ void ZipFile::Extract( const twine& zipName, const twine& targetDir)
     unzClose(uf);
 }
 
+void ZipFile::ExtractFirstFile( const twine& zipName, File& target)
+{
+	EnEx ee(FL, "ZipFile::ExtractFirstFile(const twine& zipName, File& target)");
+
+	unzFile uf=NULL;
+	int err=UNZ_OK;
+
+	if(!File::Exists( zipName )){
+		throw AnException(0, FL, "Given zip file (%s) does not exist.", zipName() );
+	}
+
+#ifdef USEWIN32IOAPI
+	zlib_filefunc64_def ffunc;
+	fill_win32_filefunc64A(&ffunc);
+	uf = unzOpen2_64(zipName(),&ffunc);
+#else
+	uf = unzOpen64(zipName());
+#endif
+	if(uf == NULL){
+		throw AnException(0, FL, "Could not open zipfile (%s)", zipName() );
+	}
+
+	if( unzGoToFirstFile(uf) != UNZ_OK){
+		unzClose(uf);
+		throw AnException(0, FL, "Zipfile (%s) is empty.", zipName() );
+	}
+	if( unzOpenCurrentFilePassword(uf,NULL) != UNZ_OK){
+		unzClose(uf);
+		throw AnException(0, FL, "Error with zipfile in unzOpenCurrentFilePassword");
+	}
+
+	FILE* fout = (FILE*)target;
+	MemBuf buf( WRITEBUFFERSIZE );
+	while((err = unzReadCurrentFile(uf,buf.data(),(unsigned)buf.size())) > 0){
+		if (fwrite(buf(),err,1,fout) != 1) {
+			unzCloseCurrentFile(uf);
+			unzClose(uf);
+			throw AnException(0, FL, "Error in writing extracted file: %s", target.name()());
+		}
+	}
+	target.flush();
+
+	unzCloseCurrentFile(uf);
+	unzClose(uf);
+
+	if(err < 0){
+		throw AnException(0, FL, "Error %d reading from zipfile (%s)", err, zipName() );
+	}
+}
@@ -31,6 +31,7 @@
 #include "xmlinc.h"
 #include "twine.h"
 #include "MemBuf.h"
+#include "File.h"
 using namespace SLib;
 
 #include "zip.h"
@@ -72,6 +73,12 @@ class DLLEXPORT ZipFile
 		/// The methods to unzip a file are all static.  This extracts all files from the given zip file.
 		static void Extract(const twine& zipName, const twine& targetDir);
 
+		/** The methods to unzip a file are all static.  This streams the first file in the given zip
+		  * file into the target file a buffer at a time.  Use this for single file archives, like the
+		  * ones created when LogFile2 rotates its log file.
+		  */
+		static void ExtractFirstFile(const twine& zipName, File& target);
+
 		/// Set our root folder.
 		void SetRootFolder( const twine& root );
 
@@ -217,6 +217,10 @@ bool HelixWorker::HasError()
 void HelixWorker::Finish()
 {
 	m_finished = 1;
+
+	// Wake up any threads waiting for more work, so they can see that we're done.
+	m_compile_queue.close();
+	m_gen_queue.close();
 }
 
 bool HelixWorker::IsFinished()
@@ -1,21 +1,256 @@
 #include <stdlib.h>
 #include <stdio.h>
+#include <string.h>
+#ifndef _WIN32
+#include <signal.h>
+#include <unistd.h>
+#endif
 
 #include "EnEx.h"
 using namespace SLib;
 
+#include <thread>
+
 void func0(void);
 void func1(void);
 void func2(void);
 void func3(void);
 void func4(void);
 void func5(void);
+int checkThreads(void);
+int checkHistogram(void);
+int checkTrace(void);
+int checkSampling(void);
+int checkCallTree(void);
+int checkReusedBlock(void);
 
 int main(void)
 {
 	func0();
 	EnEx printer("printer");
 	printer.PrintHitMap();
+
+	if(checkThreads() != 0){
+		return 1;
+	}
+	if(checkReusedBlock() != 0){
+		return 1;
+	}
+	if(checkHistogram() != 0){
+		return 1;
+	}
+	if(checkTrace() != 0){
+		return 1;
+	}
+	if(checkSampling() != 0){
+		return 1;
+	}
+	return checkCallTree();
+}
+
+/// Builds a call tree from func2, and checks its paths and folded stack output.
+int checkCallTree(void)
+{
+	EnEx::ResetProfiles();
+	EnEx::SetCallTree( true );
+	for(int i = 0; i < 10; i++){
+		func2();
+	}
+	EnEx::SetCallTree( false );
+
+	// func2 calls func3, which calls func4, which calls func5
+	vector<EnExCallPath> paths = EnEx::CallPaths();
+	const char* expected[] = { "func2", "func2;func3", "func2;func3;func4", "func2;func3;func4;func5" };
+	if(paths.size() != 4){
+		printf("Expected 4 call paths, found %d\n", (int)paths.size());
+		return 1;
+	}
+	double exclusive = 0;
+	for(size_t i = 0; i < paths.size(); i++){
+		if(paths[i].path != expected[i] || paths[i].hits != 10 ||
+			paths[i].exclusiveTime > paths[i].inclusiveTime
+		){
+			printf("Unexpected call path %s with %d hits\n", paths[i].path(), (int)paths[i].hits);
+			return 1;
+		}
+		exclusive += paths[i].exclusiveTime;
+	}
+	if(exclusive > paths[0].inclusiveTime + 1.0 || exclusive < paths[0].inclusiveTime - 1.0){
+		printf("Exclusive times don't add up to the inclusive time of func2\n");
+		return 1;
+	}
+
+	twine folded = EnEx::FoldedStacks();
+	if(strncmp( folded(), "func2 ", 6 ) != 0 || strstr( folded(), "\nfunc2;func3;func4;func5 " ) == NULL){
+		printf("Unexpected folded stacks:\n%s", folded());
+		return 1;
+	}
+	printf("Call tree and folded stacks look good.\n");
+	return 0;
+}
+
+/// Samples 1 in 10 calls, and checks that the hits are still exact.
+int checkSampling(void)
+{
+	EnEx::ResetProfiles();
+	EnEx::SetSampleRate( 10 );
+	for(int i = 0; i < 1000; i++){
+		func5();
+	}
+	EnEx::SetSampleRate( 1 );
+	vector<EnExProfile> after = EnEx::GlobalProfiles();
+	if(after.size() != 1 || after[0].Hits() != 1000 || after[0].TimedHits() != 100){
+		printf("Expected 1000 hits with 100 timed on func5\n");
+		return 1;
+	}
+	printf("Sampling looks good.\n");
+	return 0;
+}
+
+/// Traces one call to func1, and checks that every entry and exit made it to the file.
+int checkTrace(void)
+{
+	EnEx::SetTracing( true );
+	EnEx::ClearTrace();
+	func1();
+	EnEx::SetTracing( false );
+	EnEx::WriteChromeTrace( "test_enex.json" );
+
+	FILE* fp = fopen( "test_enex.json", "r" );
+	if(fp == NULL){
+		printf("Trace file was not written\n");
+		return 1;
+	}
+	char line[ 1024 ];
+	int begins = 0, ends = 0;
+	while(fgets( line, sizeof(line), fp ) != NULL){
+		if(strstr( line, "\"ph\":\"B\"" ) != NULL) begins++;
+		if(strstr( line, "\"ph\":\"E\"" ) != NULL) ends++;
+	}
+	fclose( fp );
+	// func1 calls func2, which calls func3 and so on down to func5
+	if(begins != 5 || ends != 5){
+		printf("Expected 5 trace entries and exits, found %d and %d\n", begins, ends);
+		return 1;
+	}
+	printf("Chrome trace looks good.\n");
+
+#ifndef _WIN32
+	// The same trace, written by the dump thread when we signal ourselves.
+	unlink( "test_enex_signal.json" );
+	EnEx::DumpTraceOnSignal( SIGUSR2, "test_enex_signal.json" );
+	raise( SIGUSR2 );
+	for(int i = 0; i < 200 && (fp = fopen( "test_enex_signal.json", "r" )) == NULL; i++){
+		std::this_thread::sleep_for( std::chrono::milliseconds( 10 ) );
+	}
+	if(fp == NULL){
+		printf("The trace was not written on SIGUSR2\n");
+		return 1;
+	}
+	fclose( fp );
+	printf("Trace dumped on a signal.\n");
+#endif
+	return 0;
+}
+
+/// Checks percentiles against a known distribution, and that ResetProfiles starts over.
+int checkHistogram(void)
+{
+	EnExHistogram hist;
+	for(uint64_t i = 1; i <= 100000; i++){
+		hist.Record( i );
+	}
+	double p50 = (double)hist.Percentile( 50.0 );
+	double p99 = (double)hist.Percentile( 99.0 );
+	if(p50 < 50000 * 0.875 || p50 > 50000 * 1.125 || p99 < 99000 * 0.875 || p99 > 99000 * 1.125){
+		printf("Histogram percentiles are off: p50=%.0f p99=%.0f\n", p50, p99);
+		return 1;
+	}
+
+	EnEx::ResetProfiles();
+	func5();
+	vector<EnExProfile> after = EnEx::GlobalProfiles();
+	if(after.size() != 1 || strcmp( after[0].MethodName(), "func5" ) != 0 || after[0].Hits() != 1 ||
+		after[0].Histogram().Count() != 1
+	){
+		printf("Expected only one hit on func5 after ResetProfiles\n");
+		return 1;
+	}
+	printf("Histogram percentiles and reset look good.\n");
+	return 0;
+}
+
+/// Records what a new thread sees in its own profiles after one call to func5.
+void newThread(vector<EnExProfile>* seen)
+{
+	func5();
+	*seen = EnEx::ThreadProfiles();
+}
+
+/// Checks that a new thread doesn't see the counts of the threads that exited before it.
+int checkReusedBlock(void)
+{
+	vector<EnExProfile> before = EnEx::GlobalProfiles();
+	vector<EnExProfile> seen;
+	std::thread t( newThread, &seen );
+	t.join();
+	if(seen.size() != 1 || strcmp( seen[0].MethodName(), "func5" ) != 0 || seen[0].Hits() != 1){
+		printf("A new thread started with %d methods in its profile\n", (int)seen.size());
+		return 1;
+	}
+
+	// And the threads that exited are still in the totals.
+	vector<EnExProfile> after = EnEx::GlobalProfiles();
+	for(size_t i = 0; i < after.size(); i++){
+		for(size_t j = 0; j < before.size(); j++){
+			if(strcmp( after[i].MethodName(), before[j].MethodName() ) == 0 &&
+				after[i].Hits() < before[j].Hits()
+			){
+				printf("%s lost hits when a new thread started\n", after[i].MethodName());
+				return 1;
+			}
+		}
+	}
+	printf("New threads start with empty profiles.\n");
+	return 0;
+}
+
+/// Runs func0 on several threads at once, and checks that the global view adds them all up.
+int checkThreads(void)
+{
+	vector<EnExProfile> before = EnEx::GlobalProfiles();
+	unsigned long func5Before = 0;
+	for(size_t i = 0; i < before.size(); i++){
+		if(strcmp( before[i].MethodName(), "func5" ) == 0){
+			func5Before = before[i].Hits();
+		}
+	}
+
+	vector<std::thread*> threads;
+	for(int i = 0; i < 4; i++){
+		threads.push_back( new std::thread( func0 ) );
+	}
+	for(size_t i = 0; i < threads.size(); i++){
+		threads[i]->join();
+		delete threads[i];
+	}
+
+	EnEx::PrintGlobalHitMap();
+	vector<EnExProfile> after = EnEx::GlobalProfiles();
+	for(size_t i = 0; i < after.size(); i++){
+		if(strcmp( after[i].MethodName(), "func5" ) == 0){
+			// func0 reaches func5 five times per loop, 2000 times
+			if(after[i].Hits() - func5Before != 4 * 2000 * 5){
+				printf("Expected %d more hits on func5, found %lu\n", 4 * 2000 * 5,
+					after[i].Hits() - func5Before );
+				return 1;
+			}
+			printf("Global hit counts add up across threads.\n");
+			return 0;
+		}
+	}
+	printf("func5 is missing from the global hit map\n");
+	return 1;
 }
 
 void func0(void)
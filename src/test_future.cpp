@@ -0,0 +1,173 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+#include <atomic>
+using namespace std;
+
+#include "Future.h"
+#include "AnException.h"
+#include "Timer.h"
+#include "Tools.h"
+#include "twine.h"
+using namespace SLib;
+
+void runTest1();
+void runTest2();
+void runTest3();
+void runTest4();
+
+int main(void)
+{
+	try {
+		runTest1();
+		runTest2();
+		runTest3();
+		runTest4();
+	} catch (AnException& e){
+		printf("Exception caught: %s\n", e.Msg() );
+		printf("Aborting tests.\n" );
+		return -1;
+	}
+	return 0;
+}
+
+void runTest1()
+{
+	// A chain of continuations, including one that returns another future.
+	printf("Checking spawn and then\n");
+	ThreadPool pool( 2 );
+	Future<int> a = spawn( []() { return 20; }, pool );
+	Future<twine> b = a.then( [](const int& v) { twine s; s.format( "%d", v + 1 ); return s; }, pool );
+	Future<size_t> c = b.then( [&pool](const twine& s) {
+		return spawn( [s]() { return s.size() * 100; }, pool );
+	}, pool );
+	std::atomic<int> ran( 0 );
+	Future<void> d = c.then( [&ran](const size_t& v) { ran = (int)v; }, pool );
+	Future<int> e = d.then( []() { return 7; }, pool );
+	if(e.get() != 7 || ran.load() != 200 || b.get() != "21" || !c.ready()){
+		throw AnException(0, FL, "The chain gave the wrong answers: %d %d %s", e.get(), ran.load(), b.get()() );
+	}
+
+	Promise<int> p;
+	Future<int> f = p.future();
+	if(f.wait( 20 )){
+		throw AnException(0, FL, "A future was ready before its promise was set");
+	}
+	p.setValue( 5 );
+	bool threw = false;
+	try {
+		p.setValue( 6 );
+	} catch (AnException&){
+		threw = true;
+	}
+	if(!threw || f.get() != 5){
+		throw AnException(0, FL, "Setting a promise twice didn't throw");
+	}
+	printf("spawn and then gave %d.\n", e.get());
+}
+
+void runTest2()
+{
+	// An exception skips the continuations and comes out of get.
+	printf("Checking that exceptions pass through then\n");
+	std::atomic<int> called( 0 );
+	Future<int> bad = spawn( []() -> int { throw AnException(0, FL, "bad input"); } );
+	Future<int> after = bad.then( [&called](const int& v) { called ++; return v; } )
+		.then( [&called](const int& v) { called ++; return v * 2; } );
+	bool threw = false;
+	try {
+		after.get();
+	} catch (AnException& e){
+		threw = twine( e.Msg() ) == "bad input";
+	}
+	if(!threw || called.load() != 0 || !after.failed()){
+		throw AnException(0, FL, "The exception didn't come through");
+	}
+	printf("The exception came through without calling the continuations.\n");
+}
+
+void runTest3()
+{
+	printf("Checking when_all, when_any and delay\n");
+	vector<Future<int> > all;
+	for(int i = 0; i < 10; i++){
+		all.push_back( spawn( [i]() { Tools::msleep( 10 - i ); return i * i; } ) );
+	}
+	vector<Future<int> > done = when_all( all ).get();
+	int sum = 0;
+	for(size_t i = 0; i < done.size(); i++){
+		if(!done[ i ].ready()){
+			throw AnException(0, FL, "when_all finished before future %d", (int)i );
+		}
+		sum += done[ i ].get();
+	}
+	if(sum != 285){
+		throw AnException(0, FL, "when_all gave a sum of %d", sum );
+	}
+
+	vector<Future<void> > race;
+	race.push_back( delay( 500 ) );
+	race.push_back( delay( 20 ) );
+	uint64_t start = Timer::NowNs();
+	size_t first = when_any( race ).get();
+	uint64_t took = Timer::NowNs() - start;
+	if(first != 1 || took < 20000000 || took > 400000000){
+		throw AnException(0, FL, "when_any picked %d after %llu ns", (int)first, (unsigned long long)took );
+	}
+	printf("when_all added up to %d, and when_any picked the shorter delay.\n", sum);
+}
+
+#ifdef SLIB_COROUTINES
+
+Future<int> slowSquare(int v)
+{
+	co_await delay( 5 );
+	co_return v * v;
+}
+
+Future<int> sumOfSquares(int n)
+{
+	int sum = 0;
+	for(int i = 1; i <= n; i++){
+		sum += co_await slowSquare( i );
+	}
+	co_await resume_on( ThreadPool::Global() );
+	sum += co_await spawn( []() { return 1000; } );
+	co_return sum;
+}
+
+Future<void> failing(void)
+{
+	co_await delay( 1 );
+	throw AnException(0, FL, "failed in a coroutine");
+}
+
+void runTest4()
+{
+	// Coroutines written as straight lines.
+	printf("Checking coroutines\n");
+	int sum = sumOfSquares( 5 ).get();
+	if(sum != 1055){
+		throw AnException(0, FL, "The coroutine gave %d", sum );
+	}
+	bool threw = false;
+	try {
+		failing().get();
+	} catch (AnException&){
+		threw = true;
+	}
+	if(!threw){
+		throw AnException(0, FL, "The coroutine's exception was lost");
+	}
+	printf("The coroutine gave %d.\n", sum);
+}
+
+#else
+
+void runTest4()
+{
+	printf("Coroutines need C++20 - skipping\n");
+}
+
+#endif
@@ -0,0 +1,187 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+#include <atomic>
+using namespace std;
+
+#include "Mutex.h"
+#include "Lock.h"
+#include "RWMutex.h"
+#include "AdaptiveMutex.h"
+#include "LockProfile.h"
+#include "AnException.h"
+#include "EnEx.h"
+#include "Thread.h"
+#include "Tools.h"
+using namespace SLib;
+
+#define THREADS 8
+#define PER_THREAD 100000
+
+void runTest1();
+void runTest2();
+void runTest3();
+
+int main(void)
+{
+	try {
+		runTest1();
+		runTest2();
+		runTest3();
+	} catch (AnException& e){
+		printf("Exception caught: %s\n", e.Msg() );
+		printf("Aborting tests.\n" );
+		return -1;
+	}
+	return 0;
+}
+
+AdaptiveMutex adaptive( "test adaptive" );
+long adaptiveCount = 0;
+
+void* adaptiveWorker(void*)
+{
+	for(int i = 0; i < PER_THREAD; i++){
+		AdaptiveLock theLock( &adaptive );
+		adaptiveCount ++;
+	}
+	return NULL;
+}
+
+void runTest1()
+{
+	// Every increment has to happen under the lock, or some of them get lost.
+	printf("Running %d threads through an AdaptiveMutex\n", THREADS);
+	vector<Thread*> threads;
+	for(int i = 0; i < THREADS; i++){
+		threads.push_back( new Thread() );
+		threads.back()->start( adaptiveWorker, NULL );
+	}
+	for(size_t i = 0; i < threads.size(); i++){
+		threads[ i ]->join();
+		delete threads[ i ];
+	}
+	if(adaptiveCount != (long)THREADS * PER_THREAD){
+		throw AnException(0, FL, "AdaptiveMutex lost updates: %ld of %ld", adaptiveCount,
+			(long)THREADS * PER_THREAD );
+	}
+	if(!adaptive.trylock()){
+		throw AnException(0, FL, "trylock failed on a free AdaptiveMutex");
+	}
+	if(adaptive.trylock()){
+		throw AnException(0, FL, "trylock worked on a locked AdaptiveMutex");
+	}
+	adaptive.unlock();
+	printf("AdaptiveMutex kept all %ld increments.\n", adaptiveCount);
+}
+
+RWMutex rw( "test rw" );
+std::atomic<int> readersIn( 0 );
+std::atomic<int> mostReaders( 0 );
+std::atomic<int> writersIn( 0 );
+std::atomic<int> badOverlaps( 0 );
+long rwValue[ 2 ] = { 0, 0 };
+
+void* rwWorker(void* v)
+{
+	bool writer = (intptr_t)v == 0;
+	for(int i = 0; i < 2000; i++){
+		if(writer){
+			WriteLock theLock( &rw );
+			if(writersIn.fetch_add( 1 ) != 0 || readersIn.load() != 0){
+				badOverlaps ++;
+			}
+			rwValue[ 0 ] ++;
+			rwValue[ 1 ] ++;
+			writersIn.fetch_sub( 1 );
+		} else {
+			ReadLock theLock( &rw );
+			int now = readersIn.fetch_add( 1 ) + 1;
+			int most = mostReaders.load();
+			while(now > most && !mostReaders.compare_exchange_weak( most, now )){
+			}
+			if(writersIn.load() != 0 || rwValue[ 0 ] != rwValue[ 1 ]){
+				badOverlaps ++;
+			}
+			Tools::usleep( 10 ); // linger, so that readers overlap
+			readersIn.fetch_sub( 1 );
+		}
+	}
+	return NULL;
+}
+
+void runTest2()
+{
+	// Readers share, writers don't.
+	printf("Running readers and a writer through an RWMutex\n");
+	vector<Thread*> threads;
+	for(int i = 0; i < 4; i++){
+		threads.push_back( new Thread() );
+		threads.back()->start( rwWorker, (void*)(intptr_t)i );
+	}
+	for(size_t i = 0; i < threads.size(); i++){
+		threads[ i ]->join();
+		delete threads[ i ];
+	}
+	if(badOverlaps.load() != 0){
+		throw AnException(0, FL, "RWMutex let a writer overlap %d times", badOverlaps.load() );
+	}
+	if(rwValue[ 0 ] != 2000){
+		throw AnException(0, FL, "RWMutex lost writes");
+	}
+	if(mostReaders.load() < 2){
+		throw AnException(0, FL, "RWMutex never let readers share");
+	}
+	printf("RWMutex had up to %d readers at once, and no overlapping writers.\n", mostReaders.load());
+}
+
+Mutex profiled( "test profiled" );
+
+void* slowHolder(void*)
+{
+	EnEx ee( "slowHolder" );
+	Lock theLock( &profiled );
+	Tools::msleep( 50 );
+	return NULL;
+}
+
+void runTest3()
+{
+	// A wait on a named mutex is recorded under its name, with the method that held it.
+	printf("Checking that LockProfile records who held a mutex\n");
+	LockProfile::SetProfiling( true );
+	Thread t;
+	t.start( slowHolder, NULL );
+	Tools::msleep( 10 );
+	{
+		EnEx ee( "waiter" );
+		Lock theLock( &profiled );
+	}
+	t.join();
+	LockProfile::SetProfiling( false );
+
+	vector<LockProfileStats> profiles = LockProfile::Profiles();
+	bool found = false;
+	for(size_t i = 0; i < profiles.size(); i++){
+		if(profiles[ i ].name == "test profiled"){
+			found = true;
+			if(profiles[ i ].waits != 1 || profiles[ i ].holders.size() != 1 ||
+				profiles[ i ].holders[ 0 ].site != "slowHolder" || profiles[ i ].maxWaitNs < 10e6
+			){
+				throw AnException(0, FL, "LockProfile got the wait wrong");
+			}
+		}
+	}
+	if(!found){
+		throw AnException(0, FL, "LockProfile didn't record the wait");
+	}
+	twine report;
+	LockProfile::PrintReport( report );
+	printf("%s", report() );
+
+	LockProfile::Reset();
+	if(!LockProfile::Profiles().empty()){
+		throw AnException(0, FL, "LockProfile::Reset left something behind");
+	}
+}
@@ -25,6 +25,7 @@
 #include <stdlib.h>
 
 #include "Log.h"
+#include "Tools.h"
 using namespace SLib;
 
 int main(void)
@@ -50,7 +51,77 @@ int main(void)
 
 	DEBUG(FL, "This is a debug message.");
 
-	TRACE(FL, "That's it.  Main is done.");
+	printf("Testing duplicate suppression and rate limiting:\n");
+	Log::SetDuplicateSuppression(1, true);
+	Log::SetRateLimit(2, 10, 5);
+	Log::SetLazy(true); // so we can count what makes it through
+	for(int i = 0; i <= 1000; i++){
+		ERRORL(FL, "Connection %s", i < 1000 ? "refused" : "restored");
+	}
+	// Expect: the first one, the repeated summary, and the restored message.
+	int count = Log::GetLogQueue().Size();
+	while(Log::GetLogQueue().Size() != 0){
+		LogMsg* lm = Log::GetLogQueue().GetMsg();
+		printf("%s\n", lm->msg() );
+		delete lm;
+	}
+	if(count != 3){
+		printf("Expected 3 messages after duplicate suppression, found %d\n", count);
+		return 1;
+	}
+
+	for(int i = 0; i < 1000; i++){
+		WARN(FL, "Retrying request %d", i);
+	}
+	// The summary comes out without another message from that call site.
+	Log::FlushSummaries();
+	count = 0;
+	int dropped = 0;
+	while(Log::GetLogQueue().Size() != 0){
+		LogMsg* lm = Log::GetLogQueue().GetMsg();
+		if(lm->msg.startsWith("Retrying request")){
+			count++;
+		} else {
+			dropped += atoi(lm->msg());
+		}
+		delete lm;
+	}
+	if(count < 5 || count > 10){
+		printf("Expected about 5 messages after rate limiting, found %d\n", count);
+		return 1;
+	}
+	if(count + dropped != 1000){
+		printf("Rate limiting let %d through and reported %d dropped\n", count, dropped);
+		return 1;
+	}
+	printf("Rate limiting let %d of 1000 messages through\n", count);
+
+	for(int i = 0; i < 3; i++){
+		ERRORL(FL, "Disk full");
+	}
+	Tools::msleep(1500); // the summary timer logs this one for us
+	count = Log::GetLogQueue().Size();
+	while(Log::GetLogQueue().Size() != 0){
+		LogMsg* lm = Log::GetLogQueue().GetMsg();
+		printf("%s\n", lm->msg() );
+		delete lm;
+	}
+	if(count != 2){
+		printf("Expected 2 messages from the summary timer, found %d\n", count);
+		return 1;
+	}
+
+	LogEntry(FL, 3).Field("request_id", (int64_t)42).Field("status", "ok").Write("Request complete");
+	Log::SetDebug(false);
+	LogEntry(FL, 4).Field("skipped", (int64_t)1).Write("Channel is off");
+	if(Log::GetLogQueue().Size() != 1){
+		printf("Expected 1 structured message, found %d\n", (int)Log::GetLogQueue().Size());
+		return 1;
+	}
+	LogMsg* lm = Log::GetLogQueue().GetMsg();
+	printf("%s {%s}\n", lm->msg(), lm->FieldsAsText()() );
+	delete lm;
+	Log::SetLazy(false);
 
 	printf("Log Test Done\n");
 }
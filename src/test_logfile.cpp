@@ -6,6 +6,7 @@
 using namespace SLib;
 
 #include <stdarg.h>
+#include <sys/stat.h>
 
 void runTest1();
 void runTest2();
@@ -80,16 +81,142 @@ void runTest1()
 
 void runTest2()
 {
-	// Open a new log file and write some messages to it.
-	
+	// Open a new memory mapped log file and write some messages to it.
+	printf("Opening a new memory mapped log file testLogFile1m.log\n");
+	LogFile lf("testLogFile1m.log", 
+		1024 * 1024 * 10, // 10M max size
+		10000, // entries max
+		1024 * 1024 * 1, // 1M string table
+		1024 * 10, // 10K strings
+		false, // don't re-use
+		true,  // clear at startup
+		true   // memory mapped
+	);
+
+	for(int i = 0; i < 100; i ++){
+		dptr<LogMsg> lm = buildMessage(FL, "Test Message #%d", i);
+		lm->id = i;
+		lf.writeMsg(*lm);
+	}
+
+	// Follow it with a second, read only mapping, the way LogDump -w does.
+	LogFile reader("testLogFile1m.log", 
+		1024 * 1024 * 10, // 10M max size
+		10000, // entries max
+		1024 * 1024 * 1, // 1M string table
+		1024 * 10, // 10K strings
+		false, // don't re-use
+		false, // don't clear at startup
+		true,  // memory mapped
+		true   // read only
+	);
+	if(reader.messageCount() != 100){
+		throw AnException(0, FL, "Expected 100 messages in the mapped reader, found %d",
+			reader.messageCount() );
+	}
 
+	for(int i = 100; i < 200; i ++){
+		dptr<LogMsg> lm = buildMessage(FL, "Test Message #%d", i);
+		lm->id = i;
+		lf.writeMsg(*lm);
+	}
+	reader.refresh();
+	if(reader.getNewestMessageID() != 199){
+		throw AnException(0, FL, "Expected the reader to see message 199, found %d",
+			reader.getNewestMessageID() );
+	}
+	dptr<LogMsg> last; last = reader.getMessage(199);
+	if(last == NULL || last->msg != "Test Message #199"){
+		throw AnException(0, FL, "Message 199 did not read back correctly from the mapping.");
+	}
+	lf.close();
+	reader.close();
+
+	// The file format is the same, so the stdio version can read it too.
+	LogFile lf2("testLogFile1m.log", 
+		1024 * 1024 * 10, // 10M max size
+		10000, // entries max
+		1024 * 1024 * 1, // 1M string table
+		1024 * 10, // 10K strings
+		false, // don't re-use
+		false  // don't clear at startup
+	);
+	if(lf2.messageCount() != 200){
+		throw AnException(0, FL, "Expected 200 messages reading with stdio, found %d",
+			lf2.messageCount() );
+	}
+	printf("Memory mapped log file looks good.\n");
+	lf2.close();
+}
+
+static long fileSize(const char* name)
+{
+	struct stat st;
+	if(stat(name, &st) != 0){
+		return -1;
+	}
+	return (long)st.st_size;
 }
 
 void runTest3()
 {
-	// Open a new log file and write some messages to it.
-	
+	// A read only, memory mapped reader must never grow a file that is written with stdio.
+	printf("Following a stdio log file with a read only mapping\n");
+	LogFile lf("testLogFile1r.log", 
+		1024 * 1024 * 10, // 10M max size
+		10000, // entries max
+		1024 * 1024 * 1, // 1M string table
+		1024 * 10, // 10K strings
+		false, // don't re-use
+		true   // clear at startup
+	);
+	for(int i = 0; i < 10; i ++){
+		dptr<LogMsg> lm = buildMessage(FL, "Test Message #%d", i);
+		lm->id = i;
+		lf.writeMsg(*lm);
+	}
+	long before = fileSize("testLogFile1r.log");
 
+	LogFile reader("testLogFile1r.log", 
+		1024 * 1024 * 10, // 10M max size
+		10000, // entries max
+		1024 * 1024 * 1, // 1M string table
+		1024 * 10, // 10K strings
+		false, // don't re-use
+		true,  // clear at startup - which a reader must ignore
+		true,  // memory mapped
+		true   // read only
+	);
+	if(fileSize("testLogFile1r.log") != before || reader.messageCount() != 10){
+		throw AnException(0, FL, "The reader changed the file from %ld to %ld bytes, or lost messages",
+			before, fileSize("testLogFile1r.log") );
+	}
+
+	// The writer grows the file, and the reader maps the new part on refresh.
+	for(int i = 10; i < 20; i ++){
+		dptr<LogMsg> lm = buildMessage(FL, "Test Message #%d", i);
+		lm->id = i;
+		lf.writeMsg(*lm);
+	}
+	reader.refresh();
+	dptr<LogMsg> last; last = reader.getMessage(19);
+	if(last == NULL || last->msg != "Test Message #19"){
+		throw AnException(0, FL, "The reader didn't see the writer's new messages.");
+	}
+
+	bool threw = false;
+	try {
+		dptr<LogMsg> lm = buildMessage(FL, "Not allowed");
+		reader.writeMsg(*lm);
+	} catch (AnException&){
+		threw = true;
+	}
+	if(!threw){
+		throw AnException(0, FL, "A read only log file let us write to it.");
+	}
+	printf("The read only reader left the file alone.\n");
+	reader.close();
+	lf.close();
 }
 
 LogMsg* buildMessage(const char* file, int line, const char* msg, ...)
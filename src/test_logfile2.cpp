@@ -4,6 +4,9 @@
 #include "AnException.h"
 #include "dptr.h"
 #include "Timer.h"
+#include "Tools.h"
+#include "ZipFile.h"
+#include "TmpFile.h"
 using namespace SLib;
 
 #include <stdarg.h>
@@ -11,6 +14,12 @@ using namespace SLib;
 void runTest1();
 void runTest2();
 void runTest3();
+void runTest4();
+void runTest5();
+void runTest6();
+void runTest7();
+void runTest8();
+void runTest9();
 LogMsg* buildMessage(const char* file, int line, const char* msg, ...);
 
 int main(void)
@@ -23,6 +32,18 @@ int main(void)
 
 		runTest3();
 
+		runTest4();
+
+		runTest5();
+
+		runTest6();
+
+		runTest7();
+
+		runTest8();
+
+		runTest9();
+
 	} catch (AnException& e){
 		printf("Exception caught: %s\n", e.Msg() );
 		printf("Aborting tests.\n" );
@@ -105,6 +126,255 @@ void runTest3()
 	printf("Duration for runTest3 is (%f)\n", tt.Duration() );
 }
 
+void runTest4()
+{
+	Timer tt;
+	tt.Start();
+	// Open a new log file in WAL mode and write some messages to it.
+	printf("Opening a new log file testLogFile5.log in WAL mode - writing 100,000 messages.\n");
+	twine fileName = "testLogFile5.log";
+	LogFile2 lf(fileName, (size_t)(1024 * 1024 * 10)); // 10M max size
+	printf("log file opened\n");
+	lf.setWALMode( true );
+	lf.setSyncNormal( true );
+	lf.setCacheSize( 1000 );
+
+	// Create 100,000 messages:
+	for(int i = 0; i < 100000; i ++){
+		dptr<LogMsg> lm = buildMessage(FL, "Test Message #%d", i);
+		lm->id = i;
+		lf.writeMsg(*lm);
+	}
+	lf.flush(); // ensure everything goes to the disk.
+
+	printf("Closing log:\n");
+	lf.close();
+	tt.Finish();
+	printf("Duration for runTest4 is (%f)\n", tt.Duration() );
+}
+
+void runTest5()
+{
+	// Write a few messages and make sure the flush thread puts them on the disk
+	// without anyone calling flush.
+	printf("Opening a new log file testLogFile6.log - checking cache time flushing.\n");
+	twine fileName = "testLogFile6.log";
+	LogFile2 lf(fileName, (size_t)(1024 * 1024 * 10)); // 10M max size
+	lf.setCacheSize( 1000 );
+	lf.setCacheTime( 100 );
+
+	for(int i = 0; i < 5; i ++){
+		dptr<LogMsg> lm = buildMessage(FL, "Test Message #%d", i);
+		lf.writeMsg(*lm);
+	}
+	// A few cache times, but well under a second.
+	Tools::msleep( 300 );
+
+	LogFile2 reader(true, fileName);
+	int count = reader.messageCount();
+	if(count != 5){
+		throw AnException(0, FL, "Expected 5 messages on disk after the cache time, found %d", count);
+	}
+	printf("Found %d messages on disk after the cache time.\n", count);
+}
+
+void runTest6()
+{
+	// Write messages to an indexed log file and read them back with filters.
+	printf("Opening a new log file testLogFile7.log - checking indexes and filtered reads.\n");
+	twine fileName = "testLogFile7.log";
+	LogFile2 lf(fileName, (size_t)(1024 * 1024 * 10)); // 10M max size
+	lf.setIndexes( true );
+	lf.setTextIndex( true );
+	if(lf.getSchemaVersion() != LOGFILE2_SCHEMA_VERSION){
+		throw AnException(0, FL, "Unexpected schema version %d", lf.getSchemaVersion() );
+	}
+
+	for(int i = 0; i < 1000; i ++){
+		dptr<LogMsg> lm = buildMessage(FL, "Test Message #%d %s", i, (i % 10 == 0) ? "connection refused" : "ok");
+		lm->channel = i % 7;
+		lf.writeMsg(*lm);
+	}
+	lf.flush();
+
+	LogFilter filter;
+	filter.channelMask = (1 << 1) | (1 << 2);
+	int count = lf.messageCount( filter );
+	if(count != 286){
+		throw AnException(0, FL, "Expected 286 ERROR/WARN messages, found %d", count);
+	}
+
+	LogFilter match;
+	match.msgMatch = "connection AND refused";
+	count = 0;
+	while(true){
+		dptr<vector<LogMsg*> > msgs = lf.getMessages( match, 30 );
+		for(size_t i = 0; i < msgs->size(); i++){
+			match.afterId = msgs->at( i )->id;
+			delete msgs->at( i );
+			count ++;
+		}
+		if(msgs->size() < 30) break;
+	}
+	if(count != 100){
+		throw AnException(0, FL, "Expected 100 text matches, found %d", count);
+	}
+
+	LogFilter contains;
+	contains.msgText = "#99";
+	count = lf.messageCount( contains );
+	if(count != 11){
+		throw AnException(0, FL, "Expected 11 messages containing #99, found %d", count);
+	}
+	printf("Filtered reads look good.\n");
+}
+
+void runTest7()
+{
+	// Write enough to roll over several times and let the rotator compress and prune the old files.
+	printf("Opening a new log file testLogFile8.log - checking rotation and retention.\n");
+	twine fileName = "testLogFile8.log";
+	vector<twine> archives;
+	{
+		LogFile2 lf(fileName, (size_t)(64 * 1024)); // 64K max size
+		lf.rotator().setMaxFiles( 3 );
+		lf.setCacheSize( 100 );
+
+		for(int i = 0; i < 20000; i ++){
+			dptr<LogMsg> lm = buildMessage(FL, "Test Message #%d", i);
+			lf.writeMsg(*lm);
+		}
+		lf.flush();
+		lf.rotator().Wait();
+		archives = lf.rotator().Archives();
+	}
+	if(archives.size() == 0 || archives.size() > 3){
+		throw AnException(0, FL, "Expected 1 to 3 archives, found %d", (int)archives.size() );
+	}
+
+	// Make sure the newest archive can be read back.
+	TmpFile unzipped;
+	ZipFile::ExtractFirstFile( archives[ archives.size() - 1 ], unzipped );
+	LogFile2 reader(true, unzipped.name() );
+	int count = reader.messageCount();
+	if(count == 0){
+		throw AnException(0, FL, "Expected messages in archive %s", archives[ archives.size() - 1 ]() );
+	}
+	printf("Found %d archives, the newest holds %d messages.\n", (int)archives.size(), count);
+}
+
+void runTest8()
+{
+	// Write messages with structured fields, then filter and aggregate on them.
+	printf("Opening a new log file testLogFile9.log - checking structured fields.\n");
+	twine fileName = "testLogFile9.log";
+	File::Delete( fileName );
+	LogFile2 lf(fileName, (size_t)(1024 * 1024 * 10)); // 10M max size
+
+	for(int i = 0; i < 1000; i ++){
+		dptr<LogMsg> lm = buildMessage(FL, "Request complete");
+		lm->Field( "request_id", (int64_t)i );
+		lm->Field( "latency_ms", (int64_t)(i % 200) - 50 );
+		lm->Field( "status", (i % 4 == 0) ? "error" : "ok" );
+		lf.writeMsg(*lm);
+	}
+	dptr<LogMsg> plain = buildMessage(FL, "No fields here");
+	lf.writeMsg(*plain);
+	lf.flush();
+
+	LogFilter filter;
+	filter.addField( "latency_ms", ">", "100" );
+	filter.addField( "status", "=", "error" );
+	dptr<vector<LogMsg*> > msgs = lf.getMessages( filter );
+	int count = (int)msgs->size();
+	for(size_t i = 0; i < msgs->size(); i++){
+		const LogField* f = msgs->at( i )->GetField( "latency_ms" );
+		if(f == NULL || !f->isInt || f->intValue <= 100){
+			throw AnException(0, FL, "Field filter returned a message that doesn't match");
+		}
+		delete msgs->at( i );
+	}
+	if(count != 60){
+		throw AnException(0, FL, "Expected 60 slow errors, found %d", count);
+	}
+
+	// An operator put straight into fields, around addField, never reaches the sql.
+	LogFilter sneaky;
+	LogFieldMatch m;
+	m.name = "status";
+	m.op = "= 'ok' or 1 = 1 or 'x' =";
+	m.value = "error";
+	sneaky.fields.push_back( m );
+	bool threw = false;
+	try {
+		dptr<vector<LogMsg*> > none = lf.getMessages( sneaky );
+	} catch (AnException&){
+		threw = true;
+	}
+	if(!threw){
+		throw AnException(0, FL, "An invalid field operator was accepted");
+	}
+
+	LogFilter all;
+	LogFieldStats stats = lf.fieldStats( all, "latency_ms" );
+	if(stats.count != 1000 || stats.min != -50 || stats.max != 149){
+		throw AnException(0, FL, "Unexpected latency_ms stats count=%d min=%lld max=%lld",
+			stats.count, (long long)stats.min, (long long)stats.max );
+	}
+	map<twine, int> counts = lf.fieldCounts( all, "status" );
+	if(counts.size() != 2 || counts["error"] != 250 || counts["ok"] != 750){
+		throw AnException(0, FL, "Unexpected status counts");
+	}
+	printf("Structured fields look good.\n");
+}
+
+void runTest9()
+{
+	// A file written before we kept a schema version has no logschema table and no fields
+	// column.  Opening it read-write has to upgrade it before anything is written.
+	printf("Creating a baseline schema log file testLogFile10.log - checking the upgrade.\n");
+	twine fileName = "testLogFile10.log";
+	File::Delete( fileName );
+	sqlite3* db = NULL;
+	if(sqlite3_open( fileName(), &db ) != SQLITE_OK){
+		throw AnException(0, FL, "Error creating %s", fileName() );
+	}
+	int rc = sqlite3_exec( db, "create table logtable ( "
+		"id integer primary key autoincrement, file varchar(20), line int, tid int, "
+		"timestamp_a int, timestamp_b int, channel int, appName varchar(10), "
+		"machineName varchar(10), appSession varchar(10), msg varchar(10) ); "
+		"insert into logtable ( file, line, tid, timestamp_a, timestamp_b, channel, "
+		"appName, machineName, appSession, msg ) values "
+		"( 'old.cpp', 1, 1, 0, 0, 0, '', '', '', 'Written by the old schema' );",
+		NULL, NULL, NULL );
+	sqlite3_close( db );
+	if(rc != SQLITE_OK){
+		throw AnException(0, FL, "Error creating the baseline schema in %s", fileName() );
+	}
+
+	{
+		LogFile2 lf(fileName, (size_t)(1024 * 1024 * 10)); // 10M max size
+		dptr<LogMsg> lm = buildMessage(FL, "Written by the new schema");
+		lm->Field( "request_id", (int64_t)7 );
+		lf.writeMsg(*lm);
+		lf.flush();
+	}
+
+	LogFile2 reader(true, fileName );
+	dptr<vector<LogMsg*> > msgs = reader.getMessages( "order by id" );
+	if(msgs->size() != 2){
+		throw AnException(0, FL, "Expected 2 messages in the upgraded file, found %d", (int)msgs->size() );
+	}
+	const LogField* f = msgs->at( 1 )->GetField( "request_id" );
+	if(msgs->at( 0 )->msg != "Written by the old schema" || f == NULL || f->intValue != 7){
+		throw AnException(0, FL, "The upgraded file didn't read back correctly");
+	}
+	for(size_t i = 0; i < msgs->size(); i++){
+		delete msgs->at( i );
+	}
+	printf("The baseline schema file was upgraded and written to.\n");
+}
+
 LogMsg* buildMessage(const char* file, int line, const char* msg, ...)
 {
 	LogMsg* lm = new LogMsg(file, line);
@@ -0,0 +1,238 @@
+#include "Log.h"
+#include "LogMsg.h"
+#include "LogFile2.h"
+#include "LogShipper.h"
+#include "LogCollector.h"
+#include "AnException.h"
+#include "File.h"
+#include "dptr.h"
+#include "Timer.h"
+#include "Tools.h"
+#include "Socket.h"
+using namespace SLib;
+
+#include <stdarg.h>
+#include <string.h>
+#ifndef _WIN32
+#include <arpa/inet.h>
+#endif
+
+void runTest1();
+void runTest2();
+void runTest3();
+LogMsg* buildMessage(const char* file, int line, const char* msg, ...);
+void checkMessages(LogFile2& lf, int expected);
+
+int main(void)
+{
+
+	try {
+		runTest1();
+
+		runTest2();
+
+		runTest3();
+
+	} catch (AnException& e){
+		printf("Exception caught: %s\n", e.Msg() );
+		printf("Aborting tests.\n" );
+		return -1;
+	}
+
+}
+
+void runTest1()
+{
+	Timer tt;
+	tt.Start();
+	// Ship messages over loopback to a collector and check they all arrive in order.
+	printf("Shipping 5,000 messages to a collector writing testLogShip1.log\n");
+	twine fileName = "testLogShip1.log";
+	twine spoolName = "testLogShip1.spool";
+	File::Delete( fileName );
+	File::Delete( spoolName );
+	LogFile2 lf( fileName );
+	LogCollector collector( 17321, lf );
+	collector.Start();
+
+	{
+		LogShipper shipper( "127.0.0.1", 17321, spoolName );
+		shipper.setBatchSize( 400 );
+		for(int i = 0; i < 5000; i ++){
+			LogMsg* lm = buildMessage(FL, "Test Message #%d", i);
+			lm->Field( "request_id", (int64_t)i );
+			shipper.Ship( lm );
+		}
+		shipper.Flush();
+		if(shipper.Sent() != 5000 || shipper.Spooled() != 0 || shipper.Dropped() != 0){
+			throw AnException(0, FL, "Unexpected shipper stats sent=%d spooled=%d dropped=%d",
+				(int)shipper.Sent(), (int)shipper.Spooled(), (int)shipper.Dropped() );
+		}
+	}
+	collector.Stop();
+
+	checkMessages( lf, 5000 );
+	tt.Finish();
+	printf("Duration for runTest1 is (%f)\n", tt.Duration() );
+}
+
+void runTest2()
+{
+	// Ship with no collector listening, then start one, and check that the spooled messages
+	// arrive ahead of the ones shipped afterwards.
+	printf("Shipping 2,000 messages through the spool file into testLogShip2.log\n");
+	twine fileName = "testLogShip2.log";
+	twine spoolName = "testLogShip2.spool";
+	File::Delete( fileName );
+	File::Delete( spoolName );
+	LogFile2 lf( fileName );
+	LogCollector collector( 17322, lf );
+
+	LogShipper shipper( "127.0.0.1", 17322, spoolName );
+	for(int i = 0; i < 1000; i ++){
+		shipper.Ship( buildMessage(FL, "Test Message #%d", i) );
+	}
+	shipper.Flush();
+	if(shipper.Sent() != 0 || shipper.Spooled() != 1000 || !File::Exists( spoolName )){
+		throw AnException(0, FL, "Expected 1000 spooled messages, found %d", (int)shipper.Spooled() );
+	}
+
+	collector.Start();
+	for(int i = 1000; i < 2000; i ++){
+		shipper.Ship( buildMessage(FL, "Test Message #%d", i) );
+	}
+	shipper.Flush();
+
+	// The shipper backs off after failing to connect, so give it a while to catch up.
+	for(int i = 0; i < 600 && shipper.Sent() < 2000; i++){
+		Tools::msleep( 50 );
+	}
+	if(shipper.Sent() != 2000){
+		throw AnException(0, FL, "Expected 2000 sent messages, found %d", (int)shipper.Sent() );
+	}
+	if(File::Exists( spoolName )){
+		throw AnException(0, FL, "Spool file was not removed after it was sent");
+	}
+	collector.Stop();
+
+	checkMessages( lf, 2000 );
+}
+
+void runTest3()
+{
+	// Records with lengths near 2^64 must be refused rather than read past the end of the frame.
+	printf("Sending malformed log frames to a collector writing testLogShip3.log\n");
+	const char badString[] = {
+		1, 1, 1, 1, 1, // line, tid, seconds, microseconds and channel
+		(char)0xff, (char)0xff, (char)0xff, (char)0xff, (char)0xff,
+		(char)0xff, (char)0xff, (char)0xff, (char)0xff, 1 // the length of the file name
+	};
+	const char badFields[] = {
+		1, 1, 1, 1, 1,
+		0, 0, 0, 0, 0, // empty file, app, machine, session and message
+		(char)0xff, (char)0xff, (char)0xff, (char)0xff, (char)0xff,
+		(char)0xff, (char)0xff, (char)0xff, (char)0xff, 1 // the length of the fields
+	};
+	LogMsg lm;
+	size_t pos = 0;
+	if(lm.Decode( badString, sizeof(badString), pos )){
+		throw AnException(0, FL, "Decoded a string that runs past the end of the record");
+	}
+	pos = 0;
+	if(lm.Decode( badFields, sizeof(badFields), pos )){
+		throw AnException(0, FL, "Decoded fields that run past the end of the record");
+	}
+
+	// The timestamp comes back to the microsecond.
+	LogMsg* good = buildMessage(FL, "Timestamp check");
+	MemBuf encoded;
+	good->Encode( encoded );
+	pos = 0;
+	if(!lm.Decode( encoded.data(), encoded.size(), pos ) || lm.GetTimestamp() != good->GetTimestamp()){
+		throw AnException(0, FL, "The timestamp changed from %s to %s", good->GetTimestamp()(), lm.GetTimestamp()() );
+	}
+	delete good;
+
+	// Over the wire, the collector drops the connection without an ACK or writing anything.
+	twine fileName = "testLogShip3.log";
+	File::Delete( fileName );
+	LogFile2 lf( fileName );
+	LogCollector collector( 17323, lf );
+	collector.Start();
+	Socket* conn = NULL;
+	for(int i = 0; i < 100 && conn == NULL; i++){
+		try {
+			conn = new Socket( (char*)"127.0.0.1", 17323 );
+		} catch (AnException&){
+			Tools::msleep( 20 ); // the collector may not be listening yet
+		}
+	}
+	if(conn == NULL){
+		throw AnException(0, FL, "Couldn't connect to the collector");
+	}
+	{
+		dptr<Socket> sock( conn );
+		sock->SetNoSigPipe( true );
+		char header[LOGSHIP_HEADER_SIZE];
+		uint32_t len = htonl( (uint32_t)sizeof(badFields) );
+		uint32_t count = htonl( 1 );
+		memcpy( header, LOGSHIP_MAGIC, 4 );
+		memcpy( header + 4, &len, 4 );
+		memcpy( header + 8, &count, 4 );
+		sock->SendData( header, LOGSHIP_HEADER_SIZE );
+		sock->SendData( (char*)badFields, (int)sizeof(badFields) );
+		char ack[4];
+		int n = 0;
+		try {
+			n = sock->TimedGetRawData( ack, 4, 5000 );
+		} catch (ReadTimeout&){
+			throw AnException(0, FL, "The collector kept the connection open after a malformed frame");
+		} catch (AnException&){
+			n = 0; // the connection was reset
+		}
+		if(n > 0){
+			throw AnException(0, FL, "The collector acknowledged a malformed frame");
+		}
+	}
+	collector.Stop();
+	if(lf.messageCount() != 0){
+		throw AnException(0, FL, "The collector wrote %d messages from a malformed frame", lf.messageCount() );
+	}
+	printf("Malformed records were refused.\n");
+}
+
+void checkMessages(LogFile2& lf, int expected)
+{
+	int count = lf.messageCount();
+	if(count != expected){
+		throw AnException(0, FL, "Expected %d messages in the collector's log, found %d", expected, count);
+	}
+
+	LogFilter filter;
+	dptr<vector<LogMsg*> > msgs = lf.getMessages( filter, expected );
+	for(size_t i = 0; i < msgs->size(); i++){
+		twine text; text.format( "Test Message #%d", (int)i );
+		if(msgs->at( i )->msg != text){
+			throw AnException(0, FL, "Message %d is out of order: %s", (int)i, msgs->at( i )->msg() );
+		}
+		const LogField* f = msgs->at( i )->GetField( "request_id" );
+		if(f != NULL && f->intValue != (int64_t)i){
+			throw AnException(0, FL, "Message %d has the wrong request_id field", (int)i );
+		}
+		delete msgs->at( i );
+	}
+	printf("Collector log has all %d messages in order.\n", expected);
+}
+
+LogMsg* buildMessage(const char* file, int line, const char* msg, ...)
+{
+	LogMsg* lm = new LogMsg(file, line);
+
+	va_list ap;
+	va_start(ap, msg);
+	lm->msg.format(msg, ap);
+	va_end(ap);
+
+	lm->channel = 0; // Panic
+	return lm;
+}
@@ -0,0 +1,142 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+#include <algorithm>
+using namespace std;
+
+#include "Parallel.h"
+#include "AnException.h"
+using namespace SLib;
+
+void runTest1();
+void runTest2();
+void runTest3();
+void runTest4();
+
+int main(void)
+{
+	try {
+		runTest1();
+		runTest2();
+		runTest3();
+		runTest4();
+	} catch (AnException& e){
+		printf("Exception caught: %s\n", e.Msg() );
+		printf("Aborting tests.\n" );
+		return -1;
+	}
+	return 0;
+}
+
+void runTest1()
+{
+	// Every index is visited exactly once.
+	printf("Running parallel_for over 100,000 items\n");
+	vector<int> hits( 100000, 0 );
+	parallel_for( 0, hits.size(), 1000, [&hits](size_t i) { hits[ i ] ++; } );
+	for(size_t i = 0; i < hits.size(); i++){
+		if(hits[ i ] != 1){
+			throw AnException(0, FL, "Item %d was visited %d times", (int)i, hits[ i ] );
+		}
+	}
+
+	// A parallel_for inside a pool task can use the same pool without waiting on itself.
+	ThreadPool pool( 2 );
+	std::future<size_t> f = pool.submit( [&pool]() {
+		vector<int> inner( 10000, 0 );
+		parallel_for( 0, inner.size(), 100, [&inner](size_t i) { inner[ i ] = 1; }, pool );
+		return (size_t)std::count( inner.begin(), inner.end(), 1 );
+	} );
+	if(f.get() != 10000){
+		throw AnException(0, FL, "Nested parallel_for missed some items");
+	}
+	printf("parallel_for visited everything once.\n");
+}
+
+/// Adds up a series where the order of the additions changes the floating point answer.
+static double sumSeries(size_t grain, ThreadPool& pool)
+{
+	return parallel_reduce( 0, 1000000, grain, 0.0,
+		[](size_t lo, size_t hi) {
+			double sum = 0.0;
+			for(size_t i = lo; i < hi; i++){
+				sum += 1.0 / (double)(i + 1) * ((i % 3 == 0) ? -1e8 : 1.0);
+			}
+			return sum;
+		},
+		[](double a, double b) { return a + b; },
+		pool
+	);
+}
+
+void runTest2()
+{
+	// The same grain gives the same bits, whatever the number of threads or the timing.
+	printf("Checking that parallel_reduce is deterministic\n");
+	ThreadPool one( 1 );
+	ThreadPool four( 4 );
+	ThreadPool sixteen( 16 );
+	double expected = sumSeries( 4096, one );
+	for(int run = 0; run < 10; run++){
+		double a = sumSeries( 4096, four );
+		double b = sumSeries( 4096, sixteen );
+		double c = sumSeries( 4096, ThreadPool::Global() );
+		if(memcmp( &a, &expected, sizeof(double) ) != 0 || memcmp( &b, &expected, sizeof(double) ) != 0 ||
+			memcmp( &c, &expected, sizeof(double) ) != 0
+		){
+			throw AnException(0, FL, "parallel_reduce gave different answers: %.17g %.17g %.17g %.17g",
+				expected, a, b, c );
+		}
+	}
+
+	long count = parallel_reduce( 0, 12345, 100, 0L,
+		[](size_t lo, size_t hi) { return (long)(hi - lo); },
+		[](long a, long b) { return a + b; } );
+	if(count != 12345){
+		throw AnException(0, FL, "parallel_reduce counted %ld items", count );
+	}
+	printf("parallel_reduce gave %.17g every time.\n", expected);
+}
+
+void runTest3()
+{
+	printf("Sorting 500,000 numbers with parallel_sort\n");
+	vector<int> data( 500000 );
+	srand( 42 );
+	for(size_t i = 0; i < data.size(); i++){
+		data[ i ] = rand();
+	}
+	vector<int> copy( data );
+	std::sort( copy.begin(), copy.end() );
+	parallel_sort( data.begin(), data.end() );
+	if(data != copy){
+		throw AnException(0, FL, "parallel_sort got a different answer than std::sort");
+	}
+
+	// And a grain that doesn't divide the size evenly, with a comparison of our own.
+	parallel_sort( data.begin(), data.end(), [](int a, int b) { return a > b; }, 999 );
+	std::reverse( copy.begin(), copy.end() );
+	if(data != copy){
+		throw AnException(0, FL, "parallel_sort with a comparison got the wrong answer");
+	}
+	printf("parallel_sort matches std::sort.\n");
+}
+
+void runTest4()
+{
+	// An exception in one chunk comes back to the caller.
+	printf("Checking exceptions from parallel_for\n");
+	try {
+		parallel_for( 0, 10000, 10, [](size_t i) {
+			if(i == 5000){
+				throw AnException(0, FL, "Expected");
+			}
+		} );
+	} catch (AnException& e){
+		printf("Exception came back to the caller.\n");
+		return;
+	}
+	throw AnException(0, FL, "Exception was lost");
+}
@@ -0,0 +1,359 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+#include <atomic>
+#include <thread>
+using namespace std;
+
+#include "Pool.h"
+#include "AnException.h"
+#include "Thread.h"
+#include "Timer.h"
+#include "Tools.h"
+using namespace SLib;
+
+#define THREADS 8
+#define PER_THREAD 20000
+
+/// What we pool.  owners catches an object that is handed out twice at once.
+class PooledObject {
+	public:
+		PooledObject(int id) : id(id), ok(true) { owners.store( 0 ); }
+		int id;
+		bool ok;
+		std::atomic<int> owners;
+};
+
+class PooledObject_init {
+	public:
+		std::atomic<int> created;
+};
+
+class PooledObject_create {
+	public:
+		PooledObject* operator()(PooledObject_init* i){
+			return new PooledObject( i->created++ );
+		}
+};
+
+class PooledObject_destroy {
+	public:
+		void operator()(PooledObject* po){
+			delete po;
+		}
+};
+
+class PooledObject_valid {
+	public:
+		bool operator()(PooledObject* po){
+			return po->ok;
+		}
+};
+
+/// A validator that takes its time, and says when it is busy.
+std::atomic<int> slow_validating( 0 );
+class PooledObject_slowValid {
+	public:
+		bool operator()(PooledObject* po){
+			slow_validating ++;
+			Tools::msleep( 100 );
+			slow_validating --;
+			return po->ok;
+		}
+};
+
+typedef Pool<PooledObject*, PooledObject_init*, PooledObject_create, PooledObject_destroy> TestPool;
+typedef Pool<PooledObject*, PooledObject_init*, PooledObject_create, PooledObject_destroy,
+	PooledObject_valid> ValidPool;
+typedef Pool<PooledObject*, PooledObject_init*, PooledObject_create, PooledObject_destroy,
+	PooledObject_slowValid> SlowValidPool;
+
+void runTest1();
+void runTest2();
+void runTest3();
+void runTest4();
+void runTest5();
+
+int main(void)
+{
+	try {
+		runTest1();
+		runTest2();
+		runTest3();
+		runTest4();
+		runTest5();
+	} catch (AnException& e){
+		printf("Exception caught: %s\n", e.Msg() );
+		printf("Aborting tests.\n" );
+		return -1;
+	}
+	return 0;
+}
+
+void runTest1()
+{
+	printf("Checking Acquire, Release and Remove\n");
+	PooledObject_init init;
+	init.created.store( 0 );
+	TestPool pool;
+	pool.SetInitInfo( &init );
+	pool.SetMaxSize( 3 );
+	pool.SetGrowthFactor( 2 );
+	pool.SetMinSize( 1 );
+
+	PooledObject* a = pool.Acquire();
+	PooledObject* b = pool.Acquire();
+	PooledObject* c = pool.Acquire();
+	if(a == b || b == c || a == c || pool.GetPoolSize() != 3 || pool.GetInUseSize() != 3){
+		throw AnException(0, FL, "Pool handed out the wrong objects");
+	}
+
+	// At the max, the plain Acquire throws, and the timed one gives up.
+	bool threw = false;
+	try {
+		pool.Acquire();
+	} catch (AnException& e){
+		threw = true;
+	}
+	if(!threw){
+		throw AnException(0, FL, "Acquire past the max didn't throw");
+	}
+	if(pool.Acquire( 20 ) != NULL){
+		throw AnException(0, FL, "Acquire with a timeout didn't time out");
+	}
+
+	// Releasing something twice, or something that isn't ours, is an error.
+	pool.Release( b );
+	threw = false;
+	try {
+		pool.Release( b );
+	} catch (AnException& e){
+		threw = true;
+	}
+	PooledObject stranger( 99 );
+	try {
+		pool.Release( &stranger );
+		threw = false;
+	} catch (AnException& e){
+	}
+	if(!threw){
+		throw AnException(0, FL, "Bad Release wasn't caught");
+	}
+	if(pool.Acquire( 0 ) != b){
+		throw AnException(0, FL, "Released object wasn't handed out again");
+	}
+
+	// A removed object is replaced by a new one in the same slot.
+	pool.Remove( a );
+	PooledObject* d = pool.Acquire( 0 );
+	if(d == NULL || d->id != 3 || pool.GetPoolSize() != 3){
+		throw AnException(0, FL, "Removed object wasn't replaced");
+	}
+	pool.Release( b );
+	pool.Release( c );
+	pool.Release( d );
+
+	PoolStats stats = pool.GetStats();
+	if(stats.acquires != 5 || stats.timeouts != 1 || stats.inUse != 0 || stats.peakInUse != 3){
+		throw AnException(0, FL, "Stats are wrong: %d acquires, %d timeouts, %d in use, %d peak",
+			(int)stats.acquires, (int)stats.timeouts, stats.inUse, stats.peakInUse );
+	}
+	printf("Acquire, Release and Remove behave.\n");
+}
+
+TestPool* sharedPool;
+std::atomic<int> doubleOwned( 0 );
+
+void* worker(void*)
+{
+	for(int i = 0; i < PER_THREAD; i++){
+		PooledObject* po = sharedPool->Acquire( 10000 );
+		if(po == NULL){
+			continue;
+		}
+		if(po->owners.fetch_add( 1 ) != 0){
+			doubleOwned ++;
+		}
+		if(i % 16 == 0){
+			std::this_thread::yield(); // hang on to it for a while
+		}
+		po->owners.fetch_sub( 1 );
+		sharedPool->Release( po );
+	}
+	return NULL;
+}
+
+void runTest2()
+{
+	// More threads than objects, so they have to wait for each other.
+	printf("Running %d threads against a pool of 4\n", THREADS);
+	PooledObject_init init;
+	init.created.store( 0 );
+	TestPool pool;
+	pool.SetInitInfo( &init );
+	pool.SetMaxSize( 4 );
+	sharedPool = &pool;
+
+	vector<Thread*> threads;
+	for(int i = 0; i < THREADS; i++){
+		threads.push_back( new Thread() );
+		threads.back()->start( worker, NULL );
+	}
+	for(size_t i = 0; i < threads.size(); i++){
+		threads[ i ]->join();
+		delete threads[ i ];
+	}
+
+	PoolStats stats = pool.GetStats();
+	if(doubleOwned.load() != 0){
+		throw AnException(0, FL, "%d objects were handed out twice", doubleOwned.load() );
+	}
+	if(stats.acquires != THREADS * PER_THREAD || stats.timeouts != 0 || stats.inUse != 0 ||
+		stats.size > 4 || stats.peakInUse > 4
+	){
+		throw AnException(0, FL, "Stats are wrong: %d acquires, %d timeouts, %d in use, size %d",
+			(int)stats.acquires, (int)stats.timeouts, stats.inUse, stats.size );
+	}
+	printf("%d acquires, %d waits, %.0f ns longest wait, peak %d in use.\n",
+		(int)stats.acquires, (int)stats.waits, stats.maxWaitNs, stats.peakInUse );
+}
+
+void* releaseLater(void* v)
+{
+	Tools::msleep( 50 );
+	sharedPool->Release( (PooledObject*)v );
+	return NULL;
+}
+
+void runTest3()
+{
+	// A waiter is woken by a Release from another thread well before its timeout.
+	printf("Checking that Release wakes a waiting Acquire\n");
+	PooledObject_init init;
+	init.created.store( 0 );
+	TestPool pool;
+	pool.SetInitInfo( &init );
+	pool.SetMaxSize( 1 );
+	sharedPool = &pool;
+
+	PooledObject* only = pool.Acquire();
+	Thread t;
+	t.start( releaseLater, only );
+	PooledObject* got = pool.Acquire( 10000 );
+	t.join();
+	PoolStats stats = pool.GetStats();
+	if(got != only || stats.waits != 1 || stats.maxWaitNs > 5e9){
+		throw AnException(0, FL, "Waiter wasn't woken by the Release");
+	}
+	pool.Release( got );
+	printf("Waiter was woken after %.1f ms.\n", stats.maxWaitNs / 1e6 );
+}
+
+void runTest4()
+{
+	printf("Checking validation, idle eviction, lifetime and prewarm\n");
+	PooledObject_init init;
+	init.created.store( 0 );
+	ValidPool pool;
+	pool.SetInitInfo( &init );
+	pool.SetMaxSize( 10 );
+	pool.SetGrowthFactor( 2 );
+	pool.SetMinSize( 2 );
+	pool.SetMaintenanceInterval( 20 );
+
+	// A bad object is thrown away on Acquire, and we get a good one instead.
+	pool.SetValidateOnAcquire( true );
+	PooledObject* a = pool.Acquire();
+	a->ok = false;
+	pool.Release( a );
+	PooledObject* b = pool.Acquire();
+	if(b == NULL || !b->ok || pool.GetStats().invalid != 1){
+		throw AnException(0, FL, "Validator didn't catch a bad object");
+	}
+	pool.Release( b );
+
+	// Grab a few so the pool grows, then let them sit idle until we are back to the min.
+	vector<PooledObject*> held;
+	for(int i = 0; i < 6; i++){
+		held.push_back( pool.Acquire() );
+	}
+	for(size_t i = 0; i < held.size(); i++){
+		pool.Release( held[ i ] );
+	}
+	held.clear();
+	int grown = pool.GetPoolSize();
+	pool.SetIdleTimeout( 50 );
+	for(int i = 0; i < 100 && pool.GetPoolSize() > 2; i++){
+		Tools::msleep( 10 );
+	}
+	if(grown <= 2 || pool.GetPoolSize() != 2 || pool.GetStats().idleEvictions == 0){
+		throw AnException(0, FL, "Idle objects weren't evicted: size went from %d to %d",
+			grown, pool.GetPoolSize() );
+	}
+	pool.SetIdleTimeout( 0 );
+
+	// Old objects are replaced, and the pool stays at its min while that happens.
+	int before = init.created.load();
+	pool.SetMaxLifetime( 50 );
+	for(int i = 0; i < 100 && pool.GetStats().expired < 2; i++){
+		Tools::msleep( 10 );
+	}
+	if(pool.GetStats().expired < 2 || init.created.load() < before + 2 || pool.GetPoolSize() < 2){
+		throw AnException(0, FL, "Old objects weren't recycled");
+	}
+	pool.SetMaxLifetime( 0 );
+
+	// Using most of the pool makes it build more in the background.
+	pool.SetPrewarmThreshold( 0.5 );
+	for(int i = 0; i < 2; i++){
+		held.push_back( pool.Acquire() );
+	}
+	for(int i = 0; i < 100 && pool.GetStats().prewarmed == 0; i++){
+		Tools::msleep( 10 );
+	}
+	PoolStats stats = pool.GetStats();
+	if(stats.prewarmed == 0 || stats.size <= 2){
+		throw AnException(0, FL, "Pool didn't prewarm");
+	}
+	for(size_t i = 0; i < held.size(); i++){
+		pool.Release( held[ i ] );
+	}
+	printf("%d evicted, %d expired, %d invalid, %d prewarmed.\n", (int)stats.idleEvictions,
+		(int)stats.expired, (int)stats.invalid, (int)stats.prewarmed );
+}
+
+void runTest5()
+{
+	// A slow validator in the background doesn't hold up Acquire, or make the pool look empty.
+	printf("Checking that a background sweep doesn't block Acquire\n");
+	PooledObject_init init;
+	init.created.store( 0 );
+	SlowValidPool pool;
+	pool.SetInitInfo( &init );
+	pool.SetMaxSize( 2 );
+	pool.SetGrowthFactor( 2 );
+	pool.SetMinSize( 2 );
+	pool.SetMaintenanceInterval( 20 );
+	pool.SetValidateIdle( true );
+	for(int i = 0; i < 200 && slow_validating.load() == 0; i++){
+		Tools::msleep( 5 );
+	}
+	if(slow_validating.load() == 0){
+		throw AnException(0, FL, "The background sweep never ran the validator");
+	}
+	uint64_t start = Timer::NowNs();
+	PooledObject* po = pool.Acquire();
+	pool.Release( po );
+	po = pool.Acquire( 20 );
+	uint64_t took = Timer::NowNs() - start;
+	if(po == NULL){
+		throw AnException(0, FL, "Acquire timed out while the sweep checked one object");
+	}
+	pool.Release( po );
+	if(took > 50000000 || pool.GetPoolSize() != 2){
+		throw AnException(0, FL, "Acquire waited %d ms for the sweep, and the pool has %d objects",
+			(int)(took / 1000000), pool.GetPoolSize() );
+	}
+	printf("Acquire took %d us during a sweep.\n", (int)(took / 1000) );
+}
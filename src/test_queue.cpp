@@ -25,6 +25,8 @@
 #include "twine.h"
 #include "AnException.h"
 #include "Thread.h"
+#include "Timer.h"
+#include "dptr.h"
 using namespace SLib;
 
 void* consumer1(void*);
@@ -33,8 +35,9 @@ void* producer2(void*);
 void* producer3(void*);
 void* producer4(void*);
 
-bool stopConsumer = false;
-BlockingQueue<twine*> testQueue;
+// Small enough that the producers have to wait for the consumer
+BlockingQueue<twine*> testQueue( 4 );
+int consumed = 0;
 
 int main (void)
 {
@@ -57,18 +60,52 @@ int main (void)
 	p4.join();
 	printf("Producers all done.  Shutting down consumer...\n");
 
-	stopConsumer = true;
+	testQueue.close();
 	c1.join();
+	if(consumed != 40){
+		printf("Consumer found %d messages instead of 40.\n", consumed);
+		return 1;
+	}
+
+	// Everything is gone and the queue is closed, so these should all come back straight away.
+	twine* left = NULL;
+	if(testQueue.try_pop( left ) || testQueue.pop_for( left, 5000 ) || testQueue.pop() != NULL ||
+		testQueue.push( left )
+	){
+		printf("Closed queue did not behave as expected.\n");
+		return 1;
+	}
+
+	// And a timed pop on an open, empty queue should give up after about the time we ask for.
+	BlockingQueue<int> timed;
+	int val;
+	Timer tt;
+	tt.Start();
+	if(timed.pop_for( val, 100 )){
+		printf("Timed pop found something in an empty queue.\n");
+		return 1;
+	}
+	tt.Finish();
+	if(tt.Duration() < 0.09 || tt.Duration() > 1.0){
+		printf("Timed pop waited for %f seconds instead of 0.1.\n", tt.Duration() );
+		return 1;
+	}
 
 	printf("Consumer all done.  Test exiting.\n");
+	return 0;
 }
 
 void* consumer1(void*)
 {
-	while(!stopConsumer){
-		dptr<twine > msg = testQueue.pop();
-		
-		printf("Consumer found message: %s\n", msg->c_str() );
+	// Take whatever has built up in one go, until the queue is closed and empty.
+	vector<twine*> batch;
+	while(testQueue.drain( batch, 8 ) != 0){
+		for(size_t i = 0; i < batch.size(); i++){
+			dptr<twine > msg = batch[i];
+			printf("Consumer found message: %s\n", msg->c_str() );
+			consumed ++;
+		}
+		batch.clear();
 	}
 	return NULL;
 }
@@ -0,0 +1,99 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+#include <atomic>
+using namespace std;
+
+#include "RingQueue.h"
+#include "AnException.h"
+#include "Thread.h"
+using namespace SLib;
+
+#define PRODUCERS 4
+#define CONSUMERS 2
+#define PER_PRODUCER 100000
+
+/// Small enough that both sides have to wait for each other a lot
+BlockingRing<MPMCQueue<long> > mpmc( 64 );
+BlockingRing<SPSCQueue<long> > spsc( 64 );
+
+std::atomic<long> consumedSum( 0 );
+std::atomic<long> consumedCount( 0 );
+
+void* mpmcProducer(void* v)
+{
+	long base = (long)(intptr_t)v * PER_PRODUCER;
+	for(long i = 1; i <= PER_PRODUCER; i++){
+		mpmc.push( base + i );
+	}
+	return NULL;
+}
+
+void* mpmcConsumer(void*)
+{
+	for(int i = 0; i < PRODUCERS * PER_PRODUCER / CONSUMERS; i++){
+		long val;
+		mpmc.pop( val );
+		consumedSum += val;
+		consumedCount ++;
+	}
+	return NULL;
+}
+
+void* spscProducer(void*)
+{
+	for(long i = 0; i < PER_PRODUCER; i++){
+		spsc.push( i );
+	}
+	return NULL;
+}
+
+int main(void)
+{
+	try {
+		// Every value pushed by every producer has to come out exactly once.
+		vector<Thread*> threads;
+		for(int i = 0; i < CONSUMERS; i++){
+			threads.push_back( new Thread() );
+			threads.back()->start( mpmcConsumer, NULL );
+		}
+		for(int i = 0; i < PRODUCERS; i++){
+			threads.push_back( new Thread() );
+			threads.back()->start( mpmcProducer, (void*)(intptr_t)i );
+		}
+		for(size_t i = 0; i < threads.size(); i++){
+			threads[ i ]->join();
+			delete threads[ i ];
+		}
+		long n = (long)PRODUCERS * PER_PRODUCER;
+		if(consumedCount != n || consumedSum != n * (n + 1) / 2){
+			throw AnException(0, FL, "MPMC queue lost or duplicated values: count %ld sum %ld",
+				(long)consumedCount, (long)consumedSum );
+		}
+		printf("MPMC queue passed %ld values intact.\n", n);
+
+		// And the SPSC queue has to keep them in order.
+		Thread producer;
+		producer.start( spscProducer, NULL );
+		for(long i = 0; i < PER_PRODUCER; i++){
+			long val;
+			spsc.pop( val );
+			if(val != i){
+				throw AnException(0, FL, "SPSC queue gave us %ld when we expected %ld", val, i );
+			}
+		}
+		producer.join();
+		long left;
+		if(spsc.try_pop( left ) || mpmc.try_pop( left )){
+			throw AnException(0, FL, "Queues should be empty");
+		}
+		printf("SPSC queue passed %d values in order.\n", PER_PRODUCER);
+
+	} catch (AnException& e){
+		printf("Exception caught: %s\n", e.Msg() );
+		printf("Aborting tests.\n" );
+		return -1;
+	}
+	return 0;
+}
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <vector>
+#include <atomic>
+using namespace std;
+
+#include "Thread.h"
+#include "ThreadPool.h"
+#include "AnException.h"
+#include "Tools.h"
+#include "twine.h"
+using namespace SLib;
+
+void runTest1();
+void runTest2();
+void runTest3();
+
+int main(void)
+{
+	try {
+		runTest1();
+		runTest2();
+		runTest3();
+	} catch (AnException& e){
+		printf("Exception caught: %s\n", e.Msg() );
+		printf("Aborting tests.\n" );
+		return -1;
+	}
+	return 0;
+}
+
+struct Seen {
+	twine name;
+	twine byId;
+	uint32_t id;
+	size_t stackUsed;
+};
+
+void* recordSelf(void* arg)
+{
+	Seen* seen = (Seen*)arg;
+	seen->name = Thread::CurrentName();
+	seen->id = Thread::CurrentLogId();
+	seen->byId = Thread::NameOf( seen->id );
+
+	// Use a good part of the stack, which would fail with the default on some systems.
+	char big[ 4 * 1024 * 1024 ];
+	memset( big, 1, sizeof(big) );
+	seen->stackUsed = big[ sizeof(big) - 1 ] == 1 ? sizeof(big) : 0;
+	return NULL;
+}
+
+void runTest1()
+{
+	// A thread started with options is named, and forgets its name when it exits, apart from
+	// the recently exited names kept for reports.
+	printf("Checking ThreadOptions\n");
+	ThreadOptions opts;
+	opts.name = "test thread with a long name";
+	opts.stackSize = 16 * 1024 * 1024;
+	opts.priority = -1;
+	opts.cpus.push_back( 0 );
+	Seen seen;
+	Thread t;
+	t.start( recordSelf, &seen, opts );
+	t.join();
+	if(seen.name != opts.name || seen.byId != opts.name){
+		throw AnException(0, FL, "The thread was named %s, and NameOf said %s", seen.name(), seen.byId() );
+	}
+	if(!Thread::NameOf( seen.id ).empty()){
+		throw AnException(0, FL, "The thread's name outlived it");
+	}
+	if(Thread::NameOf( seen.id, true ) != opts.name){
+		throw AnException(0, FL, "The thread's name wasn't kept for reports");
+	}
+	if(!Thread::CurrentName().empty()){
+		throw AnException(0, FL, "The main thread has a name it wasn't given");
+	}
+	printf("The thread was called %s, and used %d bytes of stack.\n", seen.name(), (int)seen.stackUsed);
+}
+
+void runTest2()
+{
+	printf("Checking NUMA nodes\n");
+	int nodes = Thread::NumaNodes();
+	size_t cpus = 0;
+	for(int i = 0; i < nodes; i++){
+		cpus += Thread::NumaNodeCpus( i ).size();
+	}
+	if(nodes < 1 || cpus < 1){
+		throw AnException(0, FL, "Found %d NUMA nodes with %d CPUs", nodes, (int)cpus );
+	}
+	bool threw = false;
+	try {
+		Thread::NumaNodeCpus( nodes );
+	} catch (AnException&){
+		threw = true;
+	}
+	if(!threw){
+		throw AnException(0, FL, "NumaNodeCpus found a node that isn't there");
+	}
+	Thread::BindToNumaNode( 0 );
+	Thread::SetAffinity( vector<int>() );
+	printf("Found %d NUMA nodes with %d CPUs between them.\n", nodes, (int)cpus);
+}
+
+void runTest3()
+{
+	// One pinned worker per CPU, each with its own name.
+	printf("Checking a pinned ThreadPool\n");
+	ThreadOptions opts;
+	opts.name = "pinned";
+	ThreadPool pool( 0, opts, true );
+	if(pool.Size() != ThreadPool::HardwareThreads()){
+		throw AnException(0, FL, "The pinned pool has %d workers", (int)pool.Size() );
+	}
+	vector<std::future<twine> > names;
+	for(size_t i = 0; i < pool.Size() * 4; i++){
+		names.push_back( pool.submit( []() { Tools::msleep( 1 ); return Thread::CurrentName(); } ) );
+	}
+	for(size_t i = 0; i < names.size(); i++){
+		twine name = names[ i ].get();
+		if(!name.startsWith( "pinned " )){
+			throw AnException(0, FL, "A worker was called %s", name() );
+		}
+	}
+	printf("Every task ran on a worker called \"pinned N\".\n");
+}
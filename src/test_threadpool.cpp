@@ -0,0 +1,157 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+#include <atomic>
+using namespace std;
+
+#include "ThreadPool.h"
+#include "AnException.h"
+#include "EnEx.h"
+#include "Tools.h"
+using namespace SLib;
+
+void runTest1();
+void runTest2();
+void runTest3();
+void runTest4();
+
+int main(void)
+{
+	try {
+		runTest1();
+		runTest2();
+		runTest3();
+		runTest4();
+	} catch (AnException& e){
+		printf("Exception caught: %s\n", e.Msg() );
+		printf("Aborting tests.\n" );
+		return -1;
+	}
+	return 0;
+}
+
+void runTest1()
+{
+	// Results come back through the futures, whichever worker ran them.
+	printf("Running 1,000 tasks on a pool of 4\n");
+	ThreadPool pool( 4 );
+	vector<std::future<long> > results;
+	for(long i = 0; i < 1000; i++){
+		results.push_back( pool.submit( [i]() { return i * i; } ) );
+	}
+	long sum = 0;
+	for(size_t i = 0; i < results.size(); i++){
+		sum += results[ i ].get();
+	}
+	if(sum != 332833500){
+		throw AnException(0, FL, "Sum of squares came back as %ld", sum );
+	}
+
+	pool.Shutdown(); // so the workers have finished counting
+	uint64_t executed = 0;
+	vector<ThreadPoolStats> stats = pool.Stats();
+	for(size_t i = 0; i < stats.size(); i++){
+		executed += stats[ i ].executed;
+	}
+	if(executed != 1000){
+		throw AnException(0, FL, "Workers say they ran %d tasks", (int)executed );
+	}
+	printf("All results came back.\n");
+}
+
+void runTest2()
+{
+	// Tasks that submit tasks put them on their own queue, where other workers can steal
+	// them, and Shutdown waits for all of them.
+	printf("Running tasks that submit more tasks\n");
+	std::atomic<int> count( 0 );
+	ThreadPool pool( 4 );
+	for(int i = 0; i < 10; i++){
+		pool.execute( [&pool, &count]() {
+			for(int j = 0; j < 100; j++){
+				pool.execute( [&count]() {
+					Tools::msleep( 1 );
+					count ++;
+				} );
+			}
+		} );
+	}
+	pool.Shutdown();
+	if(count != 1000){
+		throw AnException(0, FL, "Expected 1000 sub tasks to run, found %d", (int)count );
+	}
+	uint64_t stolen = 0;
+	vector<ThreadPoolStats> stats = pool.Stats();
+	for(size_t i = 0; i < stats.size(); i++){
+		stolen += stats[ i ].stolen;
+	}
+	printf("All sub tasks ran, %d of them stolen.\n", (int)stolen);
+
+	bool threw = false;
+	try {
+		pool.execute( [](){} );
+	} catch (AnException&){
+		threw = true;
+	}
+	if(!threw){
+		throw AnException(0, FL, "Shut down pool accepted a new task");
+	}
+}
+
+void runTest3()
+{
+	// With the only worker busy, queued tasks run in priority order.
+	printf("Checking task priorities\n");
+	ThreadPool pool( 1 );
+	std::atomic<bool> release( false );
+	pool.execute( [&release]() {
+		while(!release){
+			Tools::msleep( 1 );
+		}
+	} );
+	Tools::msleep( 50 );
+
+	vector<int> order;
+	pool.execute( [&order]() { order.push_back( 3 ); }, ThreadPool::Low );
+	pool.execute( [&order]() { order.push_back( 2 ); }, ThreadPool::Normal );
+	pool.execute( [&order]() { order.push_back( 1 ); }, ThreadPool::High );
+	release = true;
+	pool.Shutdown();
+	if(order.size() != 3 || order[0] != 1 || order[1] != 2 || order[2] != 3){
+		throw AnException(0, FL, "Tasks did not run in priority order");
+	}
+	printf("Tasks ran in priority order.\n");
+}
+
+void runTest4()
+{
+	// Exceptions come back through the future.
+	printf("Checking exceptions from tasks\n");
+	ThreadPool pool( 2 );
+	std::future<int> f = pool.submit( []() -> int { throw AnException(0, FL, "Expected"); } );
+	bool threw = false;
+	try {
+		f.get();
+	} catch (AnException& e){
+		threw = true;
+	}
+	if(!threw){
+		throw AnException(0, FL, "Exception was lost");
+	}
+	printf("Exception came back through the future.\n");
+
+	// A task can't shut down the pool that is running it.
+	std::future<bool> g = pool.submit( [&pool]() {
+		try {
+			pool.Shutdown();
+		} catch (AnException&){
+			return true;
+		}
+		return false;
+	} );
+	if(!g.get()){
+		throw AnException(0, FL, "Shutdown from a task didn't throw");
+	}
+	printf("Shutdown from a task threw.\n");
+}
@@ -21,6 +21,7 @@
 #include <stdio.h>
 
 #include "Timer.h"
+#include "Tools.h"
 using namespace SLib;
 
 int main (void)
@@ -44,5 +45,27 @@ int main (void)
 	t.Finish();
 	printf("Time for 10000 float mults is (%f)\n", t.Duration());
 
+	// Check the calibrated clock against a known sleep.  A busy machine can oversleep by a
+	// lot, so only the lower bound is tight.
+	uint64_t before = Timer::NowNs();
+	uint64_t beforeUs = Timer::GetCycleCount();
+	t.Start();
+	Tools::msleep( 200 );
+	t.Finish();
+	uint64_t after = Timer::NowNs();
+	uint64_t afterUs = Timer::GetCycleCount();
+	printf("Invariant TSC (%s), a 200ms sleep took (%f) seconds, NowNs moved (%llu), GetCycleCount moved (%llu)\n",
+		Timer::InvariantTSC() ? "yes" : "no", t.Duration(), (unsigned long long)(after - before),
+		(unsigned long long)(afterUs - beforeUs) );
+	if(t.Duration() < 0.19 || t.Duration() > 2.0 || after - before < 190000000){
+		printf("Timer calibration is off\n");
+		return 1;
+	}
+	// GetCycleCount is still in microseconds.
+	if(afterUs - beforeUs < 190000 || afterUs - beforeUs > 2000000){
+		printf("GetCycleCount is not counting microseconds\n");
+		return 1;
+	}
+	return 0;
 }
 
@@ -0,0 +1,165 @@
+#include <stdio.h>
+#include <stdlib.h>
+
+#include <vector>
+#include <atomic>
+using namespace std;
+
+#include "TimerWheel.h"
+#include "AnException.h"
+#include "Tools.h"
+using namespace SLib;
+
+#define MANY 200000
+
+void runTest1();
+void runTest2();
+void runTest3();
+void runTest4();
+
+int main(void)
+{
+	try {
+		runTest1();
+		runTest2();
+		runTest3();
+		runTest4();
+	} catch (AnException& e){
+		printf("Exception caught: %s\n", e.Msg() );
+		printf("Aborting tests.\n" );
+		return -1;
+	}
+	return 0;
+}
+
+/// Waits up to a few seconds for count to reach target
+static void waitFor(std::atomic<int>& count, int target)
+{
+	for(int i = 0; i < 500 && count.load() < target; i++){
+		Tools::msleep( 10 );
+	}
+}
+
+void runTest1()
+{
+	// Timers fire in order, and not early.
+	printf("Checking one-shot timers and Cancel\n");
+	ThreadPool pool( 1 );
+	TimerWheel wheel( &pool );
+	std::atomic<int> fired( 0 );
+	std::atomic<int> outOfOrder( 0 );
+	std::atomic<int> early( 0 );
+	uint64_t start = Timer::NowNs();
+	for(int i = 5; i >= 1; i--){
+		uint64_t delay = (uint64_t)i * 20;
+		wheel.Schedule( delay, [&, i, delay]() {
+			if(Timer::NowNs() - start < delay * 1000000){
+				early ++;
+			}
+			if(fired.fetch_add( 1 ) != i - 1){
+				outOfOrder ++;
+			}
+		} );
+	}
+
+	// One that is cancelled never fires.
+	std::atomic<int> cancelled( 0 );
+	TimerId id = wheel.Schedule( 30, [&cancelled]() { cancelled ++; } );
+	if(!wheel.Cancel( id ) || wheel.Cancel( id )){
+		throw AnException(0, FL, "Cancel gave the wrong answer");
+	}
+
+	waitFor( fired, 5 );
+	Tools::msleep( 50 );
+	if(fired.load() != 5 || outOfOrder.load() != 0 || early.load() != 0 || cancelled.load() != 0){
+		throw AnException(0, FL, "One-shot timers misbehaved: %d fired, %d out of order, %d early, %d cancelled",
+			fired.load(), outOfOrder.load(), early.load(), cancelled.load() );
+	}
+	if(wheel.Pending() != 0){
+		throw AnException(0, FL, "Wheel still has %d timers", (int)wheel.Pending() );
+	}
+	printf("One-shot timers fired in order, and the cancelled one didn't.\n");
+}
+
+void runTest2()
+{
+	printf("Checking periodic timers\n");
+	ThreadPool pool( 1 );
+	TimerWheel wheel( &pool );
+	std::atomic<int> ticks( 0 );
+	TimerId id = wheel.SchedulePeriodic( 10, [&ticks]() { ticks ++; } );
+	waitFor( ticks, 10 );
+	if(!wheel.Cancel( id )){
+		throw AnException(0, FL, "Couldn't cancel the periodic timer");
+	}
+	Tools::msleep( 30 );
+	int stopped = ticks.load();
+	Tools::msleep( 50 );
+	if(stopped < 10 || ticks.load() != stopped){
+		throw AnException(0, FL, "Periodic timer ran %d times, then %d", stopped, ticks.load() );
+	}
+	printf("Periodic timer ran %d times and then stopped.\n", stopped);
+}
+
+void runTest3()
+{
+	// Lots of timers at once, spread over all of the levels.
+	printf("Scheduling %d timers\n", MANY);
+	ThreadPool pool( 2 );
+	TimerWheel wheel( &pool );
+	std::atomic<int> fired( 0 );
+	std::atomic<int> early( 0 );
+	srand( 42 );
+
+	uint64_t start = Timer::NowNs();
+	vector<TimerId> far;
+	for(int i = 0; i < MANY; i++){
+		uint64_t delay = rand() % 1000;
+		uint64_t due = start + delay * 1000000;
+		wheel.Schedule( delay, [&fired, &early, due]() {
+			if(Timer::NowNs() + 1000000 < due){
+				early ++;
+			}
+			fired ++;
+		} );
+
+		// And as many again that are minutes to weeks away, to be cancelled.
+		far.push_back( wheel.Schedule( (uint64_t)(rand() % 1000000) * 1000 + 60000, []() {} ) );
+	}
+	double perSchedule = (double)(Timer::NowNs() - start) / (MANY * 2);
+
+	waitFor( fired, MANY );
+	if(fired.load() != MANY || early.load() != 0){
+		throw AnException(0, FL, "%d of %d timers fired, %d of them early", fired.load(), MANY, early.load() );
+	}
+	if(wheel.Pending() != (size_t)MANY){
+		throw AnException(0, FL, "Expected %d far timers to be pending, not %d", MANY, (int)wheel.Pending() );
+	}
+	for(size_t i = 0; i < far.size(); i++){
+		if(!wheel.Cancel( far[ i ] )){
+			throw AnException(0, FL, "Couldn't cancel far timer %d", (int)i );
+		}
+	}
+	if(wheel.Pending() != 0){
+		throw AnException(0, FL, "Cancel left %d timers behind", (int)wheel.Pending() );
+	}
+	printf("All %d fired on time, %.0f ns per Schedule.\n", MANY, perSchedule);
+}
+
+void runTest4()
+{
+	// The global wheel, through Timer and an Interval.
+	printf("Checking Timer::Schedule with an Interval\n");
+	std::atomic<int> fired( 0 );
+	uint64_t start = Timer::NowNs();
+	Timer::Schedule( Interval( 1, SECOND ), [&fired]() { fired ++; } );
+	TimerId id = Timer::Schedule( 10, [&fired]() { fired += 100; } );
+	Timer::Cancel( id );
+	waitFor( fired, 1 );
+	uint64_t took = Timer::NowNs() - start;
+	if(fired.load() != 1 || took < 1000000000ULL){
+		throw AnException(0, FL, "Timer::Schedule fired %d after %llu ns", fired.load(),
+			(unsigned long long)took );
+	}
+	printf("Timer::Schedule fired after %.1f ms.\n", (double)took / 1e6);
+}
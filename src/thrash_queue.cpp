@@ -0,0 +1,161 @@
+#include <stdlib.h>
+#include <stdio.h>
+
+#include <vector>
+#include <thread>
+using namespace std;
+
+#include "MsgQueue.h"
+#include "BlockingQueue.h"
+#include "RingQueue.h"
+#include "Timer.h"
+#include "Thread.h"
+using namespace SLib;
+
+/**
+  * Pushes messages from 1, 4 and 16 producer threads to a single consumer thread through each
+  * kind of queue we have, and prints the messages per second that each one manages.  MsgQueue
+  * is unbounded, so its producers never wait - the others all hold RING_SIZE messages.
+  */
+
+#define MESSAGE_COUNT 2000000
+#define RING_SIZE 4096
+
+/// Our messages are just pointers into this
+static int payload[ 1024 ];
+
+static int* message(int i)
+{
+	return &payload[ i & 1023 ];
+}
+
+/// Wraps each queue in the same interface, so that one set of threads can drive them all.
+struct MsgQueueTest {
+	MsgQueue<int*> q;
+	const char* name() { return "MsgQueue (spinning)"; }
+	void push(int* m) { q.AddMsg( m ); }
+	int* pop() {
+		int* m;
+		while((m = q.GetMsg()) == NULL){
+			std::this_thread::yield(); // MsgQueue can't wait, so all we can do is poll
+		}
+		return m;
+	}
+};
+
+struct BlockingQueueTest {
+	BlockingQueueTest() : q( RING_SIZE ) {}
+	BlockingQueue<int*> q;
+	const char* name() { return "BlockingQueue"; }
+	void push(int* m) { q.push( m ); }
+	int* pop() { return q.pop(); }
+};
+
+struct MPMCTest {
+	MPMCTest() : q( RING_SIZE ) {}
+	MPMCQueue<int*> q;
+	const char* name() { return "MPMCQueue (spinning)"; }
+	void push(int* m) { while(!q.try_push( m )){ std::this_thread::yield(); } }
+	int* pop() { int* m; while(!q.try_pop( m )){ std::this_thread::yield(); } return m; }
+};
+
+struct BlockingMPMCTest {
+	BlockingMPMCTest() : q( RING_SIZE ) {}
+	BlockingRing<MPMCQueue<int*> > q;
+	const char* name() { return "BlockingRing<MPMCQueue>"; }
+	void push(int* m) { q.push( m ); }
+	int* pop() { int* m; q.pop( m ); return m; }
+};
+
+struct SPSCTest {
+	SPSCTest() : q( RING_SIZE ) {}
+	SPSCQueue<int*> q;
+	const char* name() { return "SPSCQueue (spinning)"; }
+	void push(int* m) { while(!q.try_push( m )){ std::this_thread::yield(); } }
+	int* pop() { int* m; while(!q.try_pop( m )){ std::this_thread::yield(); } return m; }
+};
+
+struct BlockingSPSCTest {
+	BlockingSPSCTest() : q( RING_SIZE ) {}
+	BlockingRing<SPSCQueue<int*> > q;
+	const char* name() { return "BlockingRing<SPSCQueue>"; }
+	void push(int* m) { q.push( m ); }
+	int* pop() { int* m; q.pop( m ); return m; }
+};
+
+template <class Test>
+struct RunArgs {
+	Test* test;
+	int count;
+};
+
+template <class Test>
+void* produce(void* v)
+{
+	RunArgs<Test>* args = (RunArgs<Test>*)v;
+	for(int i = 0; i < args->count; i++){
+		args->test->push( message( i ) );
+	}
+	return NULL;
+}
+
+template <class Test>
+void* consume(void* v)
+{
+	RunArgs<Test>* args = (RunArgs<Test>*)v;
+	for(int i = 0; i < args->count; i++){
+		if(args->test->pop() == NULL){
+			printf("Consumer got a NULL message!\n");
+		}
+	}
+	return NULL;
+}
+
+template <class Test>
+void runTest(int producers)
+{
+	Test test;
+	RunArgs<Test> prodArgs;
+	prodArgs.test = &test;
+	prodArgs.count = MESSAGE_COUNT / producers;
+	RunArgs<Test> consArgs;
+	consArgs.test = &test;
+	consArgs.count = prodArgs.count * producers;
+
+	Timer tt;
+	tt.Start();
+	Thread consumer;
+	consumer.start( consume<Test>, &consArgs );
+	vector<Thread*> threads;
+	for(int i = 0; i < producers; i++){
+		Thread* t = new Thread();
+		t->start( produce<Test>, &prodArgs );
+		threads.push_back( t );
+	}
+	for(size_t i = 0; i < threads.size(); i++){
+		threads[ i ]->join();
+		delete threads[ i ];
+	}
+	consumer.join();
+	tt.Finish();
+
+	printf("%-26s %2d producers: %10.0f msgs/sec\n", test.name(), producers,
+		(double)consArgs.count / tt.Duration() );
+}
+
+int main(void)
+{
+	int producers[] = { 1, 4, 16 };
+	for(int i = 0; i < 3; i++){
+		runTest<MsgQueueTest>( producers[ i ] );
+		runTest<BlockingQueueTest>( producers[ i ] );
+		runTest<MPMCTest>( producers[ i ] );
+		runTest<BlockingMPMCTest>( producers[ i ] );
+		if(producers[ i ] == 1){
+			runTest<SPSCTest>( 1 );
+			runTest<BlockingSPSCTest>( 1 );
+		}
+		printf("\n");
+	}
+	return 0;
+}